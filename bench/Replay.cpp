@@ -0,0 +1,178 @@
+#include "bench.h"
+
+#include <fstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+using namespace spec_hom;
+
+constexpr std::size_t BLOCK_SIZE = 1 << 16; // [bytes] the file arrives in blocks of this size, about a SPIDR chunk
+constexpr int64_t TOA_PERIOD = int64_t(1) << 34; // [ticks] as in StreamProcessor
+constexpr auto IDLE_INTERVAL = std::chrono::microseconds(200); // wait when there is nothing new to process
+
+namespace {
+
+    struct Block {
+        std::vector<char> bytes;
+        double arrival; // [s] SPIDR time after the first packet at which the block is complete
+    };
+
+    // Reads the file in blocks, and finds when each block would arrive in a live acquisition: once the latest packet
+    // seen so far has been recorded. Timestamps are unwrapped the same way as in StreamProcessor.
+    std::vector<Block> read_blocks(const std::string &path, const Tpx3ImportSettings &settings, double &data_time) {
+
+        std::ifstream stream(path, std::ios::binary);
+        if(!stream.is_open())
+            throw std::runtime_error("Failed to open " + path);
+
+        std::vector<Block> blocks;
+        Tpx3StreamDecoder decoder(settings);
+        bool has_data = false;
+        int64_t first_toa = 0, newest_toa = 0;
+
+        while(stream) {
+            Block block { std::vector<char>(BLOCK_SIZE), 0 };
+            stream.read(block.bytes.data(), static_cast<std::streamsize>(block.bytes.size()));
+            block.bytes.resize(static_cast<std::size_t>(stream.gcount()));
+            if(block.bytes.empty())
+                break;
+
+            auto packets = decoder.feed(block.bytes.data(), block.bytes.size());
+            for(auto raw_toa : packets.toa) {
+                if(!has_data) {
+                    first_toa = newest_toa = raw_toa;
+                    has_data = true;
+                }
+                auto periods = std::llround(static_cast<double>(newest_toa - raw_toa) / static_cast<double>(TOA_PERIOD));
+                newest_toa = std::max(newest_toa, raw_toa + static_cast<int64_t>(periods) * TOA_PERIOD);
+            }
+
+            block.arrival = static_cast<double>(newest_toa - first_toa) * MIN_TICK;
+            blocks.push_back(std::move(block));
+        }
+
+        data_time = static_cast<double>(newest_toa - first_toa) * MIN_TICK;
+        return blocks;
+
+    }
+
+    double percentile(std::vector<double> &values, double fraction) {
+
+        if(values.empty())
+            return 0;
+
+        auto ix = static_cast<std::size_t>(std::llround(fraction * static_cast<double>(values.size() - 1)));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(ix), values.end());
+        return values[ix];
+
+    }
+
+}
+
+ReplayResult spec_hom::replay_tpx3(const std::string &path, const Tpx3ImportSettings &settings, double speed, double look_back) {
+
+    using clock = std::chrono::steady_clock;
+
+    ReplayResult result;
+    result.speed = speed;
+
+    auto blocks = read_blocks(path, settings, result.data_time);
+
+    // the feeder thread hands each block over once it has "arrived"
+    std::mutex queue_mutex;
+    std::deque<std::vector<char>> queue;
+    std::size_t queued_bytes = 0;
+    bool feeder_done = false;
+
+    auto start = clock::now();
+    auto arrival_time = [&](double spidr_time) { // [s] since start
+        return speed > 0 ? spidr_time / speed : 0.0;
+    };
+
+    std::thread feeder([&]() {
+        for(auto &block : blocks) {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(arrival_time(block.arrival))));
+
+            std::lock_guard lock(queue_mutex);
+            queued_bytes += block.bytes.size();
+            queue.push_back(std::move(block.bytes));
+        }
+
+        std::lock_guard lock(queue_mutex);
+        feeder_done = true;
+    });
+
+    Tpx3StreamDecoder decoder(settings);
+    StreamProcessor processor(settings, look_back);
+
+    // the pair's SPIDR time is that of its later photon, relative to the first packet; centroids are unwrapped already
+    std::vector<double> latencies;
+    double first_toa = 0;
+    bool has_first_toa = false;
+
+    processor.setBatchCallback([&](const PixelData &batch, const std::vector<ClusterCentroid> &centroids,
+                                   const std::vector<CoincidencePair> &coinc_pairs) {
+        auto now = std::chrono::duration<double>(clock::now() - start).count();
+        result.max_batch = std::max(result.max_batch, batch.numPackets());
+        result.num_pairs += coinc_pairs.size();
+
+        for(auto &coinc : coinc_pairs) {
+            auto pair_toa = std::max(centroids[coinc.id_1].toa, centroids[coinc.id_2].toa);
+            latencies.push_back(now - arrival_time(pair_toa - first_toa));
+        }
+    });
+
+    std::size_t num_samples = 0;
+    double queue_sum = 0;
+    auto last_data = clock::now();
+    bool done = false;
+
+    while(!done) {
+        std::deque<std::vector<char>> arrived;
+        {
+            std::lock_guard lock(queue_mutex);
+            auto depth = queued_bytes / 8; // packets, up to the chunk headers
+            result.max_input_queue = std::max(result.max_input_queue, depth);
+            queue_sum += static_cast<double>(depth);
+            ++num_samples;
+
+            arrived.swap(queue);
+            queued_bytes = 0;
+            done = feeder_done;
+        }
+
+        for(auto &bytes : arrived) {
+            auto packets = decoder.feed(bytes.data(), bytes.size());
+            if(!has_first_toa && !packets.isEmpty()) {
+                first_toa = static_cast<double>(packets.toa.front()) * MIN_TICK;
+                has_first_toa = true;
+            }
+            result.num_packets += packets.numPackets();
+            processor.push(std::move(packets));
+            last_data = clock::now();
+        }
+
+        processor.process(done || std::chrono::duration<double>(clock::now() - last_data).count() >= look_back);
+        result.max_pending = std::max(result.max_pending, processor.numPendingPackets());
+
+        if(arrived.empty() && !done)
+            std::this_thread::sleep_for(IDLE_INTERVAL);
+    }
+
+    feeder.join();
+
+    result.wall_time = std::chrono::duration<double>(clock::now() - start).count();
+    result.mean_input_queue = num_samples ? queue_sum / static_cast<double>(num_samples) : 0;
+    result.latency_p50 = percentile(latencies, 0.5);
+    result.latency_p90 = percentile(latencies, 0.9);
+    result.latency_p99 = percentile(latencies, 0.99);
+    result.latency_max = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    return result;
+
+}
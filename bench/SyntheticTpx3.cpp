@@ -0,0 +1,311 @@
+#include "bench.h"
+
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace spec_hom;
+
+constexpr unsigned MAX_PACKETS_PER_CHUNK = 8191; // chunk sizes are stored as a 16-bit byte count
+constexpr double TICKS_PER_SECOND = 1.0 / MIN_TICK;
+
+struct SyntheticHit {
+    int64_t toa; // [units of MIN_TICK], in chip time
+    uint16_t chip_x, chip_y;
+    uint16_t tot;
+    int32_t photon; // index into SyntheticTruth::photons, or -1 for dark counts (and when no truth is recorded)
+};
+
+// Inverse of the decoding in LoadRawFileThread::parseRawData()
+uint64_t encode_packet(const SyntheticHit &hit) {
+
+    auto ticks = static_cast<uint64_t>(hit.toa);
+    uint64_t fine = (ticks & 0xF) ^ 0xF; // fine toa counts backwards
+    uint64_t coarse_all = ticks >> 4;
+    uint64_t coarse = coarse_all & 0x3FFF;
+    uint64_t spidr = (coarse_all >> 14) & 0xFFFF;
+
+    unsigned x = hit.chip_x;
+    unsigned y = TPX3_SENSOR_SIZE - 1 - hit.chip_y; // the decoder flips the y direction
+    uint64_t addr = ((x & 0xFC) << 1) | (x & 0x3) | ((y & 0xFE) << 8) | ((y & 0x1) << 2);
+
+    uint64_t tot = std::min<uint64_t>(hit.tot, 0x3FF);
+
+    return (0xBull << 60) | (addr << 44) | (coarse << 30) | (tot << 20) | (fine << 16) | spidr;
+
+}
+
+// Generates the photons and dark counts of one time block, and sorts them into per-chip hit lists
+class HitGenerator {
+public:
+    HitGenerator(const SyntheticTpx3Settings &settings, SyntheticTruth *truth) :
+        mSettings(settings),
+        mTruth(truth),
+        mRng(settings.seed),
+        mHits(settings.geometry.numChips()),
+        mClusterPixels(),
+        mNumPairs(0) {
+
+        // Do nothing
+
+    }
+
+    std::vector<std::vector<SyntheticHit>>& generate(double t_start, double t_end) {
+
+        for(auto &chip_hits : mHits)
+            chip_hits.clear();
+
+        auto &s = mSettings;
+        double block = t_end - t_start;
+        std::uniform_real_distribution<double> time_dist(t_start, t_end);
+        std::normal_distribution<double> unit_normal(0, 1);
+
+        auto num_pairs = std::poisson_distribution<long>(s.pair_rate * block)(mRng);
+        for(long ix = 0; ix < num_pairs; ++ix) {
+            double t = time_dist(mRng);
+            double along_1 = s.spectrum_centre + s.spectrum_sigma * unit_normal(mRng);
+            double along_2 = 2 * s.spectrum_centre - along_1 + s.pair_spectral_sigma * unit_normal(mRng); // anti-correlated
+            auto pair = static_cast<int>(mNumPairs++);
+            photon(1, along_1, t, pair);
+            photon(2, along_2, t + s.pair_time_sigma * unit_normal(mRng), pair);
+        }
+
+        auto num_singles = std::poisson_distribution<long>(s.single_rate * block)(mRng);
+        for(long ix = 0; ix < num_singles; ++ix) {
+            double along = s.spectrum_centre + s.spectrum_sigma * unit_normal(mRng);
+            photon(1 + static_cast<int>(mRng() % 2), along, time_dist(mRng), -1);
+        }
+
+        auto num_dark = std::poisson_distribution<long>(s.dark_rate * block)(mRng);
+        std::exponential_distribution<double> dark_tot(1.0 / std::max(s.dark_tot_mean, 1.0));
+        for(long ix = 0; ix < num_dark; ++ix) {
+            int x = static_cast<int>(mRng() % s.geometry.width);
+            int y = static_cast<int>(mRng() % s.geometry.height);
+            auto tot = 1 + dark_tot(mRng);
+            addHit(x, y, time_dist(mRng) + s.timewalk / tot, tot, -1);
+        }
+
+        for(auto &chip_hits : mHits) {
+            std::sort(chip_hits.begin(), chip_hits.end(), [](const SyntheticHit &lhs, const SyntheticHit &rhs) {
+                return lhs.toa < rhs.toa;
+            });
+        }
+
+        return mHits;
+
+    }
+
+    [[nodiscard]] std::size_t numPairs() const { return mNumPairs; }
+
+private:
+    // a photon on the given line at position along the line [pixels], arriving at time t [s]; pair is -1 if unpaired
+    void photon(int line, double along, double t, int pair) {
+
+        auto &s = mSettings;
+        std::normal_distribution<double> unit_normal(0, 1);
+
+        double across = (line == 1 ? s.line_1_pos : s.line_2_pos) + s.line_sigma * unit_normal(mRng);
+
+        double x = s.horizontal_lines ? along : across;
+        double y = s.horizontal_lines ? across : along;
+
+        int32_t photon_id = -1;
+        if(mTruth) {
+            photon_id = static_cast<int32_t>(mTruth->photons.size());
+            mTruth->photons.push_back({x, y, t, pair, 0});
+        }
+
+        // the charge cloud is stretched along the line by cluster_elongation
+        double sigma_x = s.cluster_sigma * (s.horizontal_lines ? s.cluster_elongation : 1.0);
+        double sigma_y = s.cluster_sigma * (s.horizontal_lines ? 1.0 : s.cluster_elongation);
+
+        auto num_pixels = 1 + std::poisson_distribution<int>(std::max(s.cluster_mean_size - 1, 0.0))(mRng);
+        double peak_tot = std::max(1.0, s.tot_mean + s.tot_sigma * unit_normal(mRng));
+
+        mClusterPixels.clear();
+        mClusterPixels.emplace_back(static_cast<int>(std::round(x)), static_cast<int>(std::round(y)));
+        for(int attempt = 0; attempt < 4 * num_pixels && mClusterPixels.size() < num_pixels; ++attempt) {
+            std::pair<int, int> pixel {
+                static_cast<int>(std::round(x + sigma_x * unit_normal(mRng))),
+                static_cast<int>(std::round(y + sigma_y * unit_normal(mRng)))
+            };
+            if(std::find(mClusterPixels.begin(), mClusterPixels.end(), pixel) == mClusterPixels.end())
+                mClusterPixels.push_back(pixel);
+        }
+
+        for(auto [px, py] : mClusterPixels) {
+            // pixels further from the centre of the charge cloud collect less charge
+            double dx = (px - x) / std::max(sigma_x, 0.1), dy = (py - y) / std::max(sigma_y, 0.1);
+            double tot = std::max(1.0, std::round(peak_tot * std::exp(-(dx*dx + dy*dy) / 4)));
+            addHit(px, py, t + s.timewalk / tot, tot, photon_id);
+        }
+
+    }
+
+    void addHit(int x, int y, double t, double tot, int32_t photon) {
+
+        auto &geometry = mSettings.geometry;
+        if(x < 0 || y < 0 || x >= geometry.width || y >= geometry.height || t < 0)
+            return;
+
+        for(int chip = 0; chip < geometry.numChips(); ++chip) {
+            auto &placement = geometry.chips[chip];
+            int chip_x = x - placement.x_offset, chip_y = y - placement.y_offset;
+            if(chip_x < 0 || chip_y < 0 || chip_x >= TPX3_SENSOR_SIZE || chip_y >= TPX3_SENSOR_SIZE)
+                continue;
+
+            if(placement.rotated) {
+                chip_x = TPX3_SENSOR_SIZE - 1 - chip_x;
+                chip_y = TPX3_SENSOR_SIZE - 1 - chip_y;
+            }
+
+            // the decoder adds the chip's clock offset back on
+            auto toa = static_cast<int64_t>(std::llround(t * TICKS_PER_SECOND)) - placement.clock_offset;
+            if(toa < 0)
+                return;
+
+            mHits[chip].push_back({
+                toa,
+                static_cast<uint16_t>(chip_x),
+                static_cast<uint16_t>(chip_y),
+                static_cast<uint16_t>(std::min(tot, 1023.0)),
+                photon
+            });
+            return;
+        }
+
+    }
+
+    const SyntheticTpx3Settings &mSettings;
+    SyntheticTruth *mTruth;
+    std::mt19937_64 mRng;
+    std::vector<std::vector<SyntheticHit>> mHits; // one list per chip
+    std::vector<std::pair<int, int>> mClusterPixels;
+    std::size_t mNumPairs;
+};
+
+double SyntheticTpx3Settings::packetRate() const {
+
+    return (2 * pair_rate + single_rate) * std::max(cluster_mean_size, 1.0) + dark_rate;
+
+}
+
+void SyntheticTpx3Settings::scaleToPackets(double num_packets) {
+
+    auto scale = num_packets / (packetRate() * duration);
+    pair_rate *= scale;
+    single_rate *= scale;
+    dark_rate *= scale;
+
+}
+
+SpatialMask SyntheticTpx3Settings::mask() const {
+
+    int margin = static_cast<int>(std::ceil(4 * line_sigma + 2 * cluster_sigma)) + 1;
+    int pos_1 = static_cast<int>(std::round(line_1_pos)), pos_2 = static_cast<int>(std::round(line_2_pos));
+
+    return {
+        !horizontal_lines, // a mask on horizontal lines restricts y
+        pos_1 - margin, pos_1 + margin,
+        pos_2 - margin, pos_2 + margin
+    };
+
+}
+
+Tpx3ImportSettings SyntheticTpx3Settings::importSettings(unsigned num_threads) const {
+
+    ToTCalibration no_correction;
+    no_correction.fill(0);
+
+    // same defaults as the settings panel
+    return {
+        static_cast<int>(num_threads),
+        geometry,
+        mask(),
+        {}, // pixelMask
+        no_correction,
+        5, // clusterSizeXY [pixels]
+        750, // clusterSizeT [ns]
+        1, // minClusterSize
+        15e-9, // coincidenceWindow [s]
+        1, // rateBinWidth [s]
+        0, // lineTrackingWindow [s]
+        1, // homSegmentWidth [s]
+        true, // keepPackets
+        {1, 0, 1, 0}
+    };
+
+}
+
+std::size_t spec_hom::write_synthetic_tpx3(const std::string &path, const SyntheticTpx3Settings &settings, SyntheticTruth *truth) {
+
+    // the combined coarse ToA is 30 bits of 25 ns, so it wraps around in longer files; the import unwraps it in file order
+    if(settings.duration <= 0)
+        throw std::runtime_error("write_synthetic_tpx3(): duration must be positive");
+
+    std::ofstream file(path, std::ios::binary);
+    if(!file)
+        throw std::runtime_error("write_synthetic_tpx3(): could not open " + path);
+
+    if(truth)
+        *truth = {};
+
+    HitGenerator generator(settings, truth);
+
+    // generate in time blocks of ~1e5 packets, so that memory use does not depend on the file size
+    double block = std::clamp(1e5 / std::max(settings.packetRate(), 1.0), 1e-6, 1e-2);
+
+    std::size_t num_written = 0;
+    std::vector<char> chunk;
+    chunk.reserve((MAX_PACKETS_PER_CHUNK + 1) * sizeof(uint64_t));
+
+    for(double t = 0; t < settings.duration; t += block) {
+        auto &hits = generator.generate(t, std::min(t + block, settings.duration));
+
+        // interleave the chips' chunks, as the readout does
+        std::vector<std::size_t> next(hits.size(), 0);
+        bool remaining = true;
+        while(remaining) {
+            remaining = false;
+            for(std::size_t chip = 0; chip < hits.size(); ++chip) {
+                auto &chip_hits = hits[chip];
+                if(next[chip] >= chip_hits.size())
+                    continue;
+
+                auto end = std::min(next[chip] + MAX_PACKETS_PER_CHUNK, chip_hits.size());
+                auto num_packets = end - next[chip];
+                auto chunk_size = static_cast<uint16_t>(num_packets * sizeof(uint64_t));
+
+                chunk.assign({'T', 'P', 'X', '3', static_cast<char>(chip), 0,
+                              static_cast<char>(chunk_size & 0xFF), static_cast<char>(chunk_size >> 8)});
+                for(auto ix = next[chip]; ix < end; ++ix) {
+                    if(truth) {
+                        truth->packet_photons.push_back(chip_hits[ix].photon);
+                        if(chip_hits[ix].photon >= 0)
+                            ++truth->photons[chip_hits[ix].photon].num_packets;
+                    }
+
+                    auto packet = encode_packet(chip_hits[ix]);
+                    for(int b = 0; b < 8; ++b) // packets are little endian on disk
+                        chunk.push_back(static_cast<char>((packet >> (8 * b)) & 0xFF));
+                }
+                file.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+
+                next[chip] = end;
+                remaining |= (end < chip_hits.size());
+                num_written += num_packets;
+            }
+        }
+    }
+
+    if(!file)
+        throw std::runtime_error("write_synthetic_tpx3(): error writing " + path);
+
+    if(truth)
+        truth->num_pairs = generator.numPairs();
+
+    return num_written;
+
+}
@@ -0,0 +1,207 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+#include <filesystem>
+
+using namespace spec_hom;
+
+double ValidationResult::pairEfficiency() const {
+
+    return num_true_pairs ? static_cast<double>(num_correct_pairs) / num_true_pairs : 0;
+
+}
+
+double ValidationResult::falseCoincidenceFraction() const {
+
+    return num_found_pairs ? 1.0 - static_cast<double>(num_correct_pairs) / num_found_pairs : 0;
+
+}
+
+ValidationResult spec_hom::validate_pipeline(const std::string &path, const SyntheticTruth &truth, Tpx3ImportSettings settings) {
+
+    ValidationResult result;
+    auto &stats = result.stats;
+    stats.filename = path;
+    stats.num_files = 1;
+    stats.file_size = std::filesystem::file_size(path);
+
+    // let every packet through, so that packets stay in file order and can be matched to the truth
+    int mask_max = std::max(settings.geometry.width, settings.geometry.height) + 1;
+    settings.spatialMask = {false, -1, mask_max, -1, mask_max};
+
+    LoadRawFileThread loader(path, settings);
+
+    StageTimer parse_timer(stats, "parse");
+    PixelData data = loader.parseRawData();
+    stats.num_packets = data.numPackets();
+    parse_timer.stop();
+
+    if(data.numPackets() != truth.packet_photons.size())
+        throw std::runtime_error("validate_pipeline(): decoded " + std::to_string(data.numPackets()) + " packets, but "
+                                 + std::to_string(truth.packet_photons.size()) + " were written");
+
+    // sort_timestamps() is a stable sort by ToA, so the same stable sort gives the photon of each sorted packet
+    std::vector<std::size_t> order(data.numPackets());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&data](std::size_t lhs, std::size_t rhs) {
+        return data.toa[lhs] < data.toa[rhs];
+    });
+
+    // photon of each sorted packet; each dark count gets a label of its own (below -1), so it counts as a distinct source
+    std::vector<int64_t> packet_labels(order.size());
+    for(std::size_t ix = 0; ix < order.size(); ++ix) {
+        auto photon = truth.packet_photons[order[ix]];
+        packet_labels[ix] = photon >= 0 ? photon : -2 - static_cast<int64_t>(ix);
+    }
+
+    StageTimer sort_timer(stats, "sort");
+    sort_timestamps(data, TaskPool::global());
+    sort_timer.stop();
+
+    StageTimer cluster_timer(stats, "cluster");
+    ClusterData clusters = loader.cluster(data);
+    cluster_timer.stop();
+
+    StageTimer centroid_timer(stats, "centroid");
+    auto centroids = loader.centroid(data, clusters);
+    centroid_timer.stop();
+
+    StageTimer coincidence_timer(stats, "coincidence");
+    auto [coinc_pairs, coinc_nfolds] = loader.findCoincidences(clusters, centroids);
+    coincidence_timer.stop();
+
+    // Clusters: (cluster, label) for every packet, grouped by cluster
+    std::vector<std::pair<int, int64_t>> by_cluster;
+    by_cluster.reserve(packet_labels.size());
+    for(std::size_t ix = 0; ix < packet_labels.size(); ++ix) {
+        if(clusters.cluster_ids[ix] > 0)
+            by_cluster.emplace_back(clusters.cluster_ids[ix], packet_labels[ix]);
+    }
+    std::sort(by_cluster.begin(), by_cluster.end());
+
+    std::vector<int64_t> cluster_main_label(clusters.num_clusters + 1, -1); // indexed by cluster id
+    std::size_t clustered_packets = 0, main_packets = 0, merged_clusters = 0;
+
+    for(std::size_t begin = 0; begin < by_cluster.size();) {
+        auto cluster_id = by_cluster[begin].first;
+        std::size_t end = begin;
+        std::size_t best_count = 0, num_labels = 0;
+
+        while(end < by_cluster.size() && by_cluster[end].first == cluster_id) {
+            auto run_end = end;
+            while(run_end < by_cluster.size() && by_cluster[run_end] == by_cluster[end])
+                ++run_end;
+
+            ++num_labels;
+            if(run_end - end > best_count) {
+                best_count = run_end - end;
+                cluster_main_label[cluster_id] = by_cluster[end].second;
+            }
+            end = run_end;
+        }
+
+        clustered_packets += end - begin;
+        main_packets += best_count;
+        merged_clusters += (num_labels > 1);
+        begin = end;
+    }
+
+    result.cluster_purity = clustered_packets ? static_cast<double>(main_packets) / clustered_packets : 0;
+    result.merge_fraction = clusters.num_clusters ? static_cast<double>(merged_clusters) / clusters.num_clusters : 0;
+
+    // Photons: (photon, cluster) for every photon packet, grouped by photon; unclustered packets have cluster 0
+    std::vector<std::pair<int64_t, int>> by_photon;
+    by_photon.reserve(packet_labels.size());
+    for(std::size_t ix = 0; ix < packet_labels.size(); ++ix) {
+        if(packet_labels[ix] >= 0)
+            by_photon.emplace_back(packet_labels[ix], clusters.cluster_ids[ix]);
+    }
+    std::sort(by_photon.begin(), by_photon.end());
+
+    std::vector<int> photon_main_cluster(truth.photons.size(), 0);
+    std::size_t photon_packets = 0, complete_packets = 0, detected_photons = 0, split_photons = 0;
+
+    for(std::size_t begin = 0; begin < by_photon.size();) {
+        auto photon = by_photon[begin].first;
+        std::size_t end = begin;
+        std::size_t best_count = 0, num_clusters = 0;
+
+        while(end < by_photon.size() && by_photon[end].first == photon) {
+            auto run_end = end;
+            while(run_end < by_photon.size() && by_photon[run_end] == by_photon[end])
+                ++run_end;
+
+            if(by_photon[end].second > 0) {
+                ++num_clusters;
+                if(run_end - end > best_count) {
+                    best_count = run_end - end;
+                    photon_main_cluster[photon] = by_photon[end].second;
+                }
+            }
+            end = run_end;
+        }
+
+        photon_packets += end - begin;
+        complete_packets += best_count;
+        ++detected_photons;
+        split_photons += (num_clusters > 1);
+        begin = end;
+    }
+
+    result.cluster_completeness = photon_packets ? static_cast<double>(complete_packets) / photon_packets : 0;
+    result.split_fraction = detected_photons ? static_cast<double>(split_photons) / detected_photons : 0;
+
+    // Centroids: compare each photon with the centroid of its main cluster, if that cluster is mostly this photon
+    double position_sq_error = 0, time_sq_error = 0;
+    std::size_t num_compared = 0;
+    for(std::size_t photon = 0; photon < truth.photons.size(); ++photon) {
+        auto cluster_id = photon_main_cluster[photon];
+        if(cluster_id <= 0 || cluster_main_label[cluster_id] != static_cast<int64_t>(photon))
+            continue;
+
+        auto &centroid = centroids[cluster_id - 1];
+        auto &truth_photon = truth.photons[photon];
+        double dx = centroid.x / PIXEL_SIZE - truth_photon.x;
+        double dy = centroid.y / PIXEL_SIZE - truth_photon.y;
+        double dt = centroid.toa - truth_photon.toa;
+
+        position_sq_error += dx*dx + dy*dy;
+        time_sq_error += dt*dt;
+        ++num_compared;
+    }
+
+    if(num_compared) {
+        result.centroid_error = std::sqrt(position_sq_error / num_compared);
+        result.centroid_time_error = std::sqrt(time_sq_error / num_compared);
+    }
+
+    // Pairs: a pair can only be found if both of its photons fired
+    std::vector<unsigned char> pair_photons_fired(truth.num_pairs, 0);
+    for(auto &photon : truth.photons) {
+        if(photon.pair >= 0 && photon.num_packets)
+            ++pair_photons_fired[photon.pair];
+    }
+    result.num_true_pairs = std::count(pair_photons_fired.begin(), pair_photons_fired.end(), 2);
+
+    std::vector<bool> pair_found(truth.num_pairs, false);
+    for(auto &pair : coinc_pairs) {
+        auto label_1 = cluster_main_label[pair.id_1 + 1]; // centroid ix belongs to cluster id ix+1
+        auto label_2 = cluster_main_label[pair.id_2 + 1];
+        if(label_1 < 0 || label_2 < 0 || label_1 == label_2)
+            continue;
+
+        auto pair_1 = truth.photons[label_1].pair, pair_2 = truth.photons[label_2].pair;
+        if(pair_1 >= 0 && pair_1 == pair_2)
+            pair_found[pair_1] = true;
+    }
+
+    result.num_found_pairs = coinc_pairs.size();
+    result.num_correct_pairs = std::count(pair_found.begin(), pair_found.end(), true);
+    result.num_nfolds = coinc_nfolds.size();
+
+    return result;
+
+}
@@ -0,0 +1,117 @@
+#ifndef SPECTRAL_HOM_BENCH_H
+#define SPECTRAL_HOM_BENCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tpx3/tpx3.h"
+
+namespace spec_hom {
+
+    // Parameters of a synthetic Spectral HOM measurement. Photons land on two lines (one per output port of the
+    // spectrometer), with the SPDC pairs anti-correlated in wavelength along the lines.
+    struct SyntheticTpx3Settings {
+        DetectorGeometry geometry = DetectorGeometry::singleChip();
+        double duration = 1; // [s]; past ~27 s the SPIDR timestamp wraps around, as in a real acquisition
+        unsigned seed = 1;
+
+        // event rates [1/s]
+        double pair_rate = 1e5; // SPDC pairs, one photon on each line
+        double single_rate = 2e4; // photons whose partner was lost, on a random line
+        double dark_rate = 1e4; // single-pixel dark counts, anywhere on the sensor
+
+        // two-line spectral geometry [pixels]
+        bool horizontal_lines = true; // lines along x (spectrum along x), like the lines found by LinePair
+        double line_1_pos = 80, line_2_pos = 176; // position of each line across its length
+        double line_sigma = 3; // width of each line
+        double spectrum_centre = 128, spectrum_sigma = 30; // distribution along the lines
+        double pair_spectral_sigma = 2; // deviation from perfect anti-correlation of the two photons
+        double pair_time_sigma = 2e-9; // [s] timing jitter between the two photons of a pair
+
+        // cluster size and shape
+        double cluster_mean_size = 4; // mean number of pixels per photon (at least one)
+        double cluster_sigma = 0.8; // spatial spread of the charge cloud [pixels]
+        double cluster_elongation = 1; // spread along the line over spread across it
+
+        // ToT distribution of the central pixel of each cluster, falling off with the charge cloud [25 ns units]
+        double tot_mean = 150, tot_sigma = 60;
+        double dark_tot_mean = 20; // dark counts have an exponential ToT distribution
+        double timewalk = 100e-9; // [s] extra delay of a pixel with ToT of 1 (scales as 1/ToT)
+
+        [[nodiscard]] double packetRate() const; // mean number of packets per second
+        void scaleToPackets(double num_packets); // scales all rates so that about num_packets are written in duration
+
+        [[nodiscard]] SpatialMask mask() const; // mask around the two lines
+        [[nodiscard]] Tpx3ImportSettings importSettings(unsigned num_threads) const; // settings suited to this data
+    };
+
+    // What was injected into a synthetic file
+    struct SyntheticTruth {
+        struct Photon {
+            double x, y; // true position [pixels]
+            double toa; // true time of arrival, before timewalk [s]
+            int pair; // index of the SPDC pair, or -1 if the photon is unpaired
+            unsigned num_packets; // pixels that fired
+        };
+
+        std::vector<Photon> photons;
+        std::vector<int32_t> packet_photons; // photon of each packet in file order, or -1 for dark counts
+        std::size_t num_pairs = 0;
+    };
+
+    // Writes a synthetic .tpx3 file, chunked per chip as the SPIDR readout does; returns the number of packets written.
+    // If truth is given, the injected photons are recorded in it.
+    std::size_t write_synthetic_tpx3(const std::string &path, const SyntheticTpx3Settings &settings, SyntheticTruth *truth = nullptr);
+
+    // Accuracy of one run of the import pipeline against the injected events
+    struct ValidationResult {
+        ImportStats stats;
+
+        double cluster_purity = 0; // fraction of clustered packets that belong to their cluster's main photon
+        double cluster_completeness = 0; // fraction of photon packets found in their photon's main cluster
+        double split_fraction = 0; // fraction of detected photons spread over more than one cluster
+        double merge_fraction = 0; // fraction of clusters containing packets of more than one photon
+        double centroid_error = 0; // RMS distance between centroid and true position [pixels]
+        double centroid_time_error = 0; // RMS difference between centroid and true time of arrival [s]
+
+        std::size_t num_true_pairs = 0; // injected pairs where both photons fired at least one pixel
+        std::size_t num_found_pairs = 0;
+        std::size_t num_correct_pairs = 0; // found pairs made of the two photons of an injected pair
+        std::size_t num_nfolds = 0;
+
+        [[nodiscard]] double pairEfficiency() const; // correct pairs over true pairs
+        [[nodiscard]] double falseCoincidenceFraction() const; // wrong pairs over found pairs
+    };
+
+    // Imports a synthetic file with the given settings (the spatial mask is ignored, so that every packet can be
+    // matched to the truth), and compares the clusters, centroids and pairs found with what was injected
+    ValidationResult validate_pipeline(const std::string &path, const SyntheticTruth &truth, Tpx3ImportSettings settings);
+
+    // Result of replaying a file through the live pipeline at a multiple of its recorded (SPIDR) time
+    struct ReplayResult {
+        double speed = 0; // multiple of real time; 0 if the file was fed as fast as possible
+        std::size_t num_packets = 0;
+        std::size_t num_pairs = 0;
+        double data_time = 0; // [s] SPIDR time spanned by the file
+        double wall_time = 0; // [s] from the first packet arriving until the last batch was processed
+
+        // time from the later packet of a pair arriving until the pair was found [s]
+        double latency_p50 = 0, latency_p90 = 0, latency_p99 = 0, latency_max = 0;
+
+        // depth of each stage [packets]
+        std::size_t max_input_queue = 0; // arrived, but not yet decoded
+        double mean_input_queue = 0;
+        std::size_t max_pending = 0; // decoded, and held back for the look-back
+        std::size_t max_batch = 0; // clustered, centroided and paired at once
+
+        [[nodiscard]] double packetsPerSecond() const { return wall_time > 0 ? num_packets / wall_time : 0; }
+    };
+
+    // Feeds a .tpx3 file in blocks, each arriving once the SPIDR time of its packets has passed (scaled by speed), to
+    // a thread that decodes and processes them like the live modes of the app. A speed of 0 feeds everything at once.
+    ReplayResult replay_tpx3(const std::string &path, const Tpx3ImportSettings &settings, double speed, double look_back);
+
+}
+
+#endif //SPECTRAL_HOM_BENCH_H
@@ -0,0 +1,539 @@
+#include "bench.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <map>
+#include <cmath>
+#include <functional>
+#include <algorithm>
+#include <iomanip>
+
+#include <QThread>
+
+using namespace spec_hom;
+
+struct BenchOptions {
+    double min_packets = 1e5;
+    double max_packets = 1e7;
+    unsigned num_threads = 0; // 0: use all cores
+    bool thread_scaling = false; // also run the largest size with 1, 2, 4, ... threads
+    std::string dir = "."; // where the synthetic files are written
+    bool keep_files = false;
+    std::string csv_path; // default depends on the mode
+    std::string baseline_path; // optional results of an earlier run to compare against
+    double tolerance = 0.2; // allowed fractional slowdown relative to the baseline
+    SyntheticTpx3Settings synthetic;
+
+    // accuracy sweep: every combination of these import settings is run on one file of max_packets
+    bool validate = false;
+    std::vector<double> cluster_xy {5}; // [pixels]
+    std::vector<double> cluster_t {750}; // [ns]
+    std::vector<double> min_cluster_size {1};
+    std::vector<double> coinc_window {15}; // [ns]
+
+    // load test: a recorded file is replayed through the live pipeline at each of these multiples of real time
+    std::string replay_path;
+    std::vector<double> speeds {1, 2, 10};
+    double look_back = 200; // [ms]
+};
+
+void print_usage() {
+
+    std::cout <<
+        "Usage: spec_hom_bench [options]\n"
+        "Generates synthetic .tpx3 files and times every import stage and Tpx3Image histogram.\n"
+        "\n"
+        "  --min-packets N      smallest file, in packets (default 1e5)\n"
+        "  --max-packets N      largest file, in packets; sizes go up by factors of 10 (default 1e7)\n"
+        "  --threads N          threads in the task pool (default: all cores)\n"
+        "  --thread-scaling     also time the largest file with 1, 2, 4, ... threads\n"
+        "  --dir PATH           directory for the synthetic files (default .)\n"
+        "  --keep               keep the synthetic files\n"
+        "  --csv PATH           results file (default spec_hom_bench.csv, spec_hom_validation.csv or spec_hom_replay.csv)\n"
+        "  --baseline PATH      compare against an earlier results file, and fail on regressions\n"
+        "  --tolerance X        allowed fractional slowdown against the baseline (default 0.2)\n"
+        "\n"
+        "Validation (compares clusters, centroids and pairs with the injected photons, for one file of --max-packets):\n"
+        "  --validate           run the accuracy sweep instead of the throughput benchmark\n"
+        "  --cluster-xy L       comma-separated cluster radii to try [pixels] (default 5)\n"
+        "  --cluster-t L        comma-separated cluster time windows to try [ns] (default 750)\n"
+        "  --min-cluster L      comma-separated minimum cluster sizes to try (default 1)\n"
+        "  --coinc-window L     comma-separated coincidence windows to try [ns] (default 15)\n"
+        "\n"
+        "Replay (load test of the live pipeline; also finds the fastest speed it keeps up with):\n"
+        "  --replay FILE        replay a recorded .tpx3 file instead of running the benchmark\n"
+        "  --speeds L           comma-separated multiples of real time to replay at (default 1,2,10)\n"
+        "  --look-back MS       time packets are held back for late arrivals [ms] (default 200)\n"
+        "\n"
+        "Synthetic data (rates set the mix of events; they are scaled to reach each file size):\n"
+        "  --quad               2x2 quad detector instead of a single chip\n"
+        "  --seed N\n"
+        "  --pair-rate R        SPDC pairs per second (default 1e5)\n"
+        "  --single-rate R      unpaired photons per second (default 2e4)\n"
+        "  --dark-rate R        dark counts per second (default 1e4)\n"
+        "  --lines P1,P2        positions of the two spectral lines [pixels] (default 80,176)\n"
+        "  --vertical-lines     lines along y instead of x\n"
+        "  --line-sigma S       width of the lines [pixels] (default 3)\n"
+        "  --cluster-size N     mean pixels per photon (default 4)\n"
+        "  --cluster-sigma S    charge cloud size [pixels] (default 0.8)\n"
+        "  --elongation E       charge cloud elongation along the lines (default 1)\n"
+        "  --tot-mean T         mean ToT of the brightest pixel [25 ns] (default 150)\n"
+        "  --tot-sigma T        spread of that ToT [25 ns] (default 60)\n"
+        << std::flush;
+
+}
+
+std::vector<double> parse_list(const std::string &value) {
+
+    std::vector<double> list;
+    std::stringstream stream(value);
+    std::string item;
+    while(std::getline(stream, item, ','))
+        list.push_back(std::stod(item));
+
+    if(list.empty())
+        throw std::invalid_argument("empty list");
+
+    return list;
+
+}
+
+bool parse_options(int argc, char *argv[], BenchOptions &options) {
+
+    auto &s = options.synthetic;
+
+    std::map<std::string, std::function<void(const std::string&)>> with_value {
+        {"--min-packets", [&](const std::string &v) { options.min_packets = std::stod(v); }},
+        {"--max-packets", [&](const std::string &v) { options.max_packets = std::stod(v); }},
+        {"--threads", [&](const std::string &v) { options.num_threads = std::stoul(v); }},
+        {"--dir", [&](const std::string &v) { options.dir = v; }},
+        {"--csv", [&](const std::string &v) { options.csv_path = v; }},
+        {"--baseline", [&](const std::string &v) { options.baseline_path = v; }},
+        {"--tolerance", [&](const std::string &v) { options.tolerance = std::stod(v); }},
+        {"--seed", [&](const std::string &v) { s.seed = std::stoul(v); }},
+        {"--pair-rate", [&](const std::string &v) { s.pair_rate = std::stod(v); }},
+        {"--single-rate", [&](const std::string &v) { s.single_rate = std::stod(v); }},
+        {"--dark-rate", [&](const std::string &v) { s.dark_rate = std::stod(v); }},
+        {"--lines", [&](const std::string &v) {
+            auto comma = v.find(',');
+            if(comma == std::string::npos)
+                throw std::invalid_argument("--lines expects two comma-separated positions");
+            s.line_1_pos = std::stod(v.substr(0, comma));
+            s.line_2_pos = std::stod(v.substr(comma + 1));
+        }},
+        {"--line-sigma", [&](const std::string &v) { s.line_sigma = std::stod(v); }},
+        {"--cluster-size", [&](const std::string &v) { s.cluster_mean_size = std::stod(v); }},
+        {"--cluster-sigma", [&](const std::string &v) { s.cluster_sigma = std::stod(v); }},
+        {"--elongation", [&](const std::string &v) { s.cluster_elongation = std::stod(v); }},
+        {"--tot-mean", [&](const std::string &v) { s.tot_mean = std::stod(v); }},
+        {"--tot-sigma", [&](const std::string &v) { s.tot_sigma = std::stod(v); }},
+        {"--cluster-xy", [&](const std::string &v) { options.cluster_xy = parse_list(v); }},
+        {"--cluster-t", [&](const std::string &v) { options.cluster_t = parse_list(v); }},
+        {"--min-cluster", [&](const std::string &v) { options.min_cluster_size = parse_list(v); }},
+        {"--coinc-window", [&](const std::string &v) { options.coinc_window = parse_list(v); }},
+        {"--replay", [&](const std::string &v) { options.replay_path = v; }},
+        {"--speeds", [&](const std::string &v) { options.speeds = parse_list(v); }},
+        {"--look-back", [&](const std::string &v) { options.look_back = std::stod(v); }},
+    };
+
+    for(int ix = 1; ix < argc; ++ix) {
+        std::string arg = argv[ix];
+
+        if(arg == "--help" || arg == "-h") {
+            print_usage();
+            return false;
+        } else if(arg == "--thread-scaling") {
+            options.thread_scaling = true;
+        } else if(arg == "--validate") {
+            options.validate = true;
+        } else if(arg == "--keep") {
+            options.keep_files = true;
+        } else if(arg == "--quad") {
+            s.geometry = DetectorGeometry::quad();
+        } else if(arg == "--vertical-lines") {
+            s.horizontal_lines = false;
+        } else if(with_value.count(arg) && ix + 1 < argc) {
+            with_value[arg](argv[++ix]);
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << "\n\n";
+            print_usage();
+            return false;
+        }
+    }
+
+    if(!options.num_threads)
+        options.num_threads = std::max(QThread::idealThreadCount(), 1);
+    if(options.csv_path.empty()) {
+        if(!options.replay_path.empty())
+            options.csv_path = "spec_hom_replay.csv";
+        else
+            options.csv_path = options.validate ? "spec_hom_validation.csv" : "spec_hom_bench.csv";
+    }
+
+    return true;
+
+}
+
+SyntheticTpx3Settings synthetic_settings(const BenchOptions &options, std::size_t target_packets) {
+
+    auto synthetic = options.synthetic;
+
+    // high packet counts are reached with higher rates, so that the acquisitions stay of a realistic length; the
+    // longest still cross the rollover of the SPIDR timestamp after ~27 s
+    synthetic.duration = std::clamp(static_cast<double>(target_packets) / synthetic.packetRate(), 1e-3, 60.0);
+    synthetic.scaleToPackets(static_cast<double>(target_packets));
+
+    return synthetic;
+
+}
+
+// Runs every import stage and histogram on one file, in the same order as the app
+ImportStats run_pipeline(const std::string &path, const SyntheticTpx3Settings &synthetic, unsigned num_threads) {
+
+    TaskPool::global().setNumThreads(num_threads);
+
+    ImportStats stats;
+    stats.filename = path;
+    stats.num_files = 1;
+    stats.file_size = std::filesystem::file_size(path);
+
+    LoadRawFileThread loader(path, synthetic.importSettings(num_threads));
+
+    StageTimer parse_timer(stats, "parse");
+    PixelData data = loader.parseRawData();
+    stats.num_packets = data.numPackets();
+    parse_timer.stop();
+
+    StageTimer sort_timer(stats, "sort");
+    sort_timestamps(data, TaskPool::global());
+    sort_timer.stop();
+
+    StageTimer cluster_timer(stats, "cluster");
+    ClusterData clusters = loader.cluster(data);
+    cluster_timer.stop();
+
+    StageTimer centroid_timer(stats, "centroid");
+    auto centroids = loader.centroid(data, clusters);
+    centroid_timer.stop();
+
+    StageTimer coincidence_timer(stats, "coincidence");
+    auto [coinc_pairs, coinc_nfolds] = loader.findCoincidences(clusters, centroids);
+    coincidence_timer.stop();
+
+    StageTimer spectrum_timer(stats, "spectrum");
+    auto settings = synthetic.importSettings(num_threads);
+    Tpx3Image image(path, std::move(data), std::move(clusters), std::move(centroids), std::move(coinc_pairs),
+                    std::move(coinc_nfolds), {1, 0, 1, 0}, synthetic.geometry, settings.coincidenceWindow, settings.rateBinWidth,
+                    settings.lineTrackingWindow, settings.homSegmentWidth);
+    spectrum_timer.stop();
+
+    // the histograms behind each FileViewer view
+    std::vector<std::pair<std::string, std::function<void()>>> histograms {
+        {"rawPacketImage", [&image]() { image.rawPacketImage(); }},
+        {"toTDistribution", [&image]() { image.toTDistribution(); }},
+        {"clusterImage", [&image]() { image.clusterImage(); }},
+        {"startStopHistogram", [&image]() { image.startStopHistogram(); }},
+        {"crossCorrelation", [&image]() { image.crossCorrelation(); }},
+        {"dToADistribution", [&image]() { image.dToADistribution(); }},
+        {"spatialCorrelations", [&image]() { image.spatialCorrelations(); }},
+        {"spatialCorrelations16", [&image]() {
+            auto histogram = image.spatialCorrelations(Tpx3Image::MAX_SUBDIVISIONS);
+            histogram.marginalX();
+            histogram.marginalY();
+        }},
+        {"homHistogramSlice", [&image]() {
+            auto &hom = image.homHistogram();
+            hom.slice(0, hom.numSegments());
+            hom.segmentCounts(hom.wlMin(), hom.wlMax(), hom.wlMin(), hom.wlMax());
+        }},
+        {"lineProfileFit", [&image]() { LinePair::find(image.rawPacketImage(), true); }},
+        {"rawImagePyramid", [&image]() { image.rawImagePyramid(); }},
+        {"clusterImagePyramid", [&image]() { image.clusterImagePyramid(); }},
+        {"clusterImagePyramid16", [&image]() { image.clusterImagePyramid(Tpx3Image::MAX_SUBDIVISIONS, true); }},
+        {"spatialCorrelationPyramid", [&image]() { image.spatialCorrelationPyramid(); }},
+        {"rateTimeSeries", [&image]() {
+            auto &series = image.rateTimeSeries();
+            auto level = series.levelFor(0, series.duration(), 1000);
+            for(int ix = 0; ix < RateTimeSeries::NUM_SERIES; ++ix)
+                series.rates(static_cast<RateTimeSeries::Series>(ix), level, 0, series.duration());
+        }},
+    };
+    for(auto &[name, histogram] : histograms) {
+        StageTimer timer(stats, name);
+        histogram();
+    }
+
+    return stats;
+
+}
+
+using ResultKey = std::tuple<std::size_t, unsigned, std::string>; // packets (rounded), threads, stage
+
+std::map<ResultKey, double> read_results(const std::string &csv_path) {
+
+    std::map<ResultKey, double> results;
+
+    std::ifstream csv(csv_path);
+    if(!csv)
+        throw std::runtime_error("Could not open baseline " + csv_path);
+
+    std::string line;
+    std::getline(csv, line); // header
+    while(std::getline(csv, line)) {
+        std::stringstream row(line);
+        std::string target, packets, threads, stage, wall_time, packets_per_s;
+        std::getline(row, target, ',');
+        std::getline(row, packets, ',');
+        std::getline(row, threads, ',');
+        std::getline(row, stage, ',');
+        std::getline(row, wall_time, ',');
+        std::getline(row, packets_per_s, ',');
+        if(packets_per_s.empty())
+            continue;
+        results[{std::stoull(target), static_cast<unsigned>(std::stoul(threads)), stage}] = std::stod(packets_per_s);
+    }
+
+    return results;
+
+}
+
+// Runs every combination of the swept import settings on one synthetic file, and writes the accuracy of each
+// next to its run time, so that faster settings can be weighed against what they cost in accuracy
+int run_validation(const BenchOptions &options) {
+
+    auto target_packets = static_cast<std::size_t>(std::llround(options.max_packets));
+    auto synthetic = synthetic_settings(options, target_packets);
+    TaskPool::global().setNumThreads(options.num_threads);
+
+    std::ofstream csv(options.csv_path);
+    csv << "packets,threads,cluster_xy,cluster_t_ns,min_cluster_size,coinc_window_ns,processing_time_s,packets_per_s,"
+           "cluster_purity,cluster_completeness,split_fraction,merge_fraction,centroid_error_px,centroid_time_error_ns,"
+           "true_pairs,found_pairs,correct_pairs,nfolds,pair_efficiency,false_coincidence_fraction\n";
+
+    auto path = (std::filesystem::path(options.dir) / ("spec_hom_validation_" + std::to_string(target_packets) + ".tpx3")).string();
+
+    try {
+        std::cout << "Generating " << path << "..." << std::endl;
+        SyntheticTruth truth;
+        write_synthetic_tpx3(path, synthetic, &truth);
+
+        std::cout << std::setprecision(4)
+                  << std::setw(8) << "xy" << std::setw(8) << "t [ns]" << std::setw(6) << "min" << std::setw(10) << "win [ns]"
+                  << std::setw(12) << "time [s]" << std::setw(10) << "purity" << std::setw(10) << "compl."
+                  << std::setw(10) << "err [px]" << std::setw(10) << "err [ns]" << std::setw(10) << "pair eff"
+                  << std::setw(10) << "false" << std::endl;
+
+        for(auto cluster_xy : options.cluster_xy) {
+            for(auto cluster_t : options.cluster_t) {
+                for(auto min_cluster_size : options.min_cluster_size) {
+                    for(auto coinc_window : options.coinc_window) {
+                        auto settings = synthetic.importSettings(options.num_threads);
+                        settings.clusterSizeXY = static_cast<float>(cluster_xy);
+                        settings.clusterSizeT = static_cast<float>(cluster_t);
+                        settings.minClusterSize = static_cast<int>(min_cluster_size);
+                        settings.coincidenceWindow = coinc_window * 1e-9;
+
+                        auto result = validate_pipeline(path, truth, settings);
+
+                        // the stages that the swept settings affect
+                        double processing_time = 0;
+                        for(auto &stage : result.stats.stages) {
+                            if(stage.name == "cluster" || stage.name == "centroid" || stage.name == "coincidence")
+                                processing_time += stage.wall_time;
+                        }
+                        auto packets_per_s = processing_time > 0 ? result.stats.num_packets / processing_time : 0;
+
+                        csv << result.stats.num_packets << ',' << options.num_threads << ',' << cluster_xy << ','
+                            << cluster_t << ',' << min_cluster_size << ',' << coinc_window << ',' << processing_time << ','
+                            << packets_per_s << ',' << result.cluster_purity << ',' << result.cluster_completeness << ','
+                            << result.split_fraction << ',' << result.merge_fraction << ',' << result.centroid_error << ','
+                            << result.centroid_time_error * 1e9 << ',' << result.num_true_pairs << ','
+                            << result.num_found_pairs << ',' << result.num_correct_pairs << ',' << result.num_nfolds << ','
+                            << result.pairEfficiency() << ',' << result.falseCoincidenceFraction() << std::endl;
+
+                        std::cout << std::setw(8) << cluster_xy << std::setw(8) << cluster_t << std::setw(6)
+                                  << min_cluster_size << std::setw(10) << coinc_window << std::setw(12)
+                                  << processing_time << std::setw(10) << result.cluster_purity << std::setw(10)
+                                  << result.cluster_completeness << std::setw(10) << result.centroid_error
+                                  << std::setw(10) << result.centroid_time_error * 1e9 << std::setw(10)
+                                  << result.pairEfficiency() << std::setw(10) << result.falseCoincidenceFraction()
+                                  << std::endl;
+                    }
+                }
+            }
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "Validation failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if(!options.keep_files)
+        std::filesystem::remove(path);
+
+    std::cout << "Wrote results to " << options.csv_path << std::endl;
+    return 0;
+
+}
+
+// Replays a recorded file as fast as possible to find the break-even rate of the live pipeline, then at each of the
+// requested speeds to measure the latency and queue depths at that rate
+int run_replay(const BenchOptions &options) {
+
+    TaskPool::global().setNumThreads(options.num_threads);
+
+    // a recorded file need not match the synthetic line positions, so the whole sensor is used
+    auto settings = options.synthetic.importSettings(options.num_threads);
+    int mask_max = std::max(settings.geometry.width, settings.geometry.height) + 1;
+    settings.spatialMask = {false, -1, mask_max, -1, mask_max};
+
+    std::ofstream csv(options.csv_path);
+    csv << "speed,packets,pairs,data_time_s,wall_time_s,packets_per_s,latency_p50_s,latency_p90_s,latency_p99_s,"
+           "latency_max_s,max_input_queue,mean_input_queue,max_pending,max_batch,kept_up\n";
+
+    try {
+        std::cout << "Replaying " << options.replay_path << " as fast as possible..." << std::endl;
+        auto fastest = replay_tpx3(options.replay_path, settings, 0, options.look_back * 1e-3);
+        double break_even = fastest.wall_time > 0 ? fastest.data_time / fastest.wall_time : 0;
+
+        std::vector<ReplayResult> results {fastest};
+        for(auto speed : options.speeds) {
+            std::cout << "Replaying at " << speed << "x real time..." << std::endl;
+            results.push_back(replay_tpx3(options.replay_path, settings, speed, options.look_back * 1e-3));
+        }
+
+        std::cout << std::setprecision(4)
+                  << std::setw(8) << "speed" << std::setw(12) << "packets/s" << std::setw(10) << "p50 [ms]"
+                  << std::setw(10) << "p90 [ms]" << std::setw(10) << "p99 [ms]" << std::setw(10) << "max [ms]"
+                  << std::setw(12) << "max input" << std::setw(12) << "max held" << std::setw(12) << "max batch"
+                  << std::setw(9) << "kept up" << std::endl;
+
+        for(auto &result : results) {
+            bool kept_up = result.speed <= break_even;
+            csv << result.speed << ',' << result.num_packets << ',' << result.num_pairs << ',' << result.data_time << ','
+                << result.wall_time << ',' << result.packetsPerSecond() << ',' << result.latency_p50 << ','
+                << result.latency_p90 << ',' << result.latency_p99 << ',' << result.latency_max << ','
+                << result.max_input_queue << ',' << result.mean_input_queue << ',' << result.max_pending << ','
+                << result.max_batch << ',' << kept_up << std::endl;
+
+            std::stringstream speed;
+            speed << std::setprecision(4);
+            if(result.speed > 0)
+                speed << result.speed << "x";
+            else
+                speed << "max";
+
+            std::cout << std::setw(8) << speed.str()
+                      << std::setw(12) << result.packetsPerSecond() << std::setw(10) << result.latency_p50 * 1e3
+                      << std::setw(10) << result.latency_p90 * 1e3 << std::setw(10) << result.latency_p99 * 1e3
+                      << std::setw(10) << result.latency_max * 1e3 << std::setw(12) << result.max_input_queue
+                      << std::setw(12) << result.max_pending << std::setw(12) << result.max_batch
+                      << std::setw(9) << (result.speed > 0 ? (kept_up ? "yes" : "no") : "") << std::endl;
+        }
+
+        std::cout << "Break-even: " << break_even << "x real time, "
+                  << fastest.packetsPerSecond() << " packets/s" << std::endl;
+    } catch(const std::exception &e) {
+        std::cerr << "Replay failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Wrote results to " << options.csv_path << std::endl;
+    return 0;
+
+}
+
+int main(int argc, char *argv[]) {
+
+    BenchOptions options;
+    try {
+        if(!parse_options(argc, argv, options))
+            return 1;
+    } catch(const std::exception &e) {
+        std::cerr << "Invalid option value: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if(options.validate)
+        return run_validation(options);
+    if(!options.replay_path.empty())
+        return run_replay(options);
+
+    std::ofstream csv(options.csv_path);
+    csv << "target_packets,packets,threads,stage,wall_time_s,packets_per_s,bytes_per_s,busy_time_s,thread_utilisation,peak_memory_bytes\n";
+
+    std::vector<std::pair<std::size_t, unsigned>> runs; // (target packets, threads)
+    for(double packets = options.min_packets; packets <= options.max_packets * 1.001; packets *= 10)
+        runs.emplace_back(static_cast<std::size_t>(std::llround(packets)), options.num_threads);
+    if(options.thread_scaling && !runs.empty()) {
+        for(unsigned threads = 1; threads < options.num_threads; threads *= 2)
+            runs.emplace_back(runs.back().first, threads);
+    }
+
+    std::map<ResultKey, double> results;
+
+    try {
+        for(std::size_t run = 0; run < runs.size(); ++run) {
+            auto [target_packets, threads] = runs[run];
+            auto synthetic = synthetic_settings(options, target_packets);
+
+            auto path = (std::filesystem::path(options.dir) / ("spec_hom_bench_" + std::to_string(target_packets) + ".tpx3")).string();
+            if(!std::filesystem::exists(path)) {
+                std::cout << "Generating " << path << "..." << std::endl;
+                write_synthetic_tpx3(path, synthetic);
+            }
+
+            std::cout << "Running " << target_packets << " packets with " << threads << " thread(s)..." << std::endl;
+            auto stats = run_pipeline(path, synthetic, threads);
+            std::cout << stats.summary() << "\n" << std::endl;
+
+            for(auto &stage : stats.stages) {
+                csv << target_packets << ',' << stage.num_packets << ',' << threads << ',' << stage.name << ','
+                    << stage.wall_time << ',' << stage.packetsPerSecond() << ',' << stage.bytesPerSecond() << ','
+                    << stage.busy_time << ',' << stage.threadUtilisation() << ',' << stage.peak_memory << '\n';
+                results[{target_packets, threads, stage.name}] = stage.packetsPerSecond();
+            }
+            csv << std::flush;
+
+            // the same file is reused for the thread scaling runs
+            bool used_again = std::any_of(runs.begin() + run + 1, runs.end(), [target_packets](auto &other) {
+                return other.first == target_packets;
+            });
+            if(!options.keep_files && !used_again)
+                std::filesystem::remove(path);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Wrote results to " << options.csv_path << std::endl;
+
+    if(options.baseline_path.empty())
+        return 0;
+
+    // compare throughput with the baseline, and fail if any stage got slower than the tolerance allows
+    int num_regressions = 0;
+    try {
+        for(auto &[key, baseline_rate] : read_results(options.baseline_path)) {
+            auto result = results.find(key);
+            if(result == results.end() || baseline_rate <= 0)
+                continue;
+
+            auto ratio = result->second / baseline_rate;
+            if(ratio < 1 - options.tolerance) {
+                std::cout << "REGRESSION: " << std::get<2>(key) << " at " << std::get<0>(key) << " packets, "
+                          << std::get<1>(key) << " thread(s): " << ratio * 100 << "% of baseline throughput" << std::endl;
+                ++num_regressions;
+            }
+        }
+    } catch(const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << num_regressions << " regression(s) against " << options.baseline_path << std::endl;
+    return num_regressions ? 2 : 0;
+
+}
@@ -0,0 +1,322 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include <QCoreApplication>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUdpSocket>
+#include <QHostAddress>
+
+// Streams a recorded .tpx3 file over TCP or UDP, as Serval does during an acquisition, so that the live stream mode
+// of the app can be tested (and its sustained rate measured) without the camera.
+
+constexpr std::size_t SIZE_OF_CHUNK_HEADER = 8; // in bytes
+constexpr std::size_t SIZE_OF_PACKET = 8; // in bytes
+constexpr std::size_t MAX_TCP_BACKLOG = 1 << 22; // [bytes] queued in the socket before waiting for the receiver
+constexpr uint64_t COARSE_PERIOD = uint64_t(1) << 30; // [25 ns] the SPIDR and coarse ToA together wrap around after this
+
+struct ReplayOptions {
+    std::string path;
+    uint16_t port = 8451;
+    std::string udp_host; // send datagrams to this host instead of serving a TCP connection
+    double rate = 0; // [packets/s] 0: as fast as the receiver takes them
+    unsigned repeat = 1; // number of times the file is sent
+    std::size_t block_size = 8192; // [bytes] largest datagram, or TCP write
+};
+
+void print_usage() {
+
+    std::cout <<
+        "Usage: spec_hom_replay [options] FILE.tpx3\n"
+        "Streams a recorded .tpx3 file over TCP (waiting for the app to connect) or UDP, at a fixed packet rate.\n"
+        "\n"
+        "  --port N             port to listen on, or to send to with --udp (default 8451)\n"
+        "  --udp HOST           send UDP datagrams to HOST instead of serving TCP\n"
+        "  --rate R             packets per second (default: as fast as possible)\n"
+        "  --repeat N           send the file N times (default 1), each pass shifted to follow the previous one in time\n"
+        "  --block-size B       largest datagram or write [bytes] (default 8192); chunks are split to fit\n"
+        << std::flush;
+
+}
+
+bool parse_options(int argc, char *argv[], ReplayOptions &options) {
+
+    std::map<std::string, std::function<void(const std::string&)>> with_value {
+        {"--port", [&](const std::string &v) { options.port = static_cast<uint16_t>(std::stoul(v)); }},
+        {"--udp", [&](const std::string &v) { options.udp_host = v; }},
+        {"--rate", [&](const std::string &v) { options.rate = std::stod(v); }},
+        {"--repeat", [&](const std::string &v) { options.repeat = std::stoul(v); }},
+        {"--block-size", [&](const std::string &v) { options.block_size = std::stoul(v); }},
+    };
+
+    for(int ix = 1; ix < argc; ++ix) {
+        std::string arg = argv[ix];
+
+        if(arg == "--help" || arg == "-h") {
+            print_usage();
+            return false;
+        } else if(with_value.count(arg) && ix + 1 < argc) {
+            with_value[arg](argv[++ix]);
+        } else if(arg.rfind("--", 0) != 0 && options.path.empty()) {
+            options.path = arg;
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << "\n\n";
+            print_usage();
+            return false;
+        }
+    }
+
+    if(options.path.empty()) {
+        print_usage();
+        return false;
+    }
+    if(options.block_size < SIZE_OF_CHUNK_HEADER + SIZE_OF_PACKET)
+        throw std::invalid_argument("--block-size must hold at least one packet");
+
+    return true;
+
+}
+
+// whether a packet is pixel data, and its combined SPIDR and coarse ToA [25 ns]
+bool pixel_coarse_toa(const char *packet, uint64_t &coarse_toa) {
+
+    uint64_t full_data;
+    std::memcpy(&full_data, packet, SIZE_OF_PACKET); // little endian, as in the decoder
+    if((full_data >> 60) != 0xb)
+        return false;
+
+    coarse_toa = ((full_data & 0xFFFF) << 14) | ((full_data >> 30) & 0x3FFF);
+    return true;
+
+}
+
+// Span of the ToAs of the pixel packets in the file [25 ns], unwrapped the same way as in the app
+uint64_t coarse_toa_span(const std::string &path) {
+
+    std::ifstream stream(path, std::ios::binary);
+    if(!stream.is_open())
+        throw std::runtime_error("Failed to open " + path);
+
+    bool has_data = false;
+    int64_t newest = 0, earliest = 0;
+    char header[SIZE_OF_CHUNK_HEADER];
+    std::vector<char> chunk;
+    while(stream.read(header, SIZE_OF_CHUNK_HEADER)) {
+        std::size_t chunk_size = (static_cast<std::size_t>(static_cast<uint8_t>(header[7])) << 8) + static_cast<uint8_t>(header[6]);
+        chunk.resize(chunk_size);
+        stream.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        auto num_packets = static_cast<std::size_t>(stream.gcount()) / SIZE_OF_PACKET;
+
+        for(std::size_t ix = 0; ix < num_packets; ++ix) {
+            uint64_t raw;
+            if(!pixel_coarse_toa(chunk.data() + ix * SIZE_OF_PACKET, raw))
+                continue;
+
+            if(!has_data) {
+                newest = earliest = static_cast<int64_t>(raw);
+                has_data = true;
+            }
+            auto periods = std::llround(static_cast<double>(newest - static_cast<int64_t>(raw)) / static_cast<double>(COARSE_PERIOD));
+            auto toa = static_cast<int64_t>(raw) + static_cast<int64_t>(periods) * static_cast<int64_t>(COARSE_PERIOD);
+            newest = std::max(newest, toa);
+            earliest = std::min(earliest, toa);
+        }
+    }
+
+    return has_data ? static_cast<uint64_t>(newest - earliest) + 1 : 0;
+
+}
+
+// Reads the file one chunk at a time, and groups the chunks into blocks of at most block_size bytes. Chunks larger
+// than a block are split at packet boundaries, repeating the chunk header, so every block can be decoded on its own.
+// The ToA of every pixel packet is shifted by toa_offset [25 ns], so that a file sent again follows on in time.
+class BlockReader {
+public:
+    BlockReader(const std::string &path, std::size_t block_size, uint64_t toa_offset = 0) :
+        mStream(path, std::ios::binary),
+        mBlockSize(block_size),
+        mToaOffset(toa_offset % COARSE_PERIOD),
+        mChunk(),
+        mChunkPos(0) {
+
+        if(!mStream.is_open())
+            throw std::runtime_error("Failed to open " + path);
+
+    }
+
+    // fills block; returns false at the end of the file
+    bool next(std::vector<char> &block, std::size_t &num_packets) {
+
+        block.clear();
+        num_packets = 0;
+
+        while(true) {
+            if(mChunkPos >= mChunk.size() && !readChunk())
+                break;
+
+            auto room = mBlockSize - block.size();
+            auto left = mChunk.size() - mChunkPos;
+            if(room < SIZE_OF_CHUNK_HEADER + SIZE_OF_PACKET)
+                break;
+
+            auto payload = std::min(left, (room - SIZE_OF_CHUNK_HEADER) / SIZE_OF_PACKET * SIZE_OF_PACKET);
+            char header[SIZE_OF_CHUNK_HEADER];
+            std::memcpy(header, mHeader, SIZE_OF_CHUNK_HEADER);
+            header[6] = static_cast<char>(payload & 0xFF);
+            header[7] = static_cast<char>((payload >> 8) & 0xFF);
+
+            block.insert(block.end(), header, header + SIZE_OF_CHUNK_HEADER);
+            block.insert(block.end(), mChunk.begin() + static_cast<std::ptrdiff_t>(mChunkPos),
+                         mChunk.begin() + static_cast<std::ptrdiff_t>(mChunkPos + payload));
+            mChunkPos += payload;
+            num_packets += payload / SIZE_OF_PACKET;
+        }
+
+        return !block.empty();
+
+    }
+
+private:
+    bool readChunk() {
+
+        if(!mStream.read(mHeader, SIZE_OF_CHUNK_HEADER))
+            return false;
+
+        if(std::memcmp(mHeader, "TPX3", 4) != 0)
+            throw std::runtime_error("Corrupt chunk header");
+
+        std::size_t chunk_size = (static_cast<std::size_t>(static_cast<uint8_t>(mHeader[7])) << 8) + static_cast<uint8_t>(mHeader[6]);
+        mChunk.resize(chunk_size / SIZE_OF_PACKET * SIZE_OF_PACKET);
+        mStream.read(mChunk.data(), static_cast<std::streamsize>(mChunk.size()));
+        mChunk.resize(static_cast<std::size_t>(mStream.gcount()) / SIZE_OF_PACKET * SIZE_OF_PACKET); // the file may end mid-chunk
+        mChunkPos = 0;
+
+        if(mToaOffset) {
+            for(std::size_t pos = 0; pos < mChunk.size(); pos += SIZE_OF_PACKET) {
+                uint64_t coarse_toa;
+                if(!pixel_coarse_toa(mChunk.data() + pos, coarse_toa))
+                    continue;
+
+                coarse_toa = (coarse_toa + mToaOffset) % COARSE_PERIOD;
+                uint64_t full_data;
+                std::memcpy(&full_data, mChunk.data() + pos, SIZE_OF_PACKET);
+                full_data = (full_data & ~(uint64_t(0xFFFF) | (uint64_t(0x3FFF) << 30))) | (coarse_toa >> 14) | ((coarse_toa & 0x3FFF) << 30);
+                std::memcpy(mChunk.data() + pos, &full_data, SIZE_OF_PACKET);
+            }
+        }
+
+        return true;
+
+    }
+
+    std::ifstream mStream;
+    std::size_t mBlockSize;
+    uint64_t mToaOffset; // [25 ns]
+    char mHeader[SIZE_OF_CHUNK_HEADER];
+    std::vector<char> mChunk; // payload of the current chunk
+    std::size_t mChunkPos;
+};
+
+int main(int argc, char *argv[]) {
+
+    QCoreApplication app(argc, argv);
+
+    ReplayOptions options;
+    try {
+        if(!parse_options(argc, argv, options))
+            return 1;
+    } catch(const std::exception &e) {
+        std::cerr << "Invalid option value: " << e.what() << std::endl;
+        return 1;
+    }
+
+    bool udp = !options.udp_host.empty();
+    QTcpServer server;
+    QTcpSocket *tcp_socket = nullptr;
+    QUdpSocket udp_socket;
+    QHostAddress udp_address(QString::fromStdString(options.udp_host));
+
+    if(!udp) {
+        if(!server.listen(QHostAddress::Any, options.port)) {
+            std::cerr << "Failed to listen on port " << options.port << ": " << server.errorString().toStdString() << std::endl;
+            return 1;
+        }
+        std::cout << "Waiting for a connection on port " << options.port << "..." << std::endl;
+        server.waitForNewConnection(-1);
+        tcp_socket = server.nextPendingConnection();
+        if(!tcp_socket) {
+            std::cerr << "Failed to accept a connection" << std::endl;
+            return 1;
+        }
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    clock::duration stalled(0); // time spent waiting for a TCP receiver that was slower than the sender
+    std::size_t total_packets = 0, total_bytes = 0;
+
+    try {
+        std::vector<char> block;
+        std::size_t num_packets = 0;
+
+        // each pass follows the previous one in time; otherwise the app would drop it all as late
+        auto pass_span = options.repeat > 1 ? coarse_toa_span(options.path) : 0;
+
+        for(unsigned pass = 0; pass < options.repeat; ++pass) {
+            BlockReader reader(options.path, options.block_size, pass * pass_span);
+
+            while(reader.next(block, num_packets)) {
+                // pace the blocks so that the packet rate stays at the requested rate on average
+                if(options.rate > 0) {
+                    auto due = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(total_packets / options.rate));
+                    std::this_thread::sleep_until(due);
+                }
+
+                if(udp) {
+                    udp_socket.writeDatagram(block.data(), static_cast<qint64>(block.size()), udp_address, options.port);
+                } else {
+                    tcp_socket->write(block.data(), static_cast<qint64>(block.size()));
+                    auto stall_start = clock::now();
+                    while(tcp_socket->bytesToWrite() > static_cast<qint64>(MAX_TCP_BACKLOG)) {
+                        if(!tcp_socket->waitForBytesWritten(1000) && tcp_socket->state() != QAbstractSocket::ConnectedState)
+                            throw std::runtime_error("The receiver closed the connection");
+                    }
+                    stalled += clock::now() - stall_start;
+                }
+
+                total_packets += num_packets;
+                total_bytes += block.size();
+            }
+        }
+
+        if(!udp) {
+            while(tcp_socket->bytesToWrite() > 0 && tcp_socket->waitForBytesWritten(1000));
+            tcp_socket->disconnectFromHost();
+            if(tcp_socket->state() != QAbstractSocket::UnconnectedState)
+                tcp_socket->waitForDisconnected(5000);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "Replay failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    std::cout << "Sent " << total_packets << " packets (" << total_bytes << " bytes) in " << elapsed << " s: "
+              << total_packets / elapsed << " packets/s, " << total_bytes / elapsed / 1e6 << " MB/s" << std::endl;
+    if(!udp)
+        std::cout << "Waited for the receiver " << 100 * std::chrono::duration<double>(stalled).count() / elapsed
+                  << "% of the time" << std::endl;
+
+    return 0;
+
+}
@@ -8,26 +8,23 @@
 
 using namespace spec_hom;
 
-ClusteredImageView::ClusteredImageView(QWidget *parent, Tpx3Image *src) :
+ClusteredImageView::ClusteredImageView(QWidget *parent, Tpx3Image *src, const ViewData &data, unsigned subdivisions, bool bilinear) :
         Hist2DView(parent, src) {
 
     title("Distribution of Cluster Centroids");
     xLabel("Camera X");
     yLabel("Camera Y");
-    colorbarLabel("Cluster Centroids per Pixel");
+    colorbarLabel("Cluster Centroids per Bin");
 
-    auto width = Tpx3Image::WIDTH, height = Tpx3Image::HEIGHT;
+    setPyramid(data.pyramid);
+    addResolutionControls(subdivisions, bilinear);
 
-    auto image_2d = source()->clusterImage();
-    auto &data_arr = data();
+    updatePlot();
 
-    for (int x=0; x<Tpx3Image::WIDTH; ++x) {
-        data_arr.emplace_back(height);
-        for (int y=0; y<Tpx3Image::HEIGHT; ++y) {
-            data_arr[x][y] = image_2d[x][y];
-        }
-    }
+}
 
-    updatePlot();
+ViewData ClusteredImageView::compute(const Tpx3Image *src, unsigned subdivisions, bool bilinear) {
+
+    return {std::make_shared<const HistogramPyramid>(src->clusterImagePyramid(subdivisions, bilinear))};
 
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "fileview.h"
+
+#include "qcustomplot.h"
+
+#include "tpx3/tpx3.h"
+
+using namespace spec_hom;
+
+CrossCorrelationView::CrossCorrelationView(QWidget *parent, Tpx3Image *image, const ViewData &data) :
+        LinePlotView (parent, image) {
+
+    xData() = data.x;
+    yData() = data.y;
+
+    title("g2 Cross-Correlation between the Channels");
+    xLabel("Delay from channel 1 to channel 2 [sec]");
+    yLabel("g2");
+
+    updatePlot();
+
+}
+
+ViewData CrossCorrelationView::compute(const Tpx3Image *src) {
+
+    ViewData data;
+    std::tie(data.x, data.y) = src->crossCorrelation(MIN_TICK, LiveHistograms::G2_HALF_BINS);
+
+    return data;
+
+}
\ No newline at end of file
@@ -8,13 +8,13 @@
 
 using namespace spec_hom;
 
-DToADistributionView::DToADistributionView(QWidget *parent, Tpx3Image *image) :
+DToADistributionView::DToADistributionView(QWidget *parent, Tpx3Image *image, const ViewData &data) :
         LinePlotView(parent, image),
         mExportCalibButton(new QPushButton(this)) {
 
-    auto &x_data = xData(), &y_data = yData(), &y_err = yErr();
-
-    std::tie(x_data, y_data, y_err) = source()->dToADistribution(4);
+    xData() = data.x;
+    yData() = data.y;
+    yErr() = data.err;
 
     title("Mean Delay vs. Time over Threshold");
     xLabel("Time over Threshold [ns]");
@@ -31,6 +31,15 @@ DToADistributionView::DToADistributionView(QWidget *parent, Tpx3Image *image) :
 
 }
 
+ViewData DToADistributionView::compute(const Tpx3Image *src) {
+
+    ViewData data;
+    std::tie(data.x, data.y, data.err) = src->dToADistribution(4);
+
+    return data;
+
+}
+
 void DToADistributionView::exportCalibrationClicked() {
 
     auto filename = QFileDialog::getSaveFileName(
@@ -1,5 +1,10 @@
 #include "fileview.h"
 
+#include <sstream>
+#include <iomanip>
+
+#include <QProgressBar>
+
 #include "tpx3/tpx3.h"
 
 using namespace spec_hom;
@@ -9,20 +14,31 @@ enum ViewType {
     VIEWTYPE_TOT_DISTRIBUTION,
     VIEWTYPE_CLUSTERED_IMAGE,
     VIEWTYPE_START_STOP_HISTOGRAM,
+    VIEWTYPE_CROSS_CORRELATION,
     VIEWTYPE_DTOA_DISTRIBUTION,
     VIEWTYPE_SPATIAL_CORRELATIONS,
+    VIEWTYPE_HOM_SLICE,
+    VIEWTYPE_HOM_SCAN,
+    VIEWTYPE_RATE_TIME_SERIES,
     VIEWTYPE_NUM
 };
 
 FileViewer::FileViewer(QWidget *parent, Tpx3Image *image) :
         QWidget(parent),
         mImage(image),
+        mCache(new ViewCache(this, !image->isLive())),
+        mResolutions{{VIEWTYPE_CLUSTERED_IMAGE, {4, false}},
+                     {VIEWTYPE_SPATIAL_CORRELATIONS, {Tpx3Image::MAX_SUBDIVISIONS, false}}},
+        mHOMSegments(0, HOMSliceView::LAST_SEGMENT),
+        mHOMRegion{std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN(),
+                   std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()},
 
         mLayout(new QVBoxLayout(this)),
         mCenterWidget(new QGroupBox(this)),
         mCenterLayout(new QVBoxLayout(mCenterWidget)),
         mViewSelection(new QComboBox(mCenterWidget)),
-        mViewContainer(new QWidget(mCenterWidget)) {
+        mViewContainer(new QWidget(mCenterWidget)),
+        mLiveStatus(new QLabel(mCenterWidget)) {
 
     setLayout(mLayout);
 
@@ -32,22 +48,35 @@ FileViewer::FileViewer(QWidget *parent, Tpx3Image *image) :
 
         mCenterLayout->addWidget(mViewSelection);
         mCenterLayout->addWidget(mViewContainer, true);
+        mCenterLayout->addWidget(mLiveStatus);
 
     mLayout->addWidget(mCenterWidget);
 
     // setup signals
     connect(mViewSelection, &QComboBox::currentIndexChanged, this, &FileViewer::viewTypeChanged);
+    connect(mCache, &ViewCache::ready, this, &FileViewer::viewReady);
+    connect(mCache, &ViewCache::failed, this, &FileViewer::viewFailed);
 
     // setup combo box options
     mViewSelection->addItem("Raw Image");
     mViewSelection->addItem("Time over Threshold Distribution");
     mViewSelection->addItem("Clustered Image");
     mViewSelection->addItem("Start-Stop Histogram");
+    mViewSelection->addItem("g2 Cross-Correlation");
     mViewSelection->addItem("Relative Time of Arrival Distribution");
     mViewSelection->addItem("Spatial Correlations");
+    mViewSelection->addItem("Spectrally-Resolved HOM (Wavelength Slice)");
+    mViewSelection->addItem("Spectrally-Resolved HOM (Pairs per Segment)");
+    mViewSelection->addItem("Count Rates over Time");
 
     mViewSelection->setCurrentIndex(VIEWTYPE_RAW_IMAGE);
 
+    mLiveStatus->setVisible(mImage->isLive());
+    updateLiveStatus();
+
+    if(!mImage->isLive())
+        precomputeViews();
+
 }
 
 const std::string& FileViewer::fullFilename() const {
@@ -56,39 +85,251 @@ const std::string& FileViewer::fullFilename() const {
 
 }
 
+void FileViewer::refresh() {
+
+    mCache->invalidate();
+    showView();
+    updateLiveStatus();
+
+}
+
+void FileViewer::updateLiveStatus() {
+
+    if(!mImage->isLive())
+        return;
+
+    auto &live = *mImage->liveHistograms();
+
+    std::stringstream status;
+    status << std::fixed << std::setprecision(1);
+    // aggregated files have nothing pending
+    if(live.num_files) {
+        status << live.num_files << " files: " << live.num_packets << " packets, " << live.num_clusters << " clusters, "
+               << live.num_pairs << " pairs in " << live.data_time << " s of data";
+        mLiveStatus->setText(status.str().c_str());
+        return;
+    }
+
+    status << live.num_packets << " packets, " << live.num_clusters << " clusters, " << live.num_pairs << " pairs in "
+           << live.data_time << " s of data; " << live.num_pending_packets << " packets ("
+           << live.pending_time * 1e3 << " ms) pending";
+    if(live.num_late_packets)
+        status << ", " << live.num_late_packets << " dropped as late";
+    if(live.num_received_bytes) {
+        status << "; received " << live.num_received_bytes / 1e6 << " MB, receive buffer up to "
+               << live.buffer_fill * 100 << "% full";
+        if(live.num_dropped_datagrams)
+            status << ", " << live.num_dropped_datagrams << " datagrams (" << live.num_dropped_bytes / 1e6 << " MB) dropped";
+    }
+    if(!live.lines_found)
+        status << "; spatial correlations and rates start once enough data has arrived to fit the lines";
+
+    mLiveStatus->setText(status.str().c_str());
+
+}
+
 void FileViewer::viewTypeChanged(int newIndex) {
 
-    // we need to delete the current view and create a new one
-    auto oldViewContainer = mViewContainer;
-    mViewContainer = new QWidget(mCenterWidget);
-    auto oldLayoutItem = mCenterLayout->replaceWidget(oldViewContainer, mViewContainer);
-    delete oldLayoutItem->widget();
-    delete oldLayoutItem;
+    showView();
 
-    auto *viewContainerLayout = new QVBoxLayout(mViewContainer);
-    mViewContainer->setLayout(viewContainerLayout);
+}
+
+void FileViewer::showView() {
+
+    auto view_type = mViewSelection->currentIndex();
 
-    switch(newIndex) {
+    // the rate time series is binned as the image is filled, so there is nothing to compute
+    std::shared_ptr<const ViewData> data;
+    if(view_type != VIEWTYPE_RATE_TIME_SERIES) {
+        data = mCache->request({view_type, viewParameters(view_type)}, viewComputation(view_type));
+        if(!data) {
+            showPlaceholder("Computing " + mViewSelection->currentText() + "...", true);
+            return;
+        }
+    }
+
+    auto *viewContainer = replaceView();
+    auto *viewContainerLayout = viewContainer->layout();
+
+    Hist2DView *resolution_view = nullptr;
+    switch(view_type) {
         case VIEWTYPE_RAW_IMAGE:
-            viewContainerLayout->addWidget(new RawImageView(mViewContainer, mImage));
+            viewContainerLayout->addWidget(new RawImageView(viewContainer, mImage, *data));
             break;
         case VIEWTYPE_TOT_DISTRIBUTION:
-            viewContainerLayout->addWidget(new ToTDistributionView(mViewContainer, mImage));
+            viewContainerLayout->addWidget(new ToTDistributionView(viewContainer, mImage, *data));
             break;
         case VIEWTYPE_CLUSTERED_IMAGE:
-            viewContainerLayout->addWidget(new ClusteredImageView(mViewContainer, mImage));
+            resolution_view = new ClusteredImageView(viewContainer, mImage, *data, mResolutions[view_type].first, mResolutions[view_type].second);
+            viewContainerLayout->addWidget(resolution_view);
             break;
         case VIEWTYPE_START_STOP_HISTOGRAM:
-            viewContainerLayout->addWidget(new StartStopHistogramView(mViewContainer, mImage));
+            viewContainerLayout->addWidget(new StartStopHistogramView(viewContainer, mImage, *data));
+            break;
+        case VIEWTYPE_CROSS_CORRELATION:
+            viewContainerLayout->addWidget(new CrossCorrelationView(viewContainer, mImage, *data));
             break;
         case VIEWTYPE_DTOA_DISTRIBUTION:
-            viewContainerLayout->addWidget(new DToADistributionView(mViewContainer, mImage));
+            viewContainerLayout->addWidget(new DToADistributionView(viewContainer, mImage, *data));
             break;
         case VIEWTYPE_SPATIAL_CORRELATIONS:
-            viewContainerLayout->addWidget(new SpatialCorrelationView(mViewContainer, mImage));
+            resolution_view = new SpatialCorrelationView(viewContainer, mImage, *data, mResolutions[view_type].first, mResolutions[view_type].second);
+            viewContainerLayout->addWidget(resolution_view);
+            break;
+        case VIEWTYPE_HOM_SLICE: {
+            auto *view = new HOMSliceView(viewContainer, mImage, *data, mHOMSegments);
+            viewContainerLayout->addWidget(view);
+            connect(view, &HOMSliceView::segmentsChanged, this, [this, view_type](unsigned first, unsigned last) {
+                mHOMSegments = {first, last};
+                if(mViewSelection->currentIndex() == view_type)
+                    showView();
+            }, Qt::QueuedConnection);
+            break;
+        }
+        case VIEWTYPE_HOM_SCAN: {
+            auto *view = new HOMScanView(viewContainer, mImage, *data, mHOMRegion);
+            viewContainerLayout->addWidget(view);
+            connect(view, &HOMScanView::regionChanged, this, [this, view_type](double wl_1_min, double wl_1_max, double wl_2_min, double wl_2_max) {
+                mHOMRegion = {wl_1_min, wl_1_max, wl_2_min, wl_2_max};
+                if(mViewSelection->currentIndex() == view_type)
+                    showView();
+            }, Qt::QueuedConnection);
+            break;
+        }
+        case VIEWTYPE_RATE_TIME_SERIES:
+            viewContainerLayout->addWidget(new RateTimeSeriesView(viewContainer, mImage));
             break;
         default:
             assert(0); // one of the menu items is not implemented!
     }
 
+    // queued, since showing the view again deletes the one whose controls were changed
+    if(resolution_view) {
+        connect(resolution_view, &Hist2DView::resolutionChanged, this, [this, view_type](unsigned subdivisions, bool bilinear) {
+            mResolutions[view_type] = {subdivisions, bilinear};
+            if(mViewSelection->currentIndex() == view_type)
+                showView();
+        }, Qt::QueuedConnection);
+    }
+
+}
+
+QWidget* FileViewer::replaceView() {
+
+    // we need to delete the current view and create a new one
+    auto oldViewContainer = mViewContainer;
+    mViewContainer = new QWidget(mCenterWidget);
+    auto oldLayoutItem = mCenterLayout->replaceWidget(oldViewContainer, mViewContainer);
+    delete oldLayoutItem->widget();
+    delete oldLayoutItem;
+
+    auto *viewContainerLayout = new QVBoxLayout(mViewContainer);
+    mViewContainer->setLayout(viewContainerLayout);
+
+    return mViewContainer;
+
+}
+
+void FileViewer::showPlaceholder(const QString &text, bool busy) {
+
+    auto *viewContainer = replaceView();
+    auto *viewContainerLayout = viewContainer->layout();
+
+    auto *label = new QLabel(text, viewContainer);
+    label->setAlignment(Qt::AlignCenter);
+
+    viewContainerLayout->addWidget(label);
+
+    // a busy indicator, as the computations report no progress
+    if(busy) {
+        auto *spinner = new QProgressBar(viewContainer);
+        spinner->setRange(0, 0);
+        spinner->setMaximumWidth(300);
+        viewContainerLayout->addWidget(spinner);
+        viewContainerLayout->setAlignment(spinner, Qt::AlignHCenter | Qt::AlignTop);
+    }
+
+}
+
+void FileViewer::viewReady(int view_type, const QString &parameters) {
+
+    if(view_type == mViewSelection->currentIndex() && parameters == viewParameters(view_type))
+        showView();
+
+}
+
+void FileViewer::viewFailed(int view_type, const QString &parameters, const QString &message) {
+
+    if(view_type == mViewSelection->currentIndex() && parameters == viewParameters(view_type))
+        showPlaceholder("Failed to compute " + mViewSelection->currentText() + ": " + message, false);
+
+}
+
+void FileViewer::precomputeViews() {
+
+    // the current view was requested first, so it is computed first
+    for(int view_type = 0; view_type < VIEWTYPE_NUM; ++view_type) {
+        if(view_type != VIEWTYPE_RATE_TIME_SERIES)
+            mCache->request({view_type, viewParameters(view_type)}, viewComputation(view_type));
+    }
+
+}
+
+QString FileViewer::viewParameters(int view_type) const {
+
+    if(view_type == VIEWTYPE_HOM_SLICE)
+        return QString::number(mHOMSegments.first) + "-" + QString::number(mHOMSegments.second);
+    if(view_type == VIEWTYPE_HOM_SCAN) {
+        QStringList bounds;
+        for(auto bound : mHOMRegion)
+            bounds << QString::number(bound);
+        return bounds.join(",");
+    }
+
+    auto resolution = mResolutions.find(view_type);
+    if(resolution == mResolutions.end())
+        return {};
+
+    auto &[subdivisions, bilinear] = resolution->second;
+    return QString::number(subdivisions) + (bilinear ? "x bilinear" : "x");
+
+}
+
+ViewCache::Compute FileViewer::viewComputation(int view_type) const {
+
+    const Tpx3Image *image = mImage;
+
+    switch(view_type) {
+        case VIEWTYPE_RAW_IMAGE:
+            return [image]() { return RawImageView::compute(image); };
+        case VIEWTYPE_TOT_DISTRIBUTION:
+            return [image]() { return ToTDistributionView::compute(image); };
+        case VIEWTYPE_CLUSTERED_IMAGE: {
+            auto subdivisions = mResolutions.at(view_type).first;
+            auto bilinear = mResolutions.at(view_type).second;
+            return [image, subdivisions, bilinear]() { return ClusteredImageView::compute(image, subdivisions, bilinear); };
+        }
+        case VIEWTYPE_START_STOP_HISTOGRAM:
+            return [image]() { return StartStopHistogramView::compute(image); };
+        case VIEWTYPE_CROSS_CORRELATION:
+            return [image]() { return CrossCorrelationView::compute(image); };
+        case VIEWTYPE_DTOA_DISTRIBUTION:
+            return [image]() { return DToADistributionView::compute(image); };
+        case VIEWTYPE_SPATIAL_CORRELATIONS: {
+            auto subdivisions = mResolutions.at(view_type).first;
+            auto bilinear = mResolutions.at(view_type).second;
+            return [image, subdivisions, bilinear]() { return SpatialCorrelationView::compute(image, subdivisions, bilinear); };
+        }
+        case VIEWTYPE_HOM_SLICE: {
+            auto segments = mHOMSegments;
+            return [image, segments]() { return HOMSliceView::compute(image, segments); };
+        }
+        case VIEWTYPE_HOM_SCAN: {
+            auto region = mHOMRegion;
+            return [image, region]() { return HOMScanView::compute(image, region); };
+        }
+        default:
+            throw std::runtime_error("FileViewer: view type " + std::to_string(view_type) + " has nothing to compute");
+    }
+
 }
\ No newline at end of file
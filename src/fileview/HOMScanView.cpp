@@ -0,0 +1,84 @@
+#include "fileview.h"
+
+#include <cmath>
+
+#include "qcustomplot.h"
+
+#include "tpx3/tpx3.h"
+
+using namespace spec_hom;
+
+namespace {
+
+    // the region with the full wavelength range in place of NaN
+    HOMScanView::Region resolve_region(const SpectralHOMHistogram &hom, const HOMScanView::Region &region) {
+
+        auto resolved = region;
+        for(std::size_t ix = 0; ix < resolved.size(); ++ix) {
+            if(std::isnan(resolved[ix]))
+                resolved[ix] = ix % 2 ? hom.wlMax() : hom.wlMin();
+        }
+
+        return resolved;
+
+    }
+
+}
+
+HOMScanView::HOMScanView(QWidget *parent, Tpx3Image *src, const ViewData &data, const Region &region) :
+        LinePlotView(parent, src),
+        mRegionSpins() {
+
+    auto &hom = source()->homHistogram();
+    auto resolved = resolve_region(hom, region);
+
+    xData() = data.x;
+    yData() = data.y;
+    yErr() = data.err;
+
+    title("Spectrally-Resolved HOM: Pairs per Segment");
+    xLabel("Time Segment (" + QString::number(hom.segmentWidth()) + " s each)");
+    yLabel("Number of Pairs");
+
+    updatePlot();
+
+    const std::array<QString, 4> prefixes {"Wavelength 1 from ", "to ", "Wavelength 2 from ", "to "};
+    for(std::size_t ix = 0; ix < mRegionSpins.size(); ++ix) {
+        auto *spin = new QDoubleSpinBox(this);
+        spin->setPrefix(prefixes[ix]);
+        spin->setSuffix(" nm");
+        spin->setDecimals(2);
+        spin->setRange(hom.wlMin(), hom.wlMax());
+        spin->setValue(resolved[ix]);
+        spin->setKeyboardTracking(false);
+        spin->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+        toolbarLayout()->addWidget(spin);
+        mRegionSpins[ix] = spin;
+    }
+
+    // connected once the controls show the current choice
+    auto changed = [this]() {
+        emit regionChanged(mRegionSpins[0]->value(), mRegionSpins[1]->value(), mRegionSpins[2]->value(), mRegionSpins[3]->value());
+    };
+    for(auto *spin : mRegionSpins)
+        connect(spin, &QDoubleSpinBox::valueChanged, this, changed);
+
+}
+
+ViewData HOMScanView::compute(const Tpx3Image *src, const Region &region) {
+
+    auto &hom = src->homHistogram();
+    auto resolved = resolve_region(hom, region);
+    auto counts = hom.segmentCounts(resolved[0], resolved[1], resolved[2], resolved[3]);
+
+    // Poisson errors
+    ViewData data;
+    for(std::size_t segment = 0; segment < counts.size(); ++segment) {
+        data.x.push_back(static_cast<double>(segment));
+        data.y.push_back(static_cast<double>(counts[segment]));
+        data.err.push_back(std::sqrt(static_cast<double>(counts[segment])));
+    }
+
+    return data;
+
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "fileview.h"
+
+#include <algorithm>
+
+#include <QMessageBox>
+
+#include "qcustomplot.h"
+
+#include "tpx3/tpx3.h"
+
+using namespace spec_hom;
+
+HOMSliceView::HOMSliceView(QWidget *parent, Tpx3Image *src, const ViewData &data, std::pair<unsigned, unsigned> segments) :
+        Hist2DView(parent, src),
+        mFirstSegmentSpin(new QSpinBox(this)),
+        mLastSegmentSpin(new QSpinBox(this)),
+        mExportHistogramButton(new QPushButton(this)) {
+
+    auto &hom = source()->homHistogram();
+
+    title("Spectrally-Resolved HOM: Pairs in Segments " + QString::number(segments.first) + " to " +
+          (segments.second == LAST_SEGMENT ? QString("End") : QString::number(segments.second)));
+    xLabel("Wavelength 1 [nm]");
+    yLabel("Wavelength 2 [nm]");
+    colorbarLabel("Counts Per Bin");
+
+    setPyramid(data.pyramid);
+
+    updatePlot();
+
+    auto max_segment = static_cast<int>(std::max<std::size_t>(hom.numSegments(), 1) - 1);
+
+        mFirstSegmentSpin->setPrefix("From Segment ");
+        mFirstSegmentSpin->setRange(0, max_segment);
+        mFirstSegmentSpin->setValue(static_cast<int>(std::min<unsigned>(segments.first, max_segment)));
+        mFirstSegmentSpin->setKeyboardTracking(false);
+        mFirstSegmentSpin->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+
+        mLastSegmentSpin->setPrefix("To ");
+        mLastSegmentSpin->setRange(0, max_segment);
+        mLastSegmentSpin->setValue(static_cast<int>(std::min<unsigned>(segments.second, max_segment)));
+        mLastSegmentSpin->setKeyboardTracking(false);
+        mLastSegmentSpin->setToolTip("Each segment is " + QString::number(hom.segmentWidth()) + " s of the acquisition; "
+                                     "the last one follows a live image as it grows");
+        mLastSegmentSpin->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+
+        mExportHistogramButton->setText("Export 3D Histogram");
+        mExportHistogramButton->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+        mExportHistogramButton->setIcon(this->style()->standardIcon(QStyle::SP_ArrowForward));
+        connect(mExportHistogramButton, &QPushButton::clicked, this, &HOMSliceView::exportHistogramClicked);
+
+    toolbarLayout()->addWidget(mFirstSegmentSpin);
+    toolbarLayout()->addWidget(mLastSegmentSpin);
+    toolbarLayout()->addWidget(mExportHistogramButton);
+
+    // connected once the controls show the current choice
+    auto changed = [this]() {
+        auto last = static_cast<unsigned>(mLastSegmentSpin->value());
+        emit segmentsChanged(static_cast<unsigned>(mFirstSegmentSpin->value()),
+                             mLastSegmentSpin->value() == mLastSegmentSpin->maximum() ? LAST_SEGMENT : last);
+    };
+    connect(mFirstSegmentSpin, &QSpinBox::valueChanged, this, changed);
+    connect(mLastSegmentSpin, &QSpinBox::valueChanged, this, changed);
+
+}
+
+ViewData HOMSliceView::compute(const Tpx3Image *src, std::pair<unsigned, unsigned> segments) {
+
+    auto pyramid = src->homHistogram().slice(segments.first, static_cast<std::size_t>(segments.second) + 1);
+    if(!pyramid.empty())
+        pyramid.buildLevels();
+
+    return {std::make_shared<const HistogramPyramid>(std::move(pyramid))};
+
+}
+
+void HOMSliceView::exportHistogramClicked() {
+
+    auto filename = QFileDialog::getSaveFileName(
+            this,
+            "Save Spectrally-Resolved HOM Histogram",
+            "./data",
+            "Binary Files (*.bin)"
+    );
+
+    if(filename.isEmpty())
+        return;
+
+    if(!filename.toLower().endsWith(".bin"))
+        filename += ".bin";
+
+    try {
+        source()->homHistogram().save(filename.toStdString());
+    } catch(std::exception &e) {
+        QMessageBox::warning(this, "Export Failed", e.what());
+    }
+
+}
\ No newline at end of file
@@ -2,11 +2,28 @@
 
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <tuple>
+
+#include "qcustomplot.h"
+
+#include "tpx3/tpx3.h"
 
 using namespace spec_hom;
 
+constexpr int MIN_PLOT_BINS = 256; // bins across the plot before it has been laid out
+
 Hist2DView::Hist2DView(QWidget *parent, const Tpx3Image *src) :
         FileViewPanel(parent, src),
+        mPyramid(),
+        mResolutionCombo(nullptr),
+        mBilinearCheck(nullptr),
+        mColorMap(nullptr),
+        mLevel(0),
+        mFirstX(0),
+        mLastX(0),
+        mFirstY(0),
+        mLastY(0),
         mTitle(),
         mXLabel("X"),
         mYLabel("Y"),
@@ -16,22 +33,101 @@ Hist2DView::Hist2DView(QWidget *parent, const Tpx3Image *src) :
 
 }
 
+Hist2DView::~Hist2DView() = default;
+
+void Hist2DView::setPyramid(std::shared_ptr<const HistogramPyramid> pyramid) {
+
+    mPyramid = std::move(pyramid);
+
+}
+
+void Hist2DView::addResolutionControls(unsigned subdivisions, bool bilinear) {
+
+    mResolutionCombo = new QComboBox(this);
+    mBilinearCheck = new QCheckBox(this);
+
+        for(unsigned factor = 1; factor <= Tpx3Image::MAX_SUBDIVISIONS; factor *= 2) {
+            mResolutionCombo->addItem(QString::number(factor) + "x Sub-Pixel Bins", factor);
+            if(factor == subdivisions)
+                mResolutionCombo->setCurrentIndex(mResolutionCombo->count() - 1);
+        }
+        mResolutionCombo->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+
+        mBilinearCheck->setText("Bilinear Splatting");
+        mBilinearCheck->setChecked(bilinear);
+        mBilinearCheck->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+
+    toolbarLayout()->addWidget(mResolutionCombo);
+    toolbarLayout()->addWidget(mBilinearCheck);
+
+    // connected once the controls show the current choice
+    auto changed = [this]() {
+        emit resolutionChanged(mResolutionCombo->currentData().toUInt(), mBilinearCheck->isChecked());
+    };
+    connect(mResolutionCombo, &QComboBox::currentIndexChanged, this, changed);
+    connect(mBilinearCheck, &QCheckBox::toggled, this, changed);
+
+}
+
 void Hist2DView::saveDataBtnClick() {
 
+    QString filter;
     auto filename = QFileDialog::getSaveFileName(
             this,
-            "Save Plot as CSV",
+            "Save Plot Data",
             "./data",
-            "CSV Files (*.csv)"
+            "CSV Files (*.csv);;Binary Files (*.bin);;CSV Files, Bins in View (*.csv);;Binary Files, Bins in View (*.bin)",
+            &filter
     );
 
     if(filename.isEmpty())
         return;
 
-    if(!filename.toLower().endsWith(".csv"))
-        filename += ".csv";
+    bool binary = filter.startsWith("Binary");
+    auto extension = binary ? ".bin" : ".csv";
+    if(!filename.toLower().endsWith(extension))
+        filename += extension;
+
+    if(!mPyramid)
+        return;
+
+    // the whole map at the finest level by default, or only the (possibly coarser) bins drawn; either way, only the
+    // non-zero bins are written, with their counts at the centres of the bins
+    bool in_view = filter.contains("in View");
+    unsigned level = in_view ? mLevel : 0;
+    unsigned first_x = in_view ? mFirstX : 0, last_x = in_view ? mLastX : mPyramid->width(level);
+    unsigned first_y = in_view ? mFirstY : 0, last_y = in_view ? mLastY : mPyramid->height(level);
+    auto bin_width = mPyramid->binWidthX(level), bin_height = mPyramid->binWidthY(level);
+
+    if(binary) {
+        // header: uint32 bins along x and y at the level written, double x_min, x_max, y_min, y_max and uint64 number
+        // of records; then one record per non-zero bin, as uint32 x, uint32 y and double count, in native byte order
+        std::vector<std::tuple<uint32_t, uint32_t, double>> bins;
+        mPyramid->forEachBin(level, first_x, last_x, first_y, last_y, [&](unsigned x, unsigned y, double count) {
+            bins.emplace_back(x, y, count);
+        });
+
+        std::ofstream output(filename.toStdString(), std::ios::binary);
+        auto write = [&output](auto value) {
+            output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+
+        write(static_cast<uint32_t>(mPyramid->width(level)));
+        write(static_cast<uint32_t>(mPyramid->height(level)));
+        write(mPyramid->xMin());
+        write(mPyramid->xMax());
+        write(mPyramid->yMin());
+        write(mPyramid->yMax());
+        write(static_cast<uint64_t>(bins.size()));
+        for(auto &[x, y, count] : bins) {
+            write(x);
+            write(y);
+            write(count);
+        }
 
-    auto &data_arr = data();
+        output.close();
+        return;
+    }
 
     std::ofstream output(filename.toStdString());
 
@@ -39,11 +135,10 @@ void Hist2DView::saveDataBtnClick() {
     output << mXLabel.toStdString() << ", " << mYLabel.toStdString() << ", " << mColorbarLabel.toStdString();
     output << std::endl;
 
-    for(auto r = 0; r < data_arr.size(); ++r) {
-        for(auto c = 0; c < data_arr[r].size(); ++c) {
-            output << r << ", " << c << ", " << data_arr[r][c] << std::endl;
-        }
-    }
+    mPyramid->forEachBin(level, first_x, last_x, first_y, last_y, [&](unsigned x, unsigned y, double count) {
+        output << mPyramid->xMin() + (x + 0.5) * bin_width << ", " << mPyramid->yMin() + (y + 0.5) * bin_height << ", "
+               << count << "\n";
+    });
 
     output.close();
 
@@ -59,18 +154,7 @@ void Hist2DView::updatePlot() {
     plot()->xAxis->setLabel(mXLabel);
     plot()->yAxis->setLabel(mYLabel);
 
-    auto width = mData.size(), height = mData[0].size();
-
-    auto *colorMap = new QCPColorMap(plot()->xAxis, plot()->yAxis);
-    colorMap->data()->setSize(width, height);
-    colorMap->data()->setRange({0, static_cast<double>(width)-1},
-                               {0, static_cast<double>(height)-1});
-
-    for (int x=0; x<width; ++x) {
-        for (int y=0; y<height; ++y) {
-            colorMap->data()->setCell(x, y, mData[x][y]);
-        }
-    }
+    mColorMap = new QCPColorMap(plot()->xAxis, plot()->yAxis);
 
     plot()->plotLayout()->insertRow(0);
 
@@ -81,15 +165,65 @@ void Hist2DView::updatePlot() {
     auto *colorScale = new QCPColorScale(plot());
     plot()->plotLayout()->addElement(1, 1, colorScale);
     colorScale->setType(QCPAxis::atRight);
-    colorMap->setColorScale(colorScale);
+    mColorMap->setColorScale(colorScale);
     colorScale->axis()->setLabel(mColorbarLabel);
 
-    colorMap->setGradient(QCPColorGradient::gpThermal);
-    colorMap->rescaleDataRange();
+    mColorMap->setGradient(QCPColorGradient::gpThermal);
     auto *marginGroup = new QCPMarginGroup(plot());
     plot()->axisRect()->setMarginGroup(QCP::msBottom|QCP::msTop, marginGroup);
     colorScale->setMarginGroup(QCP::msBottom|QCP::msTop, marginGroup);
-    colorMap->setAntialiased(true);
-    plot()->rescaleAxes();
+    mColorMap->setAntialiased(true);
+
+    if(!mPyramid || mPyramid->empty())
+        return;
+
+    plot()->xAxis->setRange(mPyramid->xMin(), mPyramid->xMax());
+    plot()->yAxis->setRange(mPyramid->yMin(), mPyramid->yMax());
+    plot()->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
+
+    // the colours are fixed by the full view, so that zooming in does not change them
+    updateViewport();
+    mColorMap->rescaleDataRange(true);
+
+    connect(plot(), &QCustomPlot::beforeReplot, this, [this]() { updateViewport(); });
+
+}
 
-}
\ No newline at end of file
+void Hist2DView::updateViewport() {
+
+    auto x_range = plot()->xAxis->range(), y_range = plot()->yAxis->range();
+    auto rect = plot()->axisRect()->rect();
+
+    auto level = mPyramid->levelFor(x_range.size(), y_range.size(),
+                                    static_cast<unsigned>(std::max(rect.width(), MIN_PLOT_BINS)),
+                                    static_cast<unsigned>(std::max(rect.height(), MIN_PLOT_BINS)));
+
+    unsigned first_x, last_x, first_y, last_y;
+    mPyramid->binRangeX(level, x_range.lower, x_range.upper, first_x, last_x);
+    mPyramid->binRangeY(level, y_range.lower, y_range.upper, first_y, last_y);
+
+    if(first_x >= last_x || first_y >= last_y)
+        return; // nothing in view; keep what was drawn
+    if(level == mLevel && first_x == mFirstX && last_x == mLastX && first_y == mFirstY && last_y == mLastY && !mColorMap->data()->isEmpty())
+        return;
+
+    mLevel = level;
+    mFirstX = first_x;
+    mLastX = last_x;
+    mFirstY = first_y;
+    mLastY = last_y;
+
+    auto bin_width = mPyramid->binWidthX(level), bin_height = mPyramid->binWidthY(level);
+    auto scale = std::ldexp(1.0, -2 * static_cast<int>(level)); // counts per bin of the finest level
+
+    auto *data = mColorMap->data();
+    data->setSize(static_cast<int>(last_x - first_x), static_cast<int>(last_y - first_y));
+    data->setRange({mPyramid->xMin() + (first_x + 0.5) * bin_width, mPyramid->xMin() + (last_x - 0.5) * bin_width},
+                   {mPyramid->yMin() + (first_y + 0.5) * bin_height, mPyramid->yMin() + (last_y - 0.5) * bin_height});
+
+    data->fill(0);
+    mPyramid->forEachBin(level, first_x, last_x, first_y, last_y, [&](unsigned x, unsigned y, double count) {
+        data->setCell(static_cast<int>(x - first_x), static_cast<int>(y - first_y), count * scale);
+    });
+
+}
@@ -2,9 +2,15 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include "qcustomplot.h"
 
 using namespace spec_hom;
 
+constexpr int MIN_PLOT_POINTS = 512; // points drawn before the plot has been laid out, and below which none are merged
+
 LinePlotView::LinePlotView(QWidget *parent, const Tpx3Image *src) :
         FileViewPanel(parent, src),
         mXData(),
@@ -12,7 +18,12 @@ LinePlotView::LinePlotView(QWidget *parent, const Tpx3Image *src) :
         mYErr(),
         mTitle(),
         mXLabel("X"),
-        mYLabel("Y") {
+        mYLabel("Y"),
+        mLevels(),
+        mErrorBars(nullptr),
+        mLevel(0),
+        mFirst(0),
+        mLast(0) {
 
     // Do nothing
 
@@ -63,7 +74,7 @@ void LinePlotView::updatePlot() {
     auto max_y = *std::max_element(mYData.cbegin(), mYData.cend());
     auto min_y = *std::min_element(mYData.cbegin(), mYData.cend());
 
-    plot()->addGraph()->setData(mXData, mYData);
+    plot()->addGraph();
 
     plot()->plotLayout()->insertRow(0);
 
@@ -77,14 +88,86 @@ void LinePlotView::updatePlot() {
     plot()->xAxis->setLabel(mXLabel);
     plot()->yAxis->setLabel(mYLabel);
 
+    mErrorBars = nullptr;
     if(!mYErr.isEmpty()) {
-        auto error_bars = new QCPErrorBars(plot()->xAxis, plot()->yAxis);
-        error_bars->setAntialiased(false);
-        error_bars->setDataPlottable(plot()->graph(0));
-        error_bars->setPen(QPen(QColor(230, 230, 230)));
-        error_bars->setData(mYErr);
+        mErrorBars = new QCPErrorBars(plot()->xAxis, plot()->yAxis);
+        mErrorBars->setAntialiased(false);
+        mErrorBars->setDataPlottable(plot()->graph(0));
+        mErrorBars->setPen(QPen(QColor(230, 230, 230)));
     }
 
+    // only the x axis is zoomed and dragged
+    plot()->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
+    plot()->axisRect()->setRangeDrag(Qt::Horizontal);
+    plot()->axisRect()->setRangeZoom(Qt::Horizontal);
+
+    buildLevels();
+    updateViewport();
+    connect(plot(), &QCustomPlot::beforeReplot, this, [this]() { updateViewport(); }, Qt::UniqueConnection);
+
     plot()->replot();
 
+}
+
+void LinePlotView::buildLevels() {
+
+    mLevels.clear();
+    mLevels.push_back({mXData, mYData, mYErr});
+    mLast = 0; // nothing drawn yet
+
+    // points can only be merged with their neighbours if they are in order
+    if(!std::is_sorted(mXData.cbegin(), mXData.cend()))
+        return;
+
+    bool has_err = !mYErr.isEmpty();
+    while(mLevels.back()[0].size() > MIN_PLOT_POINTS) {
+        auto &fine = mLevels.back();
+        std::array<QVector<double>, 3> coarse;
+
+        for(auto ix = 0; ix + 1 < fine[0].size(); ix += 2) {
+            coarse[0].push_back((fine[0][ix] + fine[0][ix + 1]) / 2);
+            coarse[1].push_back((fine[1][ix] + fine[1][ix + 1]) / 2);
+            if(has_err)
+                coarse[2].push_back(std::hypot(fine[2][ix], fine[2][ix + 1]) / 2);
+        }
+
+        mLevels.push_back(std::move(coarse));
+    }
+
+}
+
+void LinePlotView::updateViewport() {
+
+    if(mLevels.empty())
+        return;
+
+    auto range = plot()->xAxis->range();
+    auto max_points = std::max(plot()->axisRect()->width(), MIN_PLOT_POINTS);
+
+    // the finest level with at most one point per pixel in view (plus one point past each edge)
+    unsigned level = 0;
+    int first = 0, last = 0;
+    for(; level < mLevels.size(); ++level) {
+        auto &x = mLevels[level][0];
+        first = static_cast<int>(std::lower_bound(x.cbegin(), x.cend(), range.lower) - x.cbegin());
+        last = static_cast<int>(std::upper_bound(x.cbegin(), x.cend(), range.upper) - x.cbegin());
+        first = std::max(first - 1, 0);
+        last = std::min(last + 1, static_cast<int>(x.size()));
+
+        if(last - first <= max_points || level + 1 == mLevels.size())
+            break;
+    }
+
+    if(level == mLevel && first == mFirst && last == mLast)
+        return;
+
+    mLevel = level;
+    mFirst = first;
+    mLast = last;
+
+    auto &points = mLevels[level];
+    plot()->graph(0)->setData(points[0].mid(first, last - first), points[1].mid(first, last - first), true);
+    if(mErrorBars)
+        mErrorBars->setData(points[2].mid(first, last - first));
+
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "fileview.h"
+
+#include <fstream>
+#include <algorithm>
+
+#include "qcustomplot.h"
+
+#include "tpx3/tpx3.h"
+
+using namespace spec_hom;
+
+constexpr int MIN_PLOT_BINS = 500; // used before the plot has a size
+
+RateTimeSeriesView::RateTimeSeriesView(QWidget *parent, Tpx3Image *image) :
+        FileViewPanel(parent, image),
+        mLevel(0),
+        mTMin(0),
+        mTMax(0) {
+
+    auto &series = source()->rateTimeSeries();
+
+    const std::vector<std::pair<QString, QPen>> graphs {
+        {"Singles (channel 1)", QPen(QColor(31, 119, 180))},
+        {"Singles (channel 2)", QPen(QColor(255, 127, 14))},
+        {"Pairs", QPen(QColor(44, 160, 44))},
+        {"N-folds", QPen(QColor(148, 103, 189))},
+        {"Accidentals (estimated)", QPen(QColor(214, 39, 40), 1, Qt::DashLine)}
+    };
+    for(auto &[name, pen] : graphs) {
+        auto graph = plot()->addGraph();
+        graph->setName(name);
+        graph->setPen(pen);
+        graph->setLineStyle(QCPGraph::lsStepCenter);
+    }
+
+    plot()->plotLayout()->insertRow(0);
+
+    QFont f;
+    f.setPointSize(12);
+    plot()->plotLayout()->addElement(0, 0, new QCPTextElement(plot(), "Count Rates over Time", f));
+
+    plot()->legend->setVisible(true);
+    plot()->xAxis->setLabel("Time since start of acquisition [sec]");
+    plot()->yAxis->setLabel("Rate [1/sec]");
+
+    // only time is zoomed and dragged; the rate axis follows the data
+    plot()->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
+    plot()->axisRect()->setRangeDrag(Qt::Horizontal);
+    plot()->axisRect()->setRangeZoom(Qt::Horizontal);
+    plot()->xAxis->setRange(0, std::max(series.duration(), series.binWidth()));
+    connect(plot()->xAxis, qOverload<const QCPRange&>(&QCPAxis::rangeChanged), this, [this](const QCPRange &range) {
+        rebin(range.lower, range.upper);
+    });
+
+    rebin(plot()->xAxis->range().lower, plot()->xAxis->range().upper);
+
+}
+
+void RateTimeSeriesView::rebin(double t_min, double t_max) {
+
+    auto &series = source()->rateTimeSeries();
+
+    mTMin = t_min;
+    mTMax = t_max;
+    mLevel = series.levelFor(t_min, t_max, static_cast<std::size_t>(std::max(plot()->axisRect()->width(), MIN_PLOT_BINS)));
+
+    double max_rate = 0;
+    for(int ix = 0; ix < RateTimeSeries::NUM_SERIES; ++ix) {
+        auto [times, rates] = series.rates(static_cast<RateTimeSeries::Series>(ix), mLevel, t_min, t_max);
+        if(!rates.isEmpty())
+            max_rate = std::max(max_rate, *std::max_element(rates.cbegin(), rates.cend()));
+        plot()->graph(ix)->setData(times, rates, true);
+    }
+
+    plot()->yAxis->setRange(0, max_rate > 0 ? 1.05 * max_rate : 1);
+    plot()->replot();
+
+}
+
+void RateTimeSeriesView::saveDataBtnClick() {
+
+    auto filename = QFileDialog::getSaveFileName(
+            this,
+            "Save Plot as CSV",
+            "./data",
+            "CSV Files (*.csv)"
+    );
+
+    if(filename.isEmpty())
+        return;
+
+    if(!filename.toLower().endsWith(".csv"))
+        filename += ".csv";
+
+    // the bins currently shown
+    auto &series = source()->rateTimeSeries();
+    std::vector<QVector<double>> rates;
+    QVector<double> times;
+    for(int ix = 0; ix < RateTimeSeries::NUM_SERIES; ++ix) {
+        auto [series_times, series_rates] = series.rates(static_cast<RateTimeSeries::Series>(ix), mLevel, mTMin, mTMax);
+        times = series_times;
+        rates.push_back(series_rates);
+    }
+
+    std::ofstream output(filename.toStdString());
+
+    output << "Time [s]";
+    for(int ix = 0; ix < RateTimeSeries::NUM_SERIES; ++ix)
+        output << ", " << plot()->graph(ix)->name().toStdString() << " [1/s]";
+    output << std::endl;
+
+    for(auto bin = 0; bin < times.size(); ++bin) {
+        output << times[bin];
+        for(auto &series_rates : rates)
+            output << ", " << series_rates[bin];
+        output << std::endl;
+    }
+
+    output.close();
+
+}
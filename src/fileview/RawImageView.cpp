@@ -8,7 +8,7 @@
 
 using namespace spec_hom;
 
-RawImageView::RawImageView(QWidget *parent, Tpx3Image *src) :
+RawImageView::RawImageView(QWidget *parent, Tpx3Image *src, const ViewData &data) :
     Hist2DView(parent, src) {
 
     title("Distribution of Raw Counts");
@@ -16,16 +16,14 @@ RawImageView::RawImageView(QWidget *parent, Tpx3Image *src) :
     yLabel("Camera Y");
     colorbarLabel("Raw Counts per Pixel");
 
-    auto image_2d = source()->rawPacketImage();
-    auto &data_arr = data();
-
-    for (int x=0; x<Tpx3Image::WIDTH; ++x) {
-        data_arr.emplace_back(Tpx3Image::HEIGHT);
-        for (int y=0; y<Tpx3Image::HEIGHT; ++y) {
-            data_arr[x][y] = image_2d[x][y];
-        }
-    }
+    setPyramid(data.pyramid);
 
     updatePlot();
 
+}
+
+ViewData RawImageView::compute(const Tpx3Image *src) {
+
+    return {std::make_shared<const HistogramPyramid>(src->rawImagePyramid())};
+
 }
\ No newline at end of file
@@ -8,26 +8,23 @@
 
 using namespace spec_hom;
 
-SpatialCorrelationView::SpatialCorrelationView(QWidget *parent, Tpx3Image *src) :
+SpatialCorrelationView::SpatialCorrelationView(QWidget *parent, Tpx3Image *src, const ViewData &data, unsigned subdivisions, bool bilinear) :
         Hist2DView(parent, src) {
 
     title("Spatial Correlations (X Axis)");
-    xLabel("X1");
-    yLabel("X2");
+    xLabel("Wavelength 1 [nm]");
+    yLabel("Wavelength 2 [nm]");
     colorbarLabel("Counts Per Bin");
 
-    auto size = Tpx3Image::SPATIAL_CORR_SIZE;
+    setPyramid(data.pyramid);
+    addResolutionControls(subdivisions, bilinear);
 
-    auto image_2d = source()->spatialCorrelations();
-    auto &data_arr = data();
+    updatePlot();
 
-    for (int x=0; x<size; ++x) {
-        data_arr.emplace_back(size);
-        for (int y=0; y<size; ++y) {
-            data_arr[x][y] = image_2d[x][y];
-        }
-    }
+}
 
-    updatePlot();
+ViewData SpatialCorrelationView::compute(const Tpx3Image *src, unsigned subdivisions, bool bilinear) {
+
+    return {std::make_shared<const HistogramPyramid>(src->spatialCorrelationPyramid(subdivisions, bilinear))};
 
 }
\ No newline at end of file
@@ -6,10 +6,11 @@
 
 using namespace spec_hom;
 
-StartStopHistogramView::StartStopHistogramView(QWidget *parent, Tpx3Image *image) :
+StartStopHistogramView::StartStopHistogramView(QWidget *parent, Tpx3Image *image, const ViewData &data) :
         LinePlotView (parent, image) {
 
-    std::tie(xData(), yData()) = source()->startStopHistogram(MIN_TICK, 128);
+    xData() = data.x;
+    yData() = data.y;
 
     title("Histogram of Start-Stop Intervals");
     xLabel("Interval between clicks [sec]");
@@ -17,4 +18,13 @@ StartStopHistogramView::StartStopHistogramView(QWidget *parent, Tpx3Image *image
 
     updatePlot();
 
+}
+
+ViewData StartStopHistogramView::compute(const Tpx3Image *src) {
+
+    ViewData data;
+    std::tie(data.x, data.y) = src->startStopHistogram(MIN_TICK, 128);
+
+    return data;
+
 }
\ No newline at end of file
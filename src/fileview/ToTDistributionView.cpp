@@ -6,10 +6,11 @@
 
 using namespace spec_hom;
 
-ToTDistributionView::ToTDistributionView(QWidget *parent, Tpx3Image *image) :
+ToTDistributionView::ToTDistributionView(QWidget *parent, Tpx3Image *image, const ViewData &data) :
         LinePlotView (parent, image) {
 
-    std::tie(xData(),yData()) = source()->toTDistribution();
+    xData() = data.x;
+    yData() = data.y;
 
     title("Histogram of Time over Threshold Values");
     xLabel("Time over threshold [ns]");
@@ -17,4 +18,13 @@ ToTDistributionView::ToTDistributionView(QWidget *parent, Tpx3Image *image) :
 
     updatePlot();
 
+}
+
+ViewData ToTDistributionView::compute(const Tpx3Image *src) {
+
+    ViewData data;
+    std::tie(data.x, data.y) = src->toTDistribution();
+
+    return data;
+
 }
\ No newline at end of file
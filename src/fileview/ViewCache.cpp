@@ -0,0 +1,123 @@
+#include "fileview.h"
+
+#include <QThreadPool>
+
+using namespace spec_hom;
+
+ViewCache::ViewCache(QObject *parent, bool asynchronous) :
+    QObject(parent),
+    mAsynchronous(asynchronous),
+    mResults(),
+    mPending(),
+    mGeneration(0),
+    mRunningMutex(),
+    mIdle(),
+    mNumRunning(0),
+    mQueued(),
+    mNextTask(0),
+    mClosing(false) {
+
+    // Do nothing
+
+}
+
+ViewCache::~ViewCache() {
+
+    // the computations read the image, so they must be done before it can go
+    mClosing = true;
+
+    std::unique_lock lock(mRunningMutex);
+
+    // those that have not started are taken back, so only the running ones are waited for
+    for(auto [id, task] : mQueued) {
+        if(QThreadPool::globalInstance()->tryTake(task)) {
+            delete task;
+            --mNumRunning;
+        }
+    }
+    mQueued.clear();
+
+    mIdle.wait(lock, [this]() { return mNumRunning == 0; });
+
+}
+
+std::shared_ptr<const ViewData> ViewCache::request(const Key &key, const Compute &compute) {
+
+    auto result = mResults.find(key);
+    if(result != mResults.end())
+        return result->second;
+
+    if(!mAsynchronous) {
+        auto data = std::make_shared<const ViewData>(compute());
+        mResults[key] = data;
+        return data;
+    }
+
+    if(mPending.contains(key))
+        return nullptr;
+    mPending.insert(key);
+
+    auto generation = mGeneration;
+    auto id = mNextTask++;
+    auto *task = QRunnable::create([this, key, compute, generation, id]() {
+        {
+            // still valid here: the destructor cannot take this task back once it has started
+            std::lock_guard lock(mRunningMutex);
+            mQueued.erase(id);
+        }
+
+        if(!mClosing) {
+            std::shared_ptr<const ViewData> data;
+            QString error;
+            try {
+                data = std::make_shared<const ViewData>(compute());
+            } catch(std::exception &e) {
+                error = e.what();
+            }
+
+            // handed to the UI thread; dropped there if the cache is gone by then
+            QMetaObject::invokeMethod(this, [this, key, generation, data, error]() {
+                finish(key, generation, data, error);
+            }, Qt::QueuedConnection);
+        }
+
+        std::lock_guard lock(mRunningMutex);
+        if(--mNumRunning == 0)
+            mIdle.notify_all();
+    });
+
+    {
+        std::lock_guard lock(mRunningMutex);
+        ++mNumRunning;
+        mQueued[id] = task;
+    }
+    QThreadPool::globalInstance()->start(task);
+
+    return nullptr;
+
+}
+
+void ViewCache::invalidate() {
+
+    mResults.clear();
+    mPending.clear();
+    ++mGeneration;
+
+}
+
+void ViewCache::finish(const Key &key, unsigned generation, std::shared_ptr<const ViewData> data, const QString &error) {
+
+    if(generation != mGeneration)
+        return;
+
+    mPending.erase(key);
+
+    if(!data) {
+        emit failed(key.first, key.second, error);
+        return;
+    }
+
+    mResults[key] = std::move(data);
+    emit ready(key.first, key.second);
+
+}
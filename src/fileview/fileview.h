@@ -5,14 +5,79 @@
 #include <QVBoxLayout>
 #include <QGroupBox>
 #include <QComboBox>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QLabel>
 #include <QPushButton>
+#include <QVector>
+#include <QRunnable>
+
+#include <memory>
+#include <array>
+#include <limits>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 
 class QCustomPlot;
+class QCPColorMap;
+class QCPErrorBars;
 
 namespace spec_hom {
 
     class Tpx3Image;
+    class HistogramPyramid;
+
+    // The data behind a view, computed away from the UI thread
+    struct ViewData {
+        std::shared_ptr<const HistogramPyramid> pyramid; // 2D views
+        QVector<double> x, y, err; // line plots
+    };
+
+    // Computes the data behind the views of one image on the global thread pool, and keeps it by view type and
+    // parameters until invalidate(). The image must outlive the cache; the destructor drops the computations that have
+    // not started and waits for the running ones.
+    // A synchronous cache computes in request() instead, for live images whose histograms are replaced on the UI thread.
+    class ViewCache : public QObject {
+        Q_OBJECT
+    public:
+        using Key = std::pair<int, QString>; // view type and parameters
+        using Compute = std::function<ViewData()>;
+
+        ViewCache(QObject *parent, bool asynchronous);
+        ~ViewCache() override;
+
+        // the data, if it is ready; otherwise starts computing it (unless it already is) and returns nullptr
+        std::shared_ptr<const ViewData> request(const Key &key, const Compute &compute);
+        void invalidate(); // drops all results, including those still being computed
+
+    signals:
+        void ready(int view_type, QString parameters);
+        void failed(int view_type, QString parameters, QString message);
+
+    private:
+        void finish(const Key &key, unsigned generation, std::shared_ptr<const ViewData> data, const QString &error);
+
+        bool mAsynchronous;
+        std::map<Key, std::shared_ptr<const ViewData>> mResults;
+        std::set<Key> mPending;
+        unsigned mGeneration; // of the results; computations started before invalidate() are dropped
+
+        // computations queued or running on the thread pool
+        std::mutex mRunningMutex;
+        std::condition_variable mIdle;
+        unsigned mNumRunning;
+        std::map<uint64_t, QRunnable*> mQueued; // not started yet, so they can be taken back from the pool
+        uint64_t mNextTask;
+        std::atomic<bool> mClosing; // queued computations are skipped once the cache is being destroyed
+    };
 
     class FileViewPanel : public QWidget {
         Q_OBJECT
@@ -40,6 +105,8 @@ namespace spec_hom {
         QPushButton *mExportDataBtn;
     };
 
+    // Plots a line; when zoomed out past one point per pixel, neighbouring points are averaged in pairs, as often as
+    // needed, and only the points in view are drawn
     class LinePlotView : public FileViewPanel {
     public:
         LinePlotView(QWidget *parent, const Tpx3Image *src);
@@ -58,19 +125,37 @@ namespace spec_hom {
         void updatePlot();
 
     private:
+        void buildLevels();
+        void updateViewport(); // redraws the points in view, if the view has changed since they were drawn
+
         QVector<double> mXData, mYData, mYErr;
         QString mTitle;
         QString mXLabel, mYLabel;
+
+        std::vector<std::array<QVector<double>, 3>> mLevels; // x, y and error of each level; the first is the data
+        QCPErrorBars *mErrorBars;
+        unsigned mLevel; // of the points drawn
+        int mFirst, mLast; // points drawn, [first, last)
     };
 
+    // Draws a histogram pyramid; zooming and panning redraw only the bins in view, from the level with about one bin
+    // per pixel. Colours are in counts per bin of the finest level, so they do not change with the level.
     class Hist2DView : public FileViewPanel {
+        Q_OBJECT
     public:
         Hist2DView(QWidget *parent, const Tpx3Image *src);
+        ~Hist2DView() override;
 
         void saveDataBtnClick() override;
 
+    signals:
+        void resolutionChanged(unsigned subdivisions, bool bilinear); // chosen with the controls; the owner recomputes the view
+
     protected:
-        [[nodiscard]] std::vector<std::vector<double>>& data() { return mData; }
+        void setPyramid(std::shared_ptr<const HistogramPyramid> pyramid);
+
+        // Adds a resolution selector and a bilinear-splatting toggle to the toolbar, showing the given choice
+        void addResolutionControls(unsigned subdivisions, bool bilinear);
 
         void title(const QString &label){ mTitle = label; }
         void xLabel(const QString &label){ mXLabel = label; }
@@ -80,7 +165,14 @@ namespace spec_hom {
         void updatePlot();
 
     private:
-        std::vector<std::vector<double>> mData;
+        void updateViewport(); // redraws the bins in view, if the view has changed since they were drawn
+
+        std::shared_ptr<const HistogramPyramid> mPyramid;
+        QComboBox *mResolutionCombo;
+        QCheckBox *mBilinearCheck;
+        QCPColorMap *mColorMap;
+        unsigned mLevel; // of the bins drawn
+        unsigned mFirstX, mLastX, mFirstY, mLastY; // bins drawn, [first, last)
         QString mTitle;
         QString mXLabel, mYLabel;
         QString mColorbarLabel;
@@ -88,28 +180,45 @@ namespace spec_hom {
 
     class RawImageView : public Hist2DView {
     public:
-        RawImageView(QWidget *parent, Tpx3Image *src);
+        RawImageView(QWidget *parent, Tpx3Image *src, const ViewData &data);
+
+        static ViewData compute(const Tpx3Image *src);
     };
 
     class ToTDistributionView : public LinePlotView {
     public:
-        ToTDistributionView(QWidget *parent, Tpx3Image *src);
+        ToTDistributionView(QWidget *parent, Tpx3Image *src, const ViewData &data);
+
+        static ViewData compute(const Tpx3Image *src);
     };
 
     class ClusteredImageView : public Hist2DView {
     public:
-        ClusteredImageView(QWidget *parent, Tpx3Image *src);
+        ClusteredImageView(QWidget *parent, Tpx3Image *src, const ViewData &data, unsigned subdivisions, bool bilinear);
+
+        static ViewData compute(const Tpx3Image *src, unsigned subdivisions, bool bilinear);
     };
 
     class StartStopHistogramView : public LinePlotView {
     public:
-        StartStopHistogramView(QWidget *parent, Tpx3Image *src);
+        StartStopHistogramView(QWidget *parent, Tpx3Image *src, const ViewData &data);
+
+        static ViewData compute(const Tpx3Image *src);
+    };
+
+    class CrossCorrelationView : public LinePlotView {
+    public:
+        CrossCorrelationView(QWidget *parent, Tpx3Image *src, const ViewData &data);
+
+        static ViewData compute(const Tpx3Image *src);
     };
 
     class DToADistributionView : public LinePlotView {
         Q_OBJECT
     public:
-        DToADistributionView(QWidget *parent, Tpx3Image *src);
+        DToADistributionView(QWidget *parent, Tpx3Image *src, const ViewData &data);
+
+        static ViewData compute(const Tpx3Image *src);
 
     private:
         void exportCalibrationClicked();
@@ -119,7 +228,62 @@ namespace spec_hom {
 
     class SpatialCorrelationView : public Hist2DView {
     public:
-        SpatialCorrelationView(QWidget *parent, Tpx3Image *src);
+        SpatialCorrelationView(QWidget *parent, Tpx3Image *src, const ViewData &data, unsigned subdivisions, bool bilinear);
+
+        static ViewData compute(const Tpx3Image *src, unsigned subdivisions, bool bilinear);
+    };
+
+    // The wavelength plane of the spectrally-resolved HOM histogram, summed over a range of its time segments
+    class HOMSliceView : public Hist2DView {
+        Q_OBJECT
+    public:
+        static constexpr unsigned LAST_SEGMENT = std::numeric_limits<unsigned>::max(); // whichever is last, as a live image grows
+
+        HOMSliceView(QWidget *parent, Tpx3Image *src, const ViewData &data, std::pair<unsigned, unsigned> segments);
+
+        static ViewData compute(const Tpx3Image *src, std::pair<unsigned, unsigned> segments); // first and last, inclusive
+
+    signals:
+        void segmentsChanged(unsigned first, unsigned last); // chosen with the controls; the owner recomputes the view
+
+    private:
+        void exportHistogramClicked(); // all segments, as a binary file
+
+        QSpinBox *mFirstSegmentSpin, *mLastSegmentSpin;
+        QPushButton *mExportHistogramButton;
+    };
+
+    // The pairs in each time segment of the spectrally-resolved HOM histogram, within a region of the wavelength plane:
+    // the HOM scan of that part of the joint spectrum
+    class HOMScanView : public LinePlotView {
+        Q_OBJECT
+    public:
+        using Region = std::array<double, 4>; // wavelength 1 min and max, wavelength 2 min and max [nm]; NaN for the full range
+
+        HOMScanView(QWidget *parent, Tpx3Image *src, const ViewData &data, const Region &region);
+
+        static ViewData compute(const Tpx3Image *src, const Region &region);
+
+    signals:
+        void regionChanged(double wl_1_min, double wl_1_max, double wl_2_min, double wl_2_max); // chosen with the controls
+
+    private:
+        std::array<QDoubleSpinBox*, 4> mRegionSpins;
+    };
+
+    // Singles, pair, n-fold and accidental rates over the acquisition; zooming re-bins from the level of the rate time
+    // series with about one bin per pixel
+    class RateTimeSeriesView : public FileViewPanel {
+    public:
+        RateTimeSeriesView(QWidget *parent, Tpx3Image *src);
+
+        void saveDataBtnClick() override;
+
+    private:
+        void rebin(double t_min, double t_max); // [s] since the start
+
+        unsigned mLevel;
+        double mTMin, mTMax;
     };
 
     class FileViewer : public QWidget {
@@ -129,17 +293,37 @@ namespace spec_hom {
 
         [[nodiscard]] const std::string& fullFilename() const;
 
+        void refresh(); // rebuilds the current view, e.g. after a live image has received new data
+
     private slots:
         void viewTypeChanged(int newIndex);
 
     private:
+        void updateLiveStatus();
+
+        // Shows the current view if its data is in the cache; otherwise shows a placeholder until it is
+        void showView();
+        QWidget* replaceView(); // swaps in an empty view container, and returns it
+        void showPlaceholder(const QString &text, bool busy);
+        void viewReady(int view_type, const QString &parameters);
+        void viewFailed(int view_type, const QString &parameters, const QString &message);
+        void precomputeViews(); // of the other view types, in the background
+
+        [[nodiscard]] QString viewParameters(int view_type) const;
+        [[nodiscard]] ViewCache::Compute viewComputation(int view_type) const;
+
         Tpx3Image *mImage;
+        ViewCache *mCache;
+        std::map<int, std::pair<unsigned, bool>> mResolutions; // subdivisions and bilinear splatting of the 2D views
+        std::pair<unsigned, unsigned> mHOMSegments; // of the HOM slice, see HOMSliceView
+        HOMScanView::Region mHOMRegion;
 
         QVBoxLayout *mLayout;
         QGroupBox *mCenterWidget;
         QVBoxLayout *mCenterLayout;
         QComboBox *mViewSelection;
         QWidget *mViewContainer;
+        QLabel *mLiveStatus; // only shown for live images
     };
 
 }
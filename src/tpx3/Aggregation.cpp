@@ -0,0 +1,65 @@
+#include "tpx3.h"
+
+#include <regex>
+
+using namespace spec_hom;
+
+std::map<std::string, std::vector<std::string>> spec_hom::group_files(const std::vector<std::string> &files, const std::string &pattern) {
+
+    std::map<std::string, std::vector<std::string>> groups;
+    if(pattern.empty()) {
+        if(!files.empty())
+            groups[""] = files;
+        return groups;
+    }
+
+    std::regex expression(pattern);
+    for(auto &file : files) {
+        std::smatch match;
+        if(!std::regex_search(file, match, expression))
+            continue;
+
+        // the groups of the match, joined, or the whole match
+        std::string key = match.size() > 1 ? "" : match.str(0);
+        for(std::size_t group = 1; group < match.size(); ++group)
+            key += (group > 1 ? "_" : "") + match.str(group);
+
+        groups[key].push_back(file);
+    }
+
+    return groups;
+
+}
+
+LiveHistograms spec_hom::merge_summaries(const std::vector<std::shared_ptr<const LiveHistograms>> &summaries, TaskPool &pool) {
+
+    if(summaries.empty())
+        throw std::runtime_error("There are no histograms to merge.");
+
+    // the first level copies pairs of summaries, so that the summaries themselves are left as they are
+    std::vector<std::unique_ptr<LiveHistograms>> merged((summaries.size() + 1) / 2);
+    pool.parallelFor(merged.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(auto ix = begin; ix < end; ++ix) {
+            merged[ix] = std::make_unique<LiveHistograms>(*summaries[2*ix]);
+            if(2*ix + 1 < summaries.size())
+                merged[ix]->add(*summaries[2*ix + 1]);
+        }
+    });
+
+    // then each level adds the neighbours of the one below, keeping them in order
+    for(std::size_t stride = 1; stride < merged.size(); stride *= 2) {
+        auto num_pairs = (merged.size() + 2*stride - 1) / (2*stride);
+        pool.parallelFor(num_pairs, 1, [&](std::size_t begin, std::size_t end) {
+            for(auto pair = begin; pair < end; ++pair) {
+                auto ix = 2 * stride * pair;
+                if(ix + stride < merged.size()) {
+                    merged[ix]->add(*merged[ix + stride]);
+                    merged[ix + stride].reset();
+                }
+            }
+        });
+    }
+
+    return std::move(*merged.front());
+
+}
@@ -0,0 +1,43 @@
+#include "tpx3.h"
+
+#include <filesystem>
+
+using namespace spec_hom;
+
+ArgonCalibrationThread::ArgonCalibrationThread(std::array<std::string, 2> filenames, Tpx3ImportSettings settings) :
+    BgThread(),
+    mFileNames(std::move(filenames)),
+    mImportSettings(std::move(settings)) {
+
+    // Do nothing
+
+}
+
+void ArgonCalibrationThread::execute() {
+
+    auto points = std::make_unique<CalibrationPoints>();
+    points->wavelengths.assign(ARGON_LINES.begin(), ARGON_LINES.end());
+
+    try {
+        std::vector<ClusterCentroid> centroids;
+        for(int channel = 1; channel <= 2; ++channel) {
+            auto &filename = mFileNames[channel - 1];
+            if(channel == 1 || filename != mFileNames[0]) {
+                emit setProgressText("Reading " + std::filesystem::path(filename).filename().string() + "...");
+                emit setProgressIndefinite(true);
+                centroids = LoadRawFileThread::loadCentroids(filename, mImportSettings, this);
+            }
+            if(shouldCancel())
+                return;
+
+            auto lines = find_emission_lines(centroids, mImportSettings.spatialMask, channel, ARGON_LINES.size());
+            (channel == 1 ? points->bins1 : points->bins2) = std::move(lines);
+        }
+    } catch(std::exception &e) {
+        emit err(e.what());
+        return;
+    }
+
+    emit yieldCalibrationPoints(points.release());
+
+}
@@ -0,0 +1,383 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include <Eigen/Dense>
+
+using namespace spec_hom;
+
+constexpr double FWHM_PER_SIGMA = 2.3548200450309493;
+constexpr double LINE_BAND_SIGMAS = 3; // centroids further than this from the line are not part of its spectrum
+constexpr double MIN_PEAK_FRACTION = 1.0 / 15; // of the highest peak, below which a peak is noise
+constexpr double MIN_PEAK_SEPARATION = 1; // [px] closer maxima are one peak
+
+namespace {
+
+    // One channel of a calibration in pixels, with the curvatures of its spline (if any) worked out once
+    class ChannelCalibration {
+    public:
+        ChannelCalibration(const WavelengthCalibration &calib, int channel) :
+            mSlope(channel == 1 ? calib.slope1 : calib.slope2),
+            mIntercept(channel == 1 ? calib.intercept1 : calib.intercept2),
+            mNonlinear(channel == 1 ? calib.nonlinear1 : calib.nonlinear2),
+            mBins(),
+            mWavelengths(),
+            mCurvatures() {
+
+            auto &bins = channel == 1 ? calib.spline.bins1 : calib.spline.bins2;
+            if(bins.size() < 2 || bins.size() != calib.spline.wavelengths.size())
+                return;
+
+            std::vector<std::size_t> order(bins.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&bins](std::size_t a, std::size_t b) { return bins[a] < bins[b]; });
+            for(auto ix : order) {
+                mBins.push_back(bins[ix]);
+                mWavelengths.push_back(calib.spline.wavelengths[ix]);
+            }
+
+            // the second derivatives at the points, from the tridiagonal system of a natural spline (0 at both ends)
+            auto n = mBins.size();
+            std::vector<double> diag(n, 0), rhs(n, 0);
+            for(std::size_t ix = 1; ix + 1 < n; ++ix) {
+                auto h0 = mBins[ix] - mBins[ix - 1], h1 = mBins[ix + 1] - mBins[ix];
+                diag[ix] = 2 * (h0 + h1);
+                rhs[ix] = 6 * ((mWavelengths[ix + 1] - mWavelengths[ix]) / h1 - (mWavelengths[ix] - mWavelengths[ix - 1]) / h0);
+                if(ix > 1) {
+                    auto w = h0 / diag[ix - 1];
+                    diag[ix] -= w * h0;
+                    rhs[ix] -= w * rhs[ix - 1];
+                }
+            }
+
+            mCurvatures.assign(n, 0);
+            for(auto ix = n - 2; ix >= 1; --ix)
+                mCurvatures[ix] = (rhs[ix] - (mBins[ix + 1] - mBins[ix]) * mCurvatures[ix + 1]) / diag[ix];
+
+        }
+
+        double operator()(double bin) const {
+
+            if(mBins.empty()) {
+                // Horner's scheme, from the highest order down
+                double value = 0;
+                for(auto coeff = mNonlinear.rbegin(); coeff != mNonlinear.rend(); ++coeff)
+                    value = value * bin + *coeff;
+                return (value * bin + mSlope) * bin + mIntercept;
+            }
+
+            auto n = mBins.size();
+            auto &x = mBins, &y = mWavelengths, &m = mCurvatures;
+
+            // straight on past the outermost points, as a natural spline has no curvature there
+            if(bin <= x.front()) {
+                auto h = x[1] - x[0];
+                return y[0] + (bin - x[0]) * ((y[1] - y[0]) / h - h * m[1] / 6);
+            }
+            if(bin >= x.back()) {
+                auto h = x[n - 1] - x[n - 2];
+                return y[n - 1] + (bin - x[n - 1]) * ((y[n - 1] - y[n - 2]) / h + h * m[n - 2] / 6);
+            }
+
+            auto k = static_cast<std::size_t>(std::upper_bound(x.begin(), x.end(), bin) - x.begin()) - 1;
+            auto h = x[k + 1] - x[k], t = bin - x[k];
+            return y[k] + t * ((y[k + 1] - y[k]) / h - h * (2 * m[k] + m[k + 1]) / 6) + t * t * m[k] / 2
+                   + t * t * t * (m[k + 1] - m[k]) / (6 * h);
+
+        }
+
+    private:
+        double mSlope, mIntercept;
+        std::array<double, WavelengthCalibration::MAX_ORDER - 1> mNonlinear;
+        std::vector<double> mBins, mWavelengths, mCurvatures; // of the spline, in order of bin
+    };
+
+    // Least-squares polynomial of the given order through the points, in the coefficients of a calibration
+    void fit_polynomial(const std::vector<double> &bins, const std::vector<double> &wavelengths, int order, double &slope,
+                        double &intercept, std::array<double, WavelengthCalibration::MAX_ORDER - 1> &nonlinear) {
+
+        // the bins are scaled to about 1, so that the powers stay comparable
+        double scale = 1;
+        for(auto bin : bins)
+            scale = std::max(scale, std::abs(bin));
+
+        auto n = static_cast<Eigen::Index>(bins.size());
+        Eigen::MatrixXd a(n, order + 1);
+        Eigen::VectorXd b(n);
+        for(Eigen::Index row = 0; row < n; ++row) {
+            double power = 1;
+            for(int col = 0; col <= order; ++col) {
+                a(row, col) = power;
+                power *= bins[row] / scale;
+            }
+            b(row) = wavelengths[row];
+        }
+
+        auto qr = a.colPivHouseholderQr();
+        if(qr.rank() < order + 1)
+            throw std::runtime_error("The calibration points do not determine a polynomial of order " + std::to_string(order));
+        Eigen::VectorXd coeffs = qr.solve(b);
+
+        intercept = coeffs(0);
+        slope = coeffs(1) / scale;
+        nonlinear.fill(0);
+        for(int col = 2; col <= order; ++col)
+            nonlinear[col - 2] = coeffs(col) / std::pow(scale, col);
+
+    }
+
+}
+
+CalibrationPoints CalibrationPoints::load(const std::string &path) {
+
+    std::ifstream input(path);
+    if(!input)
+        throw std::runtime_error("Could not open wavelength calibration " + path);
+
+    CalibrationPoints points;
+
+    std::string line;
+    std::getline(input, line); // header
+    while(std::getline(input, line)) {
+        std::vector<std::string> row;
+        std::stringstream row_stream(line);
+        std::string elem;
+        while(std::getline(row_stream, elem, ','))
+            row.push_back(std::move(elem));
+
+        if(row.empty() || (row.size() == 1 && row[0].find_first_not_of(" \t\r") == std::string::npos))
+            continue;
+        if(row.size() != 3)
+            throw std::runtime_error("Incorrect wavelength calibration format.");
+
+        points.wavelengths.push_back(std::stod(row[0]));
+        points.bins1.push_back(std::stod(row[1]));
+        points.bins2.push_back(std::stod(row[2]));
+    }
+
+    return points;
+
+}
+
+void CalibrationPoints::save(const std::string &path) const {
+
+    std::ofstream output(path);
+
+    output << "Wavelength [nm], Bin 1 [px], Bin 2 [px]" << std::endl;
+    output << std::setprecision(10);
+    for(std::size_t ix = 0; ix < wavelengths.size(); ++ix)
+        output << wavelengths[ix] << ", " << bins1[ix] << ", " << bins2[ix] << "\n";
+
+    output.close();
+
+}
+
+bool WavelengthCalibration::isLinear() const {
+
+    auto is_zero = [](double c) { return c == 0; };
+    return spline.empty() && std::all_of(nonlinear1.begin(), nonlinear1.end(), is_zero)
+           && std::all_of(nonlinear2.begin(), nonlinear2.end(), is_zero);
+
+}
+
+WavelengthCalibration WavelengthCalibration::fit(const CalibrationPoints &points, int order) {
+
+    auto n = points.wavelengths.size();
+    if(points.bins1.size() != n || points.bins2.size() != n)
+        throw std::runtime_error("Each calibration wavelength needs a position on both lines");
+    if(order < 0 || order > MAX_ORDER)
+        throw std::runtime_error("Calibration order " + std::to_string(order) + " not supported");
+
+    auto min_points = order == SPLINE ? 2 : static_cast<std::size_t>(order) + 1;
+    if(n < min_points)
+        throw std::runtime_error("This calibration needs at least " + std::to_string(min_points) + " points, but there are only " + std::to_string(n));
+
+    WavelengthCalibration calib {};
+    auto poly_order = order == SPLINE ? 1 : order;
+    fit_polynomial(points.bins1, points.wavelengths, poly_order, calib.slope1, calib.intercept1, calib.nonlinear1);
+    fit_polynomial(points.bins2, points.wavelengths, poly_order, calib.slope2, calib.intercept2, calib.nonlinear2);
+
+    if(order == SPLINE) {
+        for(auto *bins : {&points.bins1, &points.bins2}) {
+            auto sorted = *bins;
+            std::sort(sorted.begin(), sorted.end());
+            if(std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+                throw std::runtime_error("A spline calibration needs a different position for each wavelength");
+        }
+        calib.spline = points;
+    }
+
+    return calib;
+
+}
+
+double spec_hom::calibrate(const WavelengthCalibration &calib, int channel, double bin) {
+
+    if(channel != 1 && channel != 2)
+        throw std::runtime_error("calibrate(): Channel " + std::to_string(channel) + " not recognized");
+
+    return ChannelCalibration(calib, channel)(bin / PIXEL_SIZE);
+
+}
+
+CalibrationTable::CalibrationTable(const WavelengthCalibration &calib, unsigned num_bins) :
+    mLinear(calib.isLinear()),
+    mSlope {calib.slope1 / PIXEL_SIZE, calib.slope2 / PIXEL_SIZE},
+    mIntercept {calib.intercept1, calib.intercept2},
+    mNumPoints(static_cast<std::size_t>(std::max(num_bins, 1u)) * SUBDIVISIONS + 1),
+    mTable() {
+
+    if(mLinear)
+        return;
+
+    mTable.resize(2 * mNumPoints);
+    for(int channel = 1; channel <= 2; ++channel) {
+        ChannelCalibration model(calib, channel);
+        auto *table = mTable.data() + (channel - 1) * mNumPoints;
+        for(std::size_t ix = 0; ix < mNumPoints; ++ix)
+            table[ix] = model(static_cast<double>(ix) / SUBDIVISIONS);
+    }
+
+}
+
+void CalibrationTable::apply(std::size_t count, const int *channel, const double *along, double *wavelength) const {
+
+    if(mLinear) {
+        // the coefficients of each channel are picked with selects rather than branches, so that the loop vectorises
+        for(std::size_t ix = 0; ix < count; ++ix) {
+            bool first = channel[ix] == 1;
+            wavelength[ix] = (first ? mSlope[0] : mSlope[1]) * along[ix] + (first ? mIntercept[0] : mIntercept[1]);
+        }
+        return;
+    }
+
+    constexpr double POINTS_PER_METRE = SUBDIVISIONS / PIXEL_SIZE;
+    auto last = static_cast<double>(mNumPoints - 2); // the last point that starts an interval
+
+    for(std::size_t ix = 0; ix < count; ++ix) {
+        auto position = along[ix] * POINTS_PER_METRE;
+        auto point = std::clamp(std::floor(position), 0.0, last);
+        auto *entry = mTable.data() + static_cast<std::size_t>(channel[ix] - 1) * mNumPoints + static_cast<std::size_t>(point);
+        wavelength[ix] = entry[0] + (position - point) * (entry[1] - entry[0]);
+    }
+
+}
+
+std::vector<double> spec_hom::find_emission_lines(const std::vector<ClusterCentroid> &centroids, const SpatialMask &mask, int channel,
+                                                  std::size_t num_lines, unsigned subdivisions) {
+
+    if(channel != 1 && channel != 2)
+        throw std::runtime_error("find_emission_lines(): Channel " + std::to_string(channel) + " not recognized");
+    subdivisions = std::max(subdivisions, 1u);
+
+    auto across = [&mask](const ClusterCentroid &c) { return (mask.vertical ? c.x : c.y) / PIXEL_SIZE; };
+    auto along = [&mask](const ClusterCentroid &c) { return (mask.vertical ? c.y : c.x) / PIXEL_SIZE; };
+
+    // the profile across the band of the channel in the mask (whose bounds are exclusive), to find the line in it
+    auto band_min = channel == 1 ? mask.min1 : mask.min2;
+    auto band_max = channel == 1 ? mask.max1 : mask.max2;
+    std::vector<double> profile(static_cast<std::size_t>(std::max(band_max, 0)), 0);
+    for(auto &centroid : centroids) {
+        auto px = static_cast<int>(std::floor(across(centroid)));
+        if(px > band_min && px < band_max)
+            ++profile[px];
+    }
+
+    auto peak = static_cast<std::size_t>(std::max_element(profile.begin(), profile.end()) - profile.begin());
+    if(profile.empty() || !(profile[peak] > 0))
+        throw std::runtime_error("No centroids in the band of channel " + std::to_string(channel));
+
+    // the width of the line from where the profile falls below half of its peak, and its centre from the centroids above that
+    auto half = profile[peak] / 2;
+    auto first = peak, last = peak;
+    while(first > 0 && profile[first - 1] >= half)
+        --first;
+    while(last + 1 < profile.size() && profile[last + 1] >= half)
+        ++last;
+
+    // between the centres of the pixels on either side of each crossing
+    double left = static_cast<double>(first), right = static_cast<double>(last + 1);
+    if(first > 0)
+        left += (half - profile[first - 1]) / (profile[first] - profile[first - 1]) - 0.5;
+    if(last + 1 < profile.size())
+        right += (profile[last] - half) / (profile[last] - profile[last + 1]) - 0.5;
+    auto sigma = std::max((right - left) / FWHM_PER_SIGMA, 0.5);
+
+    double centre = 0, num_centre = 0;
+    for(auto &centroid : centroids) {
+        auto pos = across(centroid);
+        if(pos >= static_cast<double>(first) && pos < static_cast<double>(last + 1)) {
+            centre += pos;
+            ++num_centre;
+        }
+    }
+    centre /= num_centre;
+
+    // the spectrum along the line, with the sum of the positions in each bin to place the peaks within their bins
+    std::vector<double> counts, positions;
+    for(auto &centroid : centroids) {
+        auto pos = along(centroid), across_pos = across(centroid);
+        auto px = static_cast<int>(std::floor(across_pos));
+        if(!(std::abs(across_pos - centre) <= LINE_BAND_SIGMAS * sigma) || px <= band_min || px >= band_max || pos < 0)
+            continue;
+
+        auto bin = static_cast<std::size_t>(pos * subdivisions);
+        if(bin >= counts.size()) {
+            counts.resize(bin + 1, 0);
+            positions.resize(bin + 1, 0);
+        }
+        ++counts[bin];
+        positions[bin] += pos;
+    }
+
+    if(counts.empty())
+        throw std::runtime_error("No centroids along the line of channel " + std::to_string(channel));
+
+    auto threshold = MIN_PEAK_FRACTION * *std::max_element(counts.begin(), counts.end());
+
+    // local maxima above the threshold, with a plateau counted once at its middle; maxima too close together are one peak
+    std::vector<std::size_t> peaks;
+    for(std::size_t ix = 1; ix + 1 < counts.size(); ++ix) {
+        if(counts[ix] < threshold || !(counts[ix] > counts[ix - 1]))
+            continue;
+
+        auto end = ix;
+        while(end + 1 < counts.size() && counts[end + 1] == counts[ix])
+            ++end;
+        if(end + 1 == counts.size() || !(counts[end + 1] < counts[ix]))
+            continue;
+
+        auto mid = (ix + end) / 2;
+        if(!peaks.empty() && static_cast<double>(mid - peaks.back()) < MIN_PEAK_SEPARATION * subdivisions) {
+            if(counts[mid] > counts[peaks.back()])
+                peaks.back() = mid;
+        } else {
+            peaks.push_back(mid);
+        }
+        ix = end;
+    }
+
+    if(peaks.size() != num_lines) {
+        throw std::runtime_error("Found " + std::to_string(peaks.size()) + " peaks along the line of channel " + std::to_string(channel)
+                                 + ", expected " + std::to_string(num_lines) + "; unable to match them to the known emission lines");
+    }
+
+    std::vector<double> lines;
+    for(auto ix : peaks) {
+        double sum = 0, num = 0;
+        for(auto bin = ix - 1; bin <= ix + 1; ++bin) {
+            sum += positions[bin];
+            num += counts[bin];
+        }
+        lines.push_back(sum / num);
+    }
+
+    return lines;
+
+}
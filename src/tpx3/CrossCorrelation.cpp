@@ -0,0 +1,44 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace spec_hom;
+
+std::vector<uint64_t> spec_hom::cross_correlation(const std::vector<double> &toa_1, const std::vector<double> &toa_2, double bin_width,
+                                                  unsigned half_bins, TaskPool &pool) {
+
+    constexpr std::size_t CLICKS_PER_BLOCK = 1 << 14; // of the first list, swept as one task
+
+    auto num_bins = 2 * static_cast<std::size_t>(half_bins) + 1;
+    auto max_delay = (half_bins + 0.5) * bin_width; // to the outer edges of the outermost bins
+
+    std::vector<uint64_t> counts(num_bins, 0);
+    std::mutex counts_mutex;
+
+    pool.parallelFor(toa_1.size(), CLICKS_PER_BLOCK, [&](std::size_t begin, std::size_t end) {
+        std::vector<uint64_t> block_counts(num_bins, 0);
+
+        // the clicks of the second list within the range of the current click of the first; as both lists are sorted,
+        // the start of the range only moves forward
+        auto first = static_cast<std::size_t>(std::lower_bound(toa_2.begin(), toa_2.end(), toa_1[begin] - max_delay) - toa_2.begin());
+        for(auto ix = begin; ix < end; ++ix) {
+            auto toa = toa_1[ix];
+            while(first < toa_2.size() && toa_2[first] < toa - max_delay)
+                ++first;
+
+            for(auto jx = first; jx < toa_2.size() && toa_2[jx] < toa + max_delay; ++jx) {
+                auto position = (toa_2[jx] - toa) / bin_width + half_bins + 0.5;
+                if(position >= 0 && position < static_cast<double>(num_bins))
+                    ++block_counts[static_cast<std::size_t>(position)];
+            }
+        }
+
+        std::lock_guard lock(counts_mutex);
+        for(std::size_t bin = 0; bin < num_bins; ++bin)
+            counts[bin] += block_counts[bin];
+    });
+
+    return counts;
+
+}
@@ -0,0 +1,51 @@
+#include "tpx3.h"
+
+#include <cassert>
+
+using namespace spec_hom;
+
+DetectorGeometry DetectorGeometry::singleChip() {
+
+    return {
+        TPX3_SENSOR_SIZE,
+        TPX3_SENSOR_SIZE,
+        {
+            {0, 0, false, 0}
+        }
+    };
+
+}
+
+DetectorGeometry DetectorGeometry::quad() {
+
+    // Typical wiring of a 2x2 quad: chips 0 and 1 along the bottom edge, chips 2 and 3 along the top edge.
+    // The top row is mounted upside-down, so its readout is rotated by 180 degrees.
+    return {
+        2 * TPX3_SENSOR_SIZE,
+        2 * TPX3_SENSOR_SIZE,
+        {
+            {0,                 0,                 false, 0},
+            {TPX3_SENSOR_SIZE,  0,                 false, 0},
+            {TPX3_SENSOR_SIZE,  TPX3_SENSOR_SIZE,  true,  0},
+            {0,                 TPX3_SENSOR_SIZE,  true,  0}
+        }
+    };
+
+}
+
+PixelAddr DetectorGeometry::toGlobal(int chip, unsigned chip_x, unsigned chip_y) const {
+
+    assert(chip >= 0 && chip < numChips());
+    auto &placement = chips[chip];
+
+    if(placement.rotated) {
+        chip_x = TPX3_SENSOR_SIZE - 1 - chip_x;
+        chip_y = TPX3_SENSOR_SIZE - 1 - chip_y;
+    }
+
+    return {
+        static_cast<uint16_t>(placement.x_offset + chip_x),
+        static_cast<uint16_t>(placement.y_offset + chip_y)
+    };
+
+}
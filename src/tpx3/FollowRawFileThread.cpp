@@ -0,0 +1,114 @@
+#include "tpx3.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace spec_hom;
+
+constexpr std::size_t MAX_READ_SIZE = 1 << 26; // [bytes] read at most this much per poll, so that histograms keep updating
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(20); // wait between polls when the file has not grown
+
+LiveSourceThread::LiveSourceThread(std::string name, Tpx3ImportSettings settings, double refresh_interval, double look_back) :
+    BgThread(),
+    mName(std::move(name)),
+    mImportSettings(std::move(settings)),
+    mRefreshInterval(refresh_interval),
+    mLookBack(look_back) {
+
+    // Do nothing
+
+}
+
+FollowRawFileThread::FollowRawFileThread(const std::string &fname, Tpx3ImportSettings settings, double refresh_interval, double look_back) :
+    LiveSourceThread(fname, std::move(settings), refresh_interval, look_back) {
+
+    // Do nothing
+
+}
+
+void FollowRawFileThread::execute() {
+
+    using clock = std::chrono::steady_clock;
+
+    emit setProgressText("Following " + std::filesystem::path(mName).filename().string());
+    emit setProgressTextColor(QColor(0,0,0));
+    emit setProgressIndefinite(true);
+
+    std::ifstream data_stream(mName, std::ios::binary);
+    if(!data_stream.is_open()) {
+        emit err("Failed to open file " + mName);
+        return;
+    }
+
+    try {
+        Tpx3StreamDecoder decoder(mImportSettings);
+        auto processor = std::make_unique<StreamProcessor>(mImportSettings, mLookBack);
+
+        std::vector<char> buffer(MAX_READ_SIZE);
+        std::streamoff read_pos = 0;
+        auto last_data = clock::now();
+        auto last_refresh = clock::now();
+        auto refresh_interval = std::chrono::duration<double>(mRefreshInterval);
+        auto look_back = std::chrono::duration<double>(mLookBack);
+
+        while(!shouldCancel()) {
+            std::error_code size_error;
+            auto file_size = static_cast<std::streamoff>(std::filesystem::file_size(mName, size_error));
+            if(size_error) {
+                emit err("Lost access to file " + mName + ": " + size_error.message());
+                break;
+            }
+
+            if(file_size < read_pos) {
+                // the acquisition software has started the file over
+                emit warn("File " + mName + " was truncated; reading it again from the start");
+                read_pos = 0;
+                decoder.reset();
+
+                // the new acquisition starts its timestamps over, so it gets histograms of its own
+                processor = std::make_unique<StreamProcessor>(mImportSettings, mLookBack);
+                emit yieldLiveHistograms(new LiveHistograms(processor->histograms()));
+                last_refresh = clock::now();
+            }
+
+            bool got_data = false;
+            if(file_size > read_pos) {
+                auto num_bytes = std::min(static_cast<std::streamoff>(buffer.size()), file_size - read_pos);
+
+                data_stream.clear(); // clears the EOF flag from the previous read
+                data_stream.seekg(read_pos);
+                data_stream.read(buffer.data(), num_bytes);
+                auto num_read = data_stream.gcount();
+
+                if(num_read > 0) {
+                    read_pos += num_read;
+                    processor->push(decoder.feed(buffer.data(), static_cast<std::size_t>(num_read)));
+                    last_data = clock::now();
+                    got_data = true;
+                }
+            }
+
+            // once the file has stopped growing for longer than the look-back, everything left can be processed
+            processor->process(clock::now() - last_data >= look_back);
+
+            if(clock::now() - last_refresh >= refresh_interval) {
+                emit yieldLiveHistograms(new LiveHistograms(processor->histograms()));
+                last_refresh = clock::now();
+            }
+
+            if(!got_data)
+                std::this_thread::sleep_for(POLL_INTERVAL);
+        }
+
+        processor->process(true);
+        emit yieldLiveHistograms(new LiveHistograms(processor->histograms()));
+
+        if(decoder.bufferedBytes())
+            emit warn("File " + mName + " ends with an incomplete chunk of " + std::to_string(decoder.bufferedBytes()) + " bytes");
+    } catch(const std::runtime_error &e) {
+        emit err("Stopped following " + mName + ": " + e.what());
+    }
+
+}
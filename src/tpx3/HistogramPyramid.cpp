@@ -0,0 +1,267 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace spec_hom;
+
+constexpr unsigned TILE_SIZE = HistogramPyramid::TILE_SIZE;
+constexpr std::size_t TILE_BINS = static_cast<std::size_t>(TILE_SIZE) * TILE_SIZE;
+
+HistogramPyramid::Level::Level(unsigned width, unsigned height) :
+    width(width),
+    height(height),
+    tiles_x((width + TILE_SIZE - 1) / TILE_SIZE),
+    tiles_y((height + TILE_SIZE - 1) / TILE_SIZE),
+    tiles(static_cast<std::size_t>(tiles_x) * tiles_y) {
+
+    // Do nothing
+
+}
+
+double& HistogramPyramid::Level::bin(unsigned x, unsigned y) {
+
+    auto &tile = tiles[static_cast<std::size_t>(x / TILE_SIZE) * tiles_y + y / TILE_SIZE];
+    if(tile.empty())
+        tile.assign(TILE_BINS, 0);
+
+    return tile[(x % TILE_SIZE) * TILE_SIZE + y % TILE_SIZE];
+
+}
+
+void HistogramPyramid::Level::add(const Level &other) {
+
+    for(std::size_t ix = 0; ix < tiles.size(); ++ix) {
+        auto &from = other.tiles[ix];
+        if(from.empty())
+            continue;
+
+        auto &to = tiles[ix];
+        if(to.empty())
+            to.assign(TILE_BINS, 0);
+        for(std::size_t jx = 0; jx < TILE_BINS; ++jx)
+            to[jx] += from[jx];
+    }
+
+}
+
+HistogramPyramid::HistogramPyramid() :
+    mXMin(0),
+    mXMax(1),
+    mYMin(0),
+    mYMax(1),
+    mWidth(0),
+    mHeight(0),
+    mLevels{Level(0, 0)} {
+
+    // Do nothing
+
+}
+
+HistogramPyramid::HistogramPyramid(unsigned width, unsigned height, double x_min, double x_max, double y_min, double y_max) :
+    mXMin(x_min),
+    mXMax(x_max),
+    mYMin(y_min),
+    mYMax(y_max),
+    mWidth(width),
+    mHeight(height),
+    mLevels{Level(width, height)} {
+
+    if(!(x_max > x_min) || !(y_max > y_min))
+        throw std::runtime_error("A histogram pyramid must cover a non-empty rectangle");
+
+}
+
+HistogramPyramid::HistogramPyramid(const ImageXY<unsigned> &image, double x_min, double x_max, double y_min, double y_max) :
+    HistogramPyramid(static_cast<unsigned>(image.size()), image.empty() ? 0 : static_cast<unsigned>(image[0].size()),
+                     x_min, x_max, y_min, y_max) {
+
+    auto &finest = mLevels.front();
+    for(unsigned x = 0; x < mWidth; ++x) {
+        for(unsigned y = 0; y < mHeight; ++y) {
+            if(image[x][y])
+                finest.bin(x, y) = image[x][y];
+        }
+    }
+
+    buildLevels();
+
+}
+
+void HistogramPyramid::add(double x, double y, double weight) {
+
+    splat(mLevels.front(), x, y, weight, false);
+
+}
+
+void HistogramPyramid::add(const HistogramPyramid &other) {
+
+    if(other.mWidth != mWidth || other.mHeight != mHeight || other.mXMin != mXMin || other.mXMax != mXMax ||
+       other.mYMin != mYMin || other.mYMax != mYMax)
+        throw std::runtime_error("Cannot add histograms with different bins.");
+
+    if(!other.empty())
+        mLevels.front().add(other.mLevels.front());
+
+}
+
+void HistogramPyramid::splat(Level &level, double x, double y, double weight, bool bilinear) const {
+
+    if(!(x >= mXMin && x < mXMax && y >= mYMin && y < mYMax))
+        return;
+
+    auto u = (x - mXMin) / binWidthX(); // [bins]
+    auto v = (y - mYMin) / binWidthY();
+
+    if(!bilinear) {
+        auto bin_x = std::min(static_cast<unsigned>(u), mWidth - 1);
+        auto bin_y = std::min(static_cast<unsigned>(v), mHeight - 1);
+        level.bin(bin_x, bin_y) += weight;
+        return;
+    }
+
+    // share the weight between the four bins whose centres surround the point; weight beyond the edges is dropped
+    auto u0 = std::floor(u - 0.5), v0 = std::floor(v - 0.5);
+    auto fu = u - 0.5 - u0, fv = v - 0.5 - v0;
+
+    for(int dx = 0; dx < 2; ++dx) {
+        for(int dy = 0; dy < 2; ++dy) {
+            auto bin_x = static_cast<long long>(u0) + dx;
+            auto bin_y = static_cast<long long>(v0) + dy;
+            if(bin_x < 0 || bin_y < 0 || bin_x >= mWidth || bin_y >= mHeight)
+                continue;
+
+            auto w = (dx ? fu : 1 - fu) * (dy ? fv : 1 - fv);
+            if(w > 0)
+                level.bin(static_cast<unsigned>(bin_x), static_cast<unsigned>(bin_y)) += weight * w;
+        }
+    }
+
+}
+
+void HistogramPyramid::buildLevels(TaskPool &pool) {
+
+    mLevels.erase(mLevels.begin() + 1, mLevels.end());
+
+    while(mLevels.back().width > 1 || mLevels.back().height > 1) {
+        auto &fine = mLevels.back();
+        Level coarse((fine.width + 1) / 2, (fine.height + 1) / 2);
+
+        // each coarse tile sums (up to) 2x2 fine tiles, so the tiles can be summed in parallel
+        pool.parallelFor(coarse.tiles.size(), 16, [&](std::size_t begin, std::size_t end) {
+            for(auto coarse_ix = begin; coarse_ix < end; ++coarse_ix) {
+                auto tile_x = static_cast<unsigned>(coarse_ix / coarse.tiles_y);
+                auto tile_y = static_cast<unsigned>(coarse_ix % coarse.tiles_y);
+
+                for(unsigned fine_x = 2*tile_x; fine_x < std::min(2*tile_x + 2, fine.tiles_x); ++fine_x) {
+                    for(unsigned fine_y = 2*tile_y; fine_y < std::min(2*tile_y + 2, fine.tiles_y); ++fine_y) {
+                        auto &from = fine.tiles[static_cast<std::size_t>(fine_x) * fine.tiles_y + fine_y];
+                        if(from.empty())
+                            continue;
+
+                        auto &to = coarse.tiles[coarse_ix];
+                        if(to.empty())
+                            to.assign(TILE_BINS, 0);
+
+                        // offset of the fine tile within the coarse one, in coarse bins
+                        auto offset_x = (fine_x - 2*tile_x) * TILE_SIZE / 2;
+                        auto offset_y = (fine_y - 2*tile_y) * TILE_SIZE / 2;
+                        for(unsigned x = 0; x < TILE_SIZE; ++x) {
+                            for(unsigned y = 0; y < TILE_SIZE; ++y)
+                                to[(offset_x + x/2) * TILE_SIZE + offset_y + y/2] += from[x * TILE_SIZE + y];
+                        }
+                    }
+                }
+            }
+        });
+
+        mLevels.push_back(std::move(coarse));
+    }
+
+}
+
+double HistogramPyramid::binWidthX(unsigned level) const {
+
+    return std::ldexp((mXMax - mXMin) / std::max(mWidth, 1u), static_cast<int>(level));
+
+}
+
+double HistogramPyramid::binWidthY(unsigned level) const {
+
+    return std::ldexp((mYMax - mYMin) / std::max(mHeight, 1u), static_cast<int>(level));
+
+}
+
+double HistogramPyramid::at(unsigned level, unsigned x, unsigned y) const {
+
+    auto &lv = mLevels[level];
+    auto &tile = lv.tiles[static_cast<std::size_t>(x / TILE_SIZE) * lv.tiles_y + y / TILE_SIZE];
+
+    return tile.empty() ? 0 : tile[(x % TILE_SIZE) * TILE_SIZE + y % TILE_SIZE];
+
+}
+
+std::size_t HistogramPyramid::memsize() const {
+
+    std::size_t num_bins = 0;
+    for(auto &level : mLevels) {
+        for(auto &tile : level.tiles)
+            num_bins += tile.size();
+    }
+
+    return num_bins * sizeof(double);
+
+}
+
+std::vector<double> HistogramPyramid::marginalX(unsigned level) const {
+
+    std::vector<double> sums(width(level), 0);
+    forEachBin(level, 0, width(level), 0, height(level), [&sums](unsigned x, unsigned, double count) {
+        sums[x] += count;
+    });
+
+    return sums;
+
+}
+
+std::vector<double> HistogramPyramid::marginalY(unsigned level) const {
+
+    std::vector<double> sums(height(level), 0);
+    forEachBin(level, 0, width(level), 0, height(level), [&sums](unsigned, unsigned y, double count) {
+        sums[y] += count;
+    });
+
+    return sums;
+
+}
+
+unsigned HistogramPyramid::levelFor(double x_span, double y_span, unsigned max_bins_x, unsigned max_bins_y) const {
+
+    for(unsigned level = 0; level < numLevels(); ++level) {
+        if(x_span / binWidthX(level) <= max_bins_x && y_span / binWidthY(level) <= max_bins_y)
+            return level;
+    }
+
+    return numLevels() - 1;
+
+}
+
+void HistogramPyramid::binRangeX(unsigned level, double min, double max, unsigned &first, unsigned &last) const {
+
+    auto bin_width = binWidthX(level);
+    auto size = width(level);
+
+    first = static_cast<unsigned>(std::clamp(std::floor((min - mXMin) / bin_width), 0.0, static_cast<double>(size)));
+    last = static_cast<unsigned>(std::clamp(std::floor((max - mXMin) / bin_width) + 1, 0.0, static_cast<double>(size)));
+
+}
+
+void HistogramPyramid::binRangeY(unsigned level, double min, double max, unsigned &first, unsigned &last) const {
+
+    auto bin_width = binWidthY(level);
+    auto size = height(level);
+
+    first = static_cast<unsigned>(std::clamp(std::floor((min - mYMin) / bin_width), 0.0, static_cast<double>(size)));
+    last = static_cast<unsigned>(std::clamp(std::floor((max - mYMin) / bin_width) + 1, 0.0, static_cast<double>(size)));
+
+}
@@ -0,0 +1,225 @@
+#include "tpx3.h"
+
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace spec_hom;
+
+// Escapes a string for use as a JSON string value (Windows paths contain backslashes)
+std::string json_escape(const std::string &str) {
+
+    std::string escaped;
+    escaped.reserve(str.size());
+
+    for(char c : str) {
+        switch(c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    std::ostringstream code;
+                    code << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+                    escaped += code.str();
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+
+    return escaped;
+
+}
+
+double StageStats::packetsPerSecond() const {
+
+    return wall_time > 0 ? static_cast<double>(num_packets) / wall_time : 0;
+
+}
+
+double StageStats::bytesPerSecond() const {
+
+    return wall_time > 0 ? static_cast<double>(num_bytes) / wall_time : 0;
+
+}
+
+double StageStats::threadUtilisation() const {
+
+    if(wall_time <= 0 || !num_threads)
+        return 0;
+
+    return std::clamp(busy_time / (wall_time * num_threads), 0.0, 1.0);
+
+}
+
+double ImportStats::totalWallTime() const {
+
+    double total = 0;
+    for(auto &stage : stages)
+        total += stage.wall_time;
+    return total;
+
+}
+
+void ImportStats::add(const ImportStats &other) {
+
+    num_files += std::max<std::size_t>(other.num_files, 1);
+    num_packets += other.num_packets;
+    file_size += other.file_size;
+
+    for(auto &other_stage : other.stages) {
+        auto stage = std::find_if(stages.begin(), stages.end(), [&other_stage](const StageStats &x) {
+            return x.name == other_stage.name;
+        });
+
+        if(stage == stages.end()) {
+            stages.push_back(other_stage);
+            continue;
+        }
+
+        // times and sizes add up, so the batch throughput is the total work over the total time
+        stage->wall_time += other_stage.wall_time;
+        stage->busy_time += other_stage.busy_time;
+        stage->num_packets += other_stage.num_packets;
+        stage->num_bytes += other_stage.num_bytes;
+        stage->peak_memory = std::max(stage->peak_memory, other_stage.peak_memory);
+        stage->num_threads = std::max(stage->num_threads, other_stage.num_threads);
+    }
+
+}
+
+std::string ImportStats::summary() const {
+
+    std::ostringstream out;
+    out << std::fixed;
+
+    if(filename.empty())
+        out << "Batch of " << num_files << " file(s)";
+    else
+        out << filename;
+    out << std::setprecision(2) << ": " << totalWallTime() << " s, " << static_cast<double>(num_packets) * 1e-6 << " M packets";
+
+    for(auto &stage : stages) {
+        out << "\n    " << std::left << std::setw(26) << stage.name << std::right
+            << std::setprecision(3) << stage.wall_time << " s, "
+            << std::setprecision(2) << stage.packetsPerSecond() * 1e-6 << " M packets/s, "
+            << std::setprecision(1) << stage.bytesPerSecond() / (1024*1024) << " MB/s, "
+            << std::setprecision(0) << stage.threadUtilisation() * 100 << "% of " << stage.num_threads << " threads, "
+            << std::setprecision(2) << static_cast<double>(stage.peak_memory) / (1 << 30) << " GB peak";
+    }
+
+    return out.str();
+
+}
+
+std::string ImportStats::toJson() const {
+
+    std::ostringstream out;
+    out << std::setprecision(9);
+
+    out << "{\n";
+    if(!filename.empty())
+        out << "  \"file\": \"" << json_escape(filename) << "\",\n";
+    out << "  \"num_files\": " << std::max<std::size_t>(num_files, 1) << ",\n";
+    out << "  \"num_packets\": " << num_packets << ",\n";
+    out << "  \"file_size_bytes\": " << file_size << ",\n";
+    out << "  \"total_wall_time_s\": " << totalWallTime() << ",\n";
+    out << "  \"stages\": [";
+
+    for(std::size_t ix = 0; ix < stages.size(); ++ix) {
+        auto &stage = stages[ix];
+        out << (ix ? ",\n" : "\n");
+        out << "    {\n";
+        out << "      \"name\": \"" << json_escape(stage.name) << "\",\n";
+        out << "      \"wall_time_s\": " << stage.wall_time << ",\n";
+        out << "      \"busy_time_s\": " << stage.busy_time << ",\n";
+        out << "      \"num_packets\": " << stage.num_packets << ",\n";
+        out << "      \"num_bytes\": " << stage.num_bytes << ",\n";
+        out << "      \"packets_per_s\": " << stage.packetsPerSecond() << ",\n";
+        out << "      \"bytes_per_s\": " << stage.bytesPerSecond() << ",\n";
+        out << "      \"peak_memory_bytes\": " << stage.peak_memory << ",\n";
+        out << "      \"num_threads\": " << stage.num_threads << ",\n";
+        out << "      \"thread_utilisation\": " << stage.threadUtilisation() << "\n";
+        out << "    }";
+    }
+
+    out << "\n  ]\n}\n";
+
+    return out.str();
+
+}
+
+void ImportStats::saveTo(const std::string &json_path) const {
+
+    std::ofstream json_file(json_path);
+    json_file << toJson() << std::flush;
+
+}
+
+std::size_t ImportStats::peakResidentMemory() {
+
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<std::size_t>(usage.ru_maxrss); // already in bytes
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // in kilobytes on Linux
+#endif
+#endif
+
+}
+
+StageTimer::StageTimer(ImportStats &stats, std::string name) :
+    mStats(stats),
+    mName(std::move(name)),
+    mTimer(),
+    mStopped(false) {
+
+    // Do nothing
+
+}
+
+StageTimer::~StageTimer() {
+
+    stop();
+
+}
+
+void StageTimer::stop() {
+
+    if(mStopped)
+        return;
+
+    mTimer.stop();
+    mStopped = true;
+
+    StageStats stage;
+    stage.name = mName;
+    stage.wall_time = mTimer.wallTime();
+    stage.busy_time = mTimer.busyTime();
+    stage.num_packets = mStats.num_packets;
+    stage.num_bytes = mStats.file_size;
+    stage.peak_memory = ImportStats::peakResidentMemory();
+    stage.num_threads = TaskPool::global().numThreads() + 1; // the import's own thread helps with its tasks
+
+    mStats.stages.push_back(std::move(stage));
+
+}
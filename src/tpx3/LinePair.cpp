@@ -2,8 +2,6 @@
 
 #include <QVector>
 
-#include <dlib/optimization.h>
-
 using namespace spec_hom;
 
 LinePair::LinePair(bool vertical, double line_1_pos, double line_2_pos, double line_1_sigma, double line_2_sigma) :
@@ -17,144 +15,79 @@ LinePair::LinePair(bool vertical, double line_1_pos, double line_2_pos, double l
 
 }
 
-using input_vec = dlib::matrix<double, 1, 1>; // definitions used in the fitting code
-using param_vec = dlib::matrix<double, 6, 1>; // definitions used in the fitting code
-
-// Functors needed for fitting
-double model(const input_vec &in, const param_vec &pm) {
-    return pm(0) * std::exp(-0.5 * (in(0) - pm(1)) * (in(0) - pm(1)) / pm(2) / pm(2)) +
-           pm(3) * std::exp(-0.5 * (in(0) - pm(4)) * (in(0) - pm(4)) / pm(5) / pm(5));
-}
-double residual(const std::pair<input_vec, double> &data, const param_vec &params) {
-    return model(data.first, params) - data.second;
-}
-
-param_vec fit_data(QVector<double> &x, QVector<double> &y, bool h_lines) {
-
-    unsigned max_ix, max_jx;
-    if (h_lines) {
-        max_ix = Tpx3Image::HEIGHT;
-        max_jx = Tpx3Image::WIDTH;
-    } else {
-        max_ix = Tpx3Image::WIDTH;
-        max_jx = Tpx3Image::HEIGHT;
-    }
-
-    std::vector<std::pair<input_vec, double>> data_samples;
-    for (auto ix = 0; ix < x.size(); ++ix) {
-        data_samples.emplace_back(input_vec{x[ix]}, y[ix]);
-    }
-
-    // Before we perform the fit, we need to find an initial guess for the parameters
-    // Sort the points from highest y to lowest y, and traverse list to find peaks
-
-    std::vector<std::size_t> indices(max_ix);
-    for(auto ix = 0; ix < max_ix; ++ix)
-        indices.push_back(ix);
-
-    std::sort(indices.begin(), indices.end(), [y](auto lhs, auto rhs){
-        return y[lhs] > y[rhs];
-    });
+bool LinePair::isHorizontal(const ImageXY<unsigned> &image) {
 
-    std::vector<bool> processed;
-    processed.insert(processed.begin(), false, max_ix);
+    // Look for peaks along horizontal and vertical direction, and pick direction accordingly
+    auto width = static_cast<unsigned>(image.size());
+    auto height = width ? static_cast<unsigned>(image[0].size()) : 0;
 
-    auto fit_m1 = static_cast<double>(indices[0]);
-    auto fit_left_1 = fit_m1;
-    auto fit_right_1 = fit_m1;
+    std::vector<unsigned> h_slice(height, 0), v_slice(width, 0);
 
-    double fit_m2 = -1;
-
-    for(auto ix = 1; ix < max_ix; ++ix) {
-        auto next_highest = indices[ix];
-        if (next_highest == fit_left_1 - 1) {
-            --fit_left_1;
-        } else if (next_highest == fit_right_1 + 1) {
-            ++fit_right_1;
-        } else {
-            fit_m2 = indices[ix];
-            break;
+    for (unsigned r = 0; r < width; ++r) {
+        for (unsigned c = 0; c < height; ++c) {
+            v_slice[r] += image[r][c];
+            h_slice[c] += image[r][c];
         }
     }
 
-    if(fit_m2 == -1)
-        fit_m2 = max_ix / 2.0;
-
-    // Do the fit
-    auto max_y = std::max_element(y.cbegin(), y.cend());
-    param_vec soln{ *max_y, fit_m1, 3, *max_y, fit_m2, 3 };
+    if(h_slice.empty() || v_slice.empty())
+        return true;
 
-    dlib::solve_least_squares_lm(dlib::objective_delta_stop_strategy(1e-3),
-                                 residual,
-                                 dlib::derivative(residual), // use numerical derivatives; a bit slow, but much simpler
-                                 data_samples,
-                                 soln);
+    auto h_slice_max = *std::max_element(h_slice.cbegin(), h_slice.cend());
+    auto v_slice_max = *std::max_element(v_slice.cbegin(), v_slice.cend());
 
-    return soln;
+    return h_slice_max >= v_slice_max;
 
 }
 
-LinePair LinePair::find(ImageXY<unsigned int> &image, bool h_lines, QVector<double> *x_out, QVector<double> *y_out, QVector<double> *fit_y_out) {
+LinePair LinePair::find(const ImageXY<unsigned> &image, bool h_lines, QVector<double> *x_out, QVector<double> *y_out,
+                        QVector<double> *fit_y_out, LineProfileFit *fit_out) {
+
+    // image is indexed as image[x][y]
+    auto width = static_cast<unsigned>(image.size());
+    auto height = width ? static_cast<unsigned>(image[0].size()) : 0;
 
     unsigned max_ix, max_jx;
     if (h_lines) {
-        max_ix = Tpx3Image::HEIGHT;
-        max_jx = Tpx3Image::WIDTH;
+        max_ix = height;
+        max_jx = width;
     } else {
-        max_ix = Tpx3Image::WIDTH;
-        max_jx = Tpx3Image::HEIGHT;
+        max_ix = width;
+        max_jx = height;
     }
 
-    std::vector<unsigned> slice;
-    slice.reserve(max_ix);
-
+    // profile across the lines
+    std::vector<double> slice(max_ix, 0);
     for (unsigned ix = 0; ix < max_ix; ++ix) {
-        unsigned slice_tot = 0;
-
-        for (unsigned jx = 0; jx < max_jx; ++jx) {
-            unsigned x_ix, y_ix;
-            if (h_lines) {
-                x_ix = jx;
-                y_ix = ix;
-            } else {
-                x_ix = ix;
-                y_ix = jx;
-            }
-
-            slice_tot += image[x_ix][y_ix];
-        }
-
-        slice.push_back(slice_tot);
+        for (unsigned jx = 0; jx < max_jx; ++jx)
+            slice[ix] += h_lines ? image[jx][ix] : image[ix][jx];
     }
 
-    QVector<double> x, y;
-    x.reserve(max_ix);
-    y.reserve(max_ix);
+    auto fit = LineProfileFit::fit(slice);
 
-    for (auto ix = 0; ix < max_ix; ++ix) {
-        x.push_back(ix);
-        y.push_back(slice[ix]);
-    }
-
-    // We need to fit the data
-    param_vec soln = fit_data(x, y, h_lines);
+    if(x_out || y_out || fit_y_out) {
+        QVector<double> x, y, fit_y;
+        for (unsigned ix = 0; ix < max_ix; ++ix) {
+            x.push_back(ix);
+            y.push_back(slice[ix]);
+            fit_y.push_back(fit.model(ix));
+        }
 
-    decltype(y) fit_y(y.size());
-    for (auto ix = 0; ix < fit_y.size(); ++ix) {
-        fit_y[ix] = model({x[ix]}, soln);
+        if(x_out)
+            *x_out = x;
+        if(y_out)
+            *y_out = y;
+        if(fit_y_out)
+            *fit_y_out = fit_y;
     }
 
-    if(x_out)
-        *x_out = x;
-    if(y_out)
-        *y_out = y;
-    if(fit_y_out)
-        *fit_y_out = fit_y;
+    if(fit_out)
+        *fit_out = fit;
 
-    auto m1 = soln(1) * PIXEL_SIZE;
-    auto s1 = soln(2) * PIXEL_SIZE;
-    auto m2 = soln(4) * PIXEL_SIZE;
-    auto s2 = soln(5) * PIXEL_SIZE;
+    auto m1 = fit.params[LineProfileFit::CENTRE_1] * PIXEL_SIZE;
+    auto s1 = fit.params[LineProfileFit::SIGMA_1] * PIXEL_SIZE;
+    auto m2 = fit.params[LineProfileFit::CENTRE_2] * PIXEL_SIZE;
+    auto s2 = fit.params[LineProfileFit::SIGMA_2] * PIXEL_SIZE;
 
     return {
         h_lines,
@@ -180,7 +113,7 @@ void LinePair::getRectBounds(double &min1, double &max1, double &min2, double &m
 
 }
 
-int LinePair::closestLine(double x, double y) {
+int LinePair::closestLine(double x, double y) const {
 
     if(mIsVertical) {
         double bottom = std::min(mLine1Pos, mLine2Pos);
@@ -0,0 +1,231 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Dense>
+
+using namespace spec_hom;
+
+constexpr unsigned MAX_ITERATIONS = 200;
+constexpr double CONVERGENCE = 1e-9; // relative decrease of chi^2 below which the fit has converged
+constexpr double MAX_DAMPING = 1e10; // beyond this, no step lowers chi^2 any more
+constexpr double MIN_SIGMA = 0.3; // [bins] narrower lines are not resolved by the profile
+constexpr int SMOOTHING = 2; // [bins] half-width of the box that smooths the profile for the initial guess
+constexpr double SMOOTHING_VARIANCE = ((2*SMOOTHING + 1) * (2*SMOOTHING + 1) - 1) / 12.0; // [bins^2] added by the box
+constexpr double FWHM_PER_SIGMA = 2.3548200450309493;
+constexpr double MAX_EXPONENT = 1400; // [sigma^2] beyond this, a line is zero in double precision (and exp() is slow)
+constexpr double BACKGROUND_QUANTILE = 0.1; // of the smoothed profile, taken as the initial background
+
+namespace {
+
+    constexpr int NUM_PARAMS = LineProfileFit::NUM_PARAMS;
+    using Params = Eigen::Matrix<double, NUM_PARAMS, 1>;
+    using Normal = Eigen::Matrix<double, NUM_PARAMS, NUM_PARAMS>;
+
+    // the model at x, and its derivatives with respect to the parameters if grad is given
+    double evaluate(const Params &p, double x, bool background, Params *grad) {
+
+        double value = background ? p(LineProfileFit::BACKGROUND) : 0;
+        if(grad)
+            (*grad)(LineProfileFit::BACKGROUND) = background ? 1 : 0;
+
+        for(int line = 0; line < 2; ++line) {
+            auto a = p(3*line), m = p(3*line + 1), s = p(3*line + 2);
+            auto u = (x - m) / s;
+            auto e = u * u < MAX_EXPONENT ? std::exp(-0.5 * u * u) : 0.0;
+            value += a * e;
+
+            if(grad) {
+                (*grad)(3*line) = e;
+                (*grad)(3*line + 1) = a * e * u / s;
+                (*grad)(3*line + 2) = a * e * u * u / s;
+            }
+        }
+
+        return value;
+
+    }
+
+    // chi^2 with Poisson weights; also sums J^T W J and J^T W r, with r = model - counts, if they are given
+    double chi2(const Params &p, const std::vector<double> &counts, bool background, Normal *jtj = nullptr, Params *jtr = nullptr) {
+
+        if(jtj) {
+            jtj->setZero();
+            jtr->setZero();
+        }
+
+        double sum = 0;
+        Params grad;
+        for(std::size_t ix = 0; ix < counts.size(); ++ix) {
+            auto weight = 1 / std::max(counts[ix], 1.0);
+            auto r = evaluate(p, static_cast<double>(ix), background, jtj ? &grad : nullptr) - counts[ix];
+            sum += weight * r * r;
+
+            if(jtj) {
+                for(int col = 0; col < NUM_PARAMS; ++col) {
+                    for(int row = col; row < NUM_PARAMS; ++row)
+                        (*jtj)(row, col) += weight * grad(row) * grad(col);
+                }
+                *jtr += weight * r * grad;
+            }
+        }
+
+        if(jtj)
+            jtj->triangularView<Eigen::StrictlyUpper>() = jtj->transpose();
+
+        return sum;
+
+    }
+
+    // from the full width at half maximum of a peak in the smoothed profile, less the width added by the smoothing
+    double peak_sigma(const std::vector<double> &smooth, std::size_t peak, double background) {
+
+        auto half = background + (smooth[peak] - background) / 2;
+        auto n = smooth.size();
+
+        double left = 0, right = static_cast<double>(n - 1);
+        for(auto ix = peak; ix > 0; --ix) {
+            if(smooth[ix - 1] < half) {
+                left = static_cast<double>(ix - 1) + (half - smooth[ix - 1]) / (smooth[ix] - smooth[ix - 1]);
+                break;
+            }
+        }
+        for(auto ix = peak; ix + 1 < n; ++ix) {
+            if(smooth[ix + 1] < half) {
+                right = static_cast<double>(ix) + (smooth[ix] - half) / (smooth[ix] - smooth[ix + 1]);
+                break;
+            }
+        }
+
+        auto sigma = (right - left) / FWHM_PER_SIGMA;
+        return std::sqrt(std::max(sigma * sigma - SMOOTHING_VARIANCE, MIN_SIGMA * MIN_SIGMA));
+
+    }
+
+    // Finds the highest peak of the smoothed profile, and the highest local maximum away from it
+    Params initial_guess(const std::vector<double> &counts, bool background) {
+
+        auto n = counts.size();
+
+        std::vector<double> smooth(n, 0);
+        for(std::size_t ix = 0; ix < n; ++ix) {
+            auto first = ix >= SMOOTHING ? ix - SMOOTHING : 0;
+            auto last = std::min(ix + SMOOTHING + 1, n);
+            for(auto jx = first; jx < last; ++jx)
+                smooth[ix] += counts[jx];
+            smooth[ix] /= static_cast<double>(last - first);
+        }
+
+        double bg = 0;
+        if(background) {
+            auto sorted = smooth;
+            auto quantile = sorted.begin() + static_cast<std::ptrdiff_t>(BACKGROUND_QUANTILE * static_cast<double>(n - 1));
+            std::nth_element(sorted.begin(), quantile, sorted.end());
+            bg = *quantile;
+        }
+
+        auto peak_1 = static_cast<std::size_t>(std::max_element(smooth.begin(), smooth.end()) - smooth.begin());
+        auto sigma_1 = peak_sigma(smooth, peak_1, bg);
+
+        // the second line is the highest local maximum outside of the first
+        auto exclusion = std::max(3 * sigma_1, 2.0);
+        std::size_t peak_2 = n;
+        for(std::size_t ix = 0; ix < n; ++ix) {
+            if(std::abs(static_cast<double>(ix) - static_cast<double>(peak_1)) <= exclusion)
+                continue;
+            if((ix > 0 && smooth[ix - 1] > smooth[ix]) || (ix + 1 < n && smooth[ix + 1] > smooth[ix]))
+                continue;
+            if(peak_2 == n || smooth[ix] > smooth[peak_2])
+                peak_2 = ix;
+        }
+
+        // no second peak: the lines are usually placed symmetrically on the sensor
+        if(peak_2 == n)
+            peak_2 = n - 1 - peak_1;
+
+        auto amplitude_1 = std::max(smooth[peak_1] - bg, 1.0);
+        auto amplitude_2 = std::max(smooth[peak_2] - bg, 0.1 * amplitude_1);
+
+        Params p;
+        p << amplitude_1, static_cast<double>(peak_1), sigma_1,
+             amplitude_2, static_cast<double>(peak_2), peak_sigma(smooth, peak_2, bg),
+             bg;
+        return p;
+
+    }
+
+}
+
+LineProfileFit LineProfileFit::fit(const std::vector<double> &counts, bool background) {
+
+    LineProfileFit result;
+
+    auto num_free = background ? NUM_PARAMS : NUM_PARAMS - 1;
+    if(counts.size() <= static_cast<std::size_t>(num_free))
+        return result; // not enough bins to fit
+
+    auto p = initial_guess(counts, background);
+
+    Normal jtj;
+    Params jtr;
+    auto chi = chi2(p, counts, background, &jtj, &jtr);
+    double damping = 1e-3;
+
+    // Levenberg-Marquardt, with the damping scaled by the curvature of each parameter
+    for(; result.num_iterations < MAX_ITERATIONS && !result.converged; ++result.num_iterations) {
+        Normal a = jtj;
+        for(int ix = 0; ix < NUM_PARAMS; ++ix)
+            a(ix, ix) += damping * std::max(jtj(ix, ix), 1e-12);
+        if(!background)
+            a(BACKGROUND, BACKGROUND) = 1;
+
+        // the lines are kept on the profile, with non-negative amplitudes and resolvable widths
+        Params trial = p + a.ldlt().solve(-jtr);
+        for(auto line : {0, 3}) {
+            trial(AMPLITUDE_1 + line) = std::max(trial(AMPLITUDE_1 + line), 0.0);
+            trial(CENTRE_1 + line) = std::clamp(trial(CENTRE_1 + line), 0.0, static_cast<double>(counts.size() - 1));
+            trial(SIGMA_1 + line) = std::max(std::abs(trial(SIGMA_1 + line)), MIN_SIGMA);
+        }
+
+        auto trial_chi = chi2(trial, counts, background);
+        if(!(trial_chi < chi)) {
+            damping *= 10;
+            result.converged = damping > MAX_DAMPING; // at the minimum, to within rounding
+            continue;
+        }
+
+        result.converged = chi - trial_chi <= CONVERGENCE * chi;
+        p = trial;
+        chi = chi2(p, counts, background, &jtj, &jtr);
+        damping = std::max(damping / 10, 1e-12);
+    }
+
+    auto dof = static_cast<double>(counts.size()) - num_free;
+    result.chi2_per_dof = chi / dof;
+
+    // the covariance is the inverse of the curvature, scaled up if the profile scatters more than Poisson
+    Normal curvature = jtj;
+    if(!background) {
+        curvature.row(BACKGROUND).setZero();
+        curvature.col(BACKGROUND).setZero();
+        curvature(BACKGROUND, BACKGROUND) = 1;
+    }
+    Normal covariance = curvature.inverse() * std::max(result.chi2_per_dof, 1.0);
+
+    for(int ix = 0; ix < NUM_PARAMS; ++ix) {
+        result.params[ix] = p(ix);
+        result.errors[ix] = std::sqrt(std::max(covariance(ix, ix), 0.0));
+    }
+    if(!background)
+        result.errors[BACKGROUND] = 0;
+
+    return result;
+
+}
+
+double LineProfileFit::model(double x) const {
+
+    return evaluate(Eigen::Map<const Params>(params.data()), x, true, nullptr);
+
+}
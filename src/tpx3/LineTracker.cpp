@@ -0,0 +1,235 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace spec_hom;
+
+constexpr double MIN_WINDOW_COUNTS = 1e4; // raw packets a window needs for its lines to be fit
+constexpr double MAX_LINE_JUMP = 0.25; // [line separations] a line that moves further between fit windows is a failed fit
+constexpr int MAX_SHIFT = 16; // [px] largest drift along the lines that is looked for, relative to the reference window
+
+namespace {
+
+    // Lag [bins] of profile relative to reference, from the peak of their correlation coefficient over the bins where
+    // they overlap, with parabolic interpolation around it; 0 if either profile is empty
+    double best_lag(const std::vector<double> &reference, const std::vector<double> &profile) {
+
+        auto n = static_cast<int>(reference.size());
+        if(!(std::accumulate(reference.begin(), reference.end(), 0.0) > 0) || !(std::accumulate(profile.begin(), profile.end(), 0.0) > 0))
+            return 0;
+
+        auto max_lag = std::min(MAX_SHIFT, n / 2);
+        std::vector<double> corr(2*max_lag + 1, 0);
+        for(int lag = -max_lag; lag <= max_lag; ++lag) {
+            auto first = std::max(0, -lag), last = std::min(n, n - lag);
+            double sum_r = 0, sum_p = 0, sum_rr = 0, sum_pp = 0, sum_rp = 0;
+            for(int ix = first; ix < last; ++ix) {
+                auto r = reference[ix], p = profile[ix + lag];
+                sum_r += r;
+                sum_p += p;
+                sum_rr += r * r;
+                sum_pp += p * p;
+                sum_rp += r * p;
+            }
+
+            auto count = static_cast<double>(last - first);
+            auto var_r = sum_rr - sum_r * sum_r / count, var_p = sum_pp - sum_p * sum_p / count;
+            if(var_r > 0 && var_p > 0)
+                corr[lag + max_lag] = (sum_rp - sum_r * sum_p / count) / std::sqrt(var_r * var_p);
+        }
+
+        auto peak = static_cast<int>(std::max_element(corr.begin(), corr.end()) - corr.begin());
+        double lag = peak - max_lag;
+        if(peak > 0 && peak < 2*max_lag) {
+            auto left = corr[peak - 1], centre = corr[peak], right = corr[peak + 1];
+            auto curvature = left - 2*centre + right;
+            if(curvature < 0)
+                lag += 0.5 * (left - right) / curvature;
+        }
+
+        return lag;
+
+    }
+
+}
+
+LineTracker::LineTracker(const LinePair &reference, unsigned width, unsigned height, double window, double start) :
+    mReference(reference),
+    mAlongX(reference.alongX()),
+    mAcrossSize(mAlongX ? height : width),
+    mAlongSize(mAlongX ? width : height),
+    mWindow(window),
+    mStart(start),
+    mWindows(),
+    mNumFinished(0),
+    mFitWindows(),
+    mReferenceWindow(0) {
+
+    // Do nothing
+
+}
+
+void LineTracker::add(PixelAddr addr, double toa) {
+
+    if(!(mWindow > 0) || toa < mStart)
+        return;
+
+    auto ix = static_cast<std::size_t>((toa - mStart) / mWindow);
+    if(ix < mNumFinished)
+        return;
+
+    if(ix >= mWindows.size())
+        mWindows.resize(ix + 1);
+
+    auto &window = mWindows[ix];
+    if(window.across.empty()) {
+        window.across.assign(mAcrossSize, 0);
+        window.along[0].assign(mAlongSize, 0);
+        window.along[1].assign(mAlongSize, 0);
+    }
+
+    auto across = mAlongX ? addr.y : addr.x;
+    auto along = mAlongX ? addr.x : addr.y;
+    if(across >= mAcrossSize || along >= mAlongSize)
+        return;
+
+    // channels are split where the lines were when the packet arrived, as for the centroids
+    auto channel = closestLine((addr.x + 0.5) * PIXEL_SIZE, (addr.y + 0.5) * PIXEL_SIZE, toa);
+
+    ++window.across[across];
+    ++window.along[channel - 1][along];
+
+}
+
+void LineTracker::update(double toa) {
+
+    while(mNumFinished < mWindows.size() && mStart + static_cast<double>(mNumFinished + 1) * mWindow <= toa) {
+        auto &window = mWindows[mNumFinished];
+        window.time = mStart + (static_cast<double>(mNumFinished) + 0.5) * mWindow;
+
+        if(fitWindow(window)) {
+            if(mFitWindows.empty())
+                mReferenceWindow = mNumFinished;
+            mFitWindows.push_back(mNumFinished);
+        }
+
+        // only the spectra of the reference window are needed again
+        std::vector<double>().swap(window.across);
+        if(mFitWindows.empty() || mReferenceWindow != mNumFinished) {
+            std::vector<double>().swap(window.along[0]);
+            std::vector<double>().swap(window.along[1]);
+        }
+
+        ++mNumFinished;
+    }
+
+}
+
+bool LineTracker::fitWindow(Window &window) {
+
+    if(std::accumulate(window.across.begin(), window.across.end(), 0.0) < MIN_WINDOW_COUNTS)
+        return false;
+
+    auto fit = LineProfileFit::fit(window.across);
+    if(!fit.converged)
+        return false;
+
+    // channel 1 is the line at the lower coordinate
+    auto centre_1 = fit.params[LineProfileFit::CENTRE_1] * PIXEL_SIZE;
+    auto centre_2 = fit.params[LineProfileFit::CENTRE_2] * PIXEL_SIZE;
+    window.position = {std::min(centre_1, centre_2), std::max(centre_1, centre_2)};
+
+    auto previous = at(window.time).position;
+    auto max_jump = MAX_LINE_JUMP * (previous[1] - previous[0]);
+    for(int line = 0; line < 2; ++line) {
+        if(!(std::abs(window.position[line] - previous[line]) <= max_jump))
+            return false;
+    }
+
+    if(mFitWindows.empty()) {
+        window.shift = {0, 0};
+        return true;
+    }
+
+    auto &reference = mWindows[mReferenceWindow];
+    for(int line = 0; line < 2; ++line)
+        window.shift[line] = best_lag(reference.along[line], window.along[line]) * PIXEL_SIZE;
+
+    return true;
+
+}
+
+LineTracker::Drift LineTracker::at(double toa) const {
+
+    if(mFitWindows.empty()) {
+        auto line_1 = mReference.linePos(1), line_2 = mReference.linePos(2);
+        return {{std::min(line_1, line_2), std::max(line_1, line_2)}, {0, 0}};
+    }
+
+    auto next = std::upper_bound(mFitWindows.begin(), mFitWindows.end(), toa, [this](double t, std::size_t ix) {
+        return t < mWindows[ix].time;
+    });
+
+    if(next == mFitWindows.begin()) {
+        auto &first = mWindows[mFitWindows.front()];
+        return {first.position, first.shift};
+    }
+    if(next == mFitWindows.end()) {
+        auto &last = mWindows[mFitWindows.back()];
+        return {last.position, last.shift};
+    }
+
+    auto &before = mWindows[*(next - 1)];
+    auto &after = mWindows[*next];
+    auto f = (toa - before.time) / (after.time - before.time);
+
+    Drift drift {};
+    for(int line = 0; line < 2; ++line) {
+        drift.position[line] = before.position[line] + f * (after.position[line] - before.position[line]);
+        drift.shift[line] = before.shift[line] + f * (after.shift[line] - before.shift[line]);
+    }
+
+    return drift;
+
+}
+
+int LineTracker::closestLine(double x, double y, double toa) const {
+
+    auto drift = at(toa);
+    auto mid = (drift.position[0] + drift.position[1]) / 2.0;
+
+    return (mAlongX ? y : x) <= mid ? 1 : 2;
+
+}
+
+double LineTracker::alongLine(double x, double y, int channel, double toa) const {
+
+    return (mAlongX ? x : y) - at(toa).shift[channel - 1];
+
+}
+
+void LineTracker::assign(std::size_t count, const double *x, const double *y, const double *toa, int *channel, double *along) const {
+
+    auto *across_in = mAlongX ? y : x;
+    auto *along_in = mAlongX ? x : y;
+
+    if(!mFitWindows.empty()) {
+        for(std::size_t ix = 0; ix < count; ++ix) {
+            auto drift = at(toa[ix]);
+            channel[ix] = across_in[ix] <= (drift.position[0] + drift.position[1]) / 2.0 ? 1 : 2;
+            along[ix] = along_in[ix] - drift.shift[channel[ix] - 1];
+        }
+        return;
+    }
+
+    // the lines stay where they were fit
+    auto drift = at(0);
+    auto mid = (drift.position[0] + drift.position[1]) / 2.0;
+    for(std::size_t ix = 0; ix < count; ++ix) {
+        channel[ix] = 1 + static_cast<int>(across_in[ix] > mid);
+        along[ix] = along_in[ix];
+    }
+
+}
@@ -1,12 +1,15 @@
 #include "tpx3/tpx3.h"
 
-#include <iostream>
 #include <fstream>
 #include <cassert>
 #include <algorithm>
 #include <vector>
 #include <set>
 #include <cmath>
+#include <limits>
+#include <numeric>
+#include <iterator>
+#include <filesystem>
 
 #include <tim/timsort.h>
 
@@ -18,29 +21,48 @@ using OctreePoint = pcl::PointXYZ;
 
 using namespace spec_hom;
 
-void sort_timestamps(PixelData &data) {
+constexpr unsigned SIZE_OF_PACKET = 8; // in bytes
+constexpr int64_t TOA_PERIOD = int64_t(1) << 34; // [ticks] the decoded ToA wraps around with the 16-bit SPIDR time
+
+// A chunk of packets in a raw file, all from the same chip
+struct Tpx3Chunk {
+    std::streamoff offset; // position of the first packet in the file
+    unsigned num_packets;
+    int chip;
+};
+
+void spec_hom::sort_timestamps(PixelData &data, TaskPool &pool) {
 
     auto num_packets = data.addr.size();
 
+    // data from a single chip is often already in order
+    if(std::is_sorted(data.toa.begin(), data.toa.end()))
+        return;
+
     std::vector<std::size_t> indices(num_packets);
     std::iota(indices.begin(), indices.end(), 0); // fill with index values
 
     auto &timestamps = data.toa;
+    auto by_timestamp = [&timestamps] (std::size_t i1, std::size_t i2) { return timestamps[i1] < timestamps[i2]; };
 
-    // sort indices based on timestamp values
-    tim::timsort(indices.begin(), indices.end(), [&timestamps] (std::size_t i1, std::size_t i2) { return timestamps[i1] < timestamps[i2]; });
+    // sort indices based on timestamp values; timsort is stable, and is very fast on the long sorted runs in each chip's data
+    pool.parallelSort(indices.begin(), indices.end(), by_timestamp, [&by_timestamp](auto begin, auto end) {
+        tim::timsort(begin, end, by_timestamp);
+    });
 
     // now indices is sorted properly, and we need to create sorted address and toa arrays
     std::vector<PixelAddr> sorted_addr(num_packets);
     std::vector<int64_t> sorted_toa(num_packets);
     std::vector<uint16_t> sorted_tot(num_packets);
 
-    for(std::size_t i = 0; i < num_packets; ++i) {
-        auto ix = indices[i];
-        sorted_addr[i] = data.addr[ix];
-        sorted_toa[i] = data.toa[ix];
-        sorted_tot[i] = data.tot[ix];
-    }
+    pool.parallelFor(num_packets, 1 << 18, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; ++i) {
+            auto ix = indices[i];
+            sorted_addr[i] = data.addr[ix];
+            sorted_toa[i] = data.toa[ix];
+            sorted_tot[i] = data.tot[ix];
+        }
+    });
 
     data.addr.swap(sorted_addr);
     data.toa.swap(sorted_toa);
@@ -48,182 +70,497 @@ void sort_timestamps(PixelData &data) {
 
 }
 
-LoadRawFileThread::LoadRawFileThread(const std::string &fname, Tpx3ImportSettings settings, bool raw_packets_only) :
-    BgThread(),
-    mFileName(fname),
-    mImportSettings(settings),
-    mRawPacketsOnly(raw_packets_only) {
-
-    // Do nothing
-
-}
+bool spec_hom::decode_packets(const uint8_t *packets, unsigned num_packets, int chip, const Tpx3ImportSettings &settings,
+                              const PixelMask &mask, PixelData &out, std::string &error, bool &error_is_warning) {
+
+    auto &geometry = settings.geometry;
+    auto &placement = geometry.chips[chip];
+
+    for (unsigned packet_ix = 0; packet_ix < num_packets; ++packet_ix) {
+
+        const uint8_t *packet = packets + packet_ix * SIZE_OF_PACKET;
+
+        uint8_t packet_header = (((packet[7]) & 0xF0) >> 4);
+        switch (packet_header) {
+            case 0xb: {
+                // pixel data should always be little endian
+                uint64_t full_data = (packet[0])
+                                     | (static_cast<uint64_t>(packet[1]) << 8)
+                                     | (static_cast<uint64_t>(packet[2]) << 16)
+                                     | (static_cast<uint64_t>(packet[3]) << 24)
+                                     | (static_cast<uint64_t>(packet[4]) << 32)
+                                     | (static_cast<uint64_t>(packet[5]) << 40)
+                                     | (static_cast<uint64_t>(packet[6]) << 48)
+                                     | (static_cast<uint64_t>(packet[7]) << 56);
+
+                // pixel address in super-pixel coordinates
+                uint16_t addr            = static_cast<uint16_t>((full_data & 0x0FFFF00000000000) >> 44);
+                // fine time of arrival (640 MHz clock)
+                uint8_t chip_fine_toa    = static_cast<uint8_t> ((full_data & 0x00000000000F0000) >> 16);
+                // coarse time of arrival (40 MHz clock)
+                uint16_t chip_coarse_toa = static_cast<uint16_t>((full_data & 0x00000FFFC0000000) >> 30);
+                // SPIDR time (40 MHz clock, units of 2^14 ticks)
+                uint16_t spidr_toa       = static_cast<uint16_t> (full_data & 0x000000000000FFFF);
+                // time over threshold (40 MHz clock)
+                uint16_t tot             = static_cast<uint16_t>((full_data & 0x000000003FF00000) >> 20);
+
+                // combine coarse & SPIDR times
+                uint32_t combined_coarse = (static_cast<uint32_t>(spidr_toa) << 14) | chip_coarse_toa;
+
+                unsigned chip_x = ((addr >> 1) & 0x00FC) | (addr & 0x0003);
+                unsigned chip_y = ((addr >> 8) & 0xFE) | ((addr >> 2) & 0x0001);
+
+                chip_y = TPX3_SENSOR_SIZE - 1 - chip_y; // flip y direction
+
+                // convert chip address to global XY coordinates
+                PixelAddr addr_2d = geometry.toGlobal(chip, chip_x, chip_y);
+
+                // spatial mask, disabled pixels and ToT thresholds, all in one lookup
+                if(!mask.accepts(addr_2d, tot))
+                    continue;
+
+                chip_fine_toa = chip_fine_toa ^ 0x0F; // fine toa counts backwards
+
+                out.addr.push_back(addr_2d);
+                // combined ToA
+                int64_t toa = static_cast<int64_t>((static_cast<uint64_t>(combined_coarse) << 4) | chip_fine_toa);
+                toa += placement.clock_offset;
+
+                if(tot < settings.totCorrection.size())
+                    toa += static_cast<int>(std::round(settings.totCorrection[tot]/MIN_TICK));
+
+                out.toa.push_back(
+                    toa
+                );
+
+                out.tot.push_back(
+                        tot // time over threshold
+                );
+
+            } break;
+            case 0x6:
+                error = "Chunk header 0x6 (TDC counter) is not implemented";
+                error_is_warning = true;
+                return false;
+            case 0x4:
+                error = "Chunk header 0x4 (software timestamp) is not implemented";
+                error_is_warning = true;
+                return false;
+            case 0x7:
+                // control, ignore
+                break;
+            default:
+                error = "Unknown packet header: " + std::to_string(packet_header);
+                error_is_warning = true;
+                return false;
 
-PixelData LoadRawFileThread::parseRawData() {
+        }
 
-    std::vector<PixelAddr> addr_vec;
-    std::vector<int64_t> toa_vec;
-    std::vector<uint16_t> tot_vec;
+    }
 
-    auto mask = mImportSettings.spatialMask;
+    return true;
 
-    std::ifstream data_stream(mFileName, std::ios::binary);
+}
 
-    constexpr unsigned SIZE_OF_PACKET = 8; // in bytes
+// Reads the headers of the chunks that start in [begin, end) of a raw file, where begin is the start of a chunk, noting
+// which chip each chunk came from; on failure, error is set and an empty list is returned
+std::vector<Tpx3Chunk> read_chunks(std::ifstream &data_stream, std::streamoff begin, std::streamoff end,
+                                   const DetectorGeometry &geometry, std::string &error) {
 
     // get file size
     data_stream.seekg(0, std::ios::end);
-    unsigned file_size = data_stream.tellg();
+    std::streamoff file_size = data_stream.tellg();
     data_stream.seekg(0, std::ios::beg);
 
-    // prepare enough memory to read the max number of packets possible
-    addr_vec.reserve((file_size + SIZE_OF_PACKET - 1) / SIZE_OF_PACKET);
-    toa_vec.reserve((file_size + SIZE_OF_PACKET - 1) / SIZE_OF_PACKET);
-    tot_vec.reserve((file_size + SIZE_OF_PACKET - 1) / SIZE_OF_PACKET);
+    end = std::min(end, file_size);
+
+    std::vector<Tpx3Chunk> chunks;
 
-    while(data_stream) {
+    std::streamoff chunk_pos = begin;
+    while(chunk_pos < end) {
 
         // at the start of a chunk
         uint8_t chunk_header[8]; // headers are 8 bytes
 
-        // check that we have data remaining
-        data_stream.read(reinterpret_cast<char *>(chunk_header), 1);
+        data_stream.seekg(chunk_pos);
+        data_stream.read(reinterpret_cast<char *>(chunk_header), sizeof(chunk_header));
         if (!data_stream) {
-            // out of data - continue with processing
-            break;
-        }
-
-        data_stream.read(reinterpret_cast<char *>(chunk_header + 1), sizeof(chunk_header) - 1);
-        if (!data_stream) {
-            emit err("Failed to load file: incomplete chunk header");
+            error = "Failed to load file: incomplete chunk header";
             return {};
         }
         if (!(chunk_header[0] == 'T'
               && chunk_header[1] == 'P'
               && chunk_header[2] == 'X'
               && chunk_header[3] == '3')) {
-            emit err("Failed to load file: corrupt chunk header");
+            error = "Failed to load file: corrupt chunk header";
             return {};
         }
 
-        // chunk_header[4]: chip index
-        assert(chunk_header[4] == 0); // reading from multiple chips is not currently supported
+        int chip = chunk_header[4];
+        if(chip >= geometry.numChips()) {
+            error = "Failed to load file: data from chip " + std::to_string(chip) + ", but the detector geometry only has "
+                    + std::to_string(geometry.numChips()) + " chip(s)";
+            return {};
+        }
         // chunk_header[5]: unused
 
         uint16_t chunk_size = (static_cast<uint16_t>(chunk_header[7]) << 8) + chunk_header[6];
         if (chunk_size % 8) {
-            emit err("Failed to load file: corrupt chunk header");
+            error = "Failed to load file: corrupt chunk header";
             return {};
         }
-        chunk_size /= 8;
-
-        for (unsigned chunk_ix = 0; chunk_ix < chunk_size; ++chunk_ix) {
-
-            // read a packet
-            uint8_t packet[SIZE_OF_PACKET];
-            data_stream.read(reinterpret_cast<char *>(packet), sizeof(packet));
-
-            uint8_t packet_header = (((packet[7]) & 0xF0) >> 4);
-            switch (packet_header) {
-                case 0xb: {
-                    // pixel data should always be little endian
-                    uint64_t full_data = (packet[0])
-                                         | (static_cast<uint64_t>(packet[1]) << 8)
-                                         | (static_cast<uint64_t>(packet[2]) << 16)
-                                         | (static_cast<uint64_t>(packet[3]) << 24)
-                                         | (static_cast<uint64_t>(packet[4]) << 32)
-                                         | (static_cast<uint64_t>(packet[5]) << 40)
-                                         | (static_cast<uint64_t>(packet[6]) << 48)
-                                         | (static_cast<uint64_t>(packet[7]) << 56);
-
-                    // pixel address in super-pixel coordinates
-                    uint16_t addr            = static_cast<uint16_t>((full_data & 0x0FFFF00000000000) >> 44);
-                    // fine time of arrival (640 MHz clock)
-                    uint8_t chip_fine_toa    = static_cast<uint8_t> ((full_data & 0x00000000000F0000) >> 16);
-                    // coarse time of arrival (40 MHz clock)
-                    uint16_t chip_coarse_toa = static_cast<uint16_t>((full_data & 0x00000FFFC0000000) >> 30);
-                    // SPIDR time (40 MHz clock, units of 2^14 ticks)
-                    uint16_t spidr_toa       = static_cast<uint16_t> (full_data & 0x000000000000FFFF);
-                    // time over threshold (40 MHz clock)
-                    uint16_t tot             = static_cast<uint16_t>((full_data & 0x000000003FF00000) >> 20);
-
-                    // combine coarse & SPIDR times
-                    uint32_t combined_coarse = (static_cast<uint32_t>(spidr_toa) << 14) | chip_coarse_toa;
-
-                    PixelAddr addr_2d {
-                            static_cast<uint8_t>(((addr >> 1) & 0x00FC) | (addr & 0x0003)),
-                            static_cast<uint8_t>(((addr >> 8) & 0xFE) | ((addr >> 2) & 0x0001))
-                    };
 
-                    addr_2d.y = TPX3_SENSOR_SIZE - 1 - addr_2d.y; // flip y direction
+        auto data_pos = chunk_pos + static_cast<std::streamoff>(sizeof(chunk_header));
+        chunk_pos = data_pos + chunk_size;
 
-                    uint8_t mask_ix;
-                    if(mask.vertical)
-                        mask_ix = addr_2d.x;
-                    else
-                        mask_ix = addr_2d.y;
+        // a truncated final chunk only contributes its complete packets
+        unsigned num_packets = chunk_size / SIZE_OF_PACKET;
+        if(chunk_pos > file_size)
+            num_packets = static_cast<unsigned>((file_size - data_pos) / SIZE_OF_PACKET);
 
-                    if(!((mask_ix < mask.max1 && mask_ix > mask.min1) || (mask_ix < mask.max2 && mask_ix > mask.min2))) {
-                        continue;
-                    }
+        if(num_packets)
+            chunks.push_back({data_pos, num_packets, chip});
+
+    }
 
-                    chip_fine_toa = chip_fine_toa ^ 0x0F; // fine toa counts backwards
-
-                    // convert address to XY coordinates
-                    addr_vec.push_back(addr_2d);
-                    // combined ToA
-                    int64_t toa = static_cast<int64_t>((static_cast<uint64_t>(combined_coarse) << 4) | chip_fine_toa);
-
-                    if(tot < mImportSettings.totCorrection.size())
-                        toa += static_cast<int>(std::round(mImportSettings.totCorrection[tot]/MIN_TICK));
-
-                    toa_vec.push_back(
-                        toa
-                    );
-
-                    tot_vec.push_back(
-                            tot // time over threshold
-                    );
-
-                } break;
-                case 0x6:
-                    emit warn("Chunk header 0x6 (TDC counter) is not implemented");
-                    return {};
-                case 0x4:
-                    emit warn("Chunk header 0x4 (software timestamp) is not implemented");
-                    return {};
-                case 0x7:
-                    // control, ignore
-                    break;
-                default:
-                    emit warn("Unknown packet header: " + std::to_string(packet_header));
-                    return {};
+    return chunks;
 
-            }
+}
+
+// Decodes chunks [first, last); on failure, error is set and an empty PixelData is returned
+PixelData decode_chunks(const std::string &fname, const Tpx3ImportSettings &settings, const PixelMask &mask,
+                        const std::vector<Tpx3Chunk> &chunks, std::size_t first, std::size_t last, const BgThread *job,
+                        std::string &error, bool &error_is_warning) {
+
+    std::ifstream data_stream(fname, std::ios::binary);
+
+    std::size_t max_packets = 0;
+    for(auto ix = first; ix < last; ++ix)
+        max_packets += chunks[ix].num_packets;
 
+    PixelData data;
+
+    // prepare enough memory to read the max number of packets possible
+    data.addr.reserve(max_packets);
+    data.toa.reserve(max_packets);
+    data.tot.reserve(max_packets);
+
+    std::vector<uint8_t> chunk_data;
+
+    for(auto chunk_ix = first; chunk_ix < last; ++chunk_ix) {
+
+        auto &chunk = chunks[chunk_ix];
+
+        // read the whole chunk at once
+        chunk_data.resize(chunk.num_packets * SIZE_OF_PACKET);
+        data_stream.seekg(chunk.offset);
+        data_stream.read(reinterpret_cast<char *>(chunk_data.data()), static_cast<std::streamsize>(chunk_data.size()));
+        if(!data_stream) {
+            error = "Failed to load file: could not read chunk data";
+            return {};
         }
 
-        emit setProgress(static_cast<int>(static_cast<float>(data_stream.tellg()) / file_size * 100));
+        if(!decode_packets(chunk_data.data(), chunk.num_packets, chunk.chip, settings, mask, data, error, error_is_warning))
+            return {};
 
-        if(shouldCancel()) {
+        if(job && job->shouldCancel()) {
             return {};
         }
 
     }
 
-    // free unused memory
-    addr_vec.shrink_to_fit();
-    toa_vec.shrink_to_fit();
-    tot_vec.shrink_to_fit();
+    return data;
 
-    return PixelData {
-            std::move(addr_vec),
-            std::move(toa_vec),
-            std::move(tot_vec)
+}
+
+// The first chunk header at or after from, or -1 if there is none. A header is only taken as one if the next chunk
+// starts with a header too (or the file ends), since its 'TPX3' could also appear in the packet data.
+std::streamoff find_chunk(std::ifstream &data_stream, std::streamoff from, std::streamoff file_size, int num_chips) {
+
+    constexpr std::streamoff SEARCH_BYTES = 1 << 20; // a chunk holds at most 64 kB, so a header is found well within this
+
+    auto is_header = [&data_stream, file_size, num_chips](std::streamoff pos, uint16_t *size) {
+        uint8_t header[8];
+        if(pos + static_cast<std::streamoff>(sizeof(header)) > file_size)
+            return false;
+
+        data_stream.clear();
+        data_stream.seekg(pos);
+        data_stream.read(reinterpret_cast<char *>(header), sizeof(header));
+        if(!data_stream || header[0] != 'T' || header[1] != 'P' || header[2] != 'X' || header[3] != '3' || header[4] >= num_chips)
+            return false;
+
+        *size = (static_cast<uint16_t>(header[7]) << 8) + header[6];
+        return *size % SIZE_OF_PACKET == 0;
     };
 
+    std::vector<char> buffer(static_cast<std::size_t>(std::min(SEARCH_BYTES, std::max<std::streamoff>(file_size - from, 0))));
+    data_stream.clear();
+    data_stream.seekg(from);
+    data_stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    auto num_read = static_cast<std::size_t>(data_stream.gcount());
+
+    for(std::size_t ix = 0; ix + 4 <= num_read; ++ix) {
+        if(buffer[ix] != 'T' || buffer[ix + 1] != 'P' || buffer[ix + 2] != 'X' || buffer[ix + 3] != '3')
+            continue;
+
+        auto pos = from + static_cast<std::streamoff>(ix);
+        uint16_t size = 0, next_size = 0;
+        if(!is_header(pos, &size))
+            continue;
+
+        auto next = pos + 8 + size;
+        if(next >= file_size || is_header(next, &next_size))
+            return pos;
+    }
+
+    return -1;
+
 }
 
-ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
+ImageXY<unsigned> spec_hom::prescan_counts(const std::string &fname, const Tpx3ImportSettings &settings, std::size_t max_bytes) {
+
+    constexpr std::streamoff NUM_SAMPLES = 64; // stretches of the file that are read, spread evenly over it
+
+    auto &geometry = settings.geometry;
+
+    std::ifstream data_stream(fname, std::ios::binary);
+    if(!data_stream)
+        throw std::runtime_error("Failed to open " + fname);
+
+    data_stream.seekg(0, std::ios::end);
+    std::streamoff file_size = data_stream.tellg();
+
+    // a small file is read in full, and a large one in evenly spaced stretches that add up to max_bytes
+    auto budget = static_cast<std::streamoff>(std::min<std::size_t>(max_bytes, std::numeric_limits<std::streamoff>::max()));
+    auto num_samples = file_size > budget ? NUM_SAMPLES : 1;
+    auto sample_bytes = file_size > budget ? budget / NUM_SAMPLES : file_size;
+
+    // the pixel mask applies (so hot pixels do not stand out), but not the spatial mask
+    auto mask = PixelMask::forDecoding(settings.pixelMask, {false, -1, geometry.height, -1, geometry.height},
+                                       geometry.width, geometry.height);
+
+    ImageXY<unsigned> counts(geometry.width, std::vector<unsigned>(geometry.height, 0));
+    std::streamoff covered = 0; // the stretches never overlap
+
+    for(std::streamoff sample = 0; sample < num_samples; ++sample) {
+        auto begin = std::max(file_size / num_samples * sample, covered);
+        if(begin >= file_size)
+            break;
+        if(begin > 0 && (begin = find_chunk(data_stream, begin, file_size, geometry.numChips())) < 0)
+            continue;
+
+        std::string error;
+        bool error_is_warning = false;
+        auto chunks = read_chunks(data_stream, begin, begin + sample_bytes, geometry, error);
+        if(!error.empty())
+            throw std::runtime_error(error);
+        if(chunks.empty())
+            continue;
+        covered = chunks.back().offset + static_cast<std::streamoff>(chunks.back().num_packets * SIZE_OF_PACKET);
+
+        // each stretch goes straight into the counts, so that only one stretch of packets is held at a time
+        auto data = decode_chunks(fname, settings, mask, chunks, 0, chunks.size(), nullptr, error, error_is_warning);
+        if(!error.empty())
+            throw std::runtime_error(error);
+
+        for(auto &addr : data.addr)
+            ++counts[addr.x][addr.y];
+    }
+
+    return counts;
+
+}
+
+LoadRawFileThread::LoadRawFileThread(const std::string &fname, Tpx3ImportSettings settings, bool raw_packets_only) :
+    BgThread(),
+    mFileName(fname),
+    mImportSettings(settings),
+    mRawPacketsOnly(raw_packets_only),
+    mStats() {
+
+    // Do nothing
+
+}
+
+std::size_t LoadRawFileThread::estimatePeakMemory(std::size_t file_size) {
+
+    // Per 8-byte packet: 14 bytes of decoded data, plus either 22 bytes of indices and sorted copies while sorting,
+    // or 4 bytes of cluster ids and up to ~48 bytes of point cloud and octree while clustering
+    constexpr std::size_t PEAK_BYTES_PER_PACKET = 14 + 4 + 48;
+
+    return file_size / SIZE_OF_PACKET * PEAK_BYTES_PER_PACKET;
+
+}
+
+std::vector<ClusterCentroid> LoadRawFileThread::loadCentroids(const std::string &fname, const Tpx3ImportSettings &settings,
+                                                              BgThread *job) {
+
+    if(!std::ifstream(fname, std::ios::binary))
+        throw std::runtime_error("Could not open " + fname);
+
+    LoadRawFileThread loader(fname, settings);
+    // parseRawData() returns no packets after a warning (e.g. an unknown packet header) as well as after an error
+    std::string error;
+    QObject::connect(&loader, &BgThread::err, [&error](const std::string &str) { error = str; });
+    QObject::connect(&loader, &BgThread::warn, [&error](const std::string &str) { error = str; });
+
+    if(job) {
+        loader.shareProgress(*job);
+        QObject::connect(&loader, &BgThread::setProgressText, job, &BgThread::setProgressText);
+        QObject::connect(&loader, &BgThread::setProgressIndefinite, job, &BgThread::setProgressIndefinite);
+    }
+
+    auto data = loader.parseRawData();
+    if(!error.empty())
+        throw std::runtime_error(error);
+    if(data.isEmpty() || loader.shouldCancel())
+        return {};
+
+    sort_timestamps(data, TaskPool::global());
+    auto clusters = loader.cluster(data);
+    if(loader.shouldCancel())
+        return {};
+
+    auto centroids = loader.centroid(data, clusters);
+    if(loader.shouldCancel())
+        return {};
+
+    return centroids;
+
+}
+
+PixelData LoadRawFileThread::loadPackets(const std::string &fname, const Tpx3ImportSettings &settings) {
+
+    if(!std::ifstream(fname, std::ios::binary))
+        throw std::runtime_error("Could not open " + fname);
+
+    LoadRawFileThread loader(fname, settings, true);
+    // parseRawData() returns no packets after a warning (e.g. an unknown packet header) as well as after an error
+    std::string error;
+    QObject::connect(&loader, &BgThread::err, [&error](const std::string &str) { error = str; });
+    QObject::connect(&loader, &BgThread::warn, [&error](const std::string &str) { error = str; });
+
+    auto data = loader.parseRawData();
+    if(!error.empty())
+        throw std::runtime_error(error);
+
+    sort_timestamps(data, TaskPool::global());
+
+    return data;
+
+}
+
+PixelData LoadRawFileThread::parseRawData() {
+
+    auto &geometry = mImportSettings.geometry;
+    auto &pool = TaskPool::global();
+
+    std::ifstream data_stream(mFileName, std::ios::binary);
+
+    // First pass: only read the chunk headers, and note which chip each chunk came from
+    std::string header_error;
+    auto chunks = read_chunks(data_stream, 0, std::numeric_limits<std::streamoff>::max(), geometry, header_error);
+    if(!header_error.empty()) {
+        emit err(header_error);
+        return {};
+    }
+
+    std::size_t total_packets = 0;
+    for(auto &chunk : chunks)
+        total_packets += chunk.num_packets;
+
+    // the spatial mask, disabled pixels and ToT thresholds, as one table
+    auto mask = PixelMask::forDecoding(mImportSettings.pixelMask, mImportSettings.spatialMask, geometry.width, geometry.height);
+
+    // Second pass: decode batches of consecutive chunks (from any chip) as tasks on the shared pool
+    constexpr std::size_t PACKETS_PER_BATCH = 1 << 18;
+
+    std::vector<std::size_t> batch_bounds {0};
+    std::size_t batch_packets = 0;
+    for(std::size_t ix = 0; ix < chunks.size(); ++ix) {
+        batch_packets += chunks[ix].num_packets;
+        if(batch_packets >= PACKETS_PER_BATCH || ix + 1 == chunks.size()) {
+            batch_bounds.push_back(ix + 1);
+            batch_packets = 0;
+        }
+    }
+    auto num_batches = batch_bounds.size() - 1;
+
+    std::vector<PixelData> batch_data(num_batches);
+    std::vector<std::string> batch_errors(num_batches);
+    std::vector<char> batch_error_is_warning(num_batches, false);
+    std::atomic<std::size_t> packets_decoded = 0;
+
+    pool.parallelFor(num_batches, 1, [&](std::size_t first, std::size_t last) {
+        for(auto batch = first; batch < last; ++batch) {
+            bool is_warning = false;
+            batch_data[batch] = decode_chunks(mFileName, mImportSettings, mask, chunks, batch_bounds[batch], batch_bounds[batch + 1],
+                                              this, batch_errors[batch], is_warning);
+            batch_error_is_warning[batch] = is_warning;
+
+            std::size_t batch_size = 0;
+            for(auto ix = batch_bounds[batch]; ix < batch_bounds[batch + 1]; ++ix)
+                batch_size += chunks[ix].num_packets;
+            auto done = packets_decoded.fetch_add(batch_size, std::memory_order_relaxed) + batch_size;
+            reportProgress(static_cast<int>(static_cast<double>(done) / total_packets * 100));
+        }
+    });
+
+    for(std::size_t batch = 0; batch < num_batches; ++batch) {
+        if(batch_errors[batch].empty())
+            continue;
+
+        if(batch_error_is_warning[batch])
+            emit warn(batch_errors[batch]);
+        else
+            emit err(batch_errors[batch]);
+        return {};
+    }
+
+    if(shouldCancel()) {
+        return {};
+    }
+
+    // concatenate the batches in file order; chips are put in time order later by sort_timestamps()
+    std::vector<std::size_t> batch_offsets(num_batches + 1, 0);
+    for(std::size_t batch = 0; batch < num_batches; ++batch)
+        batch_offsets[batch + 1] = batch_offsets[batch] + batch_data[batch].numPackets();
+
+    PixelData merged {
+        std::vector<PixelAddr>(batch_offsets.back()),
+        std::vector<int64_t>(batch_offsets.back()),
+        std::vector<uint16_t>(batch_offsets.back())
+    };
+
+    pool.parallelFor(num_batches, 1, [&](std::size_t first, std::size_t last) {
+        for(auto batch = first; batch < last; ++batch) {
+            auto &data = batch_data[batch];
+            auto offset = static_cast<std::ptrdiff_t>(batch_offsets[batch]);
+            std::copy(data.addr.begin(), data.addr.end(), merged.addr.begin() + offset);
+            std::copy(data.toa.begin(), data.toa.end(), merged.toa.begin() + offset);
+            std::copy(data.tot.begin(), data.tot.end(), merged.tot.begin() + offset);
+            data = {}; // free each batch as soon as it has been copied
+        }
+    });
+
+    // the decoded ToA wraps around every ~27 s; in file order, take the copy of each timestamp closest to the newest
+    // time seen so far (as StreamProcessor does), so that longer files stay in time order
+    if(!merged.toa.empty()) {
+        auto newest_toa = merged.toa.front();
+        for(auto &toa : merged.toa) {
+            auto periods = std::llround(static_cast<double>(newest_toa - toa) / static_cast<double>(TOA_PERIOD));
+            toa += static_cast<int64_t>(periods) * TOA_PERIOD;
+            newest_toa = std::max(newest_toa, toa);
+        }
+    }
+
+    return merged;
+
+}
+
+int LoadRawFileThread::clusterSlab(const PixelData &raw_data, std::size_t begin, std::size_t end, std::vector<int> &packet_clusters,
+                                   std::atomic<std::size_t> &clustered_packets) {
 
     const float SPACE_WINDOW = mImportSettings.clusterSizeXY * 2;
     const float TIME_WINDOW = mImportSettings.clusterSizeT / 1.5625f * 2;
@@ -232,17 +569,19 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
     auto time_half_window = TIME_WINDOW / 2.0f;
     auto space_half_window = SPACE_WINDOW / 2.0f;
 
-    emit setProgress(0);
-    emit setProgressText("Preparing to cluster... (%p%)");
-    emit setProgressIndefinite(false);
+    std::size_t num_raw_packets = end - begin;
+    std::size_t total_raw_packets = raw_data.numPackets();
 
-    std::size_t num_raw_packets = raw_data.numPackets();
-    std::size_t one_percent_packets = num_raw_packets / 100 + 1; // extra one is to avoid missing packets due to divide's truncation
+    // all indices below are relative to the start of the slab
+    auto *slab_clusters = packet_clusters.data() + begin;
 
-    auto toa_max = raw_data.toa.back(), toa_min = raw_data.toa.front();
-    auto toa_mid = (toa_max + toa_min) / 2.0f, toa_half_range = (toa_max - toa_min) / 2.0f;
+    auto toa_max = raw_data.toa[end - 1], toa_min = raw_data.toa[begin];
+    auto toa_mid = (static_cast<double>(toa_max) + static_cast<double>(toa_min)) / 2.0;
 
-    auto space_max = 128/space_half_window, space_min = -128/space_half_window;
+    // centre the sensor on the origin of the octree
+    auto &geometry = mImportSettings.geometry;
+    auto sensor_half_size = static_cast<float>(std::max(geometry.width, geometry.height)) / 2.0f;
+    auto space_max = sensor_half_size/space_half_window, space_min = -sensor_half_size/space_half_window;
     auto time_max = (toa_max - toa_mid) / time_half_window, time_min = (toa_min - toa_mid) / time_half_window;
 
     auto scaled_space_half_window = 1;
@@ -260,23 +599,17 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
     octree.setInputCloud(point_cloud);
     octree.defineBoundingBox(space_min, space_min, time_min, space_max, space_max, time_max);
 
-    for(int percent = 0; percent < 100; ++percent) {
-        for (std::size_t ix = percent*one_percent_packets; ix < ((percent+1)*one_percent_packets) && (ix < num_raw_packets); ++ix) {
-            octree.addPointToCloud({
-                    static_cast<float>(raw_data.addr[ix].x - 128) / space_half_window,
-                    static_cast<float>(raw_data.addr[ix].y - 128) / space_half_window,
-                    static_cast<float>(raw_data.toa[ix] - toa_mid) / time_half_window
-            }, point_cloud);
-        }
-        emit setProgress(percent);
-        if(shouldCancel())
-            return {};
+    for (std::size_t ix = begin; ix < end; ++ix) {
+        octree.addPointToCloud({
+                (static_cast<float>(raw_data.addr[ix].x) - sensor_half_size) / space_half_window,
+                (static_cast<float>(raw_data.addr[ix].y) - sensor_half_size) / space_half_window,
+                static_cast<float>((static_cast<double>(raw_data.toa[ix]) - toa_mid) / time_half_window)
+        }, point_cloud);
     }
 
-    emit setProgressText("Preparing clustering tree...");
-    emit setProgressIndefinite(true);
+    if(shouldCancel())
+        return 0;
 
-    std::vector<int> packet_clusters(num_raw_packets, -1); // stores the cluster number of each raw packet
     std::size_t earliest_remaining_packet = 0;
 
     std::set<std::size_t> cluster_indices, old_cluster_indices; // set to store the indices of our cluster (this way we don't have to worry about duplicate inclusions
@@ -284,12 +617,6 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
 
     std::vector<int> octree_search_indices;
 
-    emit setProgressText("Clustering... (%p%)");
-    emit setProgressIndefinite(false);
-    emit setProgress(0);
-
-    std::size_t clustered_packets = 0;
-
     unsigned iteration = 0;
     int current_cluster = 1;
 
@@ -299,7 +626,7 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
         // we can skip any packets that have already been clustered
         // since clusters are independent of starting cluster, if one cluster is not clustered, we can be guaranteed that
         // all packets in the cluster are not marked yet
-        if(packet_clusters[earliest_remaining_packet] < 0) {
+        if(slab_clusters[earliest_remaining_packet] < 0) {
             cluster_indices.clear();
             new_cluster_indices.clear();
 
@@ -317,7 +644,7 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
                 new_cluster_indices.swap(prev_cluster_indices);
 
                 for(auto jx : prev_cluster_indices) {
-                    if(packet_clusters[jx] >= 0)
+                    if(slab_clusters[jx] >= 0)
                         continue;
 
                     octree_search_indices.clear();
@@ -352,25 +679,25 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
                 found_new_indices = new_cluster_indices.size();
             }
 
-            if(shouldCancel())
-                return {};
-
-            clustered_packets += cluster_indices.size();
+            auto done = clustered_packets.fetch_add(cluster_indices.size(), std::memory_order_relaxed) + cluster_indices.size();
 
             ++iteration;
-            if((iteration % 1000 )== 0)
-                emit setProgress(static_cast<int>(100.0 * static_cast<float>(clustered_packets)/num_raw_packets));
+            if((iteration % 1000 )== 0) {
+                reportProgress(static_cast<int>(100.0 * static_cast<double>(done)/total_raw_packets));
+                if(shouldCancel())
+                    return 0;
+            }
 
             if(cluster_indices.size() < MIN_CLUSTER_SIZE) {
                 for(auto jx : cluster_indices)
-                    packet_clusters[jx] = 0;
+                    slab_clusters[jx] = 0;
                 continue;
             }
 
             bool nonempty = false;
             for(auto jx : cluster_indices) {
-                if(packet_clusters[jx] == -1) {
-                    packet_clusters[jx] = current_cluster;
+                if(slab_clusters[jx] == -1) {
+                    slab_clusters[jx] = current_cluster;
                     nonempty = true;
                 }
             }
@@ -384,12 +711,68 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
 
     }
 
-    emit setProgress(0);
+    return current_cluster - 1; // important correction
+
+}
+
+ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
+
+    // minimum number of packets clustered together in one task, so that building each octree is worthwhile
+    constexpr std::size_t MIN_PACKETS_PER_SLAB = 1 << 15;
+
+    const double time_half_window = mImportSettings.clusterSizeT / 1.5625; // [ticks]
+
+    auto &pool = TaskPool::global();
+
+    emit setProgressText("Clustering... (%p%)");
+    emit setProgressIndefinite(false);
+    reportProgress(0);
+
+    std::size_t num_raw_packets = raw_data.numPackets();
+
+    // Packets further apart in time than the half window can never be in the same cluster, so the time-sorted data is
+    // split at such gaps into slabs that are clustered independently (and in parallel)
+    std::vector<std::size_t> slab_bounds {0};
+    for(std::size_t ix = 1; ix < num_raw_packets; ++ix) {
+        if(raw_data.toa[ix] - raw_data.toa[ix - 1] > time_half_window && ix - slab_bounds.back() >= MIN_PACKETS_PER_SLAB)
+            slab_bounds.push_back(ix);
+    }
+    slab_bounds.push_back(num_raw_packets);
+    auto num_slabs = slab_bounds.size() - 1;
+
+    std::vector<int> packet_clusters(num_raw_packets, -1); // stores the cluster number of each raw packet
+    std::vector<int> slab_num_clusters(num_slabs, 0);
+    std::atomic<std::size_t> clustered_packets = 0;
+
+    pool.parallelFor(num_slabs, 1, [&](std::size_t first, std::size_t last) {
+        for(auto slab = first; slab < last; ++slab)
+            slab_num_clusters[slab] = clusterSlab(raw_data, slab_bounds[slab], slab_bounds[slab + 1], packet_clusters, clustered_packets);
+    });
+
+    if(shouldCancel())
+        return {};
+
+    // cluster ids are numbered from 1 within each slab; offsetting them numbers the clusters in order of their first
+    // packet, exactly as if the whole file had been clustered in one pass
+    std::vector<int> slab_offsets(num_slabs + 1, 0);
+    for(std::size_t slab = 0; slab < num_slabs; ++slab)
+        slab_offsets[slab + 1] = slab_offsets[slab] + slab_num_clusters[slab];
+
+    pool.parallelFor(num_slabs, 1, [&](std::size_t first, std::size_t last) {
+        for(auto slab = first; slab < last; ++slab) {
+            for(auto ix = slab_bounds[slab]; ix < slab_bounds[slab + 1]; ++ix) {
+                if(packet_clusters[ix] > 0)
+                    packet_clusters[ix] += slab_offsets[slab];
+            }
+        }
+    });
+
+    reportProgress(0);
     emit setProgressText("Done clustering...");
     emit setProgressIndefinite(true);
 
     return {
-        current_cluster - 1, // important correction
+        slab_offsets.back(),
         std::move(packet_clusters)
     };
 
@@ -397,52 +780,113 @@ ClusterData LoadRawFileThread::cluster(const PixelData &raw_data) {
 
 std::vector<ClusterCentroid> LoadRawFileThread::centroid(const PixelData &data, const ClusterData &clusters) {
 
-    // array to hold centroided xyt positions
-    std::vector<ClusterCentroid> events;
-    events.resize(clusters.num_clusters);
+    constexpr std::size_t PACKETS_PER_RANGE = 1 << 18;
 
-    std::vector<double> cluster_x_weighted_sums(clusters.num_clusters, 0);
-    std::vector<double> cluster_y_weighted_sums(clusters.num_clusters, 0);
-    std::vector<uint16_t> cluster_total_weights(clusters.num_clusters, 0);
-    std::vector<uint16_t> cluster_max_tot(clusters.num_clusters, 0);
-    std::vector<double> cluster_toa(clusters.num_clusters, 0);
+    auto &pool = TaskPool::global();
+
+    // Partial sums over one range of packets. Packets are time-sorted and clusters are compact in time, so each
+    // range only touches a narrow span of cluster ids, starting at first_id.
+    struct RangeSums {
+        int first_id = 0;
+        std::vector<double> x_weighted_sums, y_weighted_sums, total_weights, toa;
+        std::vector<uint16_t> max_tot;
+    };
 
     // briefly: The brightest pixel (largest ToT) is used to find the time. This is because lower-ToT pixels have a slower rise time, and so a later ToA.
     // The positions of all cluster pixels are centroided to find location, with the weighting function being the ToT (roughly, the energy) of each pixel
     emit setProgressText("Centroiding... (%p%)");
-    emit setProgress(0);
+    reportProgress(0);
     emit setProgressIndefinite(false);
 
-    // recall that clusters start at index 1 (index 0 = unclustered packets)
-    for(auto ix = 0; ix < data.numPackets(); ++ix) {
-        if(clusters.cluster_ids[ix] == 0)
-            continue;
+    std::size_t num_packets = data.numPackets();
+    auto num_ranges = (num_packets + PACKETS_PER_RANGE - 1) / PACKETS_PER_RANGE;
+    std::vector<RangeSums> range_sums(num_ranges);
+    std::atomic<std::size_t> packets_done = 0;
+
+    pool.parallelFor(num_ranges, 1, [&](std::size_t first, std::size_t last) {
+        for(auto range = first; range < last; ++range) {
+            auto begin = range * PACKETS_PER_RANGE;
+            auto end = std::min(begin + PACKETS_PER_RANGE, num_packets);
+
+            // recall that clusters start at index 1 (index 0 = unclustered packets)
+            int min_id = std::numeric_limits<int>::max(), max_id = 0;
+            for(auto ix = begin; ix < end; ++ix) {
+                auto id = clusters.cluster_ids[ix];
+                if(id > 0) {
+                    min_id = std::min(min_id, id);
+                    max_id = std::max(max_id, id);
+                }
+            }
+            if(!max_id)
+                continue;
+
+            auto &sums = range_sums[range];
+            auto span = static_cast<std::size_t>(max_id - min_id + 1);
+            sums.first_id = min_id;
+            sums.x_weighted_sums.assign(span, 0);
+            sums.y_weighted_sums.assign(span, 0);
+            sums.total_weights.assign(span, 0);
+            sums.toa.assign(span, 0);
+            sums.max_tot.assign(span, 0);
+
+            for(auto ix = begin; ix < end; ++ix) {
+                if(clusters.cluster_ids[ix] == 0)
+                    continue;
 
-        auto cluster_id = clusters.cluster_ids[ix] - 1;
-        auto x = static_cast<double>(data.addr[ix].x)*PIXEL_SIZE; // [m]
-        auto y = static_cast<double>(data.addr[ix].y)*PIXEL_SIZE; // [m]
-        auto toa = static_cast<double>(data.toa[ix])*1.5625e-9; // [ns]
-        auto tot = data.tot[ix];
+                auto local_id = clusters.cluster_ids[ix] - min_id;
+                auto x = static_cast<double>(data.addr[ix].x)*PIXEL_SIZE; // [m]
+                auto y = static_cast<double>(data.addr[ix].y)*PIXEL_SIZE; // [m]
+                auto toa = static_cast<double>(data.toa[ix])*1.5625e-9; // [ns]
+                auto tot = data.tot[ix];
 
-        auto weight = tot;
+                double weight = tot;
 
-        cluster_x_weighted_sums[cluster_id] += x*weight;
-        cluster_y_weighted_sums[cluster_id] += y*weight;
+                sums.x_weighted_sums[local_id] += x*weight;
+                sums.y_weighted_sums[local_id] += y*weight;
 
-        cluster_total_weights[cluster_id] += weight;
+                sums.total_weights[local_id] += weight;
 
-        if(tot > cluster_max_tot[cluster_id]) {
-            cluster_max_tot[cluster_id] = tot;
-            cluster_toa[cluster_id] = toa;
+                if(tot > sums.max_tot[local_id]) {
+                    sums.max_tot[local_id] = tot;
+                    sums.toa[local_id] = toa;
+                }
+            }
+
+            auto done = packets_done.fetch_add(end - begin, std::memory_order_relaxed) + (end - begin);
+            reportProgress(static_cast<int>(100*static_cast<double>(done)/num_packets));
         }
+    });
 
-        if((ix % (data.numPackets()/100)) == 0)
-            emit setProgress(static_cast<int>(100*static_cast<double>(ix)/data.numPackets()));
+    if(shouldCancel())
+        return {};
 
-        if(shouldCancel())
-            return {};
+    // Merge the ranges in packet order; a later range only replaces the time if its ToT is strictly larger, so the
+    // earliest brightest packet wins, as in a single pass
+    std::vector<double> cluster_x_weighted_sums(clusters.num_clusters, 0);
+    std::vector<double> cluster_y_weighted_sums(clusters.num_clusters, 0);
+    std::vector<double> cluster_total_weights(clusters.num_clusters, 0);
+    std::vector<uint16_t> cluster_max_tot(clusters.num_clusters, 0);
+    std::vector<double> cluster_toa(clusters.num_clusters, 0);
+
+    for(auto &sums : range_sums) {
+        for(std::size_t local_id = 0; local_id < sums.total_weights.size(); ++local_id) {
+            auto cluster_id = sums.first_id + static_cast<int>(local_id) - 1;
+
+            cluster_x_weighted_sums[cluster_id] += sums.x_weighted_sums[local_id];
+            cluster_y_weighted_sums[cluster_id] += sums.y_weighted_sums[local_id];
+            cluster_total_weights[cluster_id] += sums.total_weights[local_id];
+
+            if(sums.max_tot[local_id] > cluster_max_tot[cluster_id]) {
+                cluster_max_tot[cluster_id] = sums.max_tot[local_id];
+                cluster_toa[cluster_id] = sums.toa[local_id];
+            }
+        }
     }
 
+    // array to hold centroided xyt positions
+    std::vector<ClusterCentroid> events;
+    events.resize(clusters.num_clusters);
+
     for(auto ix = 0; ix < clusters.num_clusters; ++ix) {
         assert(cluster_total_weights[ix]);
         events[ix] = {
@@ -458,11 +902,16 @@ std::vector<ClusterCentroid> LoadRawFileThread::centroid(const PixelData &data,
 
 std::pair<std::vector<CoincidencePair>, std::vector<CoincidenceNFold>> LoadRawFileThread::findCoincidences(const ClusterData &clusters, const std::vector<ClusterCentroid> &centroids) {
 
+    // minimum number of centroids in each parallel block
+    constexpr std::size_t MIN_CLUSTERS_PER_BLOCK = 1 << 16;
+
     std::vector<CoincidencePair> coinc_pairs;
     std::vector<CoincidenceNFold> coinc_nfolds;
 
     double window_size = mImportSettings.coincidenceWindow;
 
+    auto &pool = TaskPool::global();
+
     // we first need a time-ordered list of all centroids
     std::vector<unsigned> sorted_indices;
     sorted_indices.reserve(clusters.num_clusters);
@@ -472,85 +921,122 @@ std::pair<std::vector<CoincidencePair>, std::vector<CoincidenceNFold>> LoadRawFi
     emit setProgressText("Sorting centroids...");
     emit setProgressIndefinite(true);
 
-    std::sort(sorted_indices.begin(), sorted_indices.end(), [&centroids](auto lhs, auto rhs){
+    auto by_toa = [&centroids](auto lhs, auto rhs){
         return centroids[lhs].toa < centroids[rhs].toa;
+    };
+    pool.parallelSort(sorted_indices.begin(), sorted_indices.end(), by_toa, [&by_toa](auto begin, auto end) {
+        std::sort(begin, end, by_toa);
     });
 
     emit setProgressText("Finding coincidences...");
-    emit setProgress(0);
+    reportProgress(0);
     emit setProgressIndefinite(false);
 
-    unsigned one_percent_clusters = clusters.num_clusters / 100 + 1;
-    int last_progress = 0;
-
-    std::vector<unsigned> curr_coinc;
-
-    for(auto ix = 0; ix < clusters.num_clusters; ++ix) {
-        auto progress = static_cast<int>(static_cast<double>(ix) / one_percent_clusters);
-        if(progress != last_progress) {
-            setProgress(progress);
-            last_progress = progress;
-        }
-        if(shouldCancel())
-            return {};
-
-        auto toa = centroids[sorted_indices[ix]].toa;
-
-        // difference between current toa and ix's toa
-        bool within_window = true;
-        unsigned offset = 1;
-        while(within_window) {
-            if(ix+offset >= clusters.num_clusters)
-                break;
+    // A coincidence never spans a gap longer than the window, so the sorted list is split at such gaps into blocks
+    // that are searched independently; concatenating the blocks' results in order gives the same result as one pass
+    std::size_t num_clusters = sorted_indices.size();
+    std::vector<std::size_t> block_bounds {0};
+    for(std::size_t ix = 1; ix < num_clusters; ++ix) {
+        auto gap = centroids[sorted_indices[ix]].toa - centroids[sorted_indices[ix - 1]].toa;
+        if(gap > window_size && ix - block_bounds.back() >= MIN_CLUSTERS_PER_BLOCK)
+            block_bounds.push_back(ix);
+    }
+    block_bounds.push_back(num_clusters);
+    auto num_blocks = block_bounds.size() - 1;
+
+    std::vector<std::vector<CoincidencePair>> block_pairs(num_blocks);
+    std::vector<std::vector<CoincidenceNFold>> block_nfolds(num_blocks);
+    std::atomic<std::size_t> clusters_done = 0;
+
+    pool.parallelFor(num_blocks, 1, [&](std::size_t first, std::size_t last) {
+        for(auto block = first; block < last; ++block) {
+            auto block_end = block_bounds[block + 1];
+            auto &pairs = block_pairs[block];
+            auto &nfolds = block_nfolds[block];
+
+            std::vector<unsigned> curr_coinc;
+
+            for(auto ix = block_bounds[block]; ix < block_end; ++ix) {
+                auto toa = centroids[sorted_indices[ix]].toa;
+
+                // difference between current toa and ix's toa
+                bool within_window = true;
+                unsigned offset = 1;
+                while(within_window) {
+                    if(ix+offset >= block_end)
+                        break;
+
+                    auto curr_toa = centroids[sorted_indices[ix + offset]].toa;
+                    auto dtoa = curr_toa - toa;
+
+                    if(dtoa <= window_size) {
+                        if(offset == 1) // only two coincidences so far
+                            curr_coinc.push_back(sorted_indices[ix]); // add the first index
+                        curr_coinc.push_back(sorted_indices[ix+offset]); // add the second (third, fourth...) index
+                        ++offset;
+                    } else {
+                        within_window = false;
+                    }
+                }
 
-            auto curr_toa = centroids[sorted_indices[ix + offset]].toa;
-            auto dtoa = curr_toa - toa;
+                if(offset == 1) {
+                    // no coincidence found within window
+                } else {
+                    if(curr_coinc.size() == 2) {
+                        pairs.push_back({
+                            curr_coinc[0],
+                            curr_coinc[1]
+                        });
+                    } else {
+                        nfolds.emplace_back(curr_coinc);
+                    }
+                    curr_coinc.clear();
 
-            if(dtoa <= window_size) {
-                if(offset == 1) // only two coincidences so far
-                    curr_coinc.push_back(sorted_indices[ix]); // add the first index
-                curr_coinc.push_back(sorted_indices[ix+offset]); // add the second (third, fourth...) index
-                ++offset;
-            } else {
-                within_window = false;
+                    ix += offset - 1; // skip any clusters already processed
+                }
             }
+
+            auto block_size = block_end - block_bounds[block];
+            auto done = clusters_done.fetch_add(block_size, std::memory_order_relaxed) + block_size;
+            reportProgress(static_cast<int>(100 * static_cast<double>(done) / num_clusters));
+            if(shouldCancel())
+                return;
         }
+    });
 
-        if(offset == 1) {
-            // no coincidence found within window
-        } else {
-            if(curr_coinc.size() == 2) {
-                coinc_pairs.push_back({
-                    curr_coinc[0],
-                    curr_coinc[1]
-                });
-            } else {
-                coinc_nfolds.emplace_back(curr_coinc);
-            }
-            curr_coinc.clear();
+    if(shouldCancel())
+        return {};
 
-            ix += offset - 1; // skip any clusters already processed
-        }
+    for(std::size_t block = 0; block < num_blocks; ++block) {
+        coinc_pairs.insert(coinc_pairs.end(), block_pairs[block].begin(), block_pairs[block].end());
+        coinc_nfolds.insert(coinc_nfolds.end(), std::make_move_iterator(block_nfolds[block].begin()), std::make_move_iterator(block_nfolds[block].end()));
     }
 
-    std::cout << "Found " << coinc_pairs.size() << " pairs" << std::endl;
-    std::cout << "Found " << coinc_nfolds.size() << " n-fold coincidences" << std::endl;
-
     return std::make_pair(std::move(coinc_pairs), std::move(coinc_nfolds));
 
 }
 
 void LoadRawFileThread::execute() {
 
-    emit setProgress(0);
+    reportProgress(0);
     emit setProgressText("Loading raw Tpx3 data... (%p%)");
     emit setProgressTextColor(QColor(0,0,0));
 
+    mStats = {};
+    mStats.filename = mFileName;
+    mStats.num_files = 1;
+    std::error_code size_error;
+    auto file_size = std::filesystem::file_size(mFileName, size_error);
+    mStats.file_size = size_error ? 0 : file_size;
+
+    StageTimer parse_timer(mStats, "parse");
     PixelData data = parseRawData();
     if(shouldCancel()) { // either an error, or thread was cancelled
         finish();
         return;
     }
+    mStats.num_packets = data.numPackets();
+    parse_timer.stop();
 
     if(mRawPacketsOnly) {
         finish(std::move(data), {}, {}, {}, {});
@@ -565,7 +1051,9 @@ void LoadRawFileThread::execute() {
 
     emit setProgressText("Sorting timestamp data...");
     emit setProgressIndefinite(true); // switch to an indefinite progress bar
-    sort_timestamps(data);
+    StageTimer sort_timer(mStats, "sort");
+    sort_timestamps(data, TaskPool::global());
+    sort_timer.stop();
 
     // emit a warning
     bool zero_tot_corr = true;
@@ -574,18 +1062,23 @@ void LoadRawFileThread::execute() {
     if(mImportSettings.minClusterSize < 3 && zero_tot_corr)
         emit warn("Low cluster size, and no ToA calibration set - may be missing some coincidences.");
 
+    StageTimer cluster_timer(mStats, "cluster");
     ClusterData clusters = cluster(data);
     if(shouldCancel()) {
         finish();
         return;
     }
+    cluster_timer.stop();
 
+    StageTimer centroid_timer(mStats, "centroid");
     std::vector<ClusterCentroid> centroids = centroid(data, clusters);
     if(shouldCancel()) {
         finish();
         return;
     }
+    centroid_timer.stop();
 
+    StageTimer coincidence_timer(mStats, "coincidence");
     std::vector<CoincidencePair> coinc_pairs;
     std::vector<CoincidenceNFold> coinc_nfolds;
     std::tie(coinc_pairs, coinc_nfolds) = findCoincidences(clusters, centroids);
@@ -593,6 +1086,9 @@ void LoadRawFileThread::execute() {
         finish();
         return;
     }
+    coincidence_timer.stop();
+
+    emit log("Found " + std::to_string(coinc_pairs.size()) + " pairs and " + std::to_string(coinc_nfolds.size()) + " n-fold coincidences in " + mFileName);
 
     finish(std::move(data), std::move(clusters), std::move(centroids), std::move(coinc_pairs), std::move(coinc_nfolds));
 
@@ -613,9 +1109,29 @@ void LoadRawFileThread::finish(PixelData &&data, ClusterData &&clusters, std::ve
     emit setProgressText("Post-processing...");
     emit setProgressIndefinite(true);
 
+    bool has_data = !data.isEmpty();
+
+    // the Tpx3Image constructor runs initializeSpectrum()
+    StageTimer spectrum_timer(mStats, "spectrum");
     std::unique_ptr<Tpx3Image> image = std::make_unique<Tpx3Image>(mFileName, std::move(data), std::move(clusters),
                                                                    std::move(centroids), std::move(coinc_pairs), std::move(coinc_nfolds),
-                                                                   mImportSettings.calibration);
+                                                                   mImportSettings.calibration, mImportSettings.geometry,
+                                                                   mImportSettings.coincidenceWindow, mImportSettings.rateBinWidth,
+                                                                   mImportSettings.lineTrackingWindow, mImportSettings.homSegmentWidth);
+
+    // once the spectrum is built, the views only need the histograms of the packets; they are read again if ever needed
+    if(has_data && !mRawPacketsOnly && !mImportSettings.keepPackets && !shouldCancel()) {
+        auto packet_bytes = image->packetMemsize();
+        image->releasePackets([fname = mFileName, settings = mImportSettings]() { return loadPackets(fname, settings); });
+        emit log("Released " + std::to_string(packet_bytes >> 20) + " MB of raw packets from " + image->filename());
+    }
+    spectrum_timer.stop();
+
+    // only report stats for complete imports
+    if(has_data && !mRawPacketsOnly && !shouldCancel()) {
+        emit log(mStats.summary());
+        image->setImportStats(std::move(mStats));
+    }
 
     emit yieldPixelData(image.release());
 
@@ -0,0 +1,177 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace spec_hom;
+
+constexpr unsigned MIN_HOT_COUNTS = 100; // fewer counts than this are too few to call a pixel hot
+constexpr double HOT_PIXEL_RATIO = 10; // a hot pixel has this many times the median count of its neighbours
+
+PixelMask::PixelMask() :
+    mWidth(0),
+    mHeight(0),
+    mMinToT() {
+
+    // Do nothing
+
+}
+
+PixelMask::PixelMask(int width, int height) :
+    mWidth(width),
+    mHeight(height),
+    mMinToT(static_cast<std::size_t>(width) * height, 0) {
+
+    // Do nothing
+
+}
+
+std::size_t PixelMask::numDisabled() const {
+
+    return std::count(mMinToT.begin(), mMinToT.end(), DISABLED);
+
+}
+
+std::size_t PixelMask::numThresholds() const {
+
+    return std::count_if(mMinToT.begin(), mMinToT.end(), [](uint16_t tot) { return tot > 0 && tot != DISABLED; });
+
+}
+
+void PixelMask::setMinToT(int x, int y, uint16_t tot) {
+
+    if(x < 0 || y < 0 || x >= mWidth || y >= mHeight)
+        throw std::runtime_error("Pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") is outside of the pixel mask");
+
+    mMinToT[static_cast<std::size_t>(x) * mHeight + y] = tot;
+
+}
+
+PixelMask PixelMask::forDecoding(const PixelMask &mask, const SpatialMask &spatial, int width, int height) {
+
+    PixelMask table(width, height);
+
+    for(int x = 0; x < width; ++x) {
+        for(int y = 0; y < height; ++y) {
+            // same (exclusive) bounds as the spatial mask has always had
+            auto ix = spatial.vertical ? x : y;
+            bool in_lines = (ix < spatial.max1 && ix > spatial.min1) || (ix < spatial.max2 && ix > spatial.min2);
+
+            if(!in_lines)
+                table.disable(x, y);
+            else if(x < mask.width() && y < mask.height())
+                table.setMinToT(x, y, mask.minToT(x, y));
+        }
+    }
+
+    return table;
+
+}
+
+std::vector<PixelAddr> PixelMask::findHotPixels(const ImageXY<unsigned> &counts) {
+
+    auto width = static_cast<int>(counts.size());
+    auto height = width ? static_cast<int>(counts[0].size()) : 0;
+
+    std::vector<PixelAddr> hot;
+    std::vector<unsigned> neighbours;
+    neighbours.reserve(8);
+
+    for(int x = 0; x < width; ++x) {
+        for(int y = 0; y < height; ++y) {
+            auto count = counts[x][y];
+            if(count < MIN_HOT_COUNTS)
+                continue;
+
+            // the spectral lines vary slowly across the sensor, but a hot pixel stands out from all of its neighbours
+            neighbours.clear();
+            for(int dx = -1; dx <= 1; ++dx) {
+                for(int dy = -1; dy <= 1; ++dy) {
+                    if((dx || dy) && x + dx >= 0 && x + dx < width && y + dy >= 0 && y + dy < height)
+                        neighbours.push_back(counts[x + dx][y + dy]);
+                }
+            }
+
+            auto median = neighbours.begin() + static_cast<std::ptrdiff_t>(neighbours.size() / 2);
+            std::nth_element(neighbours.begin(), median, neighbours.end());
+            if(count > HOT_PIXEL_RATIO * std::max(*median, 1u))
+                hot.push_back({static_cast<uint16_t>(x), static_cast<uint16_t>(y)});
+        }
+    }
+
+    return hot;
+
+}
+
+void PixelMask::save(const std::string &path) const {
+
+    std::ofstream output(path);
+    if(!output)
+        throw std::runtime_error("Could not open " + path + " for writing.");
+
+    output << "x, y, min_tot" << std::endl;
+    for(int x = 0; x < mWidth; ++x) {
+        for(int y = 0; y < mHeight; ++y) {
+            auto tot = minToT(x, y);
+            if(tot == DISABLED)
+                output << x << ", " << y << ", off\n";
+            else if(tot > 0)
+                output << x << ", " << y << ", " << tot << "\n";
+        }
+    }
+
+    output.close();
+    if(!output)
+        throw std::runtime_error("Could not write " + path + ".");
+
+}
+
+PixelMask PixelMask::load(const std::string &path, int width, int height) {
+
+    std::ifstream input(path);
+    if(!input)
+        throw std::runtime_error("Could not open pixel mask " + path);
+
+    PixelMask mask(width, height);
+
+    std::string line;
+    std::getline(input, line); // header
+    while(std::getline(input, line)) {
+        std::vector<std::string> row;
+        std::stringstream row_stream(line);
+        std::string elem;
+        while(std::getline(row_stream, elem, ','))
+            row.push_back(std::move(elem));
+
+        if(row.empty() || (row.size() == 1 && row[0].find_first_not_of(" \t\r") == std::string::npos))
+            continue;
+        if(row.size() != 3)
+            throw std::runtime_error("Incorrect pixel mask format.");
+
+        bool off = row[2].find("off") != std::string::npos;
+        int x, y;
+        unsigned long tot = 0;
+        try {
+            x = std::stoi(row[0]);
+            y = std::stoi(row[1]);
+            if(!off)
+                tot = std::stoul(row[2]);
+        } catch(std::logic_error &) {
+            throw std::runtime_error("Incorrect pixel mask format.");
+        }
+
+        if(off) {
+            mask.disable(x, y);
+            continue;
+        }
+
+        if(tot >= DISABLED)
+            throw std::runtime_error("Incorrect pixel mask format.");
+        mask.setMinToT(x, y, static_cast<uint16_t>(tot));
+    }
+
+    return mask;
+
+}
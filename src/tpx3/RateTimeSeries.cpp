@@ -0,0 +1,148 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <QVector>
+
+using namespace spec_hom;
+
+constexpr std::size_t NO_CHANGES = std::numeric_limits<std::size_t>::max();
+
+RateTimeSeries::RateTimeSeries(double bin_width, double coincidence_window, double start) :
+    mBinWidth(bin_width),
+    mCoincidenceWindow(coincidence_window),
+    mStart(start),
+    mBins(),
+    mLevels(),
+    mFirstChangedBin(NO_CHANGES) {
+
+    if(!(bin_width > 0))
+        throw std::runtime_error("The bins of a rate time series must have a positive width");
+
+}
+
+void RateTimeSeries::add(Series series, double toa) {
+
+    auto bin = toa > mStart ? static_cast<std::size_t>((toa - mStart) / mBinWidth) : 0;
+
+    // all series have the same number of bins
+    if(bin >= mBins[0].size()) {
+        for(auto &bins : mBins)
+            bins.resize(bin + 1, 0);
+    }
+
+    ++mBins[series][bin];
+    mFirstChangedBin = std::min(mFirstChangedBin, bin);
+
+}
+
+void RateTimeSeries::updateLevels() {
+
+    if(mFirstChangedBin == NO_CHANGES)
+        return;
+
+    // only the bins above a changed bin need to be summed again
+    auto first = mFirstChangedBin;
+    for(unsigned level = 1; numBins(level - 1) > 1; ++level) {
+        if(level > mLevels.size())
+            mLevels.emplace_back();
+
+        auto &coarse = mLevels[level - 1];
+        auto num_fine = numBins(level - 1);
+        auto num_coarse = (num_fine + 1) / 2;
+        first = std::min(first / 2, coarse[0].size()); // new bins are summed too
+
+        for(int series = 0; series < NUM_COUNTED; ++series) {
+            coarse[series].resize(num_coarse, 0);
+            for(auto bin = first; bin < num_coarse; ++bin) {
+                coarse[series][bin] = count(series, level - 1, 2*bin);
+                if(2*bin + 1 < num_fine)
+                    coarse[series][bin] += count(series, level - 1, 2*bin + 1);
+            }
+        }
+    }
+
+    mFirstChangedBin = NO_CHANGES;
+
+}
+
+void RateTimeSeries::append(const RateTimeSeries &other) {
+
+    if(other.mBinWidth != mBinWidth)
+        throw std::runtime_error("Cannot append a rate time series with bins of a different width.");
+
+    auto first = mBins[0].size();
+    for(int series = 0; series < NUM_COUNTED; ++series)
+        mBins[series].insert(mBins[series].end(), other.mBins[series].begin(), other.mBins[series].end());
+
+    if(mBins[0].size() > first)
+        mFirstChangedBin = std::min(mFirstChangedBin, first);
+    updateLevels();
+
+}
+
+double RateTimeSeries::duration() const {
+
+    return static_cast<double>(numBins()) * mBinWidth;
+
+}
+
+double RateTimeSeries::binWidth(unsigned level) const {
+
+    return std::ldexp(mBinWidth, static_cast<int>(level));
+
+}
+
+std::size_t RateTimeSeries::numBins(unsigned level) const {
+
+    return level ? mLevels[level - 1][0].size() : mBins[0].size();
+
+}
+
+unsigned RateTimeSeries::levelFor(double t_min, double t_max, std::size_t max_bins) const {
+
+    for(unsigned level = 0; level < numLevels(); ++level) {
+        if((t_max - t_min) / binWidth(level) <= static_cast<double>(max_bins))
+            return level;
+    }
+
+    return numLevels() - 1;
+
+}
+
+std::pair<QVector<double>, QVector<double>> RateTimeSeries::rates(Series series, unsigned level, double t_min, double t_max) const {
+
+    QVector<double> times, rates;
+
+    level = std::min(level, numLevels() - 1);
+    auto width = binWidth(level);
+    auto num_bins = numBins(level);
+    if(!num_bins || t_max < 0)
+        return {times, rates};
+
+    auto first = t_min > 0 ? static_cast<std::size_t>(t_min / width) : 0;
+    auto last = std::min(num_bins, static_cast<std::size_t>(std::ceil(t_max / width)) + 1);
+
+    for(auto bin = first; bin < last; ++bin) {
+        times.push_back((static_cast<double>(bin) + 0.5) * width);
+
+        if(series == ACCIDENTALS) {
+            auto singles_1 = static_cast<double>(count(SINGLES_1, level, bin)) / width;
+            auto singles_2 = static_cast<double>(count(SINGLES_2, level, bin)) / width;
+            rates.push_back(2 * mCoincidenceWindow * singles_1 * singles_2);
+        } else {
+            rates.push_back(static_cast<double>(count(series, level, bin)) / width);
+        }
+    }
+
+    return {times, rates};
+
+}
+
+uint64_t RateTimeSeries::count(int series, unsigned level, std::size_t bin) const {
+
+    return level ? mLevels[level - 1][series][bin] : mBins[series][bin];
+
+}
@@ -0,0 +1,198 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+using namespace spec_hom;
+
+constexpr char HOM_FILE_MAGIC[4] = {'S', 'H', 'O', 'M'};
+constexpr uint32_t HOM_FILE_VERSION = 1;
+
+SpectralHOMHistogram::SpectralHOMHistogram() :
+    SpectralHOMHistogram(0, 0, 0, 1, 0) {
+
+    // Do nothing
+
+}
+
+SpectralHOMHistogram::SpectralHOMHistogram(unsigned num_bins, double wl_min, double wl_max, double segment_width, double start) :
+    mNumBins(num_bins),
+    mWlMin(wl_min),
+    mWlMax(wl_max),
+    mSegmentWidth(segment_width),
+    mStart(start),
+    mNumPairs(0),
+    mSegments() {
+
+    // Do nothing
+
+}
+
+void SpectralHOMHistogram::add(double wl_1, double wl_2, double toa) {
+
+    // same bins as HistogramPyramid, without splatting
+    if(!(wl_1 >= mWlMin && wl_1 < mWlMax && wl_2 >= mWlMin && wl_2 < mWlMax))
+        return;
+
+    auto bin_width = (mWlMax - mWlMin) / mNumBins;
+    auto bin_1 = std::min(static_cast<unsigned>((wl_1 - mWlMin) / bin_width), mNumBins - 1);
+    auto bin_2 = std::min(static_cast<unsigned>((wl_2 - mWlMin) / bin_width), mNumBins - 1);
+
+    auto segment_ix = toa > mStart ? static_cast<std::size_t>((toa - mStart) / mSegmentWidth) : 0;
+    if(segment_ix >= mSegments.size())
+        mSegments.resize(segment_ix + 1);
+
+    auto &segment = mSegments[segment_ix];
+    if(segment.empty())
+        segment.resize(mNumBins);
+
+    // the band is widened to take in the new bin
+    auto &band = segment[bin_1];
+    if(band.counts.empty()) {
+        band.first = bin_2;
+        band.counts.assign(1, 0);
+    } else if(bin_2 < band.first) {
+        band.counts.insert(band.counts.begin(), band.first - bin_2, 0);
+        band.first = bin_2;
+    } else if(bin_2 >= band.first + band.counts.size()) {
+        band.counts.resize(bin_2 - band.first + 1, 0);
+    }
+
+    ++band.counts[bin_2 - band.first];
+    ++mNumPairs;
+
+}
+
+void SpectralHOMHistogram::append(const SpectralHOMHistogram &other) {
+
+    if(other.mNumBins != mNumBins || other.mWlMin != mWlMin || other.mWlMax != mWlMax || other.mSegmentWidth != mSegmentWidth)
+        throw std::runtime_error("Cannot append a spectrally-resolved HOM histogram with different bins.");
+
+    mSegments.insert(mSegments.end(), other.mSegments.begin(), other.mSegments.end());
+    mNumPairs += other.mNumPairs;
+
+}
+
+std::size_t SpectralHOMHistogram::memsize() const {
+
+    std::size_t size = 0;
+    for(auto &segment : mSegments) {
+        size += segment.capacity() * sizeof(Band);
+        for(auto &band : segment)
+            size += band.counts.capacity() * sizeof(uint32_t);
+    }
+
+    return size;
+
+}
+
+HistogramPyramid SpectralHOMHistogram::slice(std::size_t first, std::size_t last) const {
+
+    if(empty())
+        return {};
+
+    HistogramPyramid histogram(mNumBins, mNumBins, mWlMin, mWlMax, mWlMin, mWlMax);
+    auto bin_width = (mWlMax - mWlMin) / mNumBins;
+
+    last = std::min(last, mSegments.size());
+    for(auto segment_ix = first; segment_ix < last; ++segment_ix) {
+        auto &segment = mSegments[segment_ix];
+        for(unsigned bin_1 = 0; bin_1 < segment.size(); ++bin_1) {
+            auto &band = segment[bin_1];
+            for(std::size_t ix = 0; ix < band.counts.size(); ++ix) {
+                if(band.counts[ix])
+                    histogram.add(mWlMin + (bin_1 + 0.5) * bin_width, mWlMin + (band.first + ix + 0.5) * bin_width, band.counts[ix]);
+            }
+        }
+    }
+
+    return histogram;
+
+}
+
+std::vector<uint64_t> SpectralHOMHistogram::segmentCounts(double wl_1_min, double wl_1_max, double wl_2_min, double wl_2_max) const {
+
+    std::vector<uint64_t> counts(mSegments.size(), 0);
+
+    unsigned first_1, last_1, first_2, last_2;
+    if(!binRange(wl_1_min, wl_1_max, first_1, last_1) || !binRange(wl_2_min, wl_2_max, first_2, last_2))
+        return counts;
+
+    for(std::size_t segment_ix = 0; segment_ix < mSegments.size(); ++segment_ix) {
+        auto &segment = mSegments[segment_ix];
+        if(segment.empty())
+            continue;
+
+        for(auto bin_1 = first_1; bin_1 < last_1; ++bin_1) {
+            auto &band = segment[bin_1];
+            auto begin = std::max(first_2, band.first);
+            auto end = std::min<std::size_t>(last_2, band.first + band.counts.size());
+            for(auto bin_2 = begin; bin_2 < end; ++bin_2)
+                counts[segment_ix] += band.counts[bin_2 - band.first];
+        }
+    }
+
+    return counts;
+
+}
+
+bool SpectralHOMHistogram::binRange(double wl_min, double wl_max, unsigned &first, unsigned &last) const {
+
+    if(empty() || !(wl_max > mWlMin) || !(wl_min < mWlMax) || !(wl_min < wl_max))
+        return false;
+
+    // the bins whose centres are in the range
+    auto bin_width = (mWlMax - mWlMin) / mNumBins;
+    first = static_cast<unsigned>(std::clamp(std::ceil((wl_min - mWlMin) / bin_width - 0.5), 0.0, static_cast<double>(mNumBins)));
+    last = static_cast<unsigned>(std::clamp(std::ceil((wl_max - mWlMin) / bin_width - 0.5), 0.0, static_cast<double>(mNumBins)));
+
+    return first < last;
+
+}
+
+void SpectralHOMHistogram::save(const std::string &path) const {
+
+    std::ofstream output(path, std::ios::binary);
+    if(!output)
+        throw std::runtime_error("Could not open " + path + " for writing.");
+
+    auto write = [&output](auto value) {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    uint64_t num_bands = 0;
+    for(auto &segment : mSegments) {
+        for(auto &band : segment)
+            num_bands += !band.counts.empty();
+    }
+
+    output.write(HOM_FILE_MAGIC, sizeof(HOM_FILE_MAGIC));
+    write(HOM_FILE_VERSION);
+    write(static_cast<uint32_t>(mNumBins));
+    write(static_cast<uint32_t>(mSegments.size()));
+    write(mWlMin);
+    write(mWlMax);
+    write(mSegmentWidth);
+    write(mStart);
+    write(num_bands);
+
+    for(std::size_t segment_ix = 0; segment_ix < mSegments.size(); ++segment_ix) {
+        auto &segment = mSegments[segment_ix];
+        for(unsigned bin_1 = 0; bin_1 < segment.size(); ++bin_1) {
+            auto &band = segment[bin_1];
+            if(band.counts.empty())
+                continue;
+
+            write(static_cast<uint32_t>(segment_ix));
+            write(static_cast<uint32_t>(bin_1));
+            write(static_cast<uint32_t>(band.first));
+            write(static_cast<uint32_t>(band.counts.size()));
+            output.write(reinterpret_cast<const char*>(band.counts.data()), static_cast<std::streamsize>(band.counts.size() * sizeof(uint32_t)));
+        }
+    }
+
+    if(!output)
+        throw std::runtime_error("Could not write " + path + ".");
+
+}
@@ -0,0 +1,335 @@
+#include "tpx3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace spec_hom;
+
+constexpr int64_t TOA_PERIOD = int64_t(1) << 34; // [ticks] the decoded ToA wraps around with the 16-bit SPIDR time
+constexpr std::size_t MAX_PENDING_PACKETS = 1 << 24; // beyond this, a batch is cut even if there is no gap to end it at
+constexpr std::size_t MIN_PACKETS_FOR_LINES = 1 << 14; // raw packets needed before the lines are fit
+
+LiveHistograms::LiveHistograms(unsigned width, unsigned height) :
+    raw_image(width, std::vector<unsigned>(height, 0)),
+    cluster_image(width, std::vector<unsigned>(height, 0)),
+    spatial_correlations(),
+    tot_counts(NUM_TOT, 0),
+    start_stop_counts(NUM_START_STOP_BINS, 0),
+    dtoa_counts(NUM_TOT, 0),
+    dtoa_sums(NUM_TOT, 0),
+    dtoa_sq_sums(NUM_TOT, 0),
+    g2_counts(2*G2_HALF_BINS + 1, 0) {
+
+    // Do nothing
+
+}
+
+void LiveHistograms::add(const LiveHistograms &other) {
+
+    if(other.raw_image.size() != raw_image.size() || (!raw_image.empty() && other.raw_image[0].size() != raw_image[0].size()))
+        throw std::runtime_error("Cannot add the histograms of detectors of different sizes.");
+
+    num_packets += other.num_packets;
+    num_clusters += other.num_clusters;
+    num_pairs += other.num_pairs;
+    num_nfolds += other.num_nfolds;
+    num_late_packets += other.num_late_packets;
+    num_pending_packets += other.num_pending_packets;
+    data_time += other.data_time;
+    pending_time += other.pending_time;
+    lines_found = lines_found || other.lines_found;
+    num_files += other.num_files;
+
+    num_received_bytes += other.num_received_bytes;
+    num_dropped_bytes += other.num_dropped_bytes;
+    num_dropped_datagrams += other.num_dropped_datagrams;
+    buffer_fill = std::max(buffer_fill, other.buffer_fill);
+
+    for(std::size_t x = 0; x < raw_image.size(); ++x) {
+        for(std::size_t y = 0; y < raw_image[x].size(); ++y) {
+            raw_image[x][y] += other.raw_image[x][y];
+            cluster_image[x][y] += other.cluster_image[x][y];
+        }
+    }
+
+    auto add_bins = [](auto &to, const auto &from) {
+        for(std::size_t ix = 0; ix < to.size(); ++ix)
+            to[ix] += from[ix];
+    };
+    add_bins(tot_counts, other.tot_counts);
+    add_bins(start_stop_counts, other.start_stop_counts);
+    add_bins(dtoa_counts, other.dtoa_counts);
+    add_bins(dtoa_sums, other.dtoa_sums);
+    add_bins(dtoa_sq_sums, other.dtoa_sq_sums);
+    add_bins(g2_counts, other.g2_counts);
+    add_bins(g2_clicks, other.g2_clicks);
+    g2_time += other.g2_time;
+
+    // the histograms that are only filled once the lines have been fit may still be empty on either side
+    if(spatial_correlations.empty())
+        spatial_correlations = other.spatial_correlations;
+    else if(!other.spatial_correlations.empty())
+        spatial_correlations.add(other.spatial_correlations);
+
+    if(rate_series.empty())
+        rate_series = other.rate_series;
+    else if(!other.rate_series.empty())
+        rate_series.append(other.rate_series);
+
+    if(hom_histogram.empty())
+        hom_histogram = other.hom_histogram;
+    else if(!other.hom_histogram.empty())
+        hom_histogram.append(other.hom_histogram);
+
+}
+
+StreamProcessor::StreamProcessor(Tpx3ImportSettings settings, double look_back) :
+    mSettings(std::move(settings)),
+    mLookBack(std::llround(look_back / MIN_TICK)),
+    mMinGap(std::llround(std::max(mSettings.clusterSizeT * 1e-9, mSettings.coincidenceWindow) / MIN_TICK)),
+    mStages(std::make_unique<LoadRawFileThread>("", mSettings)),
+    mPending(),
+    mNewestToa(0),
+    mProcessedToa(std::numeric_limits<int64_t>::min()),
+    mFirstToa(0),
+    mHasData(false),
+    mLastCentroidToa(std::numeric_limits<double>::quiet_NaN()), // NaN until the first batch
+    mG2Tail(),
+    mG2Start(std::numeric_limits<double>::quiet_NaN()), // NaN until the lines have been fit
+    mLines(),
+    mCalibration(mSettings.calibration, static_cast<unsigned>(std::max(mSettings.geometry.width, mSettings.geometry.height))),
+    mMinWl(0),
+    mMaxWl(0),
+    mHistograms(mSettings.geometry.width, mSettings.geometry.height),
+    mBatchCallback() {
+
+    Tpx3Image::imageBounds(mSettings.calibration, mSettings.geometry, mMinWl, mMaxWl);
+
+}
+
+void StreamProcessor::push(PixelData &&packets) {
+
+    auto num_packets = packets.numPackets();
+    if(!num_packets)
+        return;
+
+    if(!mHasData) {
+        mNewestToa = packets.toa.front();
+        mHasData = true;
+    }
+
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        // the decoded ToA wraps around every ~27 s; take the copy of it closest to the newest time seen so far
+        auto raw_toa = packets.toa[ix];
+        auto periods = std::llround(static_cast<double>(mNewestToa - raw_toa) / static_cast<double>(TOA_PERIOD));
+        int64_t toa = raw_toa + static_cast<int64_t>(periods) * TOA_PERIOD;
+
+        if(toa <= mProcessedToa) {
+            ++mHistograms.num_late_packets;
+            continue;
+        }
+
+        mNewestToa = std::max(mNewestToa, toa);
+        mPending.addr.push_back(packets.addr[ix]);
+        mPending.toa.push_back(toa);
+        mPending.tot.push_back(packets.tot[ix]);
+    }
+
+}
+
+void StreamProcessor::process(bool flush) {
+
+    sort_timestamps(mPending, TaskPool::global());
+
+    auto &toa = mPending.toa;
+    std::size_t num_pending = toa.size();
+    std::size_t batch_end = num_pending;
+
+    if(!flush) {
+        // Packets older than the limit are assumed to have all arrived. The batch ends at the latest gap that lies
+        // entirely before the limit, since no cluster or coincidence can span it, nor can a late packet fall into it.
+        auto limit = mNewestToa - mLookBack;
+        auto limit_ix = static_cast<std::size_t>(std::upper_bound(toa.begin(), toa.end(), limit) - toa.begin());
+
+        batch_end = 0;
+        for(auto ix = limit_ix; ix > 0; --ix) {
+            if(ix < num_pending && toa[ix] - toa[ix - 1] > mMinGap && toa[ix - 1] + mMinGap <= limit) {
+                batch_end = ix;
+                break;
+            }
+        }
+
+        // without a gap (at very high rates) the batch is cut anyway, to bound the memory held
+        if(!batch_end && num_pending > MAX_PENDING_PACKETS)
+            batch_end = std::max(limit_ix, num_pending - MAX_PENDING_PACKETS);
+    }
+
+    if(batch_end) {
+        auto split = static_cast<std::ptrdiff_t>(batch_end);
+        PixelData batch {
+            std::vector<PixelAddr>(mPending.addr.begin(), mPending.addr.begin() + split),
+            std::vector<int64_t>(mPending.toa.begin(), mPending.toa.begin() + split),
+            std::vector<uint16_t>(mPending.tot.begin(), mPending.tot.begin() + split)
+        };
+        mPending.addr.erase(mPending.addr.begin(), mPending.addr.begin() + split);
+        mPending.toa.erase(mPending.toa.begin(), mPending.toa.begin() + split);
+        mPending.tot.erase(mPending.tot.begin(), mPending.tot.begin() + split);
+
+        if(mProcessedToa == std::numeric_limits<int64_t>::min())
+            mFirstToa = batch.toa.front();
+        mProcessedToa = batch.toa.back();
+
+        processBatch(std::move(batch));
+    }
+
+    mHistograms.num_pending_packets = mPending.numPackets();
+    mHistograms.pending_time = mPending.isEmpty() ? 0 : static_cast<double>(mPending.toa.back() - mPending.toa.front()) * MIN_TICK;
+    if(mProcessedToa != std::numeric_limits<int64_t>::min())
+        mHistograms.data_time = static_cast<double>(mProcessedToa - mFirstToa) * MIN_TICK;
+
+}
+
+void StreamProcessor::processBatch(PixelData &&batch) {
+
+    auto clusters = mStages->cluster(batch);
+    auto centroids = mStages->centroid(batch, clusters);
+    auto [coinc_pairs, coinc_nfolds] = mStages->findCoincidences(clusters, centroids);
+
+    auto &h = mHistograms;
+    auto num_packets = batch.numPackets();
+
+    h.num_packets += num_packets;
+    h.num_clusters += centroids.size();
+    h.num_pairs += coinc_pairs.size();
+    h.num_nfolds += coinc_nfolds.size();
+
+    // raw packets, ToT, and the delay of each clustered packet after its centroid
+    for(std::size_t ix = 0; ix < num_packets; ++ix) {
+        auto &addr = batch.addr[ix];
+        auto tot = batch.tot[ix];
+        ++h.raw_image[addr.x][addr.y];
+
+        if(tot >= LiveHistograms::NUM_TOT)
+            continue;
+        ++h.tot_counts[tot];
+
+        if(clusters.cluster_ids[ix] == 0) // not in a cluster
+            continue;
+
+        auto dtoa = static_cast<double>(batch.toa[ix])*MIN_TICK - centroids[clusters.cluster_ids[ix] - 1].toa;
+        ++h.dtoa_counts[tot];
+        h.dtoa_sums[tot] += dtoa;
+        h.dtoa_sq_sums[tot] += dtoa*dtoa;
+    }
+
+    // centroids, and the intervals between consecutive centroids (including the last one of the previous batch)
+    std::vector<double> centroid_toas;
+    centroid_toas.reserve(centroids.size());
+    for(auto &centroid : centroids) {
+        auto px_x = static_cast<unsigned>(centroid.x / PIXEL_SIZE);
+        auto px_y = static_cast<unsigned>(centroid.y / PIXEL_SIZE);
+        ++h.cluster_image[px_x][px_y];
+        centroid_toas.push_back(centroid.toa);
+    }
+    std::sort(centroid_toas.begin(), centroid_toas.end());
+
+    for(auto toa : centroid_toas) {
+        if(!std::isnan(mLastCentroidToa)) {
+            // same binning as Tpx3Image::startStopHistogram()
+            auto bin_ix = static_cast<std::size_t>((toa - mLastCentroidToa + MIN_TICK/2) / MIN_TICK);
+            if(bin_ix < LiveHistograms::NUM_START_STOP_BINS)
+                ++h.start_stop_counts[bin_ix];
+        }
+        mLastCentroidToa = toa;
+    }
+
+    // the lines are fit once there is enough data; pairs found before then are not in the spatial correlations
+    if(!mLines && h.num_packets >= MIN_PACKETS_FOR_LINES) {
+        auto lines = LinePair::find(h.raw_image, LinePair::isHorizontal(h.raw_image));
+        mLines = std::make_unique<LineTracker>(lines, mSettings.geometry.width, mSettings.geometry.height,
+                                               mSettings.lineTrackingWindow, static_cast<double>(mFirstToa) * MIN_TICK);
+        h.lines_found = true;
+        h.rate_series = RateTimeSeries(mSettings.rateBinWidth, mSettings.coincidenceWindow, static_cast<double>(mFirstToa) * MIN_TICK);
+        h.hom_histogram = SpectralHOMHistogram(Tpx3Image::SPATIAL_CORR_SIZE, mMinWl, mMaxWl, mSettings.homSegmentWidth,
+                                               static_cast<double>(mFirstToa) * MIN_TICK);
+        h.spatial_correlations = HistogramPyramid(Tpx3Image::SPATIAL_CORR_SIZE, Tpx3Image::SPATIAL_CORR_SIZE, mMinWl, mMaxWl, mMinWl, mMaxWl);
+    }
+
+    if(mLines) {
+        // the windows that have ended are fit as they come, and the lines are placed by those fit so far
+        for(std::size_t ix = 0; ix < num_packets; ++ix)
+            mLines->add(batch.addr[ix], static_cast<double>(batch.toa[ix]) * MIN_TICK);
+        mLines->update(static_cast<double>(batch.toa.back()) * MIN_TICK);
+
+        // same series as Tpx3Image::initializeSpectrum(); the clicks of each channel are added to those at the end of
+        // the previous batch for g2
+        auto channel_toas = mG2Tail;
+        for(auto &centroid : centroids) {
+            auto channel = mLines->closestLine(centroid.x, centroid.y, centroid.toa);
+            h.rate_series.add(channel == 1 ? RateTimeSeries::SINGLES_1 : RateTimeSeries::SINGLES_2, centroid.toa);
+            channel_toas[channel - 1].push_back(centroid.toa);
+            ++h.g2_clicks[channel - 1];
+        }
+        updateCrossCorrelation(std::move(channel_toas));
+
+        for(auto &nfold : coinc_nfolds)
+            h.rate_series.add(RateTimeSeries::NFOLDS, centroids[nfold.ids.front()].toa);
+
+        auto biphotons = biphoton_spectrum(centroids, coinc_pairs, *mLines, mCalibration, TaskPool::global());
+        for(std::size_t ix = 0; ix < coinc_pairs.size(); ++ix) {
+            auto &biphoton = biphotons[ix];
+            if(biphoton.channel_1 == biphoton.channel_2)
+                continue;
+            auto toa = centroids[coinc_pairs[ix].id_1].toa;
+            h.rate_series.add(RateTimeSeries::PAIRS, toa);
+
+            // same binning as Tpx3Image::spatialCorrelations() and initializeSpectrum()
+            h.spatial_correlations.add(biphoton.wl_1, biphoton.wl_2);
+            h.hom_histogram.add(biphoton.wl_1, biphoton.wl_2, toa);
+        }
+
+        h.rate_series.updateLevels();
+    }
+
+    if(mBatchCallback)
+        mBatchCallback(batch, centroids, coinc_pairs);
+
+}
+
+void StreamProcessor::updateCrossCorrelation(std::array<std::vector<double>, 2> &&channel_toas) {
+
+    auto &h = mHistograms;
+    auto max_delay = (LiveHistograms::G2_HALF_BINS + 0.5) * MIN_TICK;
+
+    for(auto &toas : channel_toas)
+        std::sort(toas.begin(), toas.end());
+    if(channel_toas[0].empty() && channel_toas[1].empty())
+        return;
+
+    // the batches follow each other in time, so the pairs with a click of this batch are those of all the clicks, less
+    // those between the clicks left from the previous batch (which have already been counted)
+    auto counts = cross_correlation(channel_toas[0], channel_toas[1], MIN_TICK, LiveHistograms::G2_HALF_BINS, TaskPool::global());
+    auto tail_counts = cross_correlation(mG2Tail[0], mG2Tail[1], MIN_TICK, LiveHistograms::G2_HALF_BINS, TaskPool::global());
+    for(std::size_t bin = 0; bin < counts.size(); ++bin)
+        h.g2_counts[bin] += counts[bin] - tail_counts[bin];
+
+    double first = std::numeric_limits<double>::infinity(), last = -std::numeric_limits<double>::infinity();
+    for(auto &toas : channel_toas) {
+        if(!toas.empty()) {
+            first = std::min(first, toas.front());
+            last = std::max(last, toas.back());
+        }
+    }
+    if(std::isnan(mG2Start))
+        mG2Start = first;
+    h.g2_time = last - mG2Start;
+
+    // keep the clicks that can still pair with those of the next batch
+    for(int channel = 0; channel < 2; ++channel) {
+        auto &toas = channel_toas[channel];
+        auto begin = std::lower_bound(toas.begin(), toas.end(), last - max_delay);
+        mG2Tail[channel].assign(begin, toas.end());
+    }
+
+}
@@ -0,0 +1,179 @@
+#include "tpx3.h"
+
+#include <chrono>
+#include <thread>
+
+#include <QTcpSocket>
+#include <QUdpSocket>
+#include <QHostAddress>
+
+using namespace spec_hom;
+
+constexpr std::size_t RECEIVE_BLOCK_SIZE = 1 << 20; // [bytes] largest single read from the socket or the ring
+constexpr std::size_t MAX_DATAGRAM_SIZE = 1 << 16; // [bytes]
+constexpr int SOCKET_WAIT_MS = 50; // how long a blocking socket call waits before checking for cancellation
+constexpr int CONNECT_TIMEOUT_MS = 5000;
+constexpr auto IDLE_INTERVAL = std::chrono::milliseconds(5); // wait when the ring is empty (reader) or full (writer)
+
+StreamSocketThread::StreamSocketThread(const std::string &host, uint16_t port, bool udp, std::size_t buffer_size,
+                                       Tpx3ImportSettings settings, double refresh_interval, double look_back) :
+    LiveSourceThread((udp ? "udp://" : "tcp://") + host + ":" + std::to_string(port), std::move(settings), refresh_interval, look_back),
+    mHost(host),
+    mPort(port),
+    mUdp(udp),
+    mBufferSize(buffer_size),
+    mStopReceiving(false),
+    mReceiverDone(false),
+    mReceiverError(),
+    mReceivedBytes(0),
+    mDroppedBytes(0),
+    mDroppedDatagrams(0) {
+
+    // Do nothing
+
+}
+
+void StreamSocketThread::execute() {
+
+    using clock = std::chrono::steady_clock;
+
+    emit setProgressText("Receiving " + mName);
+    emit setProgressTextColor(QColor(0,0,0));
+    emit setProgressIndefinite(true);
+
+    ByteRing ring(mBufferSize);
+    std::thread receiver(&StreamSocketThread::receive, this, std::ref(ring));
+
+    try {
+        Tpx3StreamDecoder decoder(mImportSettings);
+        StreamProcessor processor(mImportSettings, mLookBack);
+
+        std::vector<char> block(RECEIVE_BLOCK_SIZE);
+        auto last_data = clock::now();
+        auto last_refresh = clock::now();
+        auto refresh_interval = std::chrono::duration<double>(mRefreshInterval);
+        auto look_back = std::chrono::duration<double>(mLookBack);
+        double buffer_fill = 0;
+
+        auto yield_histograms = [&]() {
+            auto histograms = new LiveHistograms(processor.histograms());
+            histograms->num_received_bytes = mReceivedBytes.load(std::memory_order_relaxed);
+            histograms->num_dropped_bytes = mDroppedBytes.load(std::memory_order_relaxed);
+            histograms->num_dropped_datagrams = mDroppedDatagrams.load(std::memory_order_relaxed);
+            histograms->buffer_fill = buffer_fill;
+            emit yieldLiveHistograms(histograms);
+        };
+
+        while(!shouldCancel()) {
+            buffer_fill = std::max(buffer_fill, static_cast<double>(ring.size()) / static_cast<double>(ring.capacity()));
+
+            auto num_read = ring.read(block.data(), block.size());
+            if(num_read) {
+                processor.push(decoder.feed(block.data(), num_read));
+                last_data = clock::now();
+            } else if(mReceiverDone.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            processor.process(clock::now() - last_data >= look_back);
+
+            if(clock::now() - last_refresh >= refresh_interval) {
+                yield_histograms();
+                buffer_fill = 0;
+                last_refresh = clock::now();
+            }
+
+            if(!num_read)
+                std::this_thread::sleep_for(IDLE_INTERVAL);
+        }
+
+        processor.process(true);
+        yield_histograms();
+    } catch(const std::runtime_error &e) {
+        emit err("Stopped receiving " + mName + ": " + e.what());
+    }
+
+    mStopReceiving.store(true, std::memory_order_relaxed);
+    receiver.join();
+
+    if(!mReceiverError.empty())
+        emit err(mReceiverError);
+    else if(!shouldCancel())
+        emit log("Stream " + mName + " was closed by the sender");
+
+    auto dropped_datagrams = mDroppedDatagrams.load(std::memory_order_relaxed);
+    if(dropped_datagrams)
+        emit warn(std::to_string(dropped_datagrams) + " datagram(s) (" + std::to_string(mDroppedBytes.load(std::memory_order_relaxed))
+                  + " bytes) from " + mName + " were dropped because the receive buffer was full");
+
+}
+
+void StreamSocketThread::receive(ByteRing &ring) {
+
+    std::vector<char> block(std::max(RECEIVE_BLOCK_SIZE, MAX_DATAGRAM_SIZE));
+
+    auto stop = [this]() {
+        return mStopReceiving.load(std::memory_order_relaxed) || shouldCancel();
+    };
+
+    if(mUdp) {
+        QUdpSocket socket;
+        if(!socket.bind(QHostAddress(QString::fromStdString(mHost)), mPort)) {
+            mReceiverError = "Failed to listen on " + mName + ": " + socket.errorString().toStdString();
+            mReceiverDone.store(true, std::memory_order_release);
+            return;
+        }
+
+        while(!stop()) {
+            if(!socket.hasPendingDatagrams() && !socket.waitForReadyRead(SOCKET_WAIT_MS))
+                continue;
+
+            while(socket.hasPendingDatagrams()) {
+                auto size = socket.readDatagram(block.data(), static_cast<qint64>(block.size()));
+                if(size <= 0)
+                    continue;
+
+                // a datagram is dropped whole, so that the chunks in the ring stay intact
+                auto num_bytes = static_cast<std::size_t>(size);
+                mReceivedBytes.fetch_add(num_bytes, std::memory_order_relaxed);
+                if(!ring.writeAll(block.data(), num_bytes)) {
+                    mDroppedBytes.fetch_add(num_bytes, std::memory_order_relaxed);
+                    mDroppedDatagrams.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    } else {
+        QTcpSocket socket;
+        socket.setReadBufferSize(static_cast<qint64>(RECEIVE_BLOCK_SIZE)); // so that a full ring holds back the sender
+        socket.connectToHost(QString::fromStdString(mHost), mPort);
+        if(!socket.waitForConnected(CONNECT_TIMEOUT_MS)) {
+            mReceiverError = "Failed to connect to " + mName + ": " + socket.errorString().toStdString();
+            mReceiverDone.store(true, std::memory_order_release);
+            return;
+        }
+
+        while(!stop()) {
+            if(!socket.bytesAvailable()) {
+                if(socket.state() != QAbstractSocket::ConnectedState)
+                    break;
+                socket.waitForReadyRead(SOCKET_WAIT_MS);
+                continue;
+            }
+
+            auto free = ring.capacity() - ring.size();
+            if(!free) {
+                std::this_thread::sleep_for(IDLE_INTERVAL);
+                continue;
+            }
+
+            auto size = socket.read(block.data(), static_cast<qint64>(std::min(free, block.size())));
+            if(size > 0) {
+                ring.write(block.data(), static_cast<std::size_t>(size)); // always fits, as only this thread writes
+                mReceivedBytes.fetch_add(static_cast<std::size_t>(size), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    mReceiverDone.store(true, std::memory_order_release);
+
+}
@@ -2,25 +2,168 @@
 
 #include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <vector>
 #include <filesystem>
 #include <cmath>
+#include <limits>
+
+#include <tim/timsort.h>
 
 using namespace spec_hom;
 
 Tpx3Image::Tpx3Image(std::string fname, PixelData &&raw_data, ClusterData &&clusters,
                      std::vector<ClusterCentroid> &&centroids, std::vector<CoincidencePair> &&coinc_pairs,
-                     std::vector<CoincidenceNFold> &&coinc_nfolds, WavelengthCalibration calibration) :
+                     std::vector<CoincidenceNFold> &&coinc_nfolds, WavelengthCalibration calibration, DetectorGeometry geometry,
+                     double coincidence_window, double rate_bin_width, double line_tracking_window, double hom_segment_width) :
         mFileName(std::move(fname)),
         mRawData(std::move(raw_data)),
+        mRawDataMutex(),
+        mPackets(),
+        mReloadPackets(),
         mClusters(std::move(clusters)),
         mCentroids(std::move(centroids)),
         mCoincidencePairs(std::move(coinc_pairs)),
         mCoincidenceNFold(std::move(coinc_nfolds)),
         mBiphotonClicks(),
-        mCalibration(calibration) {
+        mChannelToas(),
+        mRateSeries(rate_bin_width, coincidence_window),
+        mHOMHistogram(0, 0, 0, hom_segment_width, 0),
+        mCalibration(calibration),
+        mGeometry(std::move(geometry)),
+        mImportStats(),
+        mLive() {
+
+    initializeSpectrum(line_tracking_window);
+
+}
+
+Tpx3Image::Tpx3Image(std::string fname, WavelengthCalibration calibration, DetectorGeometry geometry) :
+        mFileName(std::move(fname)),
+        mRawData(),
+        mRawDataMutex(),
+        mPackets(),
+        mReloadPackets(),
+        mClusters(),
+        mCentroids(),
+        mCoincidencePairs(),
+        mCoincidenceNFold(),
+        mBiphotonClicks(),
+        mChannelToas(),
+        mRateSeries(),
+        mHOMHistogram(),
+        mCalibration(calibration),
+        mGeometry(std::move(geometry)),
+        mImportStats(),
+        mLive(std::make_unique<LiveHistograms>(mGeometry.width, mGeometry.height)) {
+
+    // Do nothing
+
+}
+
+void Tpx3Image::setLiveHistograms(std::unique_ptr<LiveHistograms> histograms) {
+
+    mLive = std::move(histograms);
+
+}
+
+LiveHistograms Tpx3Image::summary() const {
+
+    if(mLive)
+        return *mLive;
+
+    LiveHistograms h(width(), height());
+    h.num_packets = numRawPackets();
+    h.num_clusters = numClusters();
+    h.num_pairs = mCoincidencePairs.size();
+    h.num_nfolds = mCoincidenceNFold.size();
+    h.lines_found = true;
+    h.num_files = 1;
+
+    auto packets = mPackets ? *mPackets : packetHistograms();
+    h.data_time = packets.data_time;
+    h.raw_image = std::move(packets.raw_image);
+    h.tot_counts = std::move(packets.tot_counts);
+    h.dtoa_counts = std::move(packets.dtoa_counts);
+    h.dtoa_sums = std::move(packets.dtoa_sums);
+    h.dtoa_sq_sums = std::move(packets.dtoa_sq_sums);
+    h.cluster_image = clusterImage();
+
+    if(numClusters() >= 2) {
+        auto start_stop = startStopHistogram(MIN_TICK, LiveHistograms::NUM_START_STOP_BINS).second;
+        for(std::size_t bin = 0; bin < h.start_stop_counts.size(); ++bin)
+            h.start_stop_counts[bin] = static_cast<uint64_t>(start_stop[static_cast<int>(bin)]);
+    }
+
+    if(!mChannelToas[0].empty() && !mChannelToas[1].empty()) {
+        h.g2_counts = cross_correlation(mChannelToas[0], mChannelToas[1], MIN_TICK, LiveHistograms::G2_HALF_BINS, TaskPool::global());
+        h.g2_clicks = {mChannelToas[0].size(), mChannelToas[1].size()};
+        h.g2_time = std::max(mChannelToas[0].back(), mChannelToas[1].back()) - std::min(mChannelToas[0].front(), mChannelToas[1].front());
+    }
+
+    h.spatial_correlations = spatialCorrelations();
+    h.rate_series = mRateSeries;
+    h.hom_histogram = mHOMHistogram;
+
+    return h;
+
+}
+
+Tpx3Image::PacketHistograms Tpx3Image::packetHistograms() const {
+
+    PacketHistograms packets;
+    packets.num_packets = mRawData.numPackets();
+    if(!mRawData.isEmpty()) {
+        auto [first, last] = std::minmax_element(mRawData.toa.begin(), mRawData.toa.end());
+        packets.data_time = static_cast<double>(*last - *first) * MIN_TICK;
+    }
+
+    packets.raw_image = rawPacketImage();
+    packets.tot_counts.assign(LiveHistograms::NUM_TOT, 0);
+    packets.dtoa_counts.assign(LiveHistograms::NUM_TOT, 0);
+    packets.dtoa_sums.assign(LiveHistograms::NUM_TOT, 0);
+    packets.dtoa_sq_sums.assign(LiveHistograms::NUM_TOT, 0);
+
+    // same bins as StreamProcessor::processBatch()
+    for(std::size_t ix = 0; ix < mRawData.numPackets(); ++ix) {
+        auto tot = mRawData.tot[ix];
+        if(tot >= LiveHistograms::NUM_TOT)
+            continue;
+        ++packets.tot_counts[tot];
+
+        if(mClusters.cluster_ids[ix] == 0) // not in a cluster
+            continue;
+
+        auto dtoa = static_cast<double>(mRawData.toa[ix])*MIN_TICK - mCentroids[mClusters.cluster_ids[ix] - 1].toa;
+        ++packets.dtoa_counts[tot];
+        packets.dtoa_sums[tot] += dtoa;
+        packets.dtoa_sq_sums[tot] += dtoa*dtoa;
+    }
 
-    initializeSpectrum();
+    return packets;
+
+}
+
+void Tpx3Image::releasePackets(std::function<PixelData()> reload) {
+
+    if(mLive || mPackets)
+        return;
+
+    mPackets = std::make_unique<PacketHistograms>(packetHistograms());
+    mReloadPackets = std::move(reload);
+
+    // swapping with empty vectors frees their memory, unlike clear()
+    std::vector<PixelAddr>().swap(mRawData.addr);
+    std::vector<int64_t>().swap(mRawData.toa);
+    std::vector<uint16_t>().swap(mRawData.tot);
+    std::vector<int>().swap(mClusters.cluster_ids);
+
+}
+
+std::size_t Tpx3Image::packetMemsize() const {
+
+    std::lock_guard lock(mRawDataMutex);
+    return mRawData.memsize() + mClusters.cluster_ids.capacity() * sizeof(int);
 
 }
 
@@ -39,41 +182,73 @@ const std::string& Tpx3Image::fullFilename() const {
 
 PixelData& Tpx3Image::data() {
 
+    std::as_const(*this).data();
     return mRawData;
 
 }
 
 const PixelData& Tpx3Image::data() const {
 
+    // the histograms still come from mPackets once the packets are reloaded, so that nothing is counted twice
+    std::lock_guard lock(mRawDataMutex);
+    if(mPackets && mRawData.isEmpty() && mPackets->num_packets && mReloadPackets) {
+        // cleared first, so that a file that cannot be read is not read again on every call
+        auto reload = std::move(mReloadPackets);
+        mReloadPackets = nullptr;
+
+        auto packets = reload();
+        if(packets.numPackets() != mPackets->num_packets)
+            throw std::runtime_error("The packets of " + mFileName + " could not be read again; the file may have changed.");
+        mRawData = std::move(packets);
+    }
+
     return mRawData;
 
 }
 
 unsigned long Tpx3Image::numRawPackets() const {
 
-    return data().numPackets();
+    if(mLive)
+        return mLive->num_packets;
+    if(mPackets)
+        return mPackets->num_packets;
+
+    return mRawData.numPackets();
 
 }
 
 unsigned long Tpx3Image::numClusters() const {
 
+    if(mLive)
+        return mLive->num_clusters;
+
     return mClusters.num_clusters;
 
 }
 
 bool Tpx3Image::empty() const {
 
-    return data().isEmpty();
+    if(mLive)
+        return !mLive->num_packets;
+    if(mPackets)
+        return !mPackets->num_packets;
+
+    return mRawData.isEmpty();
 
 }
 
 ImageXY<unsigned> Tpx3Image::rawPacketImage() const {
 
+    if(mLive)
+        return mLive->raw_image;
+    if(mPackets)
+        return mPackets->raw_image;
+
     std::vector<unsigned> r;
-    r.insert(r.begin(), TPX3_SENSOR_SIZE, 0);
+    r.insert(r.begin(), height(), 0);
 
     ImageXY<unsigned> pixel_counts;
-    pixel_counts.insert(pixel_counts.begin(), TPX3_SENSOR_SIZE, r);
+    pixel_counts.insert(pixel_counts.begin(), width(), r);
 
     for(auto &packet : mRawData.addr)
         ++pixel_counts[packet.x][packet.y];
@@ -86,13 +261,14 @@ std::pair<QVector<double>, QVector<double>> Tpx3Image::toTDistribution(unsigned
 
     constexpr double TOT_UNIT_SIZE = 25e-9; // data in units of 25 ns
 
-    unsigned num_packets = numRawPackets();
+    // released packets are only counted in their histogram
+    unsigned num_packets = mPackets ? 0 : mRawData.numPackets();
 
-    unsigned tot_hist[1024];
+    double tot_hist[1024];
     for(unsigned ix = 0; ix < 1024; ++ix)
-        tot_hist[ix] = 0;
+        tot_hist[ix] = mLive ? static_cast<double>(mLive->tot_counts[ix]) : mPackets ? static_cast<double>(mPackets->tot_counts[ix]) : 0;
     for(unsigned ix = 0; ix < num_packets; ++ix) {
-        auto tot = data().tot[ix];
+        auto tot = mRawData.tot[ix];
         ++tot_hist[tot];
     }
 
@@ -112,11 +288,14 @@ std::pair<QVector<double>, QVector<double>> Tpx3Image::toTDistribution(unsigned
 
 ImageXY<unsigned> Tpx3Image::clusterImage() const {
 
+    if(mLive)
+        return mLive->cluster_image;
+
     std::vector<unsigned> r;
-    r.insert(r.begin(), TPX3_SENSOR_SIZE, 0);
+    r.insert(r.begin(), height(), 0);
 
     ImageXY<unsigned> pixel_counts;
-    pixel_counts.insert(pixel_counts.begin(), TPX3_SENSOR_SIZE, r);
+    pixel_counts.insert(pixel_counts.begin(), width(), r);
 
     for(auto &cluster : mCentroids) {
         auto px_x = static_cast<unsigned>(cluster.x / PIXEL_SIZE);
@@ -132,21 +311,37 @@ std::pair<QVector<double>, QVector<double>> Tpx3Image::startStopHistogram(double
 
     unsigned num_clusters = numClusters();
 
-    if(num_clusters < 2)
+    if(num_clusters < 2 && !mLive) // a live histogram is shown empty until clusters arrive
         throw std::runtime_error("Need at least two clusters to create a start-stop histogram.");
 
     std::vector<unsigned> bin_values(num_bins, 0);
 
-    for(unsigned ix = 0; ix < num_clusters - 1; ++ix) {
-        double startstop = mCentroids[ix + 1].toa - mCentroids[ix].toa;
+    if(mLive) {
+        // the live histogram has bins of MIN_TICK, with the same rounding; merge them into the requested bins
+        auto &counts = mLive->start_stop_counts;
+        for(std::size_t fine_ix = 0; fine_ix < counts.size(); ++fine_ix) {
+            auto bin_ix = static_cast<unsigned>((static_cast<double>(fine_ix)*MIN_TICK + MIN_TICK/2) / hist_bin_size);
+            if(bin_ix < num_bins)
+                bin_values[bin_ix] += counts[fine_ix];
+        }
+        num_clusters = 0; // skips the loop below
+    }
+
+    // the centroids are in cluster order rather than time order, so the intervals are taken from the sorted channels
+    std::vector<double> toas;
+    if(num_clusters > 0) {
+        toas.resize(mChannelToas[0].size() + mChannelToas[1].size());
+        std::merge(mChannelToas[0].begin(), mChannelToas[0].end(), mChannelToas[1].begin(), mChannelToas[1].end(), toas.begin());
+    }
+
+    for(std::size_t ix = 0; ix + 1 < toas.size(); ++ix) {
+        double startstop = toas[ix + 1] - toas[ix];
         // rounds down; MIN_TICK/2 moves values from edges of bins to center, so there is less numerical artifacts
         unsigned bin_ix = static_cast<unsigned>((startstop + MIN_TICK/2) / hist_bin_size);
         if(bin_ix < num_bins)
             ++bin_values[bin_ix];
     }
 
-    bin_values[0] *= 2; // accounts for the fact that we only traverse the array in one direction, which undercounts zero delays
-
     QVector<double> x(num_bins), y(num_bins);
     for (int i=0; i<num_bins; ++i) {
         x[i] = i*hist_bin_size;
@@ -157,6 +352,47 @@ std::pair<QVector<double>, QVector<double>> Tpx3Image::startStopHistogram(double
 
 }
 
+std::pair<QVector<double>, QVector<double>> Tpx3Image::crossCorrelation(double hist_bin_size, unsigned half_bins) const {
+
+    auto num_bins = 2 * half_bins + 1;
+    std::vector<uint64_t> counts(num_bins, 0);
+    std::array<double, 2> num_clicks {};
+    double span;
+
+    if(mLive) {
+        // the live histogram has bins of MIN_TICK centred on their delays; merge them into the requested bins
+        auto &fine_counts = mLive->g2_counts;
+        for(std::size_t fine_ix = 0; fine_ix < fine_counts.size(); ++fine_ix) {
+            auto delay = (static_cast<double>(fine_ix) - LiveHistograms::G2_HALF_BINS) * MIN_TICK;
+            auto position = delay / hist_bin_size + half_bins + 0.5;
+            if(position >= 0 && position < num_bins)
+                counts[static_cast<std::size_t>(position)] += fine_counts[fine_ix];
+        }
+        num_clicks = {static_cast<double>(mLive->g2_clicks[0]), static_cast<double>(mLive->g2_clicks[1])};
+        span = mLive->g2_time;
+    } else {
+        if(mChannelToas[0].empty() || mChannelToas[1].empty())
+            throw std::runtime_error("Need clicks in both channels to create a cross-correlation.");
+
+        counts = cross_correlation(mChannelToas[0], mChannelToas[1], hist_bin_size, half_bins, TaskPool::global());
+        num_clicks = {static_cast<double>(mChannelToas[0].size()), static_cast<double>(mChannelToas[1].size())};
+        span = std::max(mChannelToas[0].back(), mChannelToas[1].back()) - std::min(mChannelToas[0].front(), mChannelToas[1].front());
+    }
+
+    // pairs expected in each bin from uncorrelated clicks at the average rates; a live histogram is shown empty until
+    // the lines have been fit
+    auto accidentals = num_clicks[0] * num_clicks[1] * hist_bin_size / span;
+
+    QVector<double> x(num_bins), y(num_bins);
+    for(unsigned i = 0; i < num_bins; ++i) {
+        x[i] = (static_cast<double>(i) - half_bins) * hist_bin_size;
+        y[i] = accidentals > 0 ? static_cast<double>(counts[i]) / accidentals : 0;
+    }
+
+    return std::make_pair<QVector<double>, QVector<double>>(std::move(x), std::move(y));
+
+}
+
 std::tuple<QVector<double>, QVector<double>, QVector<double>> Tpx3Image::dToADistribution(unsigned int hist_bin_size) const {
 
     unsigned num_clusters = numClusters();
@@ -168,12 +404,31 @@ std::tuple<QVector<double>, QVector<double>, QVector<double>> Tpx3Image::dToADis
     std::vector<unsigned> tot_count(num_tot, 0);
     std::vector<double> dtoa_means(num_tot, 0); // mean dToA
 
+    if(mLive || mPackets) {
+        // the live (or released) histograms hold sums rather than the packets themselves, so use the one-pass formulas
+        auto &counts = mLive ? mLive->dtoa_counts : mPackets->dtoa_counts;
+        auto &sums = mLive ? mLive->dtoa_sums : mPackets->dtoa_sums;
+        auto &sq_sums = mLive ? mLive->dtoa_sq_sums : mPackets->dtoa_sq_sums;
+
+        QVector<double> qt_x, qt_y, qt_yerr;
+        for(unsigned ix = 0; ix < hist_size; ++ix) {
+            auto N = static_cast<double>(counts[ix]);
+            auto sum = sums[ix], sq_sum = sq_sums[ix];
+
+            qt_x.push_back(ix * TOT_UNIT_SIZE);
+            qt_y.push_back(N ? sum / N : 0);
+            qt_yerr.push_back(N > 1 ? std::sqrt(std::max(sq_sum - sum*sum/N, 0.0) / (N - 1)) : 0);
+        }
+
+        return std::make_tuple(std::move(qt_x), std::move(qt_y), std::move(qt_yerr));
+    }
+
     // now histogram
     std::vector<double> x(hist_size, 0);
     std::vector<double> y(hist_size, 0);
 
-    auto &toa_arr = data().toa;
-    auto &tot_arr = data().tot;
+    auto &toa_arr = mRawData.toa;
+    auto &tot_arr = mRawData.tot;
 
     // corrected two-pass algorithm to calculate mean and st.dev
 
@@ -242,104 +497,178 @@ std::tuple<QVector<double>, QVector<double>, QVector<double>> Tpx3Image::dToADis
 
 }
 
-ImageXY<unsigned> Tpx3Image::spatialCorrelations() const {
+HistogramPyramid Tpx3Image::spatialCorrelations(unsigned subdivisions, bool bilinear) const {
 
-    std::vector<unsigned> r;
-    r.insert(r.begin(), Tpx3Image::SPATIAL_CORR_SIZE, 0);
+    if(mLive)
+        return mLive->spatial_correlations;
 
-    ImageXY<unsigned> pixel_counts;
-    pixel_counts.insert(pixel_counts.begin(), Tpx3Image::SPATIAL_CORR_SIZE, r);
+    if(subdivisions < 1 || subdivisions > MAX_SUBDIVISIONS)
+        throw std::runtime_error("spatialCorrelations(): " + std::to_string(subdivisions) + " subdivisions of a bin are not supported");
 
     double min_wl, max_wl;
     imageBounds(min_wl, max_wl);
-    double image_size = max_wl - min_wl;
 
-    for(auto &biphoton : mBiphotonClicks) {
-        auto px_x = static_cast<unsigned>((biphoton.wl_1 - min_wl) / image_size * Tpx3Image::SPATIAL_CORR_SIZE);
-        auto px_y = static_cast<unsigned>((biphoton.wl_2 - min_wl) / image_size * Tpx3Image::SPATIAL_CORR_SIZE);
+    // pairs within one channel are skipped
+    auto size = SPATIAL_CORR_SIZE * subdivisions;
+    HistogramPyramid histogram(size, size, min_wl, max_wl, min_wl, max_wl);
+    histogram.fill(mBiphotonClicks.size(), [this](std::size_t ix) {
+        auto &biphoton = mBiphotonClicks[ix];
+        if(biphoton.channel_1 == biphoton.channel_2)
+            return std::make_pair(std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN());
+        return std::make_pair(biphoton.wl_1, biphoton.wl_2);
+    }, bilinear);
 
-        px_x = std::min(px_x, static_cast<unsigned>(Tpx3Image::SPATIAL_CORR_SIZE)-1);
-        px_y = std::min(px_y, static_cast<unsigned>(Tpx3Image::SPATIAL_CORR_SIZE)-1);
+    return histogram;
 
-        if(biphoton.channel_1 != biphoton.channel_2)
-            ++pixel_counts[px_x][px_y];
-    }
+}
 
-    return pixel_counts;
+HistogramPyramid Tpx3Image::rawImagePyramid() const {
+
+    // pixel x is binned over [x - 0.5, x + 0.5), so that the bins are centred on the pixels
+    return {rawPacketImage(), -0.5, width() - 0.5, -0.5, height() - 0.5};
 
 }
 
-double calibrate(WavelengthCalibration calib, int channel, double bin) {
+HistogramPyramid Tpx3Image::clusterImagePyramid(unsigned subdivisions, bool bilinear) const {
 
-    if(channel == 1) {
-        return calib.slope1 * (bin / PIXEL_SIZE) + calib.intercept1;
-    } else if (channel == 2) {
-        return calib.slope2 * (bin / PIXEL_SIZE) + calib.intercept2;
-    } else {
-        throw std::runtime_error("calibrate(): Channel " + std::to_string(channel) + " not recognized");
-    }
+    if(mLive)
+        return {mLive->cluster_image, -0.5, width() - 0.5, -0.5, height() - 0.5};
+
+    if(subdivisions < 1 || subdivisions > MAX_SUBDIVISIONS)
+        throw std::runtime_error("clusterImagePyramid(): " + std::to_string(subdivisions) + " subdivisions of a pixel are not supported");
+
+    HistogramPyramid pyramid(width() * subdivisions, height() * subdivisions, -0.5, width() - 0.5, -0.5, height() - 0.5);
+    pyramid.fill(mCentroids.size(), [this](std::size_t ix) {
+        return std::make_pair(mCentroids[ix].x / PIXEL_SIZE, mCentroids[ix].y / PIXEL_SIZE);
+    }, bilinear);
+    pyramid.buildLevels();
+
+    return pyramid;
 
 }
 
-void Tpx3Image::initializeSpectrum() {
+HistogramPyramid Tpx3Image::spatialCorrelationPyramid(unsigned subdivisions, bool bilinear) const {
 
-    // Look for peaks along horizontal and vertical direction, and pick direction accordingly
-    std::vector<unsigned> h_slice, v_slice;
-    h_slice.reserve(Tpx3Image::HEIGHT);
-    v_slice.reserve(Tpx3Image::WIDTH);
+    auto pyramid = spatialCorrelations(subdivisions, bilinear);
+    if(!pyramid.empty())
+        pyramid.buildLevels();
 
-    auto raw_image = rawPacketImage();
+    return pyramid;
+
+}
 
-    for (unsigned r = 0; r < Tpx3Image::HEIGHT; ++r) {
-        unsigned slice_tot = 0;
-        for (unsigned c = 0; c < Tpx3Image::WIDTH; ++c) {
-            slice_tot += raw_image[r][c];
+std::vector<SpectrumPair> spec_hom::biphoton_spectrum(const std::vector<ClusterCentroid> &centroids, const std::vector<CoincidencePair> &pairs,
+                                                      const LineTracker &lines, const CalibrationTable &calib, TaskPool &pool) {
+
+    constexpr std::size_t PAIRS_PER_CHUNK = 1 << 12; // small enough that a chunk's arrays stay in cache
+
+    std::vector<SpectrumPair> result(pairs.size());
+
+    pool.parallelFor(pairs.size(), PAIRS_PER_CHUNK, [&](std::size_t begin, std::size_t end) {
+        // clicks 2*ix and 2*ix + 1 of the chunk are the two clicks of its pair ix
+        auto num_clicks = 2 * (end - begin);
+        std::vector<double> x(num_clicks), y(num_clicks), toa(num_clicks), along(num_clicks), wavelength(num_clicks);
+        std::vector<int> channel(num_clicks);
+
+        for(auto ix = begin; ix < end; ++ix) {
+            auto click = 2 * (ix - begin);
+            auto &centroid1 = centroids[pairs[ix].id_1];
+            auto &centroid2 = centroids[pairs[ix].id_2];
+            x[click] = centroid1.x;
+            y[click] = centroid1.y;
+            toa[click] = centroid1.toa;
+            x[click + 1] = centroid2.x;
+            y[click + 1] = centroid2.y;
+            toa[click + 1] = centroid2.toa;
         }
-        v_slice.push_back(slice_tot);
-    }
-    for (unsigned c = 0; c < Tpx3Image::WIDTH; ++c) {
-        unsigned slice_tot = 0;
-        for (unsigned r = 0; r < Tpx3Image::HEIGHT; ++r) {
-            slice_tot += raw_image[r][c];
+
+        lines.assign(num_clicks, x.data(), y.data(), toa.data(), channel.data(), along.data());
+        calib.apply(num_clicks, channel.data(), along.data(), wavelength.data());
+
+        for(auto ix = begin; ix < end; ++ix) {
+            auto click = 2 * (ix - begin);
+            result[ix] = {wavelength[click], wavelength[click + 1], channel[click], channel[click + 1]};
         }
-        h_slice.push_back(slice_tot);
-    }
+    });
 
-    auto h_slice_max = *std::max_element(h_slice.cbegin(), h_slice.cend());
-    auto v_slice_max = *std::max_element(v_slice.cbegin(), v_slice.cend());
+    return result;
 
-    bool h_lines = (h_slice_max >= v_slice_max);
+}
+
+void Tpx3Image::initializeSpectrum(double line_tracking_window) {
+
+    // Look for peaks along horizontal and vertical direction, and pick direction accordingly
+    auto raw_image = rawPacketImage();
+    bool h_lines = LinePair::isHorizontal(raw_image);
 
-    // fit the lines
+    // fit the lines, then follow them through the acquisition if they are fit in windows
     LinePair lines = LinePair::find(raw_image, h_lines);
 
-    mBiphotonClicks.clear();
-    mBiphotonClicks.reserve(mCoincidencePairs.size());
+    double raw_start = mRawData.toa.empty() ? 0 : static_cast<double>(*std::min_element(mRawData.toa.begin(), mRawData.toa.end())) * MIN_TICK;
+    LineTracker tracker(lines, width(), height(), line_tracking_window, raw_start);
+    if(line_tracking_window > 0) {
+        for(std::size_t ix = 0; ix < mRawData.numPackets(); ++ix)
+            tracker.add(mRawData.addr[ix], static_cast<double>(mRawData.toa[ix]) * MIN_TICK);
+        tracker.update(std::numeric_limits<double>::infinity());
+    }
 
-    for(auto &coinc : mCoincidencePairs) {
-        auto centroid1 = mCentroids[coinc.id_1];
-        auto centroid2 = mCentroids[coinc.id_2];
+    CalibrationTable calibration(mCalibration, std::max(width(), height()));
+    mBiphotonClicks = biphoton_spectrum(mCentroids, mCoincidencePairs, tracker, calibration, TaskPool::global());
 
-        int channel1 = lines.closestLine(centroid1.x, centroid1.y);
-        int channel2 = lines.closestLine(centroid2.x, centroid2.y);
+    // the rate time series starts with the earliest centroid
+    double start = std::numeric_limits<double>::infinity();
+    for(auto &centroid : mCentroids)
+        start = std::min(start, centroid.toa);
+    mRateSeries = RateTimeSeries(mRateSeries.binWidth(), mRateSeries.coincidenceWindow(), mCentroids.empty() ? 0 : start);
 
-        double pix1, pix2;
-        if(h_lines) {
-            pix1 = centroid1.x;
-            pix2 = centroid2.x;
-        } else {
-            pix1 = centroid1.y;
-            pix2 = centroid2.y;
-        }
+    double min_wl, max_wl;
+    imageBounds(min_wl, max_wl);
+    mHOMHistogram = SpectralHOMHistogram(SPATIAL_CORR_SIZE, min_wl, max_wl, mHOMHistogram.segmentWidth(), mRateSeries.start());
+
+    for(auto &toas : mChannelToas)
+        toas.clear();
+    for(auto &centroid : mCentroids) {
+        auto channel = tracker.closestLine(centroid.x, centroid.y, centroid.toa);
+        mRateSeries.add(channel == 1 ? RateTimeSeries::SINGLES_1 : RateTimeSeries::SINGLES_2, centroid.toa);
+        mChannelToas[channel - 1].push_back(centroid.toa);
+    }
+
+    // the centroids are in cluster order, which is nearly in time order
+    for(auto &toas : mChannelToas)
+        tim::timsort(toas.begin(), toas.end());
+    for(auto &nfold : mCoincidenceNFold)
+        mRateSeries.add(RateTimeSeries::NFOLDS, mCentroids[nfold.ids.front()].toa);
 
-        mBiphotonClicks.push_back({
-            calibrate(mCalibration, channel1, pix1),
-            calibrate(mCalibration, channel2, pix2),
-            channel1,
-            channel2
-        });
+    for(std::size_t ix = 0; ix < mCoincidencePairs.size(); ++ix) {
+        auto &biphoton = mBiphotonClicks[ix];
+        if(biphoton.channel_1 == biphoton.channel_2)
+            continue;
+
+        auto toa = mCentroids[mCoincidencePairs[ix].id_1].toa;
+        mRateSeries.add(RateTimeSeries::PAIRS, toa);
+        mHOMHistogram.add(biphoton.wl_1, biphoton.wl_2, toa);
     }
 
+    mRateSeries.updateLevels();
+
+}
+
+const RateTimeSeries& Tpx3Image::rateTimeSeries() const {
+
+    if(mLive)
+        return mLive->rate_series;
+
+    return mRateSeries;
+
+}
+
+const SpectralHOMHistogram& Tpx3Image::homHistogram() const {
+
+    if(mLive)
+        return mLive->hom_histogram;
+
+    return mHOMHistogram;
+
 }
 
 void Tpx3Image::saveCoincsTo(const std::string &coinc_path) const {
@@ -368,10 +697,23 @@ void Tpx3Image::saveSinglesTo(const std::string &singles_path) const {
 
 void Tpx3Image::imageBounds(double &minWl, double &maxWl) const {
 
-    double max_bin = TPX3_SENSOR_SIZE - 1;
+    imageBounds(mCalibration, mGeometry, minWl, maxWl);
+
+}
+
+void Tpx3Image::imageBounds(const WavelengthCalibration &calibration, const DetectorGeometry &geometry, double &minWl, double &maxWl) {
 
-    minWl = std::min(mCalibration.intercept1, mCalibration.intercept2);
-    maxWl = std::max(mCalibration.intercept1 + mCalibration.slope1*max_bin,
-                     mCalibration.intercept2 + mCalibration.slope2*max_bin);
+    int num_bins = std::max(geometry.width, geometry.height);
+
+    // a nonlinear calibration need not be monotonic, so every pixel along the lines is checked
+    minWl = std::numeric_limits<double>::infinity();
+    maxWl = -std::numeric_limits<double>::infinity();
+    for(int channel = 1; channel <= 2; ++channel) {
+        for(int bin = 0; bin < num_bins; ++bin) {
+            auto wavelength = calibrate(calibration, channel, bin * PIXEL_SIZE);
+            minWl = std::min(minWl, wavelength);
+            maxWl = std::max(maxWl, wavelength);
+        }
+    }
 
 }
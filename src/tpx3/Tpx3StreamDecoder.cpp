@@ -0,0 +1,68 @@
+#include "tpx3.h"
+
+#include <stdexcept>
+
+using namespace spec_hom;
+
+constexpr std::size_t SIZE_OF_CHUNK_HEADER = 8; // in bytes
+constexpr std::size_t SIZE_OF_PACKET = 8; // in bytes
+
+Tpx3StreamDecoder::Tpx3StreamDecoder(Tpx3ImportSettings settings) :
+    mSettings(std::move(settings)),
+    mMask(PixelMask::forDecoding(mSettings.pixelMask, mSettings.spatialMask, mSettings.geometry.width, mSettings.geometry.height)),
+    mBuffer() {
+
+    // Do nothing
+
+}
+
+PixelData Tpx3StreamDecoder::feed(const char *bytes, std::size_t num_bytes) {
+
+    mBuffer.insert(mBuffer.end(), bytes, bytes + num_bytes);
+
+    PixelData data;
+    std::size_t chunk_pos = 0;
+
+    while(mBuffer.size() - chunk_pos >= SIZE_OF_CHUNK_HEADER) {
+
+        const uint8_t *chunk_header = mBuffer.data() + chunk_pos;
+
+        if (!(chunk_header[0] == 'T'
+              && chunk_header[1] == 'P'
+              && chunk_header[2] == 'X'
+              && chunk_header[3] == '3'))
+            throw std::runtime_error("Corrupt chunk header in Tpx3 stream");
+
+        int chip = chunk_header[4];
+        if(chip >= mSettings.geometry.numChips())
+            throw std::runtime_error("Data from chip " + std::to_string(chip) + ", but the detector geometry only has "
+                                     + std::to_string(mSettings.geometry.numChips()) + " chip(s)");
+
+        uint16_t chunk_size = (static_cast<uint16_t>(chunk_header[7]) << 8) + chunk_header[6];
+        if(chunk_size % SIZE_OF_PACKET)
+            throw std::runtime_error("Corrupt chunk header in Tpx3 stream");
+
+        // wait for the rest of the chunk
+        if(mBuffer.size() - chunk_pos < SIZE_OF_CHUNK_HEADER + chunk_size)
+            break;
+
+        std::string error;
+        bool error_is_warning = false;
+        if(!decode_packets(chunk_header + SIZE_OF_CHUNK_HEADER, chunk_size / SIZE_OF_PACKET, chip, mSettings, mMask, data, error, error_is_warning))
+            throw std::runtime_error(error);
+
+        chunk_pos += SIZE_OF_CHUNK_HEADER + chunk_size;
+
+    }
+
+    mBuffer.erase(mBuffer.begin(), mBuffer.begin() + static_cast<std::ptrdiff_t>(chunk_pos));
+
+    return data;
+
+}
+
+void Tpx3StreamDecoder::reset() {
+
+    mBuffer.clear();
+
+}
@@ -8,36 +8,131 @@
 #include <utility>
 #include <tuple>
 #include <array>
+#include <map>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <mutex>
 
 #include <QRunnable> // used to allow communications between the background thread and the UI
 #include <QObject>
 
-#include <dlib/optimization.h>
-
 #include "ui/threadutils.h"
 
 namespace spec_hom {
 
     constexpr double PIXEL_SIZE = 55e-6;
     constexpr double MIN_TICK = 1.5625e-9;
-    constexpr int TPX3_SENSOR_SIZE = 256;
+    constexpr int TPX3_SENSOR_SIZE = 256; // pixels along each edge of a single chip
     constexpr double TOT_UNIT_SIZE = 25e-9; // data in units of 25 ns
 
     using ToTCalibration = std::array<double, 1024>;
 
+    struct PixelAddr {
+        uint16_t x;
+        uint16_t y;
+    };
+
+    template<typename T>
+    using ImageXY = std::vector<std::vector<T>>;
+
+    // Where a single chip sits on the full sensor
+    struct ChipPlacement {
+        int x_offset, y_offset; // global position of the chip's pixel (0,0) [pixels]
+        bool rotated; // chip is mounted rotated by 180 degrees
+        int64_t clock_offset; // added to every ToA from this chip [units of MIN_TICK]
+    };
+
+    // Runtime layout of the detector; chips are indexed by the chip number in the chunk headers
+    struct DetectorGeometry {
+        int width, height; // size of the full sensor [pixels]
+        std::vector<ChipPlacement> chips;
+
+        static DetectorGeometry singleChip();
+        static DetectorGeometry quad(); // 2x2 arrangement of chips, with the top row rotated
+
+        [[nodiscard]] int numChips() const { return static_cast<int>(chips.size()); }
+        [[nodiscard]] PixelAddr toGlobal(int chip, unsigned chip_x, unsigned chip_y) const;
+    };
+
     struct SpatialMask {
         bool vertical; // horizontal if false
         int min1, max1, min2, max2; // min and max indices of the two lines
     };
 
+    // The smallest ToT the decoder keeps from each pixel; a disabled (e.g. hot) pixel keeps nothing. The spatial mask is
+    // folded in by forDecoding(), so that the decoder tests each packet with a single lookup.
+    class PixelMask {
+    public:
+        static constexpr uint16_t DISABLED = 0xFFFF; // above any 10-bit ToT
+
+        PixelMask(); // keeps every packet
+        PixelMask(int width, int height);
+
+        [[nodiscard]] bool empty() const { return mMinToT.empty(); }
+        [[nodiscard]] int width() const { return mWidth; }
+        [[nodiscard]] int height() const { return mHeight; }
+        [[nodiscard]] std::size_t numDisabled() const;
+        [[nodiscard]] std::size_t numThresholds() const; // pixels with a ToT threshold, but not disabled
+
+        [[nodiscard]] uint16_t minToT(int x, int y) const { return mMinToT[static_cast<std::size_t>(x) * mHeight + y]; }
+        [[nodiscard]] bool accepts(PixelAddr addr, uint16_t tot) const { return tot >= mMinToT[static_cast<std::size_t>(addr.x) * mHeight + addr.y]; }
+        void setMinToT(int x, int y, uint16_t tot); // a threshold of 0 keeps every packet
+        void disable(int x, int y) { setMinToT(x, y, DISABLED); }
+
+        // The table for the decoder: the given mask (where it overlaps the sensor) with the pixels outside the spatial
+        // mask disabled
+        static PixelMask forDecoding(const PixelMask &mask, const SpatialMask &spatial, int width, int height);
+
+        // Pixels that fire far more often than their neighbours, from counts per pixel (e.g. from prescan_counts())
+        static std::vector<PixelAddr> findHotPixels(const ImageXY<unsigned> &counts);
+
+        // Text file of "x, y, min_tot" lines, with min_tot "off" for a disabled pixel; pixels that keep every packet
+        // are not listed. load() throws std::runtime_error if the file cannot be read.
+        void save(const std::string &path) const;
+        static PixelMask load(const std::string &path, int width, int height);
+
+    private:
+        int mWidth, mHeight; // [pixels]
+        std::vector<uint16_t> mMinToT; // indexed by x * height + y
+    };
+
+    // Positions along the two lines [px] at which emission lines of known wavelength from a lamp fall, as in a
+    // .calib.csv file ("Wavelength [nm], Bin 1 [px], Bin 2 [px]")
+    struct CalibrationPoints {
+        std::vector<double> wavelengths; // [nm]
+        std::vector<double> bins1, bins2; // [px] along the lines of channels 1 and 2
+
+        [[nodiscard]] bool empty() const { return wavelengths.empty(); }
+
+        static CalibrationPoints load(const std::string &path); // throws std::runtime_error if the file cannot be read
+        void save(const std::string &path) const;
+    };
+
+    // Wavelength [nm] = intercept + slope * bin + nonlinear[0] * bin^2 + ... + nonlinear[MAX_ORDER - 2] * bin^MAX_ORDER,
+    // for a position along the line of bin pixels, with separate coefficients for each channel; or, if there are spline
+    // points, the natural cubic spline through them (extended linearly past the outermost points)
     struct WavelengthCalibration {
+        static constexpr int MAX_ORDER = 5;
+        static constexpr int SPLINE = 0; // order for fit()
+
         double slope1, intercept1;
         double slope2, intercept2;
+        std::array<double, MAX_ORDER - 1> nonlinear1 {}, nonlinear2 {}; // all 0 for a linear calibration
+        CalibrationPoints spline; // empty for a polynomial
+
+        [[nodiscard]] bool isLinear() const;
+
+        // A polynomial of the given order (1 to MAX_ORDER) fit to the points by least squares, or a spline through them
+        // (with the straight line fit to them as slope and intercept); throws std::runtime_error if there are too few
+        static WavelengthCalibration fit(const CalibrationPoints &points, int order);
     };
 
     struct Tpx3ImportSettings {
         int maxNumThreads;
+        DetectorGeometry geometry;
         SpatialMask spatialMask;
+        PixelMask pixelMask; // on top of the spatial mask; empty for none
 
         ToTCalibration totCorrection;
 
@@ -46,15 +141,14 @@ namespace spec_hom {
         int minClusterSize;
 
         double coincidenceWindow;
+        double rateBinWidth; // [s] finest bin of the rate time series
+        double lineTrackingWindow; // [s] the lines are fit again in windows this long; 0 to fit them once
+        double homSegmentWidth; // [s] of the time segments of the spectrally-resolved HOM histogram
+        bool keepPackets; // false to keep only the histograms of the raw packets once imported; see Tpx3Image::releasePackets()
 
         WavelengthCalibration calibration;
     };
 
-    struct PixelAddr {
-        uint8_t x;
-        uint8_t y;
-    };
-
     struct PixelData {
         std::vector<PixelAddr> addr;
         std::vector<int64_t> toa;
@@ -88,18 +182,37 @@ namespace spec_hom {
         int channel_1, channel_2; // which beam (top=1, bottom=2) the photon was in
     };
 
-    template<typename T>
-    using ImageXY = std::vector<std::vector<T>>;
+    // Fit of two Gaussian lines, optionally over a constant background, to a profile of counts across the lines, sampled
+    // at x = 0, 1, 2, ... The initial guess comes from the peaks of the smoothed profile; the fit is Levenberg-Marquardt
+    // with analytic derivatives, weighting each bin by its Poisson error. It takes microseconds for a sensor-wide profile.
+    struct LineProfileFit {
+        enum Param { AMPLITUDE_1 = 0, CENTRE_1, SIGMA_1, AMPLITUDE_2, CENTRE_2, SIGMA_2, BACKGROUND, NUM_PARAMS };
+
+        std::array<double, NUM_PARAMS> params {}; // [counts] and [bins]; line 1 is the higher peak of the initial guess
+        std::array<double, NUM_PARAMS> errors {}; // standard errors, scaled by chi2_per_dof if it is above 1; 0 if fixed
+        double chi2_per_dof = 0;
+        unsigned num_iterations = 0;
+        bool converged = false;
+
+        static LineProfileFit fit(const std::vector<double> &counts, bool background = true);
+
+        [[nodiscard]] double model(double x) const;
+    };
 
     class LinePair {
     public:
         LinePair(bool vertical, double line_1_pos, double line_2_pos, double line_1_sigma, double line_2_sigma);
 
-        // If these pointers are supplied, this function will return the fit data used
-        static LinePair find(ImageXY<unsigned> &image, bool h_lines, QVector<double> *x = nullptr, QVector<double> *y = nullptr, QVector<double> *fit_y = nullptr);
+        // If these pointers are supplied, this function will return the fit data used, and the fit with its uncertainties
+        static LinePair find(const ImageXY<unsigned> &image, bool h_lines, QVector<double> *x = nullptr, QVector<double> *y = nullptr,
+                             QVector<double> *fit_y = nullptr, LineProfileFit *fit = nullptr);
+        static bool isHorizontal(const ImageXY<unsigned> &image); // whether the lines in the image run along x
 
         void getRectBounds(double &min1, double &max1, double &min2, double &max2, double num_sigma);
-        int closestLine(double x, double y); // returns 1 if left line is nearest, 2 if right line is nearest (does not use sigma)
+        int closestLine(double x, double y) const; // returns 1 if left line is nearest, 2 if right line is nearest (does not use sigma)
+
+        [[nodiscard]] bool alongX() const { return mIsVertical; } // whether the lines run along x, as h_lines in find()
+        [[nodiscard]] double linePos(int line) const { return line == 1 ? mLine1Pos : mLine2Pos; } // [m] across the lines
 
     private:
         bool mIsVertical; // whether the lines are vertical (true) or horizontal (false)
@@ -107,51 +220,528 @@ namespace spec_hom {
         double mLine1Sigma, mLine2Sigma; // [um]
     };
 
-    class Tpx3Image {
+    // Follows the two lines through an acquisition, for runs long enough that they drift on the sensor. The raw packets
+    // are summed into profiles across and along the lines in consecutive time windows; across the lines, each window is
+    // fit as in LinePair::find, and along them, the spectrum of each line is cross-correlated with that of the first
+    // window that could be fit. Between the centres of the fit windows the drift is interpolated, and beyond them the
+    // nearest one is used, so a stream can use the windows fit so far. With no window length, it is the reference lines.
+    class LineTracker {
+    public:
+        LineTracker(const LinePair &reference, unsigned width, unsigned height, double window = 0, double start = 0); // [px], [s]
+
+        void add(PixelAddr addr, double toa); // a raw packet [s]; packets of windows already fit are dropped
+        void update(double toa); // fits the windows that end before toa [s]
+
+        [[nodiscard]] int closestLine(double x, double y, double toa) const; // [m], [s]; channel as in LinePair::closestLine
+        [[nodiscard]] double alongLine(double x, double y, int channel, double toa) const; // [m] less the drift along the line
+
+        // closestLine() and alongLine() for count clicks at once; without drift, this is a branch-free loop
+        void assign(std::size_t count, const double *x, const double *y, const double *toa, int *channel, double *along) const;
+        [[nodiscard]] std::size_t numFitWindows() const { return mFitWindows.size(); }
+
+    private:
+        struct Window {
+            std::vector<double> across; // [counts] per pixel across the lines
+            std::array<std::vector<double>, 2> along; // [counts] per pixel along each line
+            double time = 0; // [s] centre
+            std::array<double, 2> position {}; // [m] across the lines, of channels 1 and 2
+            std::array<double, 2> shift {}; // [m] along each line, relative to the reference window
+        };
+
+        struct Drift {
+            std::array<double, 2> position, shift; // as in Window
+        };
+
+        [[nodiscard]] Drift at(double toa) const;
+        bool fitWindow(Window &window); // false if it has too few counts, or the fit fails
+
+        LinePair mReference;
+        bool mAlongX;
+        unsigned mAcrossSize, mAlongSize; // [px]
+        double mWindow, mStart; // [s]
+        std::vector<Window> mWindows;
+        std::size_t mNumFinished; // windows before this one have been fit, or could not be
+        std::vector<std::size_t> mFitWindows; // in time order
+        std::size_t mReferenceWindow; // the first fit window, whose spectra the others are compared to
+    };
+
+    // Converts a position along a line [m] into a wavelength, for the given channel (1 or 2)
+    double calibrate(const WavelengthCalibration &calib, int channel, double bin);
+
+    // A calibration for many clicks: a linear one as it is, and any other tabulated at SUBDIVISIONS points per pixel
+    // along the lines and interpolated linearly between them (and from the end points beyond them), so that a
+    // polynomial or spline costs no more per click than a straight line
+    class CalibrationTable {
     public:
-        static constexpr unsigned WIDTH = TPX3_SENSOR_SIZE, HEIGHT = TPX3_SENSOR_SIZE;
+        static constexpr int SUBDIVISIONS = 16;
+
+        CalibrationTable(const WavelengthCalibration &calib, unsigned num_bins); // [px] along the lines
+
+        // calibrate() for count clicks at once, whose channels are all 1 or 2; a multiply and an add per click, or a
+        // table lookup, without branches
+        void apply(std::size_t count, const int *channel, const double *along, double *wavelength) const;
+
+    private:
+        bool mLinear;
+        std::array<double, 2> mSlope, mIntercept; // [nm/m], [nm] of each channel, if linear
+        std::size_t mNumPoints; // in the table of each channel
+        std::vector<double> mTable; // [nm] channel 1, then channel 2
+    };
+
+    // The channels and wavelengths of both clicks of every pair, from the lines at the time of each click. The pairs
+    // are done in parallel chunks, gathering the clicks of each chunk into arrays for the kernels above.
+    std::vector<SpectrumPair> biphoton_spectrum(const std::vector<ClusterCentroid> &centroids, const std::vector<CoincidencePair> &pairs,
+                                                const LineTracker &lines, const CalibrationTable &calib, TaskPool &pool);
+
+    // The number of pairs of a click from each of two time-sorted lists [s] at each delay toa_2 - toa_1, in 2 * half_bins
+    // + 1 bins of bin_width [s] centred on zero delay. The first list is swept in parallel blocks, each sliding a window
+    // over the second list from a binary search, so that every pair within range is counted rather than only neighbours.
+    std::vector<uint64_t> cross_correlation(const std::vector<double> &toa_1, const std::vector<double> &toa_2, double bin_width,
+                                            unsigned half_bins, TaskPool &pool);
+
+    // The argon emission lines that are usually used for the wavelength calibration [nm]
+    constexpr std::array<double, 8> ARGON_LINES {794.8176, 800.6157, 801.4786, 810.3693, 811.5311, 826.4522, 840.821, 842.4648};
+
+    // The positions along the line of the given channel [px] of the emission lines in an acquisition of a calibration
+    // lamp, in order. The centroids within three standard deviations of the line, found from their profile across the
+    // band of the spatial mask for the channel, are histogrammed along it in subdivisions bins per pixel, and the peaks
+    // above a fifteenth of the highest are the emission lines. Throws std::runtime_error unless there are num_lines.
+    std::vector<double> find_emission_lines(const std::vector<ClusterCentroid> &centroids, const SpatialMask &mask, int channel,
+                                            std::size_t num_lines, unsigned subdivisions = 2);
+
+    // A 2D histogram over a rectangle, with coarser levels that each sum 2x2 bins of the level below, so that a view can
+    // draw any region of it from a level with about as many bins as it has pixels. Each level is stored in square tiles
+    // that are only allocated once something falls in them, so that fine, mostly-empty histograms stay small.
+    class HistogramPyramid {
+    public:
+        static constexpr unsigned TILE_SIZE = 64; // bins along each side of a tile
+
+        HistogramPyramid(); // empty
+        HistogramPyramid(unsigned width, unsigned height, double x_min, double x_max, double y_min, double y_max); // all zero
+        HistogramPyramid(const ImageXY<unsigned> &image, double x_min, double x_max, double y_min, double y_max);
+
+        // Bins the points (x, y) = point(ix) for ix in [0, num_points) in parallel; each thread fills its own tiles,
+        // which are summed once it is done. With bilinear splatting, each point is shared between the four nearest bin
+        // centres. Points outside of the rectangle (or NaN) are skipped.
+        template<typename PointFn>
+        void fill(std::size_t num_points, const PointFn &point, bool bilinear = false, TaskPool &pool = TaskPool::global());
+        void add(double x, double y, double weight = 1); // into the finest level
+        void add(const HistogramPyramid &other); // same bins; into the finest level, so buildLevels() again after
+
+        void buildLevels(TaskPool &pool = TaskPool::global()); // sums the finest level into the coarser ones, once it has been filled
+
+        [[nodiscard]] bool empty() const { return !mWidth || !mHeight; }
+        [[nodiscard]] unsigned numLevels() const { return static_cast<unsigned>(mLevels.size()); }
+        [[nodiscard]] unsigned width(unsigned level = 0) const { return mLevels[level].width; }
+        [[nodiscard]] unsigned height(unsigned level = 0) const { return mLevels[level].height; }
+        [[nodiscard]] double xMin() const { return mXMin; }
+        [[nodiscard]] double xMax() const { return mXMax; }
+        [[nodiscard]] double yMin() const { return mYMin; }
+        [[nodiscard]] double yMax() const { return mYMax; }
+        [[nodiscard]] double binWidthX(unsigned level = 0) const;
+        [[nodiscard]] double binWidthY(unsigned level = 0) const;
+        [[nodiscard]] double at(unsigned level, unsigned x, unsigned y) const;
+        [[nodiscard]] std::size_t memsize() const; // [bytes] of the allocated tiles
+
+        // Calls bin(x, y, count) for the non-zero bins of a level within [first_x, last_x) by [first_y, last_y),
+        // skipping the tiles that were never filled
+        template<typename BinFn>
+        void forEachBin(unsigned level, unsigned first_x, unsigned last_x, unsigned first_y, unsigned last_y, const BinFn &bin) const;
+
+        // sums of the bins of a level along y (for each x bin) or along x (for each y bin)
+        [[nodiscard]] std::vector<double> marginalX(unsigned level = 0) const;
+        [[nodiscard]] std::vector<double> marginalY(unsigned level = 0) const;
+
+        // finest level at which a region of the given size spans at most max_bins_x by max_bins_y bins
+        [[nodiscard]] unsigned levelFor(double x_span, double y_span, unsigned max_bins_x, unsigned max_bins_y) const;
+
+        // bins [first, last) of a level that overlap the interval [min, max] along x (or y)
+        void binRangeX(unsigned level, double min, double max, unsigned &first, unsigned &last) const;
+        void binRangeY(unsigned level, double min, double max, unsigned &first, unsigned &last) const;
+
+    private:
+        struct Level {
+            Level(unsigned width, unsigned height);
+
+            double& bin(unsigned x, unsigned y); // allocates the tile if needed
+            void add(const Level &other); // same size
+
+            unsigned width, height; // [bins]
+            unsigned tiles_x, tiles_y;
+            std::vector<std::vector<double>> tiles; // indexed as [tile_x * tiles_y + tile_y], each as [x * TILE_SIZE + y]; empty if all zero
+        };
+
+        void splat(Level &level, double x, double y, double weight, bool bilinear) const;
+
+        double mXMin, mXMax, mYMin, mYMax;
+        unsigned mWidth, mHeight; // of the finest level
+        std::vector<Level> mLevels; // finest first
+    };
+
+    template<typename PointFn>
+    void HistogramPyramid::fill(std::size_t num_points, const PointFn &point, bool bilinear, TaskPool &pool) {
+
+        // one chunk per thread, so that each thread only allocates and sums one set of tiles
+        std::mutex merge_mutex;
+        auto grain = std::max<std::size_t>(num_points / (pool.numThreads() + 1) + 1, 1 << 14);
+
+        pool.parallelFor(num_points, grain, [&](std::size_t begin, std::size_t end) {
+            Level local(mWidth, mHeight);
+            for(auto ix = begin; ix < end; ++ix) {
+                auto [x, y] = point(ix);
+                splat(local, x, y, 1, bilinear);
+            }
+
+            std::lock_guard lock(merge_mutex);
+            mLevels.front().add(local);
+        });
+
+    }
+
+    template<typename BinFn>
+    void HistogramPyramid::forEachBin(unsigned level, unsigned first_x, unsigned last_x, unsigned first_y, unsigned last_y, const BinFn &bin) const {
+
+        auto &lv = mLevels[level];
+        last_x = std::min(last_x, lv.width);
+        last_y = std::min(last_y, lv.height);
+        if(first_x >= last_x || first_y >= last_y)
+            return;
+
+        for(auto tile_x = first_x / TILE_SIZE; tile_x <= (last_x - 1) / TILE_SIZE; ++tile_x) {
+            for(auto tile_y = first_y / TILE_SIZE; tile_y <= (last_y - 1) / TILE_SIZE; ++tile_y) {
+                auto &tile = lv.tiles[static_cast<std::size_t>(tile_x) * lv.tiles_y + tile_y];
+                if(tile.empty())
+                    continue;
+
+                auto x_begin = std::max(first_x, tile_x * TILE_SIZE), x_end = std::min(last_x, (tile_x + 1) * TILE_SIZE);
+                auto y_begin = std::max(first_y, tile_y * TILE_SIZE), y_end = std::min(last_y, (tile_y + 1) * TILE_SIZE);
+                for(auto x = x_begin; x < x_end; ++x) {
+                    for(auto y = y_begin; y < y_end; ++y) {
+                        auto count = tile[(x % TILE_SIZE) * TILE_SIZE + y % TILE_SIZE];
+                        if(count != 0)
+                            bin(x, y, count);
+                    }
+                }
+            }
+        }
+
+    }
+
+    // Counts of the singles in each channel, of the pairs between the channels, and of the n-folds, per time bin, for
+    // following drifts in the rates over an acquisition. The bins are summed pairwise into coarser and coarser levels,
+    // so that any time range can be drawn from a level with about as many bins as there are pixels on screen.
+    class RateTimeSeries {
+    public:
+        enum Series { SINGLES_1 = 0, SINGLES_2, PAIRS, NFOLDS, ACCIDENTALS, NUM_SERIES }; // accidentals are estimated, not counted
+
+        RateTimeSeries(double bin_width = 1, double coincidence_window = 0, double start = 0); // [s]
 
+        void add(Series series, double toa); // toa [s]; events before the start are put in the first bin
+        void updateLevels(); // sums the bins added to since the last call into the coarser levels
+        void append(const RateTimeSeries &other); // its bins (of the same width) follow the last bin of this series
+
+        [[nodiscard]] bool empty() const { return mBins[0].empty(); }
+        [[nodiscard]] double start() const { return mStart; } // [s]
+        [[nodiscard]] double duration() const; // [s] covered by the bins
+        [[nodiscard]] double binWidth(unsigned level = 0) const; // [s]
+        [[nodiscard]] double coincidenceWindow() const { return mCoincidenceWindow; } // [s]
+        [[nodiscard]] unsigned numLevels() const { return static_cast<unsigned>(mLevels.size()) + 1; }
+        [[nodiscard]] std::size_t numBins(unsigned level = 0) const;
+
+        // finest level with at most max_bins bins between the given times since the start [s]
+        [[nodiscard]] unsigned levelFor(double t_min, double t_max, std::size_t max_bins) const;
+
+        // Rates [1/s] at the centres of the bins of a level that overlap the given times since the start [s]. The rate
+        // of accidentals is 2 * window * R1 * R2, from the singles rates R1 and R2 in each bin.
+        [[nodiscard]] std::pair<QVector<double>, QVector<double>> rates(Series series, unsigned level, double t_min, double t_max) const;
+
+    private:
+        static constexpr int NUM_COUNTED = ACCIDENTALS;
+
+        [[nodiscard]] uint64_t count(int series, unsigned level, std::size_t bin) const;
+
+        double mBinWidth; // [s] of the finest level
+        double mCoincidenceWindow; // [s]
+        double mStart; // [s]
+        std::array<std::vector<uint32_t>, NUM_COUNTED> mBins; // finest level
+        std::vector<std::array<std::vector<uint64_t>, NUM_COUNTED>> mLevels; // each bin is the sum of two of the level below
+        std::size_t mFirstChangedBin; // in the finest level, since the last updateLevels()
+    };
+
+    // The pairs between the channels binned by both wavelengths and by the segment of the acquisition they arrived in,
+    // for spectrally-resolved HOM: with the delay stepped during an acquisition, each segment is one delay. The pairs
+    // lie in a narrow band across the wavelength plane, so each row of wavelength 1 in a segment only stores the
+    // wavelength 2 bins from its first to its last non-zero one.
+    class SpectralHOMHistogram {
+    public:
+        SpectralHOMHistogram(); // empty
+        SpectralHOMHistogram(unsigned num_bins, double wl_min, double wl_max, double segment_width, double start); // [nm], [s]
+
+        void add(double wl_1, double wl_2, double toa); // toa [s]; pairs before the start are put in the first segment
+        void append(const SpectralHOMHistogram &other); // its segments (of the same bins) follow the last segment of this one
+
+        [[nodiscard]] bool empty() const { return !mNumBins; }
+        [[nodiscard]] unsigned numBins() const { return mNumBins; } // along each wavelength
+        [[nodiscard]] std::size_t numSegments() const { return mSegments.size(); }
+        [[nodiscard]] double wlMin() const { return mWlMin; } // [nm]
+        [[nodiscard]] double wlMax() const { return mWlMax; } // [nm]
+        [[nodiscard]] double segmentWidth() const { return mSegmentWidth; } // [s]
+        [[nodiscard]] double start() const { return mStart; } // [s]
+        [[nodiscard]] uint64_t numPairs() const { return mNumPairs; }
+        [[nodiscard]] std::size_t memsize() const; // [bytes] of the stored bins
+
+        // The wavelength plane summed over segments [first, last), for the 2D views
+        [[nodiscard]] HistogramPyramid slice(std::size_t first, std::size_t last) const;
+
+        // The pairs in each segment with wavelengths within [wl_1_min, wl_1_max) and [wl_2_min, wl_2_max) [nm], i.e. the
+        // HOM scan of one region of the joint spectrum
+        [[nodiscard]] std::vector<uint64_t> segmentCounts(double wl_1_min, double wl_1_max, double wl_2_min, double wl_2_max) const;
+
+        // Binary file of all the bands, in native byte order; see the README for the layout. Throws std::runtime_error
+        // if it cannot be written.
+        void save(const std::string &path) const;
+
+    private:
+        struct Band {
+            unsigned first = 0; // wavelength 2 bin of counts[0]
+            std::vector<uint32_t> counts;
+        };
+        using Segment = std::vector<Band>; // one per wavelength 1 bin; empty until a pair falls in the segment
+
+        [[nodiscard]] bool binRange(double wl_min, double wl_max, unsigned &first, unsigned &last) const; // [first, last)
+
+        unsigned mNumBins;
+        double mWlMin, mWlMax; // [nm]
+        double mSegmentWidth; // [s]
+        double mStart; // [s]
+        uint64_t mNumPairs;
+        std::vector<Segment> mSegments;
+    };
+
+    // Histograms accumulated over a stream of data, for live views. The bins are those of the matching Tpx3Image
+    // functions, which return these instead of recomputing them for a live image.
+    struct LiveHistograms {
+        static constexpr unsigned NUM_TOT = 1024;
+        static constexpr unsigned NUM_START_STOP_BINS = 4096; // in units of MIN_TICK
+        static constexpr unsigned G2_HALF_BINS = 256; // in units of MIN_TICK, either side of zero delay
+
+        LiveHistograms(unsigned width, unsigned height);
+
+        // Sums other into these histograms, e.g. to aggregate the files of a measurement. The rate time series and HOM
+        // segments of other follow those of these histograms, as if its data had been acquired right after.
+        void add(const LiveHistograms &other);
+
+        std::size_t num_packets = 0;
+        std::size_t num_clusters = 0;
+        std::size_t num_pairs = 0;
+        std::size_t num_nfolds = 0;
+        std::size_t num_late_packets = 0; // arrived after their time had already been processed, and were dropped
+        std::size_t num_pending_packets = 0; // held back for the look-back time
+        double data_time = 0; // [s] ToA span of the processed data
+        double pending_time = 0; // [s] ToA span of the packets held back
+        bool lines_found = false; // spatial correlations and rates are only accumulated once the lines have been fit
+        std::size_t num_files = 0; // summed into these histograms, if they aggregate imported files
+
+        // filled in by sources that receive the data over the network
+        std::size_t num_received_bytes = 0;
+        std::size_t num_dropped_bytes = 0; // did not fit in the receive buffer (UDP only; TCP is slowed down instead)
+        std::size_t num_dropped_datagrams = 0;
+        double buffer_fill = 0; // highest fraction of the receive buffer in use since the last update
+
+        ImageXY<unsigned> raw_image;
+        ImageXY<unsigned> cluster_image;
+        HistogramPyramid spatial_correlations; // finest level only; empty until the lines have been fit
+        std::vector<uint64_t> tot_counts; // per ToT value
+        std::vector<uint64_t> start_stop_counts; // per MIN_TICK
+        std::vector<uint64_t> dtoa_counts; // per ToT value
+        std::vector<double> dtoa_sums, dtoa_sq_sums; // per ToT value [s], [s^2]
+        std::vector<uint64_t> g2_counts; // per MIN_TICK of delay from channel 1 to channel 2, from -G2_HALF_BINS
+        std::array<uint64_t, 2> g2_clicks {}; // in each channel, for the normalisation of g2_counts
+        double g2_time = 0; // [s] spanned by the clicks in g2_counts
+        RateTimeSeries rate_series; // empty until the lines have been fit
+        SpectralHOMHistogram hom_histogram; // empty until the lines have been fit
+    };
+
+    // Timing and throughput of one import stage
+    struct StageStats {
+        std::string name;
+        double wall_time = 0; // [s]
+        double busy_time = 0; // [s] summed over all threads that worked on the stage
+        std::size_t num_packets = 0; // raw packets in the file(s)
+        std::size_t num_bytes = 0; // size of the file(s) [bytes]
+        std::size_t peak_memory = 0; // peak resident memory of the whole process at the end of the stage [bytes]
+        unsigned num_threads = 1; // threads available to the stage
+
+        [[nodiscard]] double packetsPerSecond() const;
+        [[nodiscard]] double bytesPerSecond() const;
+        [[nodiscard]] double threadUtilisation() const; // between 0 and 1
+    };
+
+    // Per-stage statistics for importing one file, or a batch of files
+    struct ImportStats {
+        std::string filename; // empty for a batch
+        std::size_t num_files = 0;
+        std::size_t num_packets = 0;
+        std::size_t file_size = 0; // [bytes]
+        std::vector<StageStats> stages; // in the order they were run
+
+        [[nodiscard]] bool empty() const { return stages.empty(); }
+        [[nodiscard]] double totalWallTime() const; // [s]
+
+        void add(const ImportStats &other); // merges another file's stats into this batch, stage by stage
+
+        [[nodiscard]] std::string summary() const; // one line per stage, for the log
+        [[nodiscard]] std::string toJson() const;
+        void saveTo(const std::string &json_path) const;
+
+        static std::size_t peakResidentMemory(); // [bytes], or 0 if unknown on this platform
+    };
+
+    // Times one stage of an import, and appends it to stats once stopped (or destroyed)
+    class StageTimer {
+    public:
+        StageTimer(ImportStats &stats, std::string name);
+        StageTimer(const StageTimer &rhs) = delete;
+        ~StageTimer();
+
+        void stop();
+
+    private:
+        ImportStats &mStats;
+        std::string mName;
+        WorkTimer mTimer;
+        bool mStopped;
+    };
+
+    class Tpx3Image {
+    public:
         Tpx3Image(std::string fname, PixelData &&raw_data, ClusterData &&clusters, std::vector<ClusterCentroid> &&centroids,
                   std::vector<CoincidencePair> &&coinc_pairs, std::vector<CoincidenceNFold> &&coinc_nfolds,
-                  WavelengthCalibration calibration);
+                  WavelengthCalibration calibration, DetectorGeometry geometry, double coincidence_window, double rate_bin_width,
+                  double line_tracking_window = 0, double hom_segment_width = 1);
+        Tpx3Image(std::string fname, WavelengthCalibration calibration, DetectorGeometry geometry); // live image, see setLiveHistograms()
         Tpx3Image(const Tpx3Image &rhs) = delete; // this object is large; better to avoid unnecessary copies
         ~Tpx3Image() = default;
 
         [[nodiscard]] std::string filename() const;
         [[nodiscard]] const std::string& fullFilename() const;
+        // The raw packets; once released, they are read from the source file again the first time they are needed.
+        // Only one attempt is made: if it fails, the std::runtime_error is thrown and the packets stay empty.
         PixelData& data();
         [[nodiscard]] const PixelData& data() const;
         [[nodiscard]] unsigned long numRawPackets() const;
         [[nodiscard]] unsigned long numClusters() const;
         [[nodiscard]] bool empty() const;
 
+        [[nodiscard]] unsigned width() const { return mGeometry.width; }
+        [[nodiscard]] unsigned height() const { return mGeometry.height; }
+        [[nodiscard]] const DetectorGeometry& geometry() const { return mGeometry; }
+        [[nodiscard]] const WavelengthCalibration& calibration() const { return mCalibration; }
+
+        [[nodiscard]] const ImportStats& importStats() const { return mImportStats; }
+        void setImportStats(ImportStats stats) { mImportStats = std::move(stats); }
+
+        // Frees the raw packets and the cluster of each packet, keeping only their histograms (raw image, ToT and dToA),
+        // which are all that the views need of them; reload is called if data() is needed afterwards
+        void releasePackets(std::function<PixelData()> reload);
+        [[nodiscard]] bool packetsReleased() const { return static_cast<bool>(mPackets); }
+        [[nodiscard]] std::size_t packetMemsize() const; // [bytes] of the raw packets and their cluster ids
+
+        // A live image holds no events; its histograms are replaced as a stream is processed
+        [[nodiscard]] bool isLive() const { return static_cast<bool>(mLive); }
+        [[nodiscard]] const LiveHistograms* liveHistograms() const { return mLive.get(); }
+        void setLiveHistograms(std::unique_ptr<LiveHistograms> histograms);
+
+        // The histograms of this image in the bins a live image has them, so that those of many files can be summed
+        // into one image (see merge_summaries()) without keeping their data
+        [[nodiscard]] LiveHistograms summary() const;
+
         void imageBounds(double &minWl, double &maxWl) const;
+        static void imageBounds(const WavelengthCalibration &calibration, const DetectorGeometry &geometry, double &minWl, double &maxWl);
 
         [[nodiscard]] ImageXY<unsigned> rawPacketImage() const;
         [[nodiscard]] std::pair<QVector<double>, QVector<double>> toTDistribution(unsigned hist_bin_size = 1) const;
         [[nodiscard]] ImageXY<unsigned> clusterImage() const;
         [[nodiscard]] std::pair<QVector<double>, QVector<double>> startStopHistogram(double hist_bin_size = MIN_TICK, unsigned num_bins = 128) const; // hist_size in seconds
+        // g2 between the channels against the delay from a click in channel 1 to one in channel 2 [s], over all pairs of
+        // clicks in 2 * half_bins + 1 bins centred on zero delay; uncorrelated clicks give 1
+        [[nodiscard]] std::pair<QVector<double>, QVector<double>> crossCorrelation(double hist_bin_size = MIN_TICK,
+                                                                                   unsigned half_bins = LiveHistograms::G2_HALF_BINS) const;
         [[nodiscard]] std::tuple<QVector<double>, QVector<double>, QVector<double>> dToADistribution(unsigned hist_bin_size = 1) const;
 
+        // The joint spectrum of the pairs between the channels, over the wavelength range in SPATIAL_CORR_SIZE times
+        // subdivisions bins along each axis. It is stored in sparse tiles, as it is mostly empty away from the
+        // anti-diagonal, and has only its finest level; see spatialCorrelationPyramid() for a zoomable one.
         static constexpr int SPATIAL_CORR_SIZE = TPX3_SENSOR_SIZE;
-        [[nodiscard]] ImageXY<unsigned> spatialCorrelations() const;
+        static constexpr unsigned MAX_SUBDIVISIONS = 16;
+        [[nodiscard]] HistogramPyramid spatialCorrelations(unsigned subdivisions = 1, bool bilinear = false) const;
+        [[nodiscard]] const RateTimeSeries& rateTimeSeries() const;
+        [[nodiscard]] const SpectralHOMHistogram& homHistogram() const; // pairs between the channels, binned as in spatialCorrelations()
+
+        // The same histograms for zoomable views. Raw and cluster images are in pixels, and spatial correlations in
+        // wavelength. Centroids and biphotons keep their sub-pixel precision in bins subdivisions times finer than
+        // those of clusterImage(). A live image has only the bins of its live histograms.
+        [[nodiscard]] HistogramPyramid rawImagePyramid() const;
+        [[nodiscard]] HistogramPyramid clusterImagePyramid(unsigned subdivisions = 4, bool bilinear = false) const;
+        [[nodiscard]] HistogramPyramid spatialCorrelationPyramid(unsigned subdivisions = MAX_SUBDIVISIONS, bool bilinear = false) const;
 
         void saveCoincsTo(const std::string &coinc_path) const;
         void saveSinglesTo(const std::string &singles_path) const;
 
     private:
-        void initializeSpectrum();
+        // the histograms of the raw packets, in the bins of LiveHistograms
+        struct PacketHistograms {
+            std::size_t num_packets = 0;
+            double data_time = 0; // [s] ToA span of the packets
+            ImageXY<unsigned> raw_image;
+            std::vector<uint64_t> tot_counts, dtoa_counts;
+            std::vector<double> dtoa_sums, dtoa_sq_sums; // [s], [s^2]
+        };
+
+        void initializeSpectrum(double line_tracking_window);
+        [[nodiscard]] PacketHistograms packetHistograms() const;
 
         std::string mFileName;
-        PixelData mRawData;
+        mutable PixelData mRawData; // reloaded by data() once released
+        mutable std::mutex mRawDataMutex;
+        std::unique_ptr<PacketHistograms> mPackets; // once the raw packets have been released
+        mutable std::function<PixelData()> mReloadPackets; // cleared once called
         ClusterData mClusters;
         std::vector<ClusterCentroid> mCentroids;
         std::vector<CoincidencePair> mCoincidencePairs;
         std::vector<CoincidenceNFold> mCoincidenceNFold;
         std::vector<SpectrumPair> mBiphotonClicks;
+        std::array<std::vector<double>, 2> mChannelToas; // [s] of the centroids in each channel, in time order
+        RateTimeSeries mRateSeries;
+        SpectralHOMHistogram mHOMHistogram;
         WavelengthCalibration mCalibration;
+        DetectorGeometry mGeometry;
+        ImportStats mImportStats;
+        std::unique_ptr<LiveHistograms> mLive;
     };
 
+    // Groups files by the parts of their paths matched by the groups of a regular expression (or by the whole match, if
+    // it has none); files it does not match are left out, and an empty pattern puts all files in one group. Throws
+    // std::regex_error (a std::runtime_error) if the pattern is not valid.
+    std::map<std::string, std::vector<std::string>> group_files(const std::vector<std::string> &files, const std::string &pattern);
+
+    // The sum of the summaries of several files (see Tpx3Image::summary()), with the time series in the order given.
+    // Neighbouring summaries are added in pairs in parallel, then the pairs of those, and so on.
+    LiveHistograms merge_summaries(const std::vector<std::shared_ptr<const LiveHistograms>> &summaries, TaskPool &pool);
+
+    // Sorts the packets by time of arrival (stable)
+    void sort_timestamps(PixelData &data, TaskPool &pool);
+
+    // Decodes the packets of one chunk from the given chip, appending those the mask (from PixelMask::forDecoding())
+    // accepts to out. Returns false and sets error if the chunk holds packets that cannot be decoded.
+    bool decode_packets(const uint8_t *packets, unsigned num_packets, int chip, const Tpx3ImportSettings &settings,
+                        const PixelMask &mask, PixelData &out, std::string &error, bool &error_is_warning);
+
+    // Counts per pixel from about max_bytes of a raw file, read in stretches spread evenly over it (or all of a smaller
+    // file), with the pixel mask but not the spatial mask; e.g. to find hot pixels or set the spatial mask in well
+    // under a second, whatever the size of the file. Throws std::runtime_error if the file cannot be read.
+    ImageXY<unsigned> prescan_counts(const std::string &fname, const Tpx3ImportSettings &settings, std::size_t max_bytes);
+
     // Loads a given file into a vector of PixelData's
     class LoadRawFileThread : public BgThread {
     Q_OBJECT
@@ -161,6 +751,23 @@ namespace spec_hom {
 
         void execute() override;
 
+        static std::size_t estimatePeakMemory(std::size_t file_size); // [bytes]
+
+        // The centroids of a whole file, from the stages below run on the calling thread, e.g. for a short calibration
+        // acquisition; throws std::runtime_error if the file cannot be read. Given a job, the stages report their
+        // progress to it and stop (returning no centroids) once it is cancelled.
+        static std::vector<ClusterCentroid> loadCentroids(const std::string &fname, const Tpx3ImportSettings &settings,
+                                                          BgThread *job = nullptr);
+        // The raw packets of a whole file in time order, e.g. to reload those of an image; throws std::runtime_error as above
+        static PixelData loadPackets(const std::string &fname, const Tpx3ImportSettings &settings);
+
+        // The individual import stages, in the order execute() runs them (with sort_timestamps() after parsing).
+        // These are public so that they can be benchmarked on their own.
+        PixelData parseRawData();
+        ClusterData cluster(const PixelData &data);
+        std::vector<ClusterCentroid> centroid(const PixelData &data, const ClusterData &clusters);
+        std::pair<std::vector<CoincidencePair>, std::vector<CoincidenceNFold>> findCoincidences(const ClusterData &clusters, const std::vector<ClusterCentroid> &centroids);
+
     signals:
         void yieldPixelData(spec_hom::Tpx3Image *data);
 
@@ -169,14 +776,150 @@ namespace spec_hom {
                     std::vector<CoincidencePair> &&coinc_pairs, std::vector<CoincidenceNFold> &&coinc_nfolds);
         void finish(); // calls previous function, but with all arguments initialized from empty list
 
-        PixelData parseRawData();
-        ClusterData cluster(const PixelData &data);
-        std::vector<ClusterCentroid> centroid(const PixelData &data, const ClusterData &clusters);
-        std::pair<std::vector<CoincidencePair>, std::vector<CoincidenceNFold>> findCoincidences(const ClusterData &clusters, const std::vector<ClusterCentroid> &centroids);
+        int clusterSlab(const PixelData &raw_data, std::size_t begin, std::size_t end, std::vector<int> &packet_clusters,
+                        std::atomic<std::size_t> &clustered_packets); // returns the number of clusters in the slab
 
         std::string mFileName;
         Tpx3ImportSettings mImportSettings;
         bool mRawPacketsOnly;
+        ImportStats mStats;
+    };
+
+    // Finds the argon emission lines in an acquisition of the lamp for each channel (the same file can be given for
+    // both), and yields their positions as calibration points
+    class ArgonCalibrationThread : public BgThread {
+    Q_OBJECT
+
+    public:
+        ArgonCalibrationThread(std::array<std::string, 2> filenames, Tpx3ImportSettings settings);
+
+        void execute() override;
+
+    signals:
+        void yieldCalibrationPoints(spec_hom::CalibrationPoints *points);
+
+    private:
+        std::array<std::string, 2> mFileNames;
+        Tpx3ImportSettings mImportSettings;
+    };
+
+    // Decodes a raw .tpx3 byte stream that arrives in pieces (from a growing file or a socket); a chunk split between
+    // pieces is kept until the rest of it arrives
+    class Tpx3StreamDecoder {
+    public:
+        explicit Tpx3StreamDecoder(Tpx3ImportSettings settings);
+
+        // decodes every complete chunk received so far; throws std::runtime_error if the stream is corrupt
+        PixelData feed(const char *bytes, std::size_t num_bytes);
+        void reset(); // drops any partial chunk, e.g. when the stream starts again
+
+        [[nodiscard]] std::size_t bufferedBytes() const { return mBuffer.size(); }
+
+    private:
+        Tpx3ImportSettings mSettings;
+        PixelMask mMask; // as decoded
+        std::vector<uint8_t> mBuffer; // bytes received but not yet decoded
+    };
+
+    // Clusters, centroids and finds coincidences in a stream of packets, and accumulates the results in histograms.
+    // Packets are held back for a bounded look-back time in case earlier packets are still to arrive (from another
+    // chip, or in a later chunk), and are then processed in batches that end at a gap in time longer than the cluster
+    // and coincidence windows, so that no cluster or coincidence is split between batches.
+    class StreamProcessor {
+    public:
+        StreamProcessor(Tpx3ImportSettings settings, double look_back); // look_back in [s]
+
+        void push(PixelData &&packets); // packets in any order, with the timestamps as decoded
+        void process(bool flush = false); // processes the packets older than the look-back (all packets if flush)
+
+        [[nodiscard]] const LiveHistograms& histograms() const { return mHistograms; }
+        [[nodiscard]] std::size_t numPendingPackets() const { return mPending.numPackets(); }
+
+        // called after each batch has been processed, e.g. to measure how long results take to come out
+        using BatchCallback = std::function<void(const PixelData &batch, const std::vector<ClusterCentroid> &centroids,
+                                                 const std::vector<CoincidencePair> &coinc_pairs)>;
+        void setBatchCallback(BatchCallback callback) { mBatchCallback = std::move(callback); }
+
+    private:
+        void processBatch(PixelData &&batch);
+        void updateCrossCorrelation(std::array<std::vector<double>, 2> &&channel_toas); // clicks of each channel, including mG2Tail
+
+        Tpx3ImportSettings mSettings;
+        int64_t mLookBack; // [ticks]
+        int64_t mMinGap; // [ticks] gap that no cluster or coincidence spans
+        std::unique_ptr<LoadRawFileThread> mStages; // runs the same stages as a file import
+        PixelData mPending; // packets not processed yet
+        int64_t mNewestToa; // [ticks]
+        int64_t mProcessedToa; // [ticks] all packets up to this time have been processed
+        int64_t mFirstToa; // [ticks]
+        bool mHasData;
+        double mLastCentroidToa; // [s] for start-stop intervals across batches
+        std::array<std::vector<double>, 2> mG2Tail; // [s] clicks of each channel close enough to the end of the last batch to pair with the next
+        double mG2Start; // [s] first click in the g2 histogram
+        std::unique_ptr<LineTracker> mLines; // once there is enough data to fit them
+        CalibrationTable mCalibration;
+        double mMinWl, mMaxWl;
+        LiveHistograms mHistograms;
+        BatchCallback mBatchCallback;
+    };
+
+    // Source of data that arrives during an acquisition; yields the accumulated histograms every refresh interval
+    // until cancelled
+    class LiveSourceThread : public BgThread {
+    Q_OBJECT
+
+    public:
+        LiveSourceThread(std::string name, Tpx3ImportSettings settings, double refresh_interval, double look_back);
+
+        [[nodiscard]] const std::string& name() const { return mName; } // file or address the data comes from
+
+    signals:
+        void yieldLiveHistograms(spec_hom::LiveHistograms *histograms);
+
+    protected:
+        std::string mName;
+        Tpx3ImportSettings mImportSettings;
+        double mRefreshInterval; // [s]
+        double mLookBack; // [s]
+    };
+
+    // Follows a .tpx3 file that is still being written, decoding only the newly appended chunks
+    class FollowRawFileThread : public LiveSourceThread {
+    Q_OBJECT
+
+    public:
+        FollowRawFileThread(const std::string &fname, Tpx3ImportSettings settings, double refresh_interval, double look_back);
+
+        void execute() override;
+    };
+
+    // Receives raw .tpx3 chunks over TCP (e.g. from Serval) or UDP. A receiver thread copies the socket data into a
+    // lock-free ring, which this thread decodes and processes. When the ring is full, TCP reads pause so that the
+    // sender is slowed down; UDP datagrams are dropped and counted instead, so each datagram must hold whole chunks.
+    class StreamSocketThread : public LiveSourceThread {
+    Q_OBJECT
+
+    public:
+        StreamSocketThread(const std::string &host, uint16_t port, bool udp, std::size_t buffer_size,
+                           Tpx3ImportSettings settings, double refresh_interval, double look_back);
+
+        void execute() override;
+
+    private:
+        void receive(ByteRing &ring); // runs on the receiver thread
+
+        std::string mHost;
+        uint16_t mPort;
+        bool mUdp;
+        std::size_t mBufferSize; // [bytes]
+
+        // shared with the receiver thread
+        std::atomic<bool> mStopReceiving;
+        std::atomic<bool> mReceiverDone;
+        std::string mReceiverError; // written before mReceiverDone is set
+        std::atomic<std::size_t> mReceivedBytes;
+        std::atomic<std::size_t> mDroppedBytes;
+        std::atomic<std::size_t> mDroppedDatagrams;
     };
 
 }
@@ -14,7 +14,10 @@ AppActions::AppActions(QWidget *parent) :
     deleteFile(new QAction(parent)),
     openFileTab(new QAction(parent)),
     lockUiForMasking(new QAction(parent)),
-    unlockUi(new QAction(parent)) {
+    unlockUi(new QAction(parent)),
+    followLiveFile(new QAction(parent)),
+    followLiveStream(new QAction(parent)),
+    aggregateFiles(new QAction(parent)) {
 
     // Do nothing
 
@@ -1,13 +1,11 @@
 #include "threadutils.h"
 
-#include "ui.h"
-
 using namespace spec_hom;
 
 BgThread::BgThread() :
     QObject(),
     QRunnable(),
-    mShouldCancel(false) {
+    mProgress(std::make_shared<JobProgress>()) {
 
     // Do nothing
 
@@ -20,14 +18,8 @@ void BgThread::run() {
 
 }
 
-bool BgThread::shouldCancel() const {
-
-    return mShouldCancel;
-
-}
-
 void BgThread::cancel() {
 
-    mShouldCancel = true;
+    mProgress->cancelled.store(true, std::memory_order_relaxed);
 
 }
\ No newline at end of file
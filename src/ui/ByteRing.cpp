@@ -0,0 +1,77 @@
+#include "threadutils.h"
+
+#include <bit>
+#include <cstring>
+
+using namespace spec_hom;
+
+ByteRing::ByteRing(std::size_t capacity) :
+    mData(std::bit_ceil(std::max<std::size_t>(capacity, 1))),
+    mMask(mData.size() - 1),
+    mWritePos(0),
+    mReadPos(0) {
+
+    // Do nothing
+
+}
+
+std::size_t ByteRing::write(const char *bytes, std::size_t num_bytes) {
+
+    auto write_pos = mWritePos.load(std::memory_order_relaxed);
+    auto free = capacity() - (write_pos - mReadPos.load(std::memory_order_acquire));
+
+    num_bytes = std::min(num_bytes, free);
+    copyIn(write_pos, bytes, num_bytes);
+    mWritePos.store(write_pos + num_bytes, std::memory_order_release);
+
+    return num_bytes;
+
+}
+
+bool ByteRing::writeAll(const char *bytes, std::size_t num_bytes) {
+
+    auto write_pos = mWritePos.load(std::memory_order_relaxed);
+    auto free = capacity() - (write_pos - mReadPos.load(std::memory_order_acquire));
+
+    if(num_bytes > free)
+        return false;
+
+    copyIn(write_pos, bytes, num_bytes);
+    mWritePos.store(write_pos + num_bytes, std::memory_order_release);
+
+    return true;
+
+}
+
+std::size_t ByteRing::read(char *bytes, std::size_t max_bytes) {
+
+    auto read_pos = mReadPos.load(std::memory_order_relaxed);
+    auto available = mWritePos.load(std::memory_order_acquire) - read_pos;
+    auto num_bytes = std::min(max_bytes, available);
+
+    // the bytes may wrap around the end of the buffer
+    auto start = read_pos & mMask;
+    auto first_part = std::min(num_bytes, capacity() - start);
+    std::memcpy(bytes, mData.data() + start, first_part);
+    std::memcpy(bytes + first_part, mData.data(), num_bytes - first_part);
+
+    mReadPos.store(read_pos + num_bytes, std::memory_order_release);
+
+    return num_bytes;
+
+}
+
+std::size_t ByteRing::size() const {
+
+    return mWritePos.load(std::memory_order_acquire) - mReadPos.load(std::memory_order_acquire);
+
+}
+
+void ByteRing::copyIn(std::size_t pos, const char *bytes, std::size_t num_bytes) {
+
+    auto start = pos & mMask;
+    auto first_part = std::min(num_bytes, capacity() - start);
+    std::memcpy(mData.data() + start, bytes, first_part);
+    std::memcpy(mData.data(), bytes + first_part, num_bytes - first_part);
+
+}
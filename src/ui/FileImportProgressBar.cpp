@@ -10,6 +10,8 @@ using namespace spec_hom;
 FileImportProgressBar::FileImportProgressBar(QWidget *parent) :
         QProgressBar(parent),
         mConnectedThread(nullptr),
+        mConnectedProgress(),
+        mPollTimer(new QTimer(this)),
         mIsQueued(false),
         mIsLoading(false),
         mIsLoaded(false) {
@@ -23,6 +25,9 @@ FileImportProgressBar::FileImportProgressBar(QWidget *parent) :
     bold_font.setBold(true);
     setFont(bold_font);
 
+    mPollTimer->setInterval(33); // ~30 Hz is plenty for a progress bar
+    connect(mPollTimer, &QTimer::timeout, this, &FileImportProgressBar::pollProgress);
+
 }
 
 QString FileImportProgressBar::text() const {
@@ -91,7 +96,9 @@ void FileImportProgressBar::connectThread(LoadRawFileThread *thread) {
     if(!thread)
         return;
 
-    connect(thread, &LoadRawFileThread::setProgress, this, &FileImportProgressBar::setValue);
+    mConnectedProgress = thread->progressBlock();
+    mPollTimer->start();
+
     connect(thread, &LoadRawFileThread::setProgressIndefinite, this, &FileImportProgressBar::setIndefinite);
     connect(thread, &LoadRawFileThread::setProgressText, this, &FileImportProgressBar::setLabel);
     connect(thread, &LoadRawFileThread::setProgressTextColor, this, &FileImportProgressBar::setLabelColor);
@@ -108,10 +115,23 @@ void FileImportProgressBar::connectThread(const FileImportProgressBar *other) {
 void FileImportProgressBar::disconnectThread() {
 
     mConnectedThread = nullptr;
+    mConnectedProgress.reset();
+    mPollTimer->stop();
     mIsLoading = false;
 
 }
 
+void FileImportProgressBar::pollProgress() {
+
+    if(!mConnectedProgress)
+        return;
+
+    auto progress = mConnectedProgress->progress.load(std::memory_order_relaxed);
+    if(progress != value())
+        setValue(progress);
+
+}
+
 void FileImportProgressBar::setQueued() {
 
     setLabel("Queued");
@@ -120,6 +140,7 @@ void FileImportProgressBar::setQueued() {
     setValue(0);
 
     mIsQueued = true;
+    mIsLoading = false;
     mIsLoaded = false;
 
 }
@@ -137,6 +158,19 @@ void FileImportProgressBar::setLoaded() {
 
 }
 
+void FileImportProgressBar::setWaiting() {
+
+    setLabel("Waiting for memory...");
+    setLabelColor(QColor(0x80, 0x80, 0x80));
+    setIndefinite(false);
+    setValue(0);
+
+    // counts as loading, so that the batch isn't considered done while files are still waiting
+    mIsLoading = true;
+    mIsLoaded = false;
+
+}
+
 void FileImportProgressBar::setIsLoading() {
 
     mIsLoading = true;
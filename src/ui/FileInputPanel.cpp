@@ -8,6 +8,7 @@
 #include <QFileDialog>
 
 #include "tpx3/tpx3.h"
+#include "threadutils.h"
 
 using namespace spec_hom;
 
@@ -31,10 +32,20 @@ FileInputPanel::FileInputPanel(QWidget *parent, LogPanel &logger, AppActions &ac
         mStartStopLoadBtn(new QPushButton(this)),
         mClearFilesBtn(new QPushButton(this)),
         mExportFilesBtn(new QPushButton(this)),
+        mFollowFileBtn(new QPushButton(this)),
+        mFollowStreamBtn(new QPushButton(this)),
+        mAggregatePatternEdit(new QLineEdit(this)),
+        mAggregateBtn(new QPushButton(this)),
         mFileTable(new QTableWidget(this)),
-        mBottomText(new QLabel(this)),
+        mBottomWidget(new QWidget(this)),
+        mBottomLayout(new QHBoxLayout(mBottomWidget)),
+        mBottomText(new QLabel(mBottomWidget)),
+        mMemoryGauge(new QProgressBar(mBottomWidget)),
+        mMemoryGaugeTimer(new QTimer(this)),
         mCancelBtnOnly(false),
-        mFileList() {
+        mFollowing(false),
+        mFileList(),
+        mFileSizes() {
 
     setLayout(mLayout);
 
@@ -64,6 +75,24 @@ FileInputPanel::FileInputPanel(QWidget *parent, LogPanel &logger, AppActions &ac
     mExportFilesBtn->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
     connect(mExportFilesBtn, &QPushButton::clicked, actions.exportAllData, &QAction::trigger);
 
+    // Buttons to follow a file that is still being written, or a stream of packets from the camera server
+    mFollowFileBtn->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+    connect(mFollowFileBtn, &QPushButton::clicked, actions.followLiveFile, &QAction::trigger);
+    mFollowStreamBtn->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+    connect(mFollowStreamBtn, &QPushButton::clicked, actions.followLiveStream, &QAction::trigger);
+    setFollowing(false);
+
+    // Pattern grouping the imported files, and button to sum the histograms of each group
+    mAggregatePatternEdit->setPlaceholderText("Aggregation pattern");
+    mAggregatePatternEdit->setToolTip("Regular expression searched for in each path; files whose capture groups match are summed "
+                                      "together, e.g. \"(scan\\d+)_\\d+\\.tpx3\". Files that don't match are left out, and "
+                                      "an empty pattern sums all of the imported files");
+    mAggregatePatternEdit->setMaximumWidth(250);
+    mAggregateBtn->setText("Aggregate Files");
+    mAggregateBtn->setIcon(this->style()->standardIcon(QStyle::SP_FileDialogListView));
+    mAggregateBtn->setSizePolicy(QSizePolicy::Maximum, QSizePolicy::Maximum);
+    connect(mAggregateBtn, &QPushButton::clicked, actions.aggregateFiles, &QAction::trigger);
+
     // Table displaying open files
     mFileTable->setColumnCount(COL_NUM);
     mFileTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
@@ -81,14 +110,33 @@ FileInputPanel::FileInputPanel(QWidget *parent, LogPanel &logger, AppActions &ac
     mToolbarLayout->addWidget(mStartStopLoadBtn);
     mToolbarLayout->addWidget(mClearFilesBtn);
     mToolbarLayout->addWidget(mExportFilesBtn);
+    mToolbarLayout->addWidget(mFollowFileBtn);
+    mToolbarLayout->addWidget(mFollowStreamBtn);
+    mToolbarLayout->addWidget(mAggregatePatternEdit);
+    mToolbarLayout->addWidget(mAggregateBtn);
 
     // Setup bottom descriptive text
     mBottomText->setText("Double click a file to view data.");
 
+    // Gauge showing the estimated memory held by running imports
+    mMemoryGauge->setRange(0, 1000);
+    mMemoryGauge->setTextVisible(true);
+    mMemoryGauge->setAlignment(Qt::AlignCenter);
+    mMemoryGauge->setMaximumWidth(300);
+    mMemoryGaugeTimer->setInterval(250);
+    connect(mMemoryGaugeTimer, &QTimer::timeout, this, &FileInputPanel::updateMemoryGauge);
+    mMemoryGaugeTimer->start();
+    updateMemoryGauge();
+
+    mBottomWidget->setLayout(mBottomLayout);
+    mBottomLayout->setContentsMargins(0, 0, 0, 0);
+    mBottomLayout->addWidget(mBottomText);
+    mBottomLayout->addWidget(mMemoryGauge);
+
     // Setup panel layout
     mLayout->addWidget(mToolbar);
     mLayout->addWidget(mFileTable);
-    mLayout->addWidget(mBottomText);
+    mLayout->addWidget(mBottomWidget);
 
 }
 
@@ -149,7 +197,9 @@ void FileInputPanel::updateFileTable() {
         auto &filename = mFileList[ix];
 
         std::ifstream fs(filename, std::ifstream::ate | std::ifstream::binary);
-        auto file_size = static_cast<double>(fs.tellg()) / (1024*1024);
+        auto file_size_bytes = fs ? static_cast<std::size_t>(fs.tellg()) : 0;
+        mFileSizes[filename] = file_size_bytes;
+        auto file_size = static_cast<double>(file_size_bytes) / (1024*1024);
         auto file_size_str = std::to_string(file_size);
         // format the string
         file_size_str.erase(file_size_str.find('.', 0)+3);
@@ -201,6 +251,7 @@ void FileInputPanel::removeTableRow(int row) {
         mFileTable->setCellWidget(r, COL_PROG_BAR, new_pbar);
     }
     mFileTable->setRowCount(num_rows - 1);
+    mFileSizes.erase(mFileList[row]);
     mFileList.erase(mFileList.begin() + row);
 
     if(queuedFileList().empty())
@@ -211,6 +262,7 @@ void FileInputPanel::removeTableRow(int row) {
 void FileInputPanel::clearAllRows() {
 
     mFileList.clear();
+    mFileSizes.clear();
     mFileTable->setRowCount(0);
     mStartStopLoadBtn->setEnabled(false);
 
@@ -221,6 +273,10 @@ void FileInputPanel::setCancelBtnOnly(bool value) {
     mOpenFileBtn->setEnabled(!value);
     mClearFilesBtn->setEnabled(!value);
     mExportFilesBtn->setEnabled(!value);
+    mFollowFileBtn->setEnabled(!value);
+    mFollowStreamBtn->setEnabled(!value && !mFollowing);
+    mAggregatePatternEdit->setEnabled(!value);
+    mAggregateBtn->setEnabled(!value);
 
     unsigned num_rows = mFileTable->rowCount();
     for(int r = 0; r < num_rows; ++r) {
@@ -273,6 +329,25 @@ void FileInputPanel::startStopBtnClick() {
 
 }
 
+void FileInputPanel::setFollowing(bool value) {
+
+    // only one live source runs at a time; while it does, the first button stops it
+    if(value) {
+        mFollowFileBtn->setText("Stop Live Data");
+        mFollowFileBtn->setIcon(this->style()->standardIcon(QStyle::SP_MediaStop));
+    } else {
+        mFollowFileBtn->setText("Follow Live File");
+        mFollowFileBtn->setIcon(this->style()->standardIcon(QStyle::SP_BrowserReload));
+    }
+
+    mFollowStreamBtn->setText("Connect to Stream");
+    mFollowStreamBtn->setIcon(this->style()->standardIcon(QStyle::SP_DriveNetIcon));
+    mFollowStreamBtn->setEnabled(!value && !mCancelBtnOnly);
+
+    mFollowing = value;
+
+}
+
 int FileInputPanel::getFileRow(const std::string &file) {
 
     QString filename_qt = QString(file.c_str());
@@ -325,6 +400,26 @@ void FileInputPanel::setFileQueued(const std::string &file) {
 
 }
 
+void FileInputPanel::setFileWaiting(const std::string &file) {
+
+    int row = getFileRow(file);
+    assert(row != -1); // should never happen if UI is written correctly
+
+    auto pbar = dynamic_cast<FileImportProgressBar*>(mFileTable->cellWidget(row, COL_PROG_BAR));
+    pbar->setWaiting();
+
+}
+
+std::size_t FileInputPanel::fileSize(const std::string &file) const {
+
+    auto it = mFileSizes.find(file);
+    if(it == mFileSizes.end())
+        return 0;
+
+    return it->second;
+
+}
+
 void FileInputPanel::updateLoadStatus() {
 
     int num_rows = mFileTable->rowCount();
@@ -342,6 +437,18 @@ void FileInputPanel::updateLoadStatus() {
 
 }
 
+void FileInputPanel::updateMemoryGauge() {
+
+    auto &budget = MemoryBudget::global();
+    auto reserved = static_cast<double>(budget.reserved()) / (1 << 30); // [GB]
+    auto limit = static_cast<double>(budget.limit()) / (1 << 30); // [GB]
+
+    auto fraction = std::min(reserved / limit, 1.0);
+    mMemoryGauge->setValue(static_cast<int>(fraction * mMemoryGauge->maximum()));
+    mMemoryGauge->setFormat(QString("Import memory: %1 / %2 GB").arg(reserved, 0, 'f', 1).arg(limit, 0, 'f', 0));
+
+}
+
 void FileInputPanel::tableDoubleClick(int row, int col) {
 
     if(mCancelBtnOnly) {
@@ -2,11 +2,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cmath>
 
 #include <QThread>
 #include <QThreadPool>
 #include <QFileDialog>
 #include <QProgressDialog>
+#include <QApplication>
 
 using namespace spec_hom;
 
@@ -23,11 +26,30 @@ int64_t tot_correction(uint16_t tot) {
 
 }
 
+// The comma-separated chip clock offsets [ns]; false if any of them is not a number
+bool parse_clock_offsets(const QString &text, std::vector<double> &offsets) {
+
+    offsets.clear();
+    bool valid = true;
+    for(auto &elem : text.split(',')) {
+        bool ok;
+        auto offset = elem.trimmed().toDouble(&ok);
+        valid &= ok;
+        offsets.push_back(ok ? offset : 0);
+    }
+
+    return valid;
+
+}
+
 FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &actions) :
         QWidget(parent),
         mActions(actions),
         mCurrImageMask(nullptr),
+        mCurrPixelMask(),
         mCurrCalibration(),
+        mCurrCalibrationPoints(),
+        mCurrCalibrationSource(),
 
         mLayout(new QVBoxLayout(this)),
 
@@ -37,12 +59,31 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
         mNumThreadsLayout(new QHBoxLayout(mNumThreadsWidget)),
         mNumThreadsLabel(new QLabel(mNumThreadsWidget)),
         mNumThreadsSpinbox(new QSpinBox(mNumThreadsWidget)),
+        mMemoryBudgetWidget(new QWidget(mGeneralSettingsWidget)),
+        mMemoryBudgetLayout(new QHBoxLayout(mMemoryBudgetWidget)),
+        mMemoryBudgetLabel(new QLabel(mMemoryBudgetWidget)),
+        mMemoryBudgetSpinbox(new QSpinBox(mMemoryBudgetWidget)),
+        mKeepPacketsCheck(new QCheckBox(mMemoryBudgetWidget)),
+        mGeometryWidget(new QWidget(mGeneralSettingsWidget)),
+        mGeometryLayout(new QHBoxLayout(mGeometryWidget)),
+        mGeometryLabel(new QLabel(mGeometryWidget)),
+        mGeometryCombo(new QComboBox(mGeometryWidget)),
+        mClockOffsetsLabel(new QLabel(mGeometryWidget)),
+        mClockOffsetsEdit(new QLineEdit(mGeometryWidget)),
         mSpatialMaskWidget(new QWidget(mGeneralSettingsWidget)),
         mSpatialMaskLayout(new QHBoxLayout(mSpatialMaskWidget)),
         mSpatialMaskLabel(new QLabel(mSpatialMaskWidget)),
         mSpatialMaskCurrLabel(new QLabel(mSpatialMaskWidget)),
         mSpatialMaskSetBtn(new QPushButton(mSpatialMaskWidget)),
         mSpatialMaskClearBtn(new QPushButton(mSpatialMaskWidget)),
+        mPixelMaskWidget(new QWidget(mGeneralSettingsWidget)),
+        mPixelMaskLayout(new QHBoxLayout(mPixelMaskWidget)),
+        mPixelMaskLabel(new QLabel(mPixelMaskWidget)),
+        mPixelMaskCurrLabel(new QLabel(mPixelMaskWidget)),
+        mPixelMaskFindBtn(new QPushButton(mPixelMaskWidget)),
+        mPixelMaskLoadBtn(new QPushButton(mPixelMaskWidget)),
+        mPixelMaskSaveBtn(new QPushButton(mPixelMaskWidget)),
+        mPixelMaskClearBtn(new QPushButton(mPixelMaskWidget)),
 
         mToTCorrectionSettingsWidget(new QGroupBox(this)),
         mToTCorrectionSettingsLayout(new QVBoxLayout(mToTCorrectionSettingsWidget)),
@@ -72,6 +113,18 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
         mCoincidenceWindowLayout(new QHBoxLayout(mCoincidenceWindowWidget)),
         mCoincidenceWindowLabel(new QLabel(mCoincidenceWindowWidget)),
         mCoincidenceWindowEdit(new QLineEdit(mCoincidenceWindowWidget)),
+        mRateBinWidget(new QWidget(mCoincidenceSettingsWidget)),
+        mRateBinLayout(new QHBoxLayout(mRateBinWidget)),
+        mRateBinLabel(new QLabel(mRateBinWidget)),
+        mRateBinEdit(new QLineEdit(mRateBinWidget)),
+        mLineTrackingWidget(new QWidget(mCoincidenceSettingsWidget)),
+        mLineTrackingLayout(new QHBoxLayout(mLineTrackingWidget)),
+        mLineTrackingLabel(new QLabel(mLineTrackingWidget)),
+        mLineTrackingEdit(new QLineEdit(mLineTrackingWidget)),
+        mHOMSegmentWidget(new QWidget(mCoincidenceSettingsWidget)),
+        mHOMSegmentLayout(new QHBoxLayout(mHOMSegmentWidget)),
+        mHOMSegmentLabel(new QLabel(mHOMSegmentWidget)),
+        mHOMSegmentEdit(new QLineEdit(mHOMSegmentWidget)),
 
         mCalibrationSettingsWidget(new QGroupBox(this)),
         mCalibrationSettingsLayout(new QVBoxLayout(mCalibrationSettingsWidget)),
@@ -87,12 +140,38 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
         mCalibrationSlope2Edit(new QLineEdit(mCalibration2Widget)),
         mCalibrationIntercept2Label(new QLabel(mCalibration2Widget)),
         mCalibrationIntercept2Edit(new QLineEdit(mCalibration2Widget)),
-        mLoadCalibrationBtn(new QPushButton(mCalibrationSettingsWidget)),
+        mCalibrationPointsWidget(new QWidget(mCalibrationSettingsWidget)),
+        mCalibrationPointsLayout(new QHBoxLayout(mCalibrationPointsWidget)),
+        mCalibrationPointsLabel(new QLabel(mCalibrationPointsWidget)),
+        mCalibrationPointsCurrLabel(new QLabel(mCalibrationPointsWidget)),
+        mCalibrationModelCombo(new QComboBox(mCalibrationPointsWidget)),
+        mLoadCalibrationBtn(new QPushButton(mCalibrationPointsWidget)),
+        mBuildCalibrationBtn(new QPushButton(mCalibrationPointsWidget)),
 
         mExportSettingsWidget(new QGroupBox(this)),
         mExportSettingsLayout(new QVBoxLayout(mExportSettingsWidget)),
         mExportSinglesCheck(new QCheckBox(mExportSettingsWidget)),
 
+        mLiveSettingsWidget(new QGroupBox(this)),
+        mLiveSettingsLayout(new QVBoxLayout(mLiveSettingsWidget)),
+        mLiveRefreshWidget(new QWidget(mLiveSettingsWidget)),
+        mLiveRefreshLayout(new QHBoxLayout(mLiveRefreshWidget)),
+        mLiveRefreshLabel(new QLabel(mLiveRefreshWidget)),
+        mLiveRefreshSpinbox(new QSpinBox(mLiveRefreshWidget)),
+        mLiveLookBackWidget(new QWidget(mLiveSettingsWidget)),
+        mLiveLookBackLayout(new QHBoxLayout(mLiveLookBackWidget)),
+        mLiveLookBackLabel(new QLabel(mLiveLookBackWidget)),
+        mLiveLookBackSpinbox(new QSpinBox(mLiveLookBackWidget)),
+        mLiveStreamWidget(new QWidget(mLiveSettingsWidget)),
+        mLiveStreamLayout(new QHBoxLayout(mLiveStreamWidget)),
+        mLiveStreamLabel(new QLabel(mLiveStreamWidget)),
+        mLiveStreamProtocolCombo(new QComboBox(mLiveStreamWidget)),
+        mLiveStreamAddressEdit(new QLineEdit(mLiveStreamWidget)),
+        mLiveBufferWidget(new QWidget(mLiveSettingsWidget)),
+        mLiveBufferLayout(new QHBoxLayout(mLiveBufferWidget)),
+        mLiveBufferLabel(new QLabel(mLiveBufferWidget)),
+        mLiveBufferSpinbox(new QSpinBox(mLiveBufferWidget)),
+
         mBottomText(new QLabel(this)){
 
     for(auto &x : mCurrCalibration) // default is to do nothing
@@ -115,6 +194,54 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
             mNumThreadsLayout->addWidget(mNumThreadsLabel);
             mNumThreadsLayout->addWidget(mNumThreadsSpinbox);
 
+            mMemoryBudgetWidget->setLayout(mMemoryBudgetLayout);
+
+                mMemoryBudgetLabel->setText("Import memory budget: ");
+                mMemoryBudgetSpinbox->setRange(1, 4096);
+                mMemoryBudgetSpinbox->setValue(16);
+                mMemoryBudgetSpinbox->setSuffix(" GB");
+                mMemoryBudgetSpinbox->setToolTip("Files are only imported in parallel while their estimated peak memory fits in this budget");
+                connect(mMemoryBudgetSpinbox, &QSpinBox::valueChanged, this, [this]() {
+                    MemoryBudget::global().setLimit(memoryBudget());
+                });
+                MemoryBudget::global().setLimit(memoryBudget());
+
+                mKeepPacketsCheck->setText("Keep raw packets");
+                mKeepPacketsCheck->setChecked(true);
+                mKeepPacketsCheck->setToolTip("If unchecked, only the histograms of the raw packets (raw image, ToT and "
+                                              "dToA) are kept once a file is imported, which takes far less memory; "
+                                              "the packets are read from the file again if they are ever needed");
+
+            mMemoryBudgetLayout->addWidget(mMemoryBudgetLabel);
+            mMemoryBudgetLayout->addWidget(mMemoryBudgetSpinbox);
+            mMemoryBudgetLayout->addWidget(mKeepPacketsCheck);
+
+            mGeometryWidget->setLayout(mGeometryLayout);
+
+                mGeometryLabel->setText("Detector layout: ");
+                mGeometryCombo->addItem("Single chip (256 x 256)");
+                mGeometryCombo->addItem("Quad (512 x 512)");
+                mGeometryCombo->setCurrentIndex(0);
+                mClockOffsetsLabel->setText("Chip clock offsets [ns]: ");
+                mClockOffsetsEdit->setText("0, 0, 0, 0");
+                mClockOffsetsEdit->setToolTip("Comma-separated offset added to the ToA of each chip, in chip order");
+                mClockOffsetsEdit->setEnabled(false);
+                connect(mClockOffsetsEdit, &QLineEdit::textChanged, this, [this](const QString &text) {
+                    std::vector<double> offsets;
+                    if(parse_clock_offsets(text, offsets))
+                        mClockOffsetsLabel->setText("Chip clock offsets [ns]: ");
+                    else
+                        mClockOffsetsLabel->setText("Chip clock offsets [ns] <b>(invalid; 0 used)</b>: ");
+                });
+                connect(mGeometryCombo, &QComboBox::currentIndexChanged, this, [this](int index) {
+                    mClockOffsetsEdit->setEnabled(index != 0);
+                });
+
+            mGeometryLayout->addWidget(mGeometryLabel);
+            mGeometryLayout->addWidget(mGeometryCombo);
+            mGeometryLayout->addWidget(mClockOffsetsLabel);
+            mGeometryLayout->addWidget(mClockOffsetsEdit);
+
             mSpatialMaskWidget->setLayout(mSpatialMaskLayout);
 
                 mSpatialMaskLabel->setText("Spatial mask: ");
@@ -129,8 +256,35 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
             mSpatialMaskLayout->addWidget(mSpatialMaskSetBtn);
             mSpatialMaskLayout->addWidget(mSpatialMaskClearBtn);
 
+            mPixelMaskWidget->setLayout(mPixelMaskLayout);
+
+                mPixelMaskLabel->setText("Pixel mask: ");
+                mPixelMaskCurrLabel->setText("<b>(No pixels masked)</b>");
+                mPixelMaskFindBtn->setText("Find Hot Pixels");
+                mPixelMaskFindBtn->setToolTip("Masks the pixels that fire far more often than their neighbours, from a "
+                                              "quick scan of the start of a file");
+                connect(mPixelMaskFindBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::findHotPixelsClick);
+                mPixelMaskLoadBtn->setText("Load");
+                mPixelMaskLoadBtn->setToolTip("Loads disabled pixels and per-pixel ToT thresholds, as lines of "
+                                              "\"x, y, min_tot\" (or \"x, y, off\")");
+                connect(mPixelMaskLoadBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::loadPixelMaskClick);
+                mPixelMaskSaveBtn->setText("Save");
+                connect(mPixelMaskSaveBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::savePixelMaskClick);
+                mPixelMaskClearBtn->setText("Clear");
+                connect(mPixelMaskClearBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::clearPixelMaskClick);
+
+            mPixelMaskLayout->addWidget(mPixelMaskLabel);
+            mPixelMaskLayout->addWidget(mPixelMaskCurrLabel);
+            mPixelMaskLayout->addWidget(mPixelMaskFindBtn);
+            mPixelMaskLayout->addWidget(mPixelMaskLoadBtn);
+            mPixelMaskLayout->addWidget(mPixelMaskSaveBtn);
+            mPixelMaskLayout->addWidget(mPixelMaskClearBtn);
+
         mGeneralSettingsLayout->addWidget(mNumThreadsWidget);
+        mGeneralSettingsLayout->addWidget(mMemoryBudgetWidget);
+        mGeneralSettingsLayout->addWidget(mGeometryWidget);
         mGeneralSettingsLayout->addWidget(mSpatialMaskWidget);
+        mGeneralSettingsLayout->addWidget(mPixelMaskWidget);
 
         mToTCorrectionSettingsWidget->setTitle("Time over Threshold Correction");
         mToTCorrectionSettingsWidget->setStyleSheet("QGroupBox { font-weight: bold; }");
@@ -202,7 +356,43 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
             mCoincidenceWindowLayout->addWidget(mCoincidenceWindowLabel);
             mCoincidenceWindowLayout->addWidget(mCoincidenceWindowEdit);
 
+            mRateBinWidget->setLayout(mRateBinLayout);
+
+                mRateBinLabel->setText("Rate Time Series Bin [s]: ");
+                mRateBinEdit->setValidator(new QDoubleValidator(0.001, 3600, 3, mRateBinEdit));
+                mRateBinEdit->setText("1");
+                mRateBinEdit->setToolTip("Width of the finest time bin of the singles, pairs and n-fold rates; "
+                                         "coarser bins are used when zoomed out");
+
+            mRateBinLayout->addWidget(mRateBinLabel);
+            mRateBinLayout->addWidget(mRateBinEdit);
+
+            mLineTrackingWidget->setLayout(mLineTrackingLayout);
+
+                mLineTrackingLabel->setText("Line Tracking Window [s]: ");
+                mLineTrackingEdit->setValidator(new QDoubleValidator(0, 3600, 3, mLineTrackingEdit));
+                mLineTrackingEdit->setText("0");
+                mLineTrackingEdit->setToolTip("The lines are fit again in windows this long, to follow them as they drift "
+                                              "during long acquisitions; 0 fits them once");
+
+            mLineTrackingLayout->addWidget(mLineTrackingLabel);
+            mLineTrackingLayout->addWidget(mLineTrackingEdit);
+
+            mHOMSegmentWidget->setLayout(mHOMSegmentLayout);
+
+                mHOMSegmentLabel->setText("HOM Segment Length [s]: ");
+                mHOMSegmentEdit->setValidator(new QDoubleValidator(0.1, 3600, 3, mHOMSegmentEdit));
+                mHOMSegmentEdit->setText("1");
+                mHOMSegmentEdit->setToolTip("The pairs are binned by both wavelengths in time segments this long, e.g. "
+                                            "the time spent at each step of a delay scan");
+
+            mHOMSegmentLayout->addWidget(mHOMSegmentLabel);
+            mHOMSegmentLayout->addWidget(mHOMSegmentEdit);
+
         mCoincidenceSettingsLayout->addWidget(mCoincidenceWindowWidget);
+        mCoincidenceSettingsLayout->addWidget(mRateBinWidget);
+        mCoincidenceSettingsLayout->addWidget(mLineTrackingWidget);
+        mCoincidenceSettingsLayout->addWidget(mHOMSegmentWidget);
 
         mCalibrationSettingsWidget->setTitle("Wavelength Calibration");
         mCalibrationSettingsWidget->setStyleSheet("QGroupBox { font-weight: bold; }");
@@ -239,12 +429,40 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
             mCalibration2Layout->addWidget(mCalibrationIntercept2Label);
             mCalibration2Layout->addWidget(mCalibrationIntercept2Edit);
 
-            mLoadCalibrationBtn->setText("Load From File");
-            connect(mLoadCalibrationBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::loadCalibrationFileClick);
+            for(auto *edit : {mCalibrationSlope1Edit, mCalibrationIntercept1Edit, mCalibrationSlope2Edit, mCalibrationIntercept2Edit})
+                connect(edit, &QLineEdit::textEdited, this, &FileInputSettingsPanel::calibrationEdited);
+
+            mCalibrationPointsWidget->setLayout(mCalibrationPointsLayout);
+
+                mCalibrationPointsLabel->setText("Calibration points: ");
+                mCalibrationPointsCurrLabel->setText("<b>(None; typed in)</b>");
+
+                mCalibrationModelCombo->addItem("Linear", 1);
+                mCalibrationModelCombo->addItem("Quadratic", 2);
+                mCalibrationModelCombo->addItem("Cubic", 3);
+                mCalibrationModelCombo->addItem("Quartic", 4);
+                mCalibrationModelCombo->addItem("Quintic", WavelengthCalibration::MAX_ORDER);
+                mCalibrationModelCombo->addItem("Cubic Spline", WavelengthCalibration::SPLINE);
+                mCalibrationModelCombo->setToolTip("How the wavelength varies along the lines between the calibration points");
+                connect(mCalibrationModelCombo, &QComboBox::currentIndexChanged, this, &FileInputSettingsPanel::fitCalibrationPoints);
+
+                mLoadCalibrationBtn->setText("Load From File");
+                connect(mLoadCalibrationBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::loadCalibrationFileClick);
+
+                mBuildCalibrationBtn->setText("Build From Argon Lamp");
+                mBuildCalibrationBtn->setToolTip("Finds the argon emission lines in an acquisition of the lamp for each "
+                                                 "channel, within the bands of the spatial mask");
+                connect(mBuildCalibrationBtn, &QPushButton::clicked, this, &FileInputSettingsPanel::buildArgonCalibrationClick);
+
+            mCalibrationPointsLayout->addWidget(mCalibrationPointsLabel);
+            mCalibrationPointsLayout->addWidget(mCalibrationPointsCurrLabel);
+            mCalibrationPointsLayout->addWidget(mCalibrationModelCombo);
+            mCalibrationPointsLayout->addWidget(mLoadCalibrationBtn);
+            mCalibrationPointsLayout->addWidget(mBuildCalibrationBtn);
 
         mCalibrationSettingsLayout->addWidget(mCalibration1Widget);
         mCalibrationSettingsLayout->addWidget(mCalibration2Widget);
-        mCalibrationSettingsLayout->addWidget(mLoadCalibrationBtn);
+        mCalibrationSettingsLayout->addWidget(mCalibrationPointsWidget);
 
     mExportSettingsWidget->setTitle("Export Settings");
     mExportSettingsWidget->setStyleSheet("QGroupBox { font-weight: bold; }");
@@ -256,20 +474,89 @@ FileInputSettingsPanel::FileInputSettingsPanel(QWidget *parent, AppActions &acti
 
         mExportSettingsLayout->addWidget(mExportSinglesCheck);
 
+    mLiveSettingsWidget->setTitle("Live Acquisition");
+    mLiveSettingsWidget->setStyleSheet("QGroupBox { font-weight: bold; }");
+    mLiveSettingsWidget->setLayout(mLiveSettingsLayout);
+    mLiveSettingsWidget->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Maximum);
+
+        mLiveRefreshWidget->setLayout(mLiveRefreshLayout);
+
+            mLiveRefreshLabel->setText("Histogram refresh rate: ");
+            mLiveRefreshSpinbox->setRange(1, 20);
+            mLiveRefreshSpinbox->setValue(4);
+            mLiveRefreshSpinbox->setSuffix(" Hz");
+
+        mLiveRefreshLayout->addWidget(mLiveRefreshLabel);
+        mLiveRefreshLayout->addWidget(mLiveRefreshSpinbox);
+
+        mLiveLookBackWidget->setLayout(mLiveLookBackLayout);
+
+            mLiveLookBackLabel->setText("Look-back window: ");
+            mLiveLookBackSpinbox->setRange(1, 10000);
+            mLiveLookBackSpinbox->setValue(200);
+            mLiveLookBackSpinbox->setSuffix(" ms");
+            mLiveLookBackSpinbox->setToolTip("Packets are only clustered once they are this much older than the newest packet, "
+                                             "so that packets written out of order are not missed");
+
+        mLiveLookBackLayout->addWidget(mLiveLookBackLabel);
+        mLiveLookBackLayout->addWidget(mLiveLookBackSpinbox);
+
+        mLiveStreamWidget->setLayout(mLiveStreamLayout);
+
+            mLiveStreamLabel->setText("Stream source: ");
+            mLiveStreamProtocolCombo->addItem("TCP");
+            mLiveStreamProtocolCombo->addItem("UDP");
+            mLiveStreamAddressEdit->setText("127.0.0.1:8451");
+            mLiveStreamAddressEdit->setToolTip("host:port to connect to for TCP, or the local address to listen on for UDP");
+
+        mLiveStreamLayout->addWidget(mLiveStreamLabel);
+        mLiveStreamLayout->addWidget(mLiveStreamProtocolCombo);
+        mLiveStreamLayout->addWidget(mLiveStreamAddressEdit);
+
+        mLiveBufferWidget->setLayout(mLiveBufferLayout);
+
+            mLiveBufferLabel->setText("Stream receive buffer: ");
+            mLiveBufferSpinbox->setRange(1, 4096);
+            mLiveBufferSpinbox->setValue(256);
+            mLiveBufferSpinbox->setSuffix(" MB");
+            mLiveBufferSpinbox->setToolTip("Data waiting to be processed; when it is full, TCP senders are slowed down and UDP datagrams are dropped");
+
+        mLiveBufferLayout->addWidget(mLiveBufferLabel);
+        mLiveBufferLayout->addWidget(mLiveBufferSpinbox);
+
+        mLiveSettingsLayout->addWidget(mLiveRefreshWidget);
+        mLiveSettingsLayout->addWidget(mLiveLookBackWidget);
+        mLiveSettingsLayout->addWidget(mLiveStreamWidget);
+        mLiveSettingsLayout->addWidget(mLiveBufferWidget);
+
     mLayout->addWidget(mGeneralSettingsWidget);
     mLayout->addWidget(mToTCorrectionSettingsWidget);
     mLayout->addWidget(mClusteringSettingsWidget);
     mLayout->addWidget(mCoincidenceSettingsWidget);
     mLayout->addWidget(mCalibrationSettingsWidget);
     mLayout->addWidget(mExportSettingsWidget);
+    mLayout->addWidget(mLiveSettingsWidget);
     mLayout->addWidget(new QWidget());
     mLayout->addWidget(mBottomText);
 
-    mCurrImageMask = std::make_unique<SpatialMask>(
-                    false,
-                    0, Tpx3Image::WIDTH,
-                    0, Tpx3Image::WIDTH
-            );
+    // no mask is set by default; getSettings() then uses the full sensor of the selected detector layout
+
+}
+
+DetectorGeometry FileInputSettingsPanel::getGeometry() {
+
+    if(mGeometryCombo->currentIndex() == 0)
+        return DetectorGeometry::singleChip();
+
+    auto geometry = DetectorGeometry::quad();
+
+    // offsets that are not numbers are left at 0, as shown next to the field
+    std::vector<double> offsets;
+    parse_clock_offsets(mClockOffsetsEdit->text(), offsets);
+    for(int chip = 0; chip < geometry.numChips() && chip < static_cast<int>(offsets.size()); ++chip)
+        geometry.chips[chip].clock_offset = std::llround(offsets[chip] * 1e-9 / MIN_TICK);
+
+    return geometry;
 
 }
 
@@ -277,14 +564,17 @@ Tpx3ImportSettings FileInputSettingsPanel::getSettings() {
 
     int maxNumThreads = mNumThreadsSpinbox->value();
 
+    auto geometry = getGeometry();
+    int sensor_size = std::max(geometry.width, geometry.height);
+
     SpatialMask mask;
     if (mCurrImageMask) {
         mask = *mCurrImageMask;
     } else {
         mask = {
             false,
-            0, Tpx3Image::WIDTH,
-            0, Tpx3Image::WIDTH
+            0, sensor_size,
+            0, sensor_size
         };
     }
 
@@ -293,15 +583,24 @@ Tpx3ImportSettings FileInputSettingsPanel::getSettings() {
     int minClusterSize = mMinClusterSizeEdit->value();
 
     double coincidenceWindow = std::stod(mCoincidenceWindowEdit->text().toStdString());
+    double rateBinWidth = std::stod(mRateBinEdit->text().toStdString());
+    double lineTrackingWindow = std::stod(mLineTrackingEdit->text().toStdString());
+    double homSegmentWidth = std::stod(mHOMSegmentEdit->text().toStdString());
 
     double ch1Slope = std::stod(mCalibrationSlope1Edit->text().toStdString());
     double ch1Intercept = std::stod(mCalibrationIntercept1Edit->text().toStdString());
     double ch2Slope = std::stod(mCalibrationSlope2Edit->text().toStdString());
     double ch2Intercept = std::stod(mCalibrationIntercept2Edit->text().toStdString());
 
+    WavelengthCalibration calibration {ch1Slope, ch1Intercept, ch2Slope, ch2Intercept};
+    if(!mCurrCalibrationPoints.empty())
+        calibration = WavelengthCalibration::fit(mCurrCalibrationPoints, mCalibrationModelCombo->currentData().toInt());
+
     return {
         maxNumThreads,
+        geometry,
         mask,
+        mCurrPixelMask,
 
         mCurrCalibration,
 
@@ -310,13 +609,12 @@ Tpx3ImportSettings FileInputSettingsPanel::getSettings() {
         minClusterSize,
 
         coincidenceWindow*1e-9,
+        rateBinWidth,
+        lineTrackingWindow,
+        homSegmentWidth,
+        mKeepPacketsCheck->isChecked(),
 
-        {
-                ch1Slope,
-                ch1Intercept,
-                ch2Slope,
-                ch2Intercept
-        }
+        calibration
     };
 
 }
@@ -333,44 +631,143 @@ void FileInputSettingsPanel::setImageMaskClick() {
     if(filename.isEmpty())
         return;
 
-    // we want to ignore any previously-set spatial mask
-    auto import_settings = getSettings();
-    import_settings.spatialMask = {
-            false,
-            0, Tpx3Image::WIDTH,
-            0, Tpx3Image::WIDTH
-    };
-    import_settings.calibration = {
-            1, 0,
-            1, 0
-    };
+    // a sample of the file is enough to fit the lines; the previously-set spatial mask is ignored by the pre-scan
+    constexpr std::size_t PRESCAN_BYTES = 16 << 20;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    ImageXY<unsigned> counts;
+    try {
+        counts = prescan_counts(filename.toStdString(), getSettings(), PRESCAN_BYTES);
+    } catch(std::exception &e) {
+        QApplication::restoreOverrideCursor();
+        mSpatialMaskCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+        return;
+    }
+    QApplication::restoreOverrideCursor();
 
     mActions.lockUiForMasking->trigger();
 
-    auto file_loader = new LoadRawFileThread(filename.toStdString(), import_settings, true);
+    auto set_mask_dialog = new SetImageMaskDialog(std::move(counts), filename.toStdString(), this);
+    connect(set_mask_dialog, &SetImageMaskDialog::yieldImageMask, this, &FileInputSettingsPanel::receiveImageMask);
+    set_mask_dialog->exec();
+    // regardless of the outcome, we need to re-enable UI
+    mActions.unlockUi->trigger();
 
-    auto dialog = new QProgressDialog("Loading raw counts...", "Cancel", 0, 100, this);
-    auto pbar = new FileImportProgressBar(dialog);
-    dialog->setMinimumWidth(dialog->size().width()*1.5);
-    dialog->setBar(pbar);
-    dialog->setMinimumDuration(0);
+}
 
-    pbar->connectThread(file_loader);
-    pbar->setIsLoading();
+void FileInputSettingsPanel::clearImageMaskClick() {
 
-    connect(file_loader, &LoadRawFileThread::threadDone, [dialog, this](){
-        dialog->close();
-    });
-    connect(file_loader, &LoadRawFileThread::yieldPixelData, this, &FileInputSettingsPanel::receiveImageMaskReference);
+    mCurrImageMask.reset();
+    mSpatialMaskCurrLabel->setText("<b>(No mask set)</b>");
+
+}
+
+void FileInputSettingsPanel::findHotPixelsClick() {
+
+    constexpr std::size_t PRESCAN_BYTES = 64 << 20; // enough for a good count in every pixel of a typical file
+
+    auto filename = QFileDialog::getOpenFileName(
+            this,
+            "Select Reference File",
+            "./data",
+            "Tpx3 Files (*.tpx3)"
+    );
+
+    if(filename.isEmpty())
+        return;
+
+    // the pixels already masked are scanned too, so that they are found again
+    auto settings = getSettings();
+    settings.pixelMask = {};
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    ImageXY<unsigned> counts;
+    try {
+        counts = prescan_counts(filename.toStdString(), settings, PRESCAN_BYTES);
+    } catch(std::exception &e) {
+        QApplication::restoreOverrideCursor();
+        mPixelMaskCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+        return;
+    }
+    QApplication::restoreOverrideCursor();
 
-    QThreadPool::globalInstance()->start(file_loader);
+    // hot pixels are added to any thresholds already set
+    if(mCurrPixelMask.width() != settings.geometry.width || mCurrPixelMask.height() != settings.geometry.height)
+        mCurrPixelMask = PixelMask(settings.geometry.width, settings.geometry.height);
+    for(auto &addr : PixelMask::findHotPixels(counts))
+        mCurrPixelMask.disable(addr.x, addr.y);
+
+    updatePixelMaskLabel();
 
 }
 
-void FileInputSettingsPanel::clearImageMaskClick() {
+void FileInputSettingsPanel::loadPixelMaskClick() {
 
-    mCurrImageMask.reset();
-    mSpatialMaskCurrLabel->setText("<b>(No mask set)</b>");
+    auto filename = QFileDialog::getOpenFileName(
+            this,
+            "Select Pixel Mask",
+            "./data",
+            "Pixel Mask Files (*.mask.csv)"
+    );
+
+    if(filename.isEmpty())
+        return;
+
+    // the previous mask is kept if the file cannot be read, or does not fit the geometry
+    auto geometry = getGeometry();
+    try {
+        mCurrPixelMask = PixelMask::load(filename.toStdString(), geometry.width, geometry.height);
+    } catch(std::exception &e) {
+        mPixelMaskCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+        return;
+    }
+
+    updatePixelMaskLabel();
+
+}
+
+void FileInputSettingsPanel::savePixelMaskClick() {
+
+    auto filename = QFileDialog::getSaveFileName(
+            this,
+            "Save Pixel Mask",
+            "./data",
+            "Pixel Mask Files (*.mask.csv)"
+    );
+
+    if(filename.isEmpty())
+        return;
+
+    if(!filename.toLower().endsWith(".mask.csv"))
+        filename += ".mask.csv";
+
+    try {
+        mCurrPixelMask.save(filename.toStdString());
+    } catch(std::exception &e) {
+        mPixelMaskCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+    }
+
+}
+
+void FileInputSettingsPanel::clearPixelMaskClick() {
+
+    mCurrPixelMask = PixelMask();
+    updatePixelMaskLabel();
+
+}
+
+void FileInputSettingsPanel::updatePixelMaskLabel() {
+
+    auto num_disabled = mCurrPixelMask.numDisabled();
+    auto num_thresholds = mCurrPixelMask.numThresholds();
+
+    if(!num_disabled && !num_thresholds) {
+        mPixelMaskCurrLabel->setText("<b>(No pixels masked)</b>");
+        return;
+    }
+
+    mPixelMaskCurrLabel->setText("<b>(" + QString::number(num_disabled) + " pixels disabled, "
+                                 + QString::number(num_thresholds) + " ToT thresholds)</b>");
 
 }
 
@@ -428,91 +825,155 @@ void FileInputSettingsPanel::clearToACalibClick() {
 
 }
 
-void FileInputSettingsPanel::receiveImageMaskReference(Tpx3Image *image_ptr) {
+void FileInputSettingsPanel::receiveImageMask(spec_hom::SpatialMask mask, std::string filename) {
 
-    std::unique_ptr<Tpx3Image> image(image_ptr);
+    mCurrImageMask = std::make_unique<SpatialMask>(mask);
+    auto new_label = "<b>(" + filename + ")</b>";
+    mSpatialMaskCurrLabel->setText(new_label.c_str());
 
-    if(!image) {
-        mActions.unlockUi->trigger();
-        return;
-    }
+}
 
-    auto set_mask_dialog = new SetImageMaskDialog(std::move(image), this);
-    connect(set_mask_dialog, &SetImageMaskDialog::yieldImageMask, this, &FileInputSettingsPanel::receiveImageMask);
-    auto dialog_result = set_mask_dialog->exec();
-    // regardless of the outcome, we need to re-enable UI
-    mActions.unlockUi->trigger();
+void FileInputSettingsPanel::loadCalibrationFileClick() {
 
-}
+    auto filename = QFileDialog::getOpenFileName(
+            this,
+            "Select Calibration File",
+            "./data",
+            "Wavelength Calibration Files (*.calib.csv)"
+    );
 
-void FileInputSettingsPanel::receiveImageMask(spec_hom::SpatialMask mask, std::string filename) {
+    if(filename.isEmpty())
+        return;
 
-    mCurrImageMask = std::make_unique<SpatialMask>(mask);
-    auto new_label = "<b>(" + filename + ")</b>";
-    mSpatialMaskCurrLabel->setText(new_label.c_str());
+    try {
+        setCalibrationPoints(CalibrationPoints::load(filename.toStdString()), filename);
+    } catch(std::exception &e) {
+        mCalibrationPointsCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+    }
 
 }
 
-// Simple linear regression
-void linfit(const std::vector<double> &x, const std::vector<double> &y, double &m, double &b) {
-
-    double x1 = 0, x2 = 0, y1 = 0, xy = 0;
-    double n = x.size();
-    assert(x.size() == y.size()); // vectors must be same length
-    for(unsigned ix = 0; ix < x.size(); ++ix) {
-        x1 += x[ix];
-        x2 += x[ix]*x[ix];
-        y1 += y[ix];
-        xy += x[ix]*y[ix];
+void FileInputSettingsPanel::buildArgonCalibrationClick() {
+
+    // the lines are looked for in the bands of the spatial mask, which also say which way they run
+    if(!mCurrImageMask) {
+        mCalibrationPointsCurrLabel->setText("<b>(Set the spatial mask first)</b>");
+        return;
+    }
+
+    // the lamp is usually coupled into one channel at a time; the same file can be picked for both
+    std::array<QString, 2> filenames;
+    for(int channel = 1; channel <= 2; ++channel) {
+        filenames[channel - 1] = QFileDialog::getOpenFileName(
+                this,
+                "Select Argon Lamp File for Channel " + QString::number(channel),
+                "./data",
+                "Tpx3 Files (*.tpx3)"
+        );
+
+        if(filenames[channel - 1].isEmpty())
+            return;
     }
 
-    b = (xy*x1 - x2*y1)/(x1*x1 - n*x2);
-    m = (y1 - n*b)/x1;
+    // the lamp files are imported in the background; the dialog blocks the settings until they are done
+    auto thread = new ArgonCalibrationThread({filenames[0].toStdString(), filenames[1].toStdString()}, getSettings());
+    auto progress = thread->progressBlock();
+
+    auto dialog = new QProgressDialog("Reading argon lamp files...", "Cancel", 0, 100, this);
+    dialog->setWindowTitle("Building Calibration...");
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setAutoReset(false);
+    dialog->setAutoClose(false);
+    dialog->setMinimumDuration(0);
+
+    auto poll_timer = new QTimer(dialog);
+    connect(poll_timer, &QTimer::timeout, dialog, [dialog, progress]() { dialog->setValue(progress->progress.load()); });
+    poll_timer->start(100);
+
+    connect(dialog, &QProgressDialog::canceled, this, [progress]() { progress->cancelled = true; });
+    connect(thread, &BgThread::setProgressText, dialog, [dialog](const std::string &str) {
+        dialog->setLabelText(QString::fromStdString(str).remove(" (%p%)"));
+    });
+    connect(thread, &BgThread::setProgressIndefinite, dialog, [dialog](bool value) { dialog->setMaximum(value ? 0 : 100); });
+    connect(thread, &BgThread::err, this, [this](const std::string &str) {
+        mCalibrationPointsCurrLabel->setText(QString("<b>(") + QString::fromStdString(str) + ")</b>");
+    });
+    connect(thread, &ArgonCalibrationThread::yieldCalibrationPoints, this, [this, dialog](CalibrationPoints *points) {
+        dialog->hide(); // before asking where to save the points
+        receiveArgonCalibration(points);
+    });
+    connect(thread, &BgThread::threadDone, dialog, &QObject::deleteLater);
+
+    QThreadPool::globalInstance()->start(thread);
 
 }
 
-void FileInputSettingsPanel::loadCalibrationFileClick() {
+void FileInputSettingsPanel::receiveArgonCalibration(CalibrationPoints *data) {
 
-    auto filename = QFileDialog::getOpenFileName(
+    std::unique_ptr<CalibrationPoints> points(data);
+
+    // the points can be kept, to calibrate again without the lamp files
+    auto filename = QFileDialog::getSaveFileName(
             this,
-            "Select Calibration File",
+            "Save Calibration Points",
             "./data",
             "Wavelength Calibration Files (*.calib.csv)"
     );
 
-    if(filename.isEmpty())
-        return;
+    if(!filename.isEmpty()) {
+        if(!filename.toLower().endsWith(".calib.csv"))
+            filename += ".calib.csv";
+        points->save(filename.toStdString());
+    }
 
-    // read the file
-    std::ifstream input(filename.toStdString());
-    std::string line;
+    setCalibrationPoints(std::move(*points), "Argon lamp");
 
-    std::vector<double> channel1, channel2, wavelengths;
+}
 
-    std::getline(input, line); // skip header line
-    while(std::getline(input, line)) {
-        std::vector<std::string> row;
-        std::stringstream row_stream(line);
-        std::string elem;
-        while(std::getline(row_stream, elem, ','))
-            row.push_back(std::move(elem));
+void FileInputSettingsPanel::setCalibrationPoints(CalibrationPoints &&points, const QString &source) {
 
-        if(row.size() != 3)
-            throw std::runtime_error("Incorrect wavelength calibration format.");
+    mCurrCalibrationPoints = std::move(points);
+    mCurrCalibrationSource = source;
+    fitCalibrationPoints();
+
+}
+
+void FileInputSettingsPanel::fitCalibrationPoints() {
+
+    if(mCurrCalibrationPoints.empty())
+        return;
 
-        wavelengths.push_back(std::stod(row[0]));
-        channel1.push_back(std::stod(row[1]));
-        channel2.push_back(std::stod(row[2]));
+    WavelengthCalibration calibration {};
+    try {
+        calibration = WavelengthCalibration::fit(mCurrCalibrationPoints, mCalibrationModelCombo->currentData().toInt());
+    } catch(std::exception &e) {
+        // e.g. too few points for the model; the slopes and intercepts shown are kept
+        mCurrCalibrationPoints = {};
+        mCalibrationPointsCurrLabel->setText(QString("<b>(") + e.what() + ")</b>");
+        return;
     }
 
-    double slope1, intercept1, slope2, intercept2;
-    linfit(channel1, wavelengths, slope1, intercept1);
-    linfit(channel2, wavelengths, slope2, intercept2);
+    // the linear terms, or the straight line through the points of a spline
+    mCalibrationSlope1Edit->setText(QString::number(calibration.slope1));
+    mCalibrationIntercept1Edit->setText(QString::number(calibration.intercept1));
+    mCalibrationSlope2Edit->setText(QString::number(calibration.slope2));
+    mCalibrationIntercept2Edit->setText(QString::number(calibration.intercept2));
+
+    mCalibrationPointsCurrLabel->setText("<b>(" + QString::number(mCurrCalibrationPoints.wavelengths.size()) + " lines from "
+                                         + mCurrCalibrationSource + ")</b>");
+
+}
+
+void FileInputSettingsPanel::calibrationEdited() {
+
+    mCurrCalibrationPoints = {};
+    mCalibrationPointsCurrLabel->setText("<b>(None; typed in)</b>");
 
-    mCalibrationSlope1Edit->setText(QString::number(slope1));
-    mCalibrationIntercept1Edit->setText(QString::number(intercept1));
-    mCalibrationSlope2Edit->setText(QString::number(slope2));
-    mCalibrationIntercept2Edit->setText(QString::number(intercept2));
+}
+
+std::size_t FileInputSettingsPanel::memoryBudget() const {
+
+    return static_cast<std::size_t>(mMemoryBudgetSpinbox->value()) << 30;
 
 }
 
@@ -520,4 +981,49 @@ bool FileInputSettingsPanel::shouldExportSingles() const {
 
     return mExportSinglesCheck->isChecked();
 
+}
+
+double FileInputSettingsPanel::liveRefreshInterval() const {
+
+    return 1.0 / mLiveRefreshSpinbox->value();
+
+}
+
+double FileInputSettingsPanel::liveLookBack() const {
+
+    return mLiveLookBackSpinbox->value() * 1e-3;
+
+}
+
+bool FileInputSettingsPanel::liveStreamAddress(std::string &host, uint16_t &port) const {
+
+    auto address = mLiveStreamAddressEdit->text().trimmed().toStdString();
+    auto colon = address.rfind(':');
+    if(colon == std::string::npos || colon == 0)
+        return false;
+
+    try {
+        auto port_value = std::stoul(address.substr(colon + 1));
+        if(port_value == 0 || port_value > 65535)
+            return false;
+        port = static_cast<uint16_t>(port_value);
+    } catch(const std::exception&) {
+        return false;
+    }
+
+    host = address.substr(0, colon);
+    return true;
+
+}
+
+bool FileInputSettingsPanel::liveStreamUdp() const {
+
+    return mLiveStreamProtocolCombo->currentIndex() == 1;
+
+}
+
+std::size_t FileInputSettingsPanel::liveStreamBufferSize() const {
+
+    return static_cast<std::size_t>(mLiveBufferSpinbox->value()) << 20;
+
 }
\ No newline at end of file
@@ -3,11 +3,13 @@
 #include <vector>
 #include <iostream>
 #include <filesystem>
+#include <regex>
 
 #include <QFileDialog>
 #include <QProgressDialog>
 #include <QThreadPool>
 #include <QCoreApplication>
+#include <QApplication>
 
 #include "qcustomplot.h"
 
@@ -31,8 +33,16 @@ MainWindow::MainWindow() :
         mFileSettingsPanel(new FileInputSettingsPanel(mTabContainer, mActions)),
         mFilePanel(new FileInputPanel(mTabContainer, *mLogPanel, mActions)),
         mActiveImportThreads(),
+        mPendingImports(),
+        mPendingImportSettings(),
+        mBatchFiles(),
         mOpenImages(),
         mOpenFileViewTabs(),
+        mSummaries(),
+        mAggregateImages(),
+        mLiveThread(nullptr),
+        mLiveImage(),
+        mLiveViewTab(nullptr),
         mProcessStartTime() {
 
     setWindowTitle("Spectral HOM Analysis");
@@ -70,6 +80,9 @@ MainWindow::MainWindow() :
     connect(mActions.openFileTab, &QAction::triggered, this, &MainWindow::openNewFileTab);
     connect(mActions.lockUiForMasking, &QAction::triggered, this, &MainWindow::freezeUiForMasking);
     connect(mActions.unlockUi, &QAction::triggered, this, &MainWindow::unfreezeUi);
+    connect(mActions.followLiveFile, &QAction::triggered, this, &MainWindow::startStopFollowing);
+    connect(mActions.followLiveStream, &QAction::triggered, this, &MainWindow::startStopStreaming);
+    connect(mActions.aggregateFiles, &QAction::triggered, this, &MainWindow::aggregateFiles);
 
     mTabContainer->setCurrentIndex(TAB_FILE_SETTINGS); // for some reason, we need this on Windows or else the tab isn't shown
     show();
@@ -87,6 +100,8 @@ MainWindow::~MainWindow() {
 void MainWindow::closeEvent(QCloseEvent *event) {
 
     stopImportFiles();
+    if(mLiveThread)
+        mLiveThread->cancel();
 
     QMainWindow::closeEvent(event);
 
@@ -95,6 +110,8 @@ void MainWindow::closeEvent(QCloseEvent *event) {
 bool MainWindow::closeWindow() {
 
     stopImportFiles();
+    if(mLiveThread)
+        mLiveThread->cancel();
     while(!mActiveImportThreads.empty()); // wait until all threads closed
 
     return close();
@@ -154,6 +171,8 @@ void MainWindow::exportAllData() {
 
     int counter = 0;
 
+    ImportStats all_stats;
+
     for(auto &pair : mOpenImages) {
         progbar.setValue(counter++);
 
@@ -167,6 +186,10 @@ void MainWindow::exportAllData() {
         image.saveCoincsTo(coincs_path);
         if(mFileSettingsPanel->shouldExportSingles())
             image.saveSinglesTo(singles_path);
+        if(!image.importStats().empty()) {
+            image.importStats().saveTo(file_prefix + ".stats.json");
+            all_stats.add(image.importStats());
+        }
 
         mLogPanel->log("Wrote files to " + file_prefix + ".*.csv");
 
@@ -174,6 +197,12 @@ void MainWindow::exportAllData() {
             break;
     }
 
+    if(!all_stats.empty()) {
+        std::string stats_path = folder.toStdString() + "/import_stats.json";
+        all_stats.saveTo(stats_path);
+        mLogPanel->log("Wrote import statistics for all files to " + stats_path);
+    }
+
     mLogPanel->log("Done exporting");
 
 }
@@ -205,6 +234,7 @@ void MainWindow::deleteFiles() {
         }
 
         files_deleted += mOpenImages.erase(str);
+        mSummaries.erase(str);
     }
 
     if(files_deleted)
@@ -224,6 +254,7 @@ void MainWindow::deleteAllFiles() {
     }
 
     mOpenImages.clear();
+    mSummaries.clear();
     mFilePanel->clearAllRows();
 
     if(files_deleted)
@@ -241,11 +272,43 @@ void MainWindow::startImportFiles() {
 
     mLogPanel->log("Loading " + std::to_string(queued_files.size()) + " Tpx3 files.");
 
-    QThreadPool::globalInstance()->setMaxThreadCount(import_settings.maxNumThreads);
+    // the file jobs themselves mostly wait on (and help with) the stage tasks they submit to the shared TaskPool
+    // a followed file keeps its own thread next to them; the TaskPool can be resized while its tasks are running
+    QThreadPool::globalInstance()->setMaxThreadCount(import_settings.maxNumThreads + (mLiveThread ? 1 : 0));
+    TaskPool::global().setNumThreads(import_settings.maxNumThreads);
+    MemoryBudget::global().setLimit(mFileSettingsPanel->memoryBudget());
     mProcessStartTime = std::chrono::high_resolution_clock::now();
 
-    for(auto &file : queued_files) {
-        auto file_loader = new LoadRawFileThread(file, import_settings);
+    // files are only started once their estimated peak memory fits in the budget
+    mPendingImportSettings = import_settings;
+    mPendingImports = queued_files;
+    mBatchFiles = queued_files;
+    for(auto &file : queued_files)
+        mFilePanel->setFileWaiting(file);
+
+    admitPendingImports();
+
+    if(!mPendingImports.empty())
+        mLogPanel->log(std::to_string(mPendingImports.size()) + " file(s) waiting for memory to become available.");
+
+}
+
+void MainWindow::admitPendingImports() {
+
+    auto &budget = MemoryBudget::global();
+
+    // admit files in order, but let smaller files further down the list use any memory left over
+    for(auto it = mPendingImports.begin(); it != mPendingImports.end();) {
+        auto file = *it;
+        auto reserved_memory = LoadRawFileThread::estimatePeakMemory(mFilePanel->fileSize(file));
+
+        if(!budget.tryAcquire(reserved_memory)) {
+            ++it;
+            continue;
+        }
+        it = mPendingImports.erase(it);
+
+        auto file_loader = new LoadRawFileThread(file, mPendingImportSettings);
         mLogPanel->connectToThread(file_loader);
         mFilePanel->connectThread(file, file_loader);
 
@@ -255,10 +318,13 @@ void MainWindow::startImportFiles() {
 
         // keep track of which threads are currently running
         mActiveImportThreads.push_back(file_loader);
-        connect(file_loader, &LoadRawFileThread::threadDone, this, [this, file_loader]() {
+        connect(file_loader, &LoadRawFileThread::threadDone, this, [this, file_loader, reserved_memory]() {
             this->mActiveImportThreads.erase(
                     std::remove(this->mActiveImportThreads.begin(), this->mActiveImportThreads.end(), file_loader),
                     this->mActiveImportThreads.end());
+
+            MemoryBudget::global().release(reserved_memory);
+            this->admitPendingImports();
         });
     }
 
@@ -266,6 +332,11 @@ void MainWindow::startImportFiles() {
 
 void MainWindow::stopImportFiles() {
 
+    // files that haven't started yet go straight back to the queue
+    for(auto &file : mPendingImports)
+        mFilePanel->setFileQueued(file);
+    mPendingImports.clear();
+
     for(auto thread : mActiveImportThreads)
         thread->cancel();
 
@@ -274,7 +345,19 @@ void MainWindow::stopImportFiles() {
 void MainWindow::doneImportFiles() {
 
     auto stop_time = std::chrono::high_resolution_clock::now();
-    mLogPanel->log("File loading took " + std::to_string((stop_time - mProcessStartTime).count() / 1e9) + " seconds.");
+    auto elapsed = std::chrono::duration<double>(stop_time - mProcessStartTime).count(); // [s]
+    mLogPanel->log("File loading took " + std::to_string(elapsed) + " seconds.");
+
+    // per-stage totals over the files imported in this batch
+    ImportStats batch_stats;
+    for(auto &file : mBatchFiles) {
+        auto image = mOpenImages.find(file);
+        if(image != mOpenImages.end() && !image->second->importStats().empty())
+            batch_stats.add(image->second->importStats());
+    }
+    if(!batch_stats.empty())
+        mLogPanel->log(batch_stats.summary());
+    mBatchFiles.clear();
 
     unfreezeUi();
 
@@ -287,6 +370,7 @@ void MainWindow::receiveImageData(Tpx3Image *data) {
 
     // empty data sent if the user pressed "Cancel"
     if(!image->empty()) {
+        mSummaries.erase(filename);
         mOpenImages[filename] = std::move(image);
         mFilePanel->setFileLoaded(filename);
     } else {
@@ -295,6 +379,173 @@ void MainWindow::receiveImageData(Tpx3Image *data) {
 
 }
 
+void MainWindow::startStopFollowing() {
+
+    if(mLiveThread) {
+        mLiveThread->cancel();
+        return;
+    }
+
+    auto q_file = QFileDialog::getOpenFileName(
+            this,
+            "Follow Tpx3 File During Acquisition",
+            "./data",
+            "Tpx3 Files (*.tpx3)"
+    );
+
+    if(q_file.isEmpty())
+        return;
+
+    auto import_settings = mFileSettingsPanel->getSettings();
+    startLiveSource(new FollowRawFileThread(q_file.toStdString(), import_settings, mFileSettingsPanel->liveRefreshInterval(),
+                                            mFileSettingsPanel->liveLookBack()), import_settings);
+
+}
+
+void MainWindow::startStopStreaming() {
+
+    if(mLiveThread) {
+        mLiveThread->cancel();
+        return;
+    }
+
+    std::string host;
+    uint16_t port;
+    if(!mFileSettingsPanel->liveStreamAddress(host, port)) {
+        mLogPanel->err("Invalid stream source; expected host:port");
+        return;
+    }
+
+    auto import_settings = mFileSettingsPanel->getSettings();
+    startLiveSource(new StreamSocketThread(host, port, mFileSettingsPanel->liveStreamUdp(), mFileSettingsPanel->liveStreamBufferSize(),
+                                           import_settings, mFileSettingsPanel->liveRefreshInterval(), mFileSettingsPanel->liveLookBack()),
+                    import_settings);
+
+}
+
+void MainWindow::startLiveSource(LiveSourceThread *live_thread, const Tpx3ImportSettings &settings) {
+
+    // the live source spends most of its time waiting for data, so it gets a thread next to the imports
+    QThreadPool::globalInstance()->setMaxThreadCount(settings.maxNumThreads + 1);
+    TaskPool::global().setNumThreads(settings.maxNumThreads);
+
+    // the tab of a previous live source still shows its last histograms
+    if(mLiveViewTab)
+        closeFileTab(mTabContainer->indexOf(mLiveViewTab));
+
+    mLiveImage = std::make_unique<Tpx3Image>(live_thread->name(), settings.calibration, settings.geometry);
+    mLiveViewTab = new FileViewer(mTabContainer, mLiveImage.get());
+    mTabContainer->addTab(mLiveViewTab, ("Live: " + mLiveImage->filename()).c_str());
+    mTabContainer->setCurrentWidget(mLiveViewTab);
+
+    mLogPanel->connectToThread(live_thread);
+
+    connect(live_thread, &LiveSourceThread::yieldLiveHistograms, this, [this, live_thread](LiveHistograms *histograms) {
+        std::unique_ptr<LiveHistograms> owned(histograms);
+
+        // updates that were queued before the tab was closed are dropped
+        if(live_thread != mLiveThread || !mLiveViewTab)
+            return;
+
+        mLiveImage->setLiveHistograms(std::move(owned));
+        mLiveViewTab->refresh();
+    });
+
+    connect(live_thread, &LiveSourceThread::threadDone, this, [this, live_thread]() {
+        if(live_thread != mLiveThread)
+            return;
+
+        mLiveThread = nullptr;
+        mFilePanel->setFollowing(false);
+        mLogPanel->log("Stopped following " + mLiveImage->fullFilename());
+    });
+
+    mLiveThread = live_thread;
+    mFilePanel->setFollowing(true);
+    mLogPanel->log("Following " + live_thread->name());
+
+    QThreadPool::globalInstance()->start(live_thread);
+
+}
+
+void MainWindow::aggregateFiles() {
+
+    std::vector<std::string> files;
+    for(auto &pair : mOpenImages)
+        files.push_back(pair.first);
+
+    std::map<std::string, std::vector<std::string>> groups;
+    try {
+        groups = group_files(files, mFilePanel->aggregatePattern());
+    } catch(std::regex_error &e) {
+        mLogPanel->err("Invalid aggregation pattern: " + std::string(e.what()));
+        return;
+    }
+
+    if(groups.empty()) {
+        mLogPanel->warn("No imported files match the aggregation pattern.");
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+
+    // the histograms of each file are only computed once, and kept until the file is deleted or imported again
+    std::vector<std::string> missing;
+    for(auto &file : files) {
+        if(!mSummaries.contains(file))
+            missing.push_back(file);
+    }
+
+    std::vector<std::shared_ptr<const LiveHistograms>> summaries(missing.size());
+    try {
+        TaskPool::global().parallelFor(missing.size(), 1, [&](std::size_t begin, std::size_t end) {
+            for(auto ix = begin; ix < end; ++ix)
+                summaries[ix] = std::make_shared<const LiveHistograms>(mOpenImages.at(missing[ix])->summary());
+        });
+    } catch(std::runtime_error &e) {
+        QApplication::restoreOverrideCursor();
+        mLogPanel->err("Could not aggregate the files: " + std::string(e.what()));
+        return;
+    }
+    for(std::size_t ix = 0; ix < missing.size(); ++ix)
+        mSummaries[missing[ix]] = std::move(summaries[ix]);
+
+    for(auto &[key, group] : groups) {
+        auto name = key.empty() ? std::string("all") : key;
+
+        std::vector<std::shared_ptr<const LiveHistograms>> group_summaries;
+        for(auto &file : group)
+            group_summaries.push_back(mSummaries.at(file));
+
+        auto &first = *mOpenImages.at(group.front());
+        auto image = std::make_unique<Tpx3Image>(name, first.calibration(), first.geometry());
+        try {
+            image->setLiveHistograms(std::make_unique<LiveHistograms>(merge_summaries(group_summaries, TaskPool::global())));
+        } catch(std::runtime_error &e) {
+            mLogPanel->err("Could not aggregate " + name + ": " + e.what());
+            continue;
+        }
+
+        // a previous aggregate of the same group is replaced
+        for(auto it = mAggregateImages.begin(); it != mAggregateImages.end(); ++it) {
+            if(it->second->fullFilename() == name) {
+                closeFileTab(mTabContainer->indexOf(it->first));
+                break;
+            }
+        }
+
+        auto view_tab = new FileViewer(mTabContainer, image.get());
+        mAggregateImages[view_tab] = std::move(image);
+        mTabContainer->addTab(view_tab, ("Aggregate: " + name + " (" + std::to_string(group.size()) + " files)").c_str());
+        mTabContainer->setCurrentWidget(view_tab);
+
+        mLogPanel->log("Aggregated " + std::to_string(group.size()) + " files as " + name);
+    }
+
+    QApplication::restoreOverrideCursor();
+
+}
+
 void MainWindow::openNewFileTab() {
 
     QVariant data = mActions.openFileTab->data();
@@ -337,9 +588,23 @@ void MainWindow::closeFileTab(int index) {
     auto tab = dynamic_cast<FileViewer*>(mTabContainer->widget(index));
     assert(tab); // check for nullptr
 
+    // the live tab owns no file in mOpenImages; closing it stops following the file
+    if(tab == mLiveViewTab) {
+        if(mLiveThread)
+            mLiveThread->cancel();
+        mLiveViewTab = nullptr;
+        mTabContainer->removeTab(index);
+        tab->deleteLater();
+        return;
+    }
+
     auto filename = tab->fullFilename();
-    mOpenFileViewTabs.erase(filename); // remove from list of open tabs
+    if(!mAggregateImages.contains(tab))
+        mOpenFileViewTabs.erase(filename); // remove from list of open tabs
 
+    // deleted now, so that its views are done computing before the image can be deleted
     mTabContainer->removeTab(index);
+    delete tab;
+    mAggregateImages.erase(tab);
 
 }
\ No newline at end of file
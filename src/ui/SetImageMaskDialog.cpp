@@ -4,6 +4,7 @@
 #include <vector>
 #include <iostream>
 #include <cmath>
+#include <sstream>
 
 #include "qcustomplot.h"
 
@@ -11,10 +12,12 @@ constexpr int SLIDER_RES = 100;
 
 using namespace spec_hom;
 
-SetImageMaskDialog::SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, QWidget *parent) :
+SetImageMaskDialog::SetImageMaskDialog(ImageXY<unsigned> &&counts, std::string filename, QWidget *parent) :
         QDialog(parent),
-        mRefImage(std::move(reference)),
-        mRawImage(mRefImage->rawPacketImage()),
+        mFilename(std::move(filename)),
+        mRawImage(std::move(counts)),
+        mWidth(static_cast<int>(mRawImage.size())),
+        mHeight(mRawImage.empty() ? 0 : static_cast<int>(mRawImage[0].size())),
         mLastFit(false, -1, -1, -1, -1),
 
         mLayout(new QHBoxLayout(this)),
@@ -40,7 +43,7 @@ SetImageMaskDialog::SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, Q
 
         mAcceptButton(new QPushButton(mRightWidget)) {
 
-    assert(mRefImage);
+    assert(mWidth && mHeight);
 
     setWindowTitle("Pixel Mask Selection");
     setLayout(mLayout);
@@ -51,18 +54,16 @@ SetImageMaskDialog::SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, Q
         mImagePlot->xAxis->setLabel("Camera X");
         mImagePlot->yAxis->setLabel("Camera Y");
 
-        auto width = Tpx3Image::WIDTH, height = Tpx3Image::HEIGHT;
+        auto width = mWidth, height = mHeight;
 
         auto *colorMap = new QCPColorMap(mImagePlot->xAxis, mImagePlot->yAxis);
         colorMap->data()->setSize(width, height);
         colorMap->data()->setRange({0, static_cast<double>(width)-1},
                                    {0, static_cast<double>(height)-1});
 
-        auto image_2d = mRefImage->rawPacketImage();
-
-        for (int x=0; x<Tpx3Image::WIDTH; ++x) {
-            for (int y=0; y<Tpx3Image::HEIGHT; ++y) {
-                colorMap->data()->setCell(x, y, image_2d[x][y]);
+        for (int x=0; x<width; ++x) {
+            for (int y=0; y<height; ++y) {
+                colorMap->data()->setCell(x, y, mRawImage[x][y]);
             }
         }
 
@@ -121,19 +122,19 @@ SetImageMaskDialog::SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, Q
 
     // Look for peaks along horizontal and vertical direction, and set option accordingly
     std::vector<unsigned> h_slice, v_slice;
-    h_slice.reserve(Tpx3Image::HEIGHT);
-    v_slice.reserve(Tpx3Image::WIDTH);
+    h_slice.reserve(height);
+    v_slice.reserve(width);
 
-    for (unsigned r = 0; r < Tpx3Image::HEIGHT; ++r) {
+    for (unsigned r = 0; r < width; ++r) {
         unsigned slice_tot = 0;
-        for (unsigned c = 0; c < Tpx3Image::WIDTH; ++c) {
+        for (unsigned c = 0; c < height; ++c) {
             slice_tot += mRawImage[r][c];
         }
         v_slice.push_back(slice_tot);
     }
-    for (unsigned c = 0; c < Tpx3Image::WIDTH; ++c) {
+    for (unsigned c = 0; c < height; ++c) {
         unsigned slice_tot = 0;
-        for (unsigned r = 0; r < Tpx3Image::HEIGHT; ++r) {
+        for (unsigned r = 0; r < width; ++r) {
             slice_tot += mRawImage[r][c];
         }
         h_slice.push_back(slice_tot);
@@ -151,7 +152,7 @@ SetImageMaskDialog::SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, Q
     setTabOrder(mAcceptButton, mHorButton);
     setTabOrder(mAcceptButton, mVertButton);
 
-    setFixedSize(width*5, height*2.5);
+    setFixedSize(TPX3_SENSOR_SIZE*5, TPX3_SENSOR_SIZE*2.5); // independent of the detector geometry, so quads still fit on screen
     show();
 
 }
@@ -168,24 +169,30 @@ void SetImageMaskDialog::updateSlicePlot() {
 
     // We need to fit the data
     QVector<double> x, y, fit_y;
-    mLastFit = LinePair::find(mRawImage, h_lines, &x, &y, &fit_y);
+    LineProfileFit fit;
+    mLastFit = LinePair::find(mRawImage, h_lines, &x, &y, &fit_y, &fit);
     auto &lines = mLastFit;
 
     auto max_y = std::max_element(y.cbegin(), y.cend());
 
     mFitPlot->clearGraphs();
 
+    // the fitted line positions, with their standard errors
+    auto fit_summary = QString(" (lines at %1 ± %2 and %3 ± %4 px)")
+            .arg(fit.params[LineProfileFit::CENTRE_1], 0, 'f', 2).arg(fit.errors[LineProfileFit::CENTRE_1], 0, 'f', 2)
+            .arg(fit.params[LineProfileFit::CENTRE_2], 0, 'f', 2).arg(fit.errors[LineProfileFit::CENTRE_2], 0, 'f', 2);
+
     mFitPlot->plotLayout()->removeAt(mFitPlot->plotLayout()->rowColToIndex(0,0));
     if(h_lines)
-        mFitPlot->plotLayout()->addElement(0, 0, new QCPTextElement(mFitPlot, "Integration Along Rows"));
+        mFitPlot->plotLayout()->addElement(0, 0, new QCPTextElement(mFitPlot, "Integration Along Rows" + fit_summary));
     else
-        mFitPlot->plotLayout()->addElement(0, 0, new QCPTextElement(mFitPlot, "Integration Along Columns"));
+        mFitPlot->plotLayout()->addElement(0, 0, new QCPTextElement(mFitPlot, "Integration Along Columns" + fit_summary));
 
     mFitPlot->addGraph()->setData(x, y);
     mFitPlot->addGraph()->setData(x, fit_y);
     mFitPlot->xAxis->setLabel("Pixel");
     mFitPlot->yAxis->setLabel("Integrated Counts");
-    mFitPlot->xAxis->setRange(1, TPX3_SENSOR_SIZE);
+    mFitPlot->xAxis->setRange(1, x.size());
     mFitPlot->yAxis->setRange(0, *max_y);
 
     mFitPlot->replot();
@@ -223,20 +230,22 @@ void SetImageMaskDialog::updateSlicePlot() {
     mid_rect_top /= PIXEL_SIZE;
     mid_rect_bottom /= PIXEL_SIZE;
 
+    double width = mWidth, height = mHeight;
+
     if (h_lines) {
         rects[0]->topLeft->setCoords(QPointF(0, bottom_rect_top));
-        rects[0]->bottomRight->setCoords(QPointF(Tpx3Image::WIDTH, 0));
+        rects[0]->bottomRight->setCoords(QPointF(width, 0));
         rects[1]->topLeft->setCoords(QPointF(0, mid_rect_top));
-        rects[1]->bottomRight->setCoords(QPointF(Tpx3Image::WIDTH, mid_rect_bottom));
-        rects[2]->topLeft->setCoords(QPointF(0, Tpx3Image::HEIGHT));
-        rects[2]->bottomRight->setCoords(QPointF(Tpx3Image::WIDTH, top_rect_bottom));
+        rects[1]->bottomRight->setCoords(QPointF(width, mid_rect_bottom));
+        rects[2]->topLeft->setCoords(QPointF(0, height));
+        rects[2]->bottomRight->setCoords(QPointF(width, top_rect_bottom));
     } else {
-        rects[0]->topLeft->setCoords(QPointF(0, Tpx3Image::HEIGHT));
+        rects[0]->topLeft->setCoords(QPointF(0, height));
         rects[0]->bottomRight->setCoords(QPointF(bottom_rect_top, 0));
-        rects[1]->topLeft->setCoords(QPointF(mid_rect_bottom, Tpx3Image::HEIGHT));
+        rects[1]->topLeft->setCoords(QPointF(mid_rect_bottom, height));
         rects[1]->bottomRight->setCoords(QPointF(mid_rect_top, 0));
-        rects[2]->topLeft->setCoords(QPointF(top_rect_bottom, Tpx3Image::HEIGHT));
-        rects[2]->bottomRight->setCoords(QPointF(Tpx3Image::WIDTH, 0));
+        rects[2]->topLeft->setCoords(QPointF(top_rect_bottom, height));
+        rects[2]->bottomRight->setCoords(QPointF(width, 0));
     }
 
     rects[1]->setVisible(mid_rect_top > mid_rect_bottom);
@@ -261,7 +270,7 @@ void SetImageMaskDialog::acceptClicked() {
         imin2, imax2
     };
 
-    emit yieldImageMask(mask, mRefImage->fullFilename());
+    emit yieldImageMask(mask, mFilename);
 
     accept();
 
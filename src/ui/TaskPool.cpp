@@ -0,0 +1,359 @@
+#include "threadutils.h"
+
+#include <chrono>
+#include <limits>
+
+#include <QThread>
+
+using namespace spec_hom;
+
+// the pool that owns the current thread (nullptr outside of any pool), and the index of the thread's queue
+thread_local const TaskPool *tl_worker_pool = nullptr;
+thread_local unsigned tl_worker_index = 0;
+
+// the WorkTimer that work on the current thread is charged to (nullptr if none)
+thread_local WorkTimer *tl_work_timer = nullptr;
+
+int64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+}
+
+WorkTimer::WorkTimer() :
+    mStart(std::chrono::steady_clock::now()),
+    mWallTime(),
+    mTaskTime(0),
+    mParallelTime(0),
+    mPrevious(tl_work_timer),
+    mStopped(false) {
+
+    tl_work_timer = this;
+
+}
+
+WorkTimer::~WorkTimer() {
+
+    stop();
+
+}
+
+void WorkTimer::stop() {
+
+    if(mStopped)
+        return;
+
+    mWallTime = std::chrono::steady_clock::now() - mStart;
+    tl_work_timer = mPrevious;
+    mStopped = true;
+
+}
+
+double WorkTimer::wallTime() const {
+
+    if(!mStopped)
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+
+    return std::chrono::duration<double>(mWallTime).count();
+
+}
+
+double WorkTimer::busyTime() const {
+
+    // the owning thread is busy except while it waits in parallelFor; the chunks it runs there are counted as tasks
+    auto owner_time = wallTime() - static_cast<double>(mParallelTime.load()) * 1e-9;
+    return owner_time + static_cast<double>(mTaskTime.load()) * 1e-9;
+
+}
+
+TaskPool::TaskPool(unsigned num_threads) :
+    mQueues(),
+    mWorkers(),
+    mNumThreads(0),
+    mResizeMutex(),
+    mSleepMutex(),
+    mWakeup(),
+    mQueuedTasks(0),
+    mNextQueue(0),
+    mStopping(false) {
+
+    // the queues are never replaced, since threads outside the pool may be submitting to them during a resize
+    auto num_queues = std::max({num_threads, std::thread::hardware_concurrency(), 1u});
+    for(unsigned ix = 0; ix < num_queues; ++ix)
+        mQueues.push_back(std::make_unique<WorkerQueue>());
+
+    startWorkers(num_threads);
+
+}
+
+TaskPool::~TaskPool() {
+
+    std::lock_guard<std::mutex> lock(mResizeMutex);
+    stopWorkers();
+
+}
+
+TaskPool& TaskPool::global() {
+
+    static TaskPool pool(QThread::idealThreadCount());
+    return pool;
+
+}
+
+void TaskPool::setNumThreads(unsigned num_threads) {
+
+    std::lock_guard<std::mutex> lock(mResizeMutex);
+
+    num_threads = std::max(num_threads, 1u);
+    if(num_threads == numThreads())
+        return;
+
+    // tasks left queued meanwhile are run by the threads waiting on them, or by the new workers
+    stopWorkers();
+    startWorkers(num_threads);
+
+}
+
+void TaskPool::startWorkers(unsigned num_threads) {
+
+    num_threads = std::max(num_threads, 1u);
+
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = false;
+    }
+
+    // with more workers than queues, some workers share a queue
+    for(unsigned ix = 0; ix < num_threads; ++ix)
+        mWorkers.emplace_back(&TaskPool::workerLoop, this, ix % static_cast<unsigned>(mQueues.size()));
+    mNumThreads = num_threads;
+
+}
+
+void TaskPool::stopWorkers() {
+
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = true;
+    }
+    mWakeup.notify_all();
+
+    for(auto &worker : mWorkers)
+        worker.join();
+    mWorkers.clear();
+    mNumThreads = 0;
+
+}
+
+void TaskPool::workerLoop(unsigned index) {
+
+    tl_worker_pool = this;
+    tl_worker_index = index;
+
+    // a stopping worker leaves the queued tasks to the threads waiting on them, so that a resize does not wait for
+    // work that other threads keep submitting
+    while(!mStopping.load()) {
+        if(runOneTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mWakeup.wait(lock, [this]() { return mStopping.load() || mQueuedTasks.load() > 0; });
+    }
+
+}
+
+void TaskPool::push(Task &&task) {
+
+    unsigned queue_ix;
+    if(tl_worker_pool == this)
+        queue_ix = tl_worker_index; // keep nested work local to the worker that created it
+    else
+        queue_ix = mNextQueue.fetch_add(1, std::memory_order_relaxed) % mQueues.size();
+
+    {
+        std::lock_guard<std::mutex> lock(mQueues[queue_ix]->mutex);
+        mQueues[queue_ix]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex); // avoids a lost wakeup between a worker's check and its wait
+        ++mQueuedTasks;
+    }
+    mWakeup.notify_one();
+
+}
+
+bool TaskPool::runOneTask() {
+
+    auto num_queues = static_cast<unsigned>(mQueues.size());
+
+    bool is_worker = (tl_worker_pool == this);
+    unsigned start = is_worker ? tl_worker_index : mNextQueue.load(std::memory_order_relaxed) % num_queues;
+
+    Task task;
+    bool found = false;
+
+    for(unsigned offset = 0; offset < num_queues && !found; ++offset) {
+        auto &queue = *mQueues[(start + offset) % num_queues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.tasks.empty())
+            continue;
+
+        if(is_worker && offset == 0) {
+            // own queue: newest task first, since its data is most likely still in cache
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            // steal the oldest task, which is usually the largest remaining piece of work
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+
+    if(!found)
+        return false;
+
+    --mQueuedTasks;
+
+    // charge the task (and anything it submits) to the timer of the work that submitted it
+    auto previous_timer = tl_work_timer;
+    tl_work_timer = task.timer;
+    auto task_start = std::chrono::steady_clock::now();
+
+    try {
+        task.fn();
+    } catch(...) {
+        std::lock_guard<std::mutex> lock(task.group->mutex);
+        if(!task.group->error)
+            task.group->error = std::current_exception();
+    }
+
+    if(task.timer)
+        task.timer->mTaskTime += elapsed_ns(task_start);
+    tl_work_timer = previous_timer;
+
+    {
+        // decrement under the lock, so that the waiting thread cannot destroy the group while we still use it
+        std::lock_guard<std::mutex> lock(task.group->mutex);
+        if(task.group->remaining.fetch_sub(1) == 1)
+            task.group->done.notify_all();
+    }
+
+    return true;
+
+}
+
+void TaskPool::parallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &fn) {
+
+    if(!count)
+        return;
+
+    grain = std::max<std::size_t>(grain, 1);
+    auto num_chunks = (count + grain - 1) / grain;
+
+    if(num_chunks == 1) {
+        fn(0, count);
+        return;
+    }
+
+    auto timer = tl_work_timer;
+    auto parallel_start = std::chrono::steady_clock::now();
+
+    TaskGroup group;
+    group.remaining = num_chunks;
+
+    for(std::size_t chunk = 1; chunk < num_chunks; ++chunk) {
+        auto begin = chunk * grain;
+        auto end = std::min(begin + grain, count);
+        push({[&fn, begin, end]() { fn(begin, end); }, &group, timer});
+    }
+
+    // the first chunk is run on this thread
+    auto chunk_start = std::chrono::steady_clock::now();
+    try {
+        fn(0, std::min(grain, count));
+    } catch(...) {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if(!group.error)
+            group.error = std::current_exception();
+    }
+    if(timer)
+        timer->mTaskTime += elapsed_ns(chunk_start);
+    --group.remaining;
+
+    // help with any queued work until our chunks are done
+    while(group.remaining.load() > 0) {
+        if(runOneTask())
+            continue;
+
+        std::unique_lock<std::mutex> lock(group.mutex);
+        group.done.wait_for(lock, std::chrono::milliseconds(2), [&group]() { return group.remaining.load() == 0; });
+    }
+
+    if(timer)
+        timer->mParallelTime += elapsed_ns(parallel_start);
+
+    // the last task may still hold the mutex while notifying, so take it before the group goes out of scope
+    std::lock_guard<std::mutex> lock(group.mutex);
+
+    if(group.error)
+        std::rethrow_exception(group.error);
+
+}
+
+MemoryBudget::MemoryBudget() :
+    mMutex(),
+    mLimit(std::numeric_limits<std::size_t>::max()),
+    mReserved(0) {
+
+    // Do nothing
+
+}
+
+MemoryBudget& MemoryBudget::global() {
+
+    static MemoryBudget budget;
+    return budget;
+
+}
+
+void MemoryBudget::setLimit(std::size_t bytes) {
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLimit = bytes;
+
+}
+
+std::size_t MemoryBudget::limit() const {
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mLimit;
+
+}
+
+std::size_t MemoryBudget::reserved() const {
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mReserved;
+
+}
+
+bool MemoryBudget::tryAcquire(std::size_t bytes) {
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if(mReserved != 0 && (bytes > mLimit || mReserved > mLimit - bytes))
+        return false;
+
+    mReserved += bytes;
+    return true;
+
+}
+
+void MemoryBudget::release(std::size_t bytes) {
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mReserved -= std::min(bytes, mReserved);
+
+}
@@ -1,6 +1,18 @@
 #ifndef SPECTRAL_HOM_THREADUTILS_H
 #define SPECTRAL_HOM_THREADUTILS_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <exception>
+#include <chrono>
+
 #include <QObject>
 #include <QRunnable>
 #include <QProgressDialog>
@@ -10,6 +22,13 @@ namespace spec_hom {
     class LogPanel;
     class BgProgressBar;
 
+    // Progress and cancellation state shared between a background job and the UI. Workers update it with relaxed
+    // atomics and the UI polls it on a timer, so reporting progress from hot loops costs almost nothing.
+    struct JobProgress {
+        std::atomic<int> progress = 0; // between 0 and 100
+        std::atomic<bool> cancelled = false;
+    };
+
     // Handles common functionality of background long-running threads
     class BgThread : public QObject, public QRunnable {
         Q_OBJECT
@@ -19,15 +38,18 @@ namespace spec_hom {
 
         void run() final;
         virtual void execute() = 0; // override this in the child classes
-        [[nodiscard]] bool shouldCancel() const;
+        [[nodiscard]] bool shouldCancel() const { return mProgress->cancelled.load(std::memory_order_relaxed); }
+        void reportProgress(int value) { mProgress->progress.store(value, std::memory_order_relaxed); } // between 0 and 100
+
+        [[nodiscard]] std::shared_ptr<JobProgress> progressBlock() const { return mProgress; }
+        void shareProgress(const BgThread &job) { mProgress = job.mProgress; } // report to, and be cancelled with, job
 
     signals:
         void log(std::string str);
         void warn(std::string str);
         void err(std::string str);
 
-        // controls for the progress bar
-        void setProgress(int value); // between 0 and 100
+        // controls for the progress bar; the progress value itself is polled from progressBlock()
         void setProgressIndefinite(bool value);
         void setProgressText(std::string str);
         void setProgressTextColor(QColor color);
@@ -38,7 +60,164 @@ namespace spec_hom {
         void cancel();
 
     private:
-        bool mShouldCancel;
+        std::shared_ptr<JobProgress> mProgress;
+    };
+
+    // Measures how much thread time a piece of work uses, including the TaskPool tasks it submits (wherever they run).
+    // The timer covers the creating thread from construction until stop() or destruction, and must not outlive it.
+    class WorkTimer {
+    public:
+        WorkTimer();
+        WorkTimer(const WorkTimer &rhs) = delete;
+        ~WorkTimer();
+
+        void stop();
+
+        [[nodiscard]] double wallTime() const; // [s]
+        [[nodiscard]] double busyTime() const; // [s] summed over all threads
+
+    private:
+        friend class TaskPool;
+
+        std::chrono::steady_clock::time_point mStart;
+        std::chrono::steady_clock::duration mWallTime;
+        std::atomic<int64_t> mTaskTime; // [ns] spent running this work's TaskPool chunks
+        std::atomic<int64_t> mParallelTime; // [ns] the owning thread spent inside TaskPool::parallelFor
+        WorkTimer *mPrevious; // timer that was active on the owning thread before this one
+        bool mStopped;
+    };
+
+    // Work-stealing pool shared by every import, so that the stages of all files (chunk decode, sort partitions,
+    // cluster slabs, centroid ranges, coincidence blocks) keep all cores busy regardless of the number of files.
+    // Each worker has its own deque; it pops its own tasks LIFO, and steals FIFO from the others when idle.
+    class TaskPool {
+    public:
+        explicit TaskPool(unsigned num_threads);
+        TaskPool(const TaskPool &rhs) = delete;
+        ~TaskPool();
+
+        static TaskPool& global();
+
+        void setNumThreads(unsigned num_threads); // may be called while other threads submit work
+        [[nodiscard]] unsigned numThreads() const { return mNumThreads.load(); }
+
+        // Splits [0, count) into chunks of at most grain items and calls fn(begin, end) for each, returning once all
+        // chunks are done. The calling thread also works on tasks while it waits, so calls may be nested in tasks.
+        void parallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &fn);
+
+        // Sorts partitions of [begin, end) in parallel with sort_partition, then merges them pairwise. The merges
+        // are stable, so the result is stable whenever sort_partition is.
+        template<typename It, typename Compare, typename Sorter>
+        void parallelSort(It begin, It end, Compare comp, Sorter sort_partition, std::size_t min_partition = 1 << 16);
+
+    private:
+        struct TaskGroup {
+            std::atomic<std::size_t> remaining;
+            std::mutex mutex;
+            std::condition_variable done;
+            std::exception_ptr error;
+        };
+
+        struct Task {
+            std::function<void()> fn;
+            TaskGroup *group;
+            WorkTimer *timer; // timer of the work that submitted the task, if any
+        };
+
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void startWorkers(unsigned num_threads);
+        void stopWorkers();
+        void workerLoop(unsigned index);
+        void push(Task &&task);
+        bool runOneTask(); // runs a task from this thread's queue, or steals one; false if there was nothing to run
+
+        std::vector<std::unique_ptr<WorkerQueue>> mQueues; // fixed at construction; workers may outnumber them
+        std::vector<std::thread> mWorkers;
+        std::atomic<unsigned> mNumThreads;
+        std::mutex mResizeMutex; // serialises setNumThreads and the destructor
+        std::mutex mSleepMutex;
+        std::condition_variable mWakeup;
+        std::atomic<std::size_t> mQueuedTasks;
+        std::atomic<unsigned> mNextQueue; // queue used for tasks pushed from outside the pool
+        std::atomic<bool> mStopping;
+    };
+
+    template<typename It, typename Compare, typename Sorter>
+    void TaskPool::parallelSort(It begin, It end, Compare comp, Sorter sort_partition, std::size_t min_partition) {
+
+        auto count = static_cast<std::size_t>(end - begin);
+
+        std::size_t num_parts = 1;
+        while(num_parts < 2 * std::max(numThreads(), 1u) && count / (num_parts * 2) >= min_partition)
+            num_parts *= 2;
+
+        std::vector<std::size_t> bounds(num_parts + 1);
+        for(std::size_t part = 0; part <= num_parts; ++part)
+            bounds[part] = count * part / num_parts;
+
+        parallelFor(num_parts, 1, [&](std::size_t first, std::size_t last) {
+            for(auto part = first; part < last; ++part)
+                sort_partition(begin + bounds[part], begin + bounds[part + 1]);
+        });
+
+        for(std::size_t width = 1; width < num_parts; width *= 2) {
+            parallelFor(num_parts / (2 * width), 1, [&](std::size_t first, std::size_t last) {
+                for(auto pair = first; pair < last; ++pair) {
+                    auto lo = pair * 2 * width;
+                    std::inplace_merge(begin + bounds[lo], begin + bounds[lo + width], begin + bounds[lo + 2 * width], comp);
+                }
+            });
+        }
+
+    }
+
+    // Lock-free ring of bytes between exactly one writer thread and one reader thread. The capacity is rounded up to a
+    // power of two; the positions only ever increase, and are wrapped when indexing.
+    class ByteRing {
+    public:
+        explicit ByteRing(std::size_t capacity);
+        ByteRing(const ByteRing &rhs) = delete;
+
+        std::size_t write(const char *bytes, std::size_t num_bytes); // writes as much as fits; returns bytes written
+        bool writeAll(const char *bytes, std::size_t num_bytes); // writes all of the bytes, or none if they don't fit
+        std::size_t read(char *bytes, std::size_t max_bytes); // returns bytes read
+
+        [[nodiscard]] std::size_t size() const; // bytes waiting to be read
+        [[nodiscard]] std::size_t capacity() const { return mData.size(); }
+
+    private:
+        void copyIn(std::size_t pos, const char *bytes, std::size_t num_bytes);
+
+        std::vector<char> mData;
+        std::size_t mMask;
+        alignas(64) std::atomic<std::size_t> mWritePos; // only changed by the writer
+        alignas(64) std::atomic<std::size_t> mReadPos; // only changed by the reader
+    };
+
+    // Global memory budget for imports. Each file import reserves its estimated peak memory before it is started, and
+    // releases it when done; imports that don't fit stay queued until enough memory has been released.
+    class MemoryBudget {
+    public:
+        MemoryBudget();
+
+        static MemoryBudget& global();
+
+        void setLimit(std::size_t bytes);
+        [[nodiscard]] std::size_t limit() const;
+        [[nodiscard]] std::size_t reserved() const;
+
+        // A request is always admitted when nothing else is reserved, so that a single large import can still run
+        bool tryAcquire(std::size_t bytes);
+        void release(std::size_t bytes);
+
+    private:
+        mutable std::mutex mMutex;
+        std::size_t mLimit;
+        std::size_t mReserved;
     };
 
 }
@@ -22,8 +22,8 @@
 #include <QSpinBox>
 #include <QLineEdit>
 #include <QCheckBox>
-
-#include <dlib/optimization.h>
+#include <QComboBox>
+#include <QTimer>
 
 class QCustomPlot;
 class QCPItemRect;
@@ -38,6 +38,7 @@ namespace spec_hom {
     class MainWindow;
     class BgThread;
     class LoadRawFileThread;
+    class LiveSourceThread;
     class FileViewer;
 
     // actions for the global app that are launched by sub-panels of the UI
@@ -54,6 +55,9 @@ namespace spec_hom {
         QAction *openFileTab; // to use this action, set its data to a QString with the filename to open
         QAction *lockUiForMasking;
         QAction *unlockUi;
+        QAction *followLiveFile; // starts following a growing file, or stops if one is already being followed
+        QAction *followLiveStream; // starts receiving a stream of packets, or stops the current live source
+        QAction *aggregateFiles; // sums the histograms of the imported files, in groups matching the aggregation pattern
 
         explicit AppActions(QWidget *parent);
     };
@@ -73,6 +77,7 @@ namespace spec_hom {
 
         void setQueued();
         void setLoaded();
+        void setWaiting(); // queued for import, but waiting for memory
 
         [[nodiscard]] bool isLoading() const { return mIsLoading; }
         void setIsLoading();
@@ -90,7 +95,11 @@ namespace spec_hom {
         void disconnectThread();
 
     private:
+        void pollProgress();
+
         LoadRawFileThread *mConnectedThread; // needed so that we can clone properly
+        std::shared_ptr<JobProgress> mConnectedProgress; // shared with the thread, so it outlives it if needed
+        QTimer *mPollTimer; // polls mConnectedProgress while a thread is connected
         bool mIsQueued; // whether file is queued
         bool mIsLoading; // whether the file is currently being loaded
         bool mIsLoaded; // whether the file is done loading
@@ -99,7 +108,7 @@ namespace spec_hom {
     class SetImageMaskDialog : public QDialog {
         Q_OBJECT
     public:
-        SetImageMaskDialog(std::unique_ptr<Tpx3Image> &&reference, QWidget *parent);
+        SetImageMaskDialog(ImageXY<unsigned> &&counts, std::string filename, QWidget *parent); // counts as from prescan_counts()
 
     signals:
         void yieldImageMask(spec_hom::SpatialMask, std::string filename);
@@ -108,8 +117,9 @@ namespace spec_hom {
         void updateSlicePlot();
         void acceptClicked();
 
-        std::unique_ptr<Tpx3Image> mRefImage;
+        std::string mFilename; // of the reference file
         ImageXY<unsigned> mRawImage;
+        int mWidth, mHeight; // [pixels]
         LinePair mLastFit;
 
         QHBoxLayout *mLayout;
@@ -142,7 +152,14 @@ namespace spec_hom {
         FileInputSettingsPanel(QWidget *parent, AppActions &actions);
 
         Tpx3ImportSettings getSettings();
+        DetectorGeometry getGeometry();
+        std::size_t memoryBudget() const; // [bytes]
         bool shouldExportSingles() const;
+        double liveRefreshInterval() const; // [s]
+        double liveLookBack() const; // [s]
+        bool liveStreamAddress(std::string &host, uint16_t &port) const; // false if the address is not valid
+        bool liveStreamUdp() const;
+        std::size_t liveStreamBufferSize() const; // [bytes]
 
     private slots:
         void receiveImageMask(spec_hom::SpatialMask mask, std::string filename);
@@ -150,14 +167,26 @@ namespace spec_hom {
     private:
         void setImageMaskClick();
         void clearImageMaskClick();
-        void receiveImageMaskReference(Tpx3Image *image);
+        void findHotPixelsClick();
+        void loadPixelMaskClick();
+        void savePixelMaskClick();
+        void clearPixelMaskClick();
+        void updatePixelMaskLabel();
         void setToACalibClick();
         void clearToACalibClick();
         void loadCalibrationFileClick();
+        void buildArgonCalibrationClick();
+        void receiveArgonCalibration(CalibrationPoints *data);
+        void setCalibrationPoints(CalibrationPoints &&points, const QString &source);
+        void fitCalibrationPoints(); // with the model chosen, into the slopes and intercepts shown
+        void calibrationEdited(); // a slope or intercept typed in replaces the points with straight lines
 
         AppActions &mActions;
         std::unique_ptr<SpatialMask> mCurrImageMask;
+        PixelMask mCurrPixelMask;
         ToTCalibration mCurrCalibration;
+        CalibrationPoints mCurrCalibrationPoints; // the wavelength calibration is fit to these, unless it was typed in
+        QString mCurrCalibrationSource;
 
         QVBoxLayout *mLayout;
 
@@ -167,12 +196,31 @@ namespace spec_hom {
         QHBoxLayout *mNumThreadsLayout;
         QLabel *mNumThreadsLabel;
         QSpinBox *mNumThreadsSpinbox;
+        QWidget *mMemoryBudgetWidget;                       // Memory budget shared by all concurrent imports
+        QHBoxLayout *mMemoryBudgetLayout;
+        QLabel *mMemoryBudgetLabel;
+        QSpinBox *mMemoryBudgetSpinbox;
+        QCheckBox *mKeepPacketsCheck;                       // Keep the raw packets of imported files, or only their histograms
+        QWidget *mGeometryWidget;                           // Detector layout (single chip or quad)
+        QHBoxLayout *mGeometryLayout;
+        QLabel *mGeometryLabel;
+        QComboBox *mGeometryCombo;
+        QLabel *mClockOffsetsLabel;
+        QLineEdit *mClockOffsetsEdit;
         QWidget *mSpatialMaskWidget;
         QHBoxLayout *mSpatialMaskLayout;
         QLabel *mSpatialMaskLabel;
         QLabel *mSpatialMaskCurrLabel;
         QPushButton *mSpatialMaskSetBtn;
         QPushButton *mSpatialMaskClearBtn;
+        QWidget *mPixelMaskWidget;                          // Disabled pixels and per-pixel ToT thresholds
+        QHBoxLayout *mPixelMaskLayout;
+        QLabel *mPixelMaskLabel;
+        QLabel *mPixelMaskCurrLabel;
+        QPushButton *mPixelMaskFindBtn;
+        QPushButton *mPixelMaskLoadBtn;
+        QPushButton *mPixelMaskSaveBtn;
+        QPushButton *mPixelMaskClearBtn;
 
         QGroupBox *mToTCorrectionSettingsWidget;            // Settings for ToT correction
         QVBoxLayout *mToTCorrectionSettingsLayout;
@@ -202,6 +250,18 @@ namespace spec_hom {
         QHBoxLayout *mCoincidenceWindowLayout;
         QLabel *mCoincidenceWindowLabel;
         QLineEdit *mCoincidenceWindowEdit;
+        QWidget *mRateBinWidget;                            // Finest bin of the rate time series
+        QHBoxLayout *mRateBinLayout;
+        QLabel *mRateBinLabel;
+        QLineEdit *mRateBinEdit;
+        QWidget *mLineTrackingWidget;                       // Time windows the lines are fit in
+        QHBoxLayout *mLineTrackingLayout;
+        QLabel *mLineTrackingLabel;
+        QLineEdit *mLineTrackingEdit;
+        QWidget *mHOMSegmentWidget;                         // Time segments of the spectrally-resolved HOM histogram
+        QHBoxLayout *mHOMSegmentLayout;
+        QLabel *mHOMSegmentLabel;
+        QLineEdit *mHOMSegmentEdit;
 
         QGroupBox *mCalibrationSettingsWidget;
         QVBoxLayout *mCalibrationSettingsLayout;
@@ -217,12 +277,38 @@ namespace spec_hom {
         QLineEdit *mCalibrationSlope2Edit;
         QLabel *mCalibrationIntercept2Label;
         QLineEdit *mCalibrationIntercept2Edit;
+        QWidget *mCalibrationPointsWidget;                  // Emission lines the calibration is fit to, and how
+        QHBoxLayout *mCalibrationPointsLayout;
+        QLabel *mCalibrationPointsLabel;
+        QLabel *mCalibrationPointsCurrLabel;
+        QComboBox *mCalibrationModelCombo;
         QPushButton *mLoadCalibrationBtn;
+        QPushButton *mBuildCalibrationBtn;
 
         QGroupBox *mExportSettingsWidget;
         QVBoxLayout *mExportSettingsLayout;
         QCheckBox *mExportSinglesCheck;
 
+        QGroupBox *mLiveSettingsWidget;                     // Settings for following a file during acquisition
+        QVBoxLayout *mLiveSettingsLayout;
+        QWidget *mLiveRefreshWidget;                        // How often the histograms are updated
+        QHBoxLayout *mLiveRefreshLayout;
+        QLabel *mLiveRefreshLabel;
+        QSpinBox *mLiveRefreshSpinbox;
+        QWidget *mLiveLookBackWidget;                       // How long to wait for out-of-order packets
+        QHBoxLayout *mLiveLookBackLayout;
+        QLabel *mLiveLookBackLabel;
+        QSpinBox *mLiveLookBackSpinbox;
+        QWidget *mLiveStreamWidget;                         // Where packets are streamed from
+        QHBoxLayout *mLiveStreamLayout;
+        QLabel *mLiveStreamLabel;
+        QComboBox *mLiveStreamProtocolCombo;
+        QLineEdit *mLiveStreamAddressEdit;
+        QWidget *mLiveBufferWidget;                         // Receive buffer between the socket and the processing
+        QHBoxLayout *mLiveBufferLayout;
+        QLabel *mLiveBufferLabel;
+        QSpinBox *mLiveBufferSpinbox;
+
         QLabel *mBottomText;
 
     };
@@ -236,6 +322,7 @@ namespace spec_hom {
         void removeTableRow(int row);
         void clearAllRows();
         void setCancelBtnOnly(bool value);
+        void setFollowing(bool value); // switches the follow button between starting and stopping
 
         [[nodiscard]] const std::vector<std::string>& fileList() const { return mFileList; }
         [[nodiscard]] std::vector<std::string> queuedFileList() const;
@@ -244,6 +331,10 @@ namespace spec_hom {
         void connectThread(const std::string &file, LoadRawFileThread *thread);
         void setFileLoaded(const std::string &file);
         void setFileQueued(const std::string &file);
+        void setFileWaiting(const std::string &file);
+
+        [[nodiscard]] std::size_t fileSize(const std::string &file) const; // [bytes]
+        [[nodiscard]] std::string aggregatePattern() const { return mAggregatePatternEdit->text().toStdString(); }
 
     public slots:
         void startStopBtnClick();
@@ -253,6 +344,7 @@ namespace spec_hom {
         void addQueuedFiles(std::vector<std::string> paths);
         void updateFileTable();
         void updateLoadStatus();
+        void updateMemoryGauge();
 
         AppActions &mActions;
         LogPanel &mLogger;
@@ -264,14 +356,24 @@ namespace spec_hom {
         QPushButton *mStartStopLoadBtn;
         QPushButton *mClearFilesBtn;
         QPushButton *mExportFilesBtn;
+        QPushButton *mFollowFileBtn;
+        QPushButton *mFollowStreamBtn;
+        QLineEdit *mAggregatePatternEdit; // regex matched against the paths; files with the same capture groups are summed together
+        QPushButton *mAggregateBtn;
 
         QTableWidget *mFileTable;
 
+        QWidget *mBottomWidget;
+        QHBoxLayout *mBottomLayout;
         QLabel *mBottomText;
+        QProgressBar *mMemoryGauge; // memory reserved by running imports, out of the budget
+        QTimer *mMemoryGaugeTimer;
 
         bool mCancelBtnOnly;
+        bool mFollowing; // a live source is running
 
         std::vector<std::string> mFileList;
+        std::map<std::string, std::size_t> mFileSizes; // [bytes]
     };
 
     class MainWindow : public QMainWindow {
@@ -292,6 +394,9 @@ namespace spec_hom {
         void stopImportFiles();
         void doneImportFiles();
         void receiveImageData(spec_hom::Tpx3Image *data);
+        void startStopFollowing();
+        void startStopStreaming();
+        void aggregateFiles();
 
         void openNewFileTab(); // note: this requires that the filename be stored in the corresponding QAction's data()
         void closeFileTab(int index);
@@ -300,6 +405,9 @@ namespace spec_hom {
         void closeEvent(QCloseEvent *event) override;
 
     private:
+        void admitPendingImports();
+        void startLiveSource(LiveSourceThread *thread, const Tpx3ImportSettings &settings);
+
         AppActions mActions;
 
         QSplitter *mCentralSplitter; // Splitter containing the log panel (left) and the viewing panel (right)
@@ -310,8 +418,16 @@ namespace spec_hom {
         FileInputSettingsPanel *mFileSettingsPanel; // Settings used to import tpx3 files
         FileInputPanel *mFilePanel; // Panel to open files
         std::vector<LoadRawFileThread*> mActiveImportThreads;
+        std::vector<std::string> mPendingImports; // files waiting for enough memory to be imported
+        Tpx3ImportSettings mPendingImportSettings;
+        std::vector<std::string> mBatchFiles; // files started by the last call to startImportFiles()
         std::map<std::string, std::unique_ptr<Tpx3Image>> mOpenImages;
         std::map<std::string, FileViewer*> mOpenFileViewTabs;
+        std::map<std::string, std::shared_ptr<const LiveHistograms>> mSummaries; // histograms of the imported files, kept for aggregation
+        std::map<FileViewer*, std::unique_ptr<Tpx3Image>> mAggregateImages; // summed histograms, owned by their tabs
+        LiveSourceThread *mLiveThread; // thread following a file or stream during acquisition, if any
+        std::unique_ptr<Tpx3Image> mLiveImage; // histograms of the live source; not in mOpenImages, since it has no data
+        FileViewer *mLiveViewTab;
 
         decltype(std::chrono::high_resolution_clock::now()) mProcessStartTime;
     };